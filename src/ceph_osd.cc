@@ -330,6 +330,10 @@ int main(int argc, const char **argv)
   messenger_hbclient->set_cluster_protocol(CEPH_OSD_PROTOCOL);
   messenger_hbserver->set_cluster_protocol(CEPH_OSD_PROTOCOL);
 
+  // only these two see large message data
+  client_messenger->set_rx_pool_bytes(g_conf->osd_rx_pool_bytes);
+  cluster_messenger->set_rx_pool_bytes(g_conf->osd_rx_pool_bytes);
+
   cout << "starting osd." << whoami
        << " at " << client_messenger->get_myaddr()
        << " osd_data " << g_conf->osd_data
@@ -0,0 +1,226 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/WeightedScheduler.h"
+#include "common/Clock.h"
+#include "common/Formatter.h"
+#include "common/dout.h"
+#include "common/ceph_context.h"
+
+#define dout_subsys ceph_subsys_throttle
+
+#undef dout_prefix
+#define dout_prefix *_dout << "sched(" << name << ") "
+
+static inline uint64_t read_u64(const uint64_t *p)
+{
+  return __sync_fetch_and_add(const_cast<uint64_t *>(p), 0);
+}
+
+static inline void add_u64(uint64_t *p, uint64_t v)
+{
+  __sync_fetch_and_add(p, v);
+}
+
+WeightedScheduler::WeightedScheduler(CephContext *cct, const std::string &n,
+				     uint64_t burst, double max_wait)
+  : cct(cct), name(n),
+    lock("WeightedScheduler::lock"),
+    burst(burst), max_wait(max_wait)
+{
+}
+
+WeightedScheduler::~WeightedScheduler()
+{
+  for (unsigned i = 0; i < classes.size(); ++i)
+    delete classes[i];
+}
+
+int WeightedScheduler::add_class(const std::string &n, unsigned weight,
+				 bool blocking)
+{
+  Mutex::Locker l(lock);
+  classes.push_back(new Class(n, weight, blocking));
+  return classes.size() - 1;
+}
+
+void WeightedScheduler::set_weight(int c, unsigned weight)
+{
+  Mutex::Locker l(lock);
+  classes[c]->weight = weight;
+  cond.SignalAll();
+}
+
+void WeightedScheduler::set_burst(uint64_t b)
+{
+  Mutex::Locker l(lock);
+  burst = b;
+  cond.SignalAll();
+}
+
+bool WeightedScheduler::_is_active(const Class *c) const
+{
+  return c->weight &&
+    (c->queued.read() || c->in_flight.read() || c->waiting);
+}
+
+double WeightedScheduler::_vtime(const Class *c) const
+{
+  return (double)(read_u64(&c->cost) + c->base) / (double)c->weight;
+}
+
+/// the furthest-behind class other than c with demand, if any
+bool WeightedScheduler::_min_vtime(int c, double *vt) const
+{
+  bool found = false;
+  for (unsigned i = 0; i < classes.size(); ++i) {
+    if ((int)i == c || !_is_active(classes[i]))
+      continue;
+    double v = _vtime(classes[i]);
+    if (!found || v < *vt)
+      *vt = v;
+    found = true;
+  }
+  return found;
+}
+
+/// no banking credit: idle classes (and c itself) are dragged up to vt
+void WeightedScheduler::_catch_up(int c, double vt)
+{
+  for (unsigned i = 0; i < classes.size(); ++i) {
+    Class *o = classes[i];
+    if (!o->weight || ((int)i != c && _is_active(o)))
+      continue;
+    uint64_t target = (uint64_t)(vt * (double)o->weight);
+    if (target > read_u64(&o->cost) + o->base)
+      o->base = target - read_u64(&o->cost);
+  }
+}
+
+bool WeightedScheduler::_should_wait(int c)
+{
+  assert(lock.is_locked());
+  Class *me = classes[c];
+  if (!me->blocking || !me->weight)
+    return false;
+
+  double min_vt = 0;
+  if (!_min_vtime(c, &min_vt)) {
+    _catch_up(c, _vtime(me));
+    return false;
+  }
+  _catch_up(c, min_vt);
+  return _vtime(me) > min_vt + (double)burst / (double)me->weight;
+}
+
+/// after charging a blocking class: if it is alone, the others keep up
+void WeightedScheduler::_charged(int c)
+{
+  double vt;
+  if (!_min_vtime(c, &vt))
+    _catch_up(c, _vtime(classes[c]));
+}
+
+utime_t WeightedScheduler::get(int c, uint64_t cost)
+{
+  Class *me = classes[c];
+  utime_t start = ceph_clock_now(cct);
+  if (!me->blocking || !me->weight) {
+    me->in_flight.inc();
+    add_u64(&me->ops, 1);
+    add_u64(&me->cost, cost);
+    return start;
+  }
+
+  Mutex::Locker l(lock);
+  utime_t now = start;
+  if (_should_wait(c)) {
+    ldout(cct, 10) << "get " << me->name << " " << cost << " waiting" << dendl;
+    me->waiting++;
+    utime_t until = start;
+    until += max_wait;
+    while (_should_wait(c)) {
+      if (max_wait > 0 && now >= until) {
+	ldout(cct, 5) << "get " << me->name << " waited " << (now - start)
+		      << ", proceeding anyway" << dendl;
+	break;
+      }
+      // non-blocking classes are charged without signalling us, so poll.
+      cond.WaitInterval(cct, lock, utime_t(0, 10000000));
+      now = ceph_clock_now(cct);
+    }
+    me->waiting--;
+    add_u64(&me->wait_us, (uint64_t)((double)(now - start) * 1000000.0));
+  }
+  me->in_flight.inc();
+  add_u64(&me->ops, 1);
+  add_u64(&me->cost, cost);
+  _charged(c);
+  ldout(cct, 20) << "get " << me->name << " " << cost << " granted" << dendl;
+  cond.SignalAll();
+  return now;
+}
+
+void WeightedScheduler::charge(int c, uint64_t cost)
+{
+  Class *me = classes[c];
+  add_u64(&me->cost, cost);
+  if (me->blocking) {
+    Mutex::Locker l(lock);
+    if (me->weight)
+      _charged(c);
+    cond.SignalAll();
+  }
+}
+
+void WeightedScheduler::put(int c, utime_t start)
+{
+  Class *me = classes[c];
+  utime_t dur = ceph_clock_now(cct) - start;
+  add_u64(&me->service_us, (uint64_t)((double)dur * 1000000.0));
+  me->in_flight.dec();
+  if (me->blocking) {
+    Mutex::Locker l(lock);
+    cond.SignalAll();
+  }
+}
+
+void WeightedScheduler::dump(Formatter *f) const
+{
+  Mutex::Locker l(lock);
+  f->open_object_section(name.c_str());
+  f->dump_unsigned("burst", burst);
+  f->dump_float("max_wait", max_wait);
+  f->open_array_section("classes");
+  for (unsigned i = 0; i < classes.size(); ++i) {
+    const Class *c = classes[i];
+    uint64_t ops = read_u64(&c->ops);
+    f->open_object_section("class");
+    f->dump_string("name", c->name);
+    f->dump_unsigned("weight", c->weight);
+    f->dump_int("blocking", c->blocking);
+    f->dump_int("active", _is_active(c));
+    f->dump_unsigned("queued", c->queued.read());
+    f->dump_unsigned("in_flight", c->in_flight.read());
+    f->dump_unsigned("waiting", c->waiting);
+    f->dump_unsigned("ops", ops);
+    f->dump_unsigned("cost", read_u64(&c->cost));
+    f->dump_float("vtime", c->weight ? _vtime(c) : 0);
+    f->dump_float("avg_wait",
+		  ops ? (double)read_u64(&c->wait_us) / 1000000.0 / (double)ops : 0);
+    f->dump_float("avg_service",
+		  ops ? (double)read_u64(&c->service_us) / 1000000.0 / (double)ops : 0);
+    f->close_section();
+  }
+  f->close_section();
+  f->close_section();
+}
@@ -0,0 +1,117 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_WEIGHTEDSCHEDULER_H
+#define CEPH_WEIGHTEDSCHEDULER_H
+
+#include <string>
+#include <vector>
+
+#include "include/atomic.h"
+#include "include/utime.h"
+#include "Mutex.h"
+#include "Cond.h"
+
+class CephContext;
+namespace ceph { class Formatter; }
+
+/**
+ * WeightedScheduler - share a resource between classes of work by weight
+ *
+ * Each class has a weight and accumulates the cost (e.g., bytes) of the
+ * work it is charged for.  Its virtual time is that cost divided by its
+ * weight.  A blocking class may only start new work while its virtual
+ * time is no more than one burst ahead of the furthest-behind class
+ * that currently has demand, so under contention every class gets a
+ * share of the total cost proportional to its weight, while a class
+ * without competition is never held back.  Idle classes do not bank
+ * credit: their virtual time is dragged forward while others run, and
+ * a class running alone sets the pace, so it is not ahead of anyone
+ * when they turn up.
+ *
+ * Non-blocking classes (client IO) are charged without ever waiting,
+ * and their accounting is lock-free, so they can be charged from hot
+ * paths; they only hold back the blocking classes.  A class with weight
+ * 0 is neither held back nor holds anyone else back.
+ */
+class WeightedScheduler {
+  struct Class {
+    std::string name;
+    unsigned weight;
+    bool blocking;
+    atomic_t queued;     ///< items waiting to be started (reported by caller)
+    atomic_t in_flight;  ///< granted and not yet put()
+    // cumulative; 64 bits wide even where atomic_t is not (__sync ops)
+    uint64_t cost;       ///< total cost charged
+    uint64_t ops;        ///< total grants
+    uint64_t wait_us;    ///< total time spent blocked in get()
+    uint64_t service_us; ///< total time between grant and put()
+    uint64_t base;       ///< cost credited while idle (protected by lock)
+    unsigned waiting;    ///< threads blocked in get() (protected by lock)
+
+    Class(const std::string &n, unsigned w, bool b)
+      : name(n), weight(w), blocking(b),
+	cost(0), ops(0), wait_us(0), service_us(0),
+	base(0), waiting(0) {}
+  };
+
+  CephContext *cct;
+  std::string name;
+  mutable Mutex lock;
+  Cond cond;
+  uint64_t burst;
+  double max_wait;
+  std::vector<Class*> classes;
+
+  bool _is_active(const Class *c) const;
+  double _vtime(const Class *c) const;
+  bool _min_vtime(int c, double *vt) const;
+  void _catch_up(int c, double vt);
+  void _charged(int c);
+  bool _should_wait(int c);
+
+public:
+  WeightedScheduler(CephContext *cct, const std::string &n,
+		    uint64_t burst, double max_wait);
+  ~WeightedScheduler();
+
+  /// add a class of work, returning its id
+  int add_class(const std::string &n, unsigned weight, bool blocking);
+  void set_weight(int c, unsigned weight);
+  void set_burst(uint64_t b);
+
+  /// note that n items of class c are waiting to be started
+  void queued(int c, int n = 1) {
+    classes[c]->queued.add(n);
+  }
+  void dequeued(int c, int n = 1) {
+    classes[c]->queued.sub(n);
+  }
+
+  /**
+   * start work of class c
+   *
+   * Blocks a blocking class until it is within its share (or has waited
+   * max_wait, so it can never starve outright), then charges cost.
+   *
+   * @returns the grant time, to be passed to put()
+   */
+  utime_t get(int c, uint64_t cost);
+  /// charge additional cost to class c (e.g., once the real size is known)
+  void charge(int c, uint64_t cost);
+  /// finish work of class c granted at start
+  void put(int c, utime_t start);
+
+  void dump(Formatter *f) const;
+};
+
+#endif
@@ -27,6 +27,7 @@
 #include <sstream>
 #include <sys/uio.h>
 #include <limits.h>
+#include <pthread.h>
 
 namespace ceph {
 
@@ -41,19 +42,326 @@ static uint32_t simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZE
 
 atomic_t buffer_total_alloc;
 bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
+atomic_t buffer_live_bytes;  // all raw buffers, for get_live_bytes()
 
   void buffer::inc_total_alloc(unsigned len) {
     if (buffer_track_alloc)
       buffer_total_alloc.add(len);
+    buffer_live_bytes.add(len);
   }
   void buffer::dec_total_alloc(unsigned len) {
     if (buffer_track_alloc)
       buffer_total_alloc.sub(len);
+    buffer_live_bytes.sub(len);
   }
   int buffer::get_total_alloc() {
     return buffer_total_alloc.read();
   }
 
+  /*
+   * raw buffer pool
+   *
+   * Data for the common raw sizes (4K, 64K and 4M, page aligned or
+   * not) is carved from per-size-class free lists instead of going
+   * to malloc/posix_memalign each time.  Every chunk is page aligned,
+   * so aligned and unaligned buffers share the same classes.  A request
+   * is served from the smallest class it fits in, if it is at least
+   * pool_class_min of it; anything else is allocated at its exact size,
+   * so that a 2M buffer doesn't take a 4M chunk.
+   *
+   * Each thread keeps a few free chunks per class, up to
+   * pool_thread_max_bytes in all; it moves batches to and from a
+   * shared, spinlocked depot when it runs out or over, and gives them
+   * all back when it exits.  Chunks bigger than a thread may keep go
+   * straight back to the depot.  Free chunks are linked through their
+   * first word.  Accounting is kept per thread too and summed by
+   * get_pool_stats(), so the hot path touches no shared cache lines.
+   *
+   * The depot keeps at most pool_depot_max chunks per class (see
+   * set_pool_depot_max()).  trim_pool() frees those that sat in the
+   * depot, unused, since the last trim.  CEPH_BUFFER_NOPOOL=1 turns the
+   * pool off.
+   */
+  static const unsigned pool_class_size[buffer::POOL_NUM_CLASSES] = {
+    4 << 10, 64 << 10, 4 << 20
+  };
+  static const unsigned pool_class_min[buffer::POOL_NUM_CLASSES] = {
+    (2 << 10) + 1, (32 << 10) + 1, (4 << 20) - (64 << 10)
+  };
+  static const unsigned pool_thread_max[buffer::POOL_NUM_CLASSES] = { 128, 16, 2 };
+  static const uint64_t pool_thread_max_bytes = 1 << 20;
+  static unsigned pool_depot_max[buffer::POOL_NUM_CLASSES] = { 256, 16, 2 };
+
+  struct pool_chunk {
+    pool_chunk *next;
+  };
+
+  struct pool_thread_cache {
+    pool_chunk *head[buffer::POOL_NUM_CLASSES];
+    unsigned count[buffer::POOL_NUM_CLASSES];
+    uint64_t bytes;   // in all of head[]
+    uint64_t allocs[buffer::POOL_NUM_CLASSES];
+    uint64_t frees[buffer::POOL_NUM_CLASSES];
+    uint64_t hits[buffer::POOL_NUM_CLASSES];
+    pool_thread_cache *prev, *next;   // on pool_threads
+  };
+
+  struct pool_depot {
+    simple_spinlock_t lock;
+    pool_chunk *head;
+    unsigned count;
+    unsigned low;   // fewest chunks held since the last trim
+  };
+
+  static pool_depot pool_depots[buffer::POOL_NUM_CLASSES];
+  static simple_spinlock_t pool_threads_lock = SIMPLE_SPINLOCK_INITIALIZER;
+  static pool_thread_cache *pool_threads = 0;
+  static pool_thread_cache pool_retired;  // stats of exited threads
+  static __thread pool_thread_cache *pool_tcache = 0;
+  static pthread_key_t pool_tcache_key;
+  static pthread_once_t pool_tcache_once = PTHREAD_ONCE_INIT;
+  bool buffer_pool_enabled = !get_env_bool("CEPH_BUFFER_NOPOOL");
+
+  static int pool_class_for(unsigned len)
+  {
+    if (!buffer_pool_enabled)
+      return -1;
+    for (unsigned i = 0; i < buffer::POOL_NUM_CLASSES; i++)
+      if (len <= pool_class_size[i])
+	return len >= pool_class_min[i] ? (int)i : -1;
+    return -1;
+  }
+
+  /*
+   * move the coldest n of a thread's free chunks of class c to the
+   * depot, or to the system once the depot is full
+   */
+  static void pool_give_back(pool_thread_cache *tc, unsigned c, unsigned n)
+  {
+    if (!n)
+      return;
+    pool_chunk **pp = &tc->head[c];
+    for (unsigned i = n; i < tc->count[c]; i++)
+      pp = &(*pp)->next;
+    pool_chunk *head = *pp;
+    *pp = 0;
+    tc->count[c] -= n;
+    tc->bytes -= (uint64_t)n * pool_class_size[c];
+
+    pool_depot& d = pool_depots[c];
+    simple_spin_lock(&d.lock);
+    while (head && d.count < pool_depot_max[c]) {
+      pool_chunk *p = head;
+      head = p->next;
+      p->next = d.head;
+      d.head = p;
+      d.count++;
+    }
+    simple_spin_unlock(&d.lock);
+    while (head) {
+      pool_chunk *p = head;
+      head = head->next;
+      ::free(p);
+    }
+  }
+
+  static void pool_thread_exit(void *arg)
+  {
+    pool_thread_cache *tc = (pool_thread_cache *)arg;
+    for (unsigned c = 0; c < buffer::POOL_NUM_CLASSES; c++)
+      pool_give_back(tc, c, tc->count[c]);
+    simple_spin_lock(&pool_threads_lock);
+    for (unsigned c = 0; c < buffer::POOL_NUM_CLASSES; c++) {
+      pool_retired.allocs[c] += tc->allocs[c];
+      pool_retired.frees[c] += tc->frees[c];
+      pool_retired.hits[c] += tc->hits[c];
+    }
+    if (tc->prev)
+      tc->prev->next = tc->next;
+    else
+      pool_threads = tc->next;
+    if (tc->next)
+      tc->next->prev = tc->prev;
+    simple_spin_unlock(&pool_threads_lock);
+    ::free(tc);
+    pool_tcache = 0;
+  }
+
+  static void pool_make_key()
+  {
+    pthread_key_create(&pool_tcache_key, pool_thread_exit);
+  }
+
+  static pool_thread_cache *pool_get_tcache()
+  {
+    if (pool_tcache)
+      return pool_tcache;
+    pool_thread_cache *tc = (pool_thread_cache *)::calloc(1, sizeof(*tc));
+    if (!tc)
+      throw buffer::bad_alloc();
+    pthread_once(&pool_tcache_once, pool_make_key);
+    pthread_setspecific(pool_tcache_key, tc);
+    simple_spin_lock(&pool_threads_lock);
+    tc->next = pool_threads;
+    if (pool_threads)
+      pool_threads->prev = tc;
+    pool_threads = tc;
+    simple_spin_unlock(&pool_threads_lock);
+    pool_tcache = tc;
+    return tc;
+  }
+
+  static char *pool_alloc(unsigned c)
+  {
+    pool_thread_cache *tc = pool_get_tcache();
+    tc->allocs[c]++;
+    if (!tc->head[c]) {
+      // refill half a cache's worth from the depot
+      // (as much as fits under the byte limit, and always one)
+      pool_depot& d = pool_depots[c];
+      unsigned want = (pool_thread_max[c] + 1) / 2;
+      uint64_t room = tc->bytes < pool_thread_max_bytes ?
+	(pool_thread_max_bytes - tc->bytes) / pool_class_size[c] : 0;
+      if (want > room)
+	want = room ? room : 1;
+      simple_spin_lock(&d.lock);
+      while (d.head && want--) {
+	pool_chunk *p = d.head;
+	d.head = p->next;
+	d.count--;
+	p->next = tc->head[c];
+	tc->head[c] = p;
+	tc->count[c]++;
+	tc->bytes += pool_class_size[c];
+      }
+      if (d.count < d.low)
+	d.low = d.count;
+      simple_spin_unlock(&d.lock);
+    }
+    pool_chunk *p = tc->head[c];
+    if (p) {
+      tc->head[c] = p->next;
+      tc->count[c]--;
+      tc->bytes -= pool_class_size[c];
+      tc->hits[c]++;
+      return (char *)p;
+    }
+    void *data = 0;
+    if (::posix_memalign(&data, CEPH_PAGE_SIZE, pool_class_size[c]))
+      throw buffer::bad_alloc();
+    return (char *)data;
+  }
+
+  static void pool_free(unsigned c, char *data)
+  {
+    pool_thread_cache *tc = pool_get_tcache();
+    tc->frees[c]++;
+    pool_chunk *p = (pool_chunk *)data;
+    p->next = tc->head[c];
+    tc->head[c] = p;
+    tc->count[c]++;
+    tc->bytes += pool_class_size[c];
+
+    // hand the colder half back if this class has too many...
+    if (tc->count[c] > pool_thread_max[c])
+      pool_give_back(tc, c, tc->count[c] / 2);
+    // ...and trim the whole cache to its byte limit, big chunks first
+    for (int i = buffer::POOL_NUM_CLASSES - 1;
+	 i >= 0 && tc->bytes > pool_thread_max_bytes;
+	 i--) {
+      while (tc->count[i] && tc->bytes > pool_thread_max_bytes)
+	pool_give_back(tc, i, (tc->count[i] + 1) / 2);
+    }
+  }
+
+  static void pool_free_list(pool_chunk *head)
+  {
+    while (head) {
+      pool_chunk *p = head;
+      head = head->next;
+      ::free(p);
+    }
+  }
+
+  /*
+   * unlink the first n chunks of depot d, which must be locked
+   */
+  static pool_chunk *pool_depot_take(pool_depot& d, unsigned n)
+  {
+    pool_chunk *head = d.head;
+    pool_chunk **pp = &head;
+    for (unsigned i = 0; i < n && *pp; i++) {
+      pp = &(*pp)->next;
+      d.count--;
+    }
+    d.head = *pp;
+    *pp = 0;
+    return head;
+  }
+
+  void buffer::set_pool_depot_max(unsigned c, unsigned n)
+  {
+    assert(c < POOL_NUM_CLASSES);
+    pool_depot& d = pool_depots[c];
+    simple_spin_lock(&d.lock);
+    pool_depot_max[c] = n;
+    pool_chunk *excess = 0;
+    if (d.count > n)
+      excess = pool_depot_take(d, d.count - n);
+    if (d.low > d.count)
+      d.low = d.count;
+    simple_spin_unlock(&d.lock);
+    pool_free_list(excess);
+  }
+
+  void buffer::trim_pool()
+  {
+    for (unsigned c = 0; c < POOL_NUM_CLASSES; c++) {
+      pool_depot& d = pool_depots[c];
+      simple_spin_lock(&d.lock);
+      // chunks that sat in the depot since the last trim aren't needed
+      pool_chunk *idle = pool_depot_take(d, d.low);
+      d.low = d.count;
+      simple_spin_unlock(&d.lock);
+      pool_free_list(idle);
+    }
+  }
+
+  uint64_t buffer::get_live_bytes()
+  {
+    return buffer_live_bytes.read();
+  }
+
+  void buffer::get_pool_stats(pool_stats_t stats[POOL_NUM_CLASSES])
+  {
+    uint64_t allocs[POOL_NUM_CLASSES], frees[POOL_NUM_CLASSES];
+    simple_spin_lock(&pool_threads_lock);
+    for (unsigned c = 0; c < POOL_NUM_CLASSES; c++) {
+      stats[c].chunk_size = pool_class_size[c];
+      stats[c].cached = 0;
+      allocs[c] = pool_retired.allocs[c];
+      frees[c] = pool_retired.frees[c];
+      stats[c].hits = pool_retired.hits[c];
+    }
+    for (pool_thread_cache *tc = pool_threads; tc; tc = tc->next) {
+      for (unsigned c = 0; c < POOL_NUM_CLASSES; c++) {
+	stats[c].cached += tc->count[c];
+	allocs[c] += tc->allocs[c];
+	frees[c] += tc->frees[c];
+	stats[c].hits += tc->hits[c];
+      }
+    }
+    simple_spin_unlock(&pool_threads_lock);
+    for (unsigned c = 0; c < POOL_NUM_CLASSES; c++) {
+      simple_spin_lock(&pool_depots[c].lock);
+      stats[c].cached += pool_depots[c].count;
+      simple_spin_unlock(&pool_depots[c].lock);
+      stats[c].allocs = allocs[c];
+      // reads of other threads' counters are not synchronized
+      stats[c].live = allocs[c] > frees[c] ? allocs[c] - frees[c] : 0;
+    }
+  }
+
   class buffer::raw {
   public:
     char *data;
@@ -133,23 +441,31 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
   };
 
   class buffer::raw_posix_aligned : public buffer::raw {
+    int pool_class;
   public:
-    raw_posix_aligned(unsigned l) : raw(l) {
+    raw_posix_aligned(unsigned l) : raw(l), pool_class(pool_class_for(l)) {
+      if (pool_class >= 0) {
+	data = pool_alloc(pool_class);
+      } else {
 #ifdef DARWIN
-      data = (char *) valloc (len);
+	data = (char *) valloc (len);
 #else
-      data = 0;
-      int r = ::posix_memalign((void**)(void*)&data, CEPH_PAGE_SIZE, len);
-      if (r)
-	throw bad_alloc();
+	data = 0;
+	int r = ::posix_memalign((void**)(void*)&data, CEPH_PAGE_SIZE, len);
+	if (r)
+	  throw bad_alloc();
 #endif /* DARWIN */
+      }
       if (!data)
 	throw bad_alloc();
       inc_total_alloc(len);
       bdout << "raw_posix_aligned " << this << " alloc " << (void *)data << " " << l << " " << buffer::get_total_alloc() << bendl;
     }
     ~raw_posix_aligned() {
-      ::free((void*)data);
+      if (pool_class >= 0)
+	pool_free(pool_class, data);
+      else
+	::free((void*)data);
       dec_total_alloc(len);
       bdout << "raw_posix_aligned " << this << " free " << (void *)data << " " << buffer::get_total_alloc() << bendl;
     }
@@ -190,21 +506,27 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
    * primitive buffer types
    */
   class buffer::raw_char : public buffer::raw {
+    int pool_class;
   public:
-    raw_char(unsigned l) : raw(l) {
-      if (len)
+    raw_char(unsigned l) : raw(l), pool_class(pool_class_for(l)) {
+      if (pool_class >= 0)
+	data = pool_alloc(pool_class);
+      else if (len)
 	data = new char[len];
       else
 	data = 0;
       inc_total_alloc(len);
       bdout << "raw_char " << this << " alloc " << (void *)data << " " << l << " " << buffer::get_total_alloc() << bendl;
     }
-    raw_char(unsigned l, char *b) : raw(b, l) {
+    raw_char(unsigned l, char *b) : raw(b, l), pool_class(-1) {
       inc_total_alloc(len);
       bdout << "raw_char " << this << " alloc " << (void *)data << " " << l << " " << buffer::get_total_alloc() << bendl;
     }
     ~raw_char() {
-      delete[] data;
+      if (pool_class >= 0)
+	pool_free(pool_class, data);
+      else
+	delete[] data;
       dec_total_alloc(len);
       bdout << "raw_char " << this << " free " << (void *)data << " " << buffer::get_total_alloc() << bendl;
     }
@@ -1259,6 +1581,62 @@ int buffer::list::write_fd(int fd) const
   return 0;
 }
 
+/*
+ * like write_fd(fd), but with pwritev at offset, leaving the fd's file
+ * position alone (so that the fd can be shared).
+ */
+int buffer::list::write_fd(int fd, uint64_t offset) const
+{
+  iovec iov[IOV_MAX];
+  int iovlen = 0;
+  ssize_t bytes = 0;
+
+  std::list<ptr>::const_iterator p = _buffers.begin(); 
+  while (p != _buffers.end()) {
+    if (p->length() > 0) {
+      iov[iovlen].iov_base = (void *)p->c_str();
+      iov[iovlen].iov_len = p->length();
+      bytes += p->length();
+      iovlen++;
+    }
+    p++;
+
+    if (iovlen == IOV_MAX-1 ||
+	p == _buffers.end()) {
+      iovec *start = iov;
+      int num = iovlen;
+      ssize_t wrote;
+    retry:
+      wrote = ::pwritev(fd, start, num, offset);
+      if (wrote < 0) {
+	int err = errno;
+	if (err == EINTR)
+	  goto retry;
+	return -err;
+      }
+      offset += wrote;
+      if (wrote < bytes) {
+	// partial write, recover!
+	while ((size_t)wrote >= start[0].iov_len) {
+	  wrote -= start[0].iov_len;
+	  bytes -= start[0].iov_len;
+	  start++;
+	  num--;
+	}
+	if (wrote > 0) {
+	  start[0].iov_len -= wrote;
+	  start[0].iov_base = (char *)start[0].iov_base + wrote;
+	  bytes -= wrote;
+	}
+	goto retry;
+      }
+      iovlen = 0;
+      bytes = 0;
+    }
+  }
+  return 0;
+}
+
 
 void buffer::list::hexdump(std::ostream &out) const
 {
@@ -66,6 +66,7 @@ public:
 	_reopen_logs = false;
       }
       _cct->_heartbeat_map->check_touch_file();
+      buffer::trim_pool();
     }
     return NULL;
   }
@@ -148,6 +149,44 @@ public:
 };
 
 
+// buffer pool accounting
+
+enum {
+  l_buffer_first = 9700,
+  l_buffer_live_bytes,
+  l_buffer_cached_bytes,
+  l_buffer_allocs,
+  l_buffer_pool_hits,
+  l_buffer_live_4k,
+  l_buffer_cached_4k,
+  l_buffer_live_64k,
+  l_buffer_cached_64k,
+  l_buffer_live_4m,
+  l_buffer_cached_4m,
+  l_buffer_total_alloc,
+  l_buffer_last,
+};
+
+void CephContext::_refresh_buffer_perf()
+{
+  buffer::pool_stats_t stats[buffer::POOL_NUM_CLASSES];
+  buffer::get_pool_stats(stats);
+  uint64_t cached = 0, allocs = 0, hits = 0;
+  for (unsigned c = 0; c < buffer::POOL_NUM_CLASSES; c++) {
+    cached += stats[c].cached * stats[c].chunk_size;
+    allocs += stats[c].allocs;
+    hits += stats[c].hits;
+    _buffer_perf->set(l_buffer_live_4k + 2 * c, stats[c].live * stats[c].chunk_size);
+    _buffer_perf->set(l_buffer_cached_4k + 2 * c, stats[c].cached * stats[c].chunk_size);
+  }
+  _buffer_perf->set(l_buffer_live_bytes, buffer::get_live_bytes());  // pooled or not
+  _buffer_perf->set(l_buffer_cached_bytes, cached);
+  _buffer_perf->set(l_buffer_allocs, allocs);
+  _buffer_perf->set(l_buffer_pool_hits, hits);
+  _buffer_perf->set(l_buffer_total_alloc, buffer::get_total_alloc());
+}
+
+
 // perfcounter hooks
 
 class CephContextHook : public AdminSocketHook {
@@ -167,6 +206,8 @@ void CephContext::do_command(std::string command, std::string args, bufferlist *
   lgeneric_dout(this, 1) << "do_command '" << command << "' '" << args << "'" << dendl;
   if (command == "perfcounters_dump" || command == "1" ||
       command == "perf dump") {
+    if (_buffer_perf)
+      _refresh_buffer_perf();
     _perf_counters_collection->write_json_to_buf(*out, false);
   }
   else if (command == "perfcounters_schema" || command == "2" ||
@@ -219,6 +260,35 @@ void CephContext::do_command(std::string command, std::string args, bufferlist *
 };
 
 
+/**
+ * observe raw buffer pool config changes
+ *
+ * The pool is process-wide; the last context to set a limit wins.
+ */
+class BufferPoolObs : public md_config_obs_t {
+public:
+  const char** get_tracked_conf_keys() const {
+    static const char *KEYS[] = {
+      "buffer_pool_depot_4k",
+      "buffer_pool_depot_64k",
+      "buffer_pool_depot_4m",
+      NULL
+    };
+    return KEYS;
+  }
+
+  void handle_conf_change(const md_config_t *conf,
+			  const std::set <std::string> &changed) {
+    if (changed.count("buffer_pool_depot_4k"))
+      buffer::set_pool_depot_max(0, MAX(conf->buffer_pool_depot_4k, 0));
+    if (changed.count("buffer_pool_depot_64k"))
+      buffer::set_pool_depot_max(1, MAX(conf->buffer_pool_depot_64k, 0));
+    if (changed.count("buffer_pool_depot_4m"))
+      buffer::set_pool_depot_max(2, MAX(conf->buffer_pool_depot_4m, 0));
+  }
+};
+
+
 CephContext::CephContext(uint32_t module_type_)
   : nref(1),
     _conf(new md_config_t()),
@@ -226,9 +296,11 @@ CephContext::CephContext(uint32_t module_type_)
     _module_type(module_type_),
     _service_thread(NULL),
     _log_obs(NULL),
+    _buffer_pool_obs(NULL),
     _admin_socket(NULL),
     _perf_counters_collection(NULL),
     _perf_counters_conf_obs(NULL),
+    _buffer_perf(NULL),
     _heartbeat_map(NULL),
     _crypto_none(NULL),
     _crypto_aes(NULL)
@@ -241,6 +313,9 @@ CephContext::CephContext(uint32_t module_type_)
   _log_obs = new LogObs(_log);
   _conf->add_observer(_log_obs);
 
+  _buffer_pool_obs = new BufferPoolObs;
+  _conf->add_observer(_buffer_pool_obs);
+
   _perf_counters_collection = new PerfCountersCollection(this);
   _admin_socket = new AdminSocket(this);
   _heartbeat_map = new HeartbeatMap(this);
@@ -289,6 +364,9 @@ CephContext::~CephContext()
   delete _perf_counters_collection;
   _perf_counters_collection = NULL;
 
+  delete _buffer_perf;
+  _buffer_perf = NULL;
+
   delete _perf_counters_conf_obs;
   _perf_counters_conf_obs = NULL;
 
@@ -296,6 +374,10 @@ CephContext::~CephContext()
   delete _log_obs;
   _log_obs = NULL;
 
+  _conf->remove_observer(_buffer_pool_obs);
+  delete _buffer_pool_obs;
+  _buffer_pool_obs = NULL;
+
   _log->stop();
   delete _log;
   _log = NULL;
@@ -318,6 +400,23 @@ void CephContext::start_service_thread()
   _service_thread->create();
   pthread_spin_unlock(&_service_thread_lock);
 
+  if (_conf->perf_buffer_pool) {
+    PerfCountersBuilder b(this, "buffer", l_buffer_first, l_buffer_last);
+    b.add_u64(l_buffer_live_bytes, "live_bytes");
+    b.add_u64(l_buffer_cached_bytes, "cached_bytes");
+    b.add_u64(l_buffer_allocs, "allocs");         // totals, sampled
+    b.add_u64(l_buffer_pool_hits, "pool_hits");
+    b.add_u64(l_buffer_live_4k, "live_4k");
+    b.add_u64(l_buffer_cached_4k, "cached_4k");
+    b.add_u64(l_buffer_live_64k, "live_64k");
+    b.add_u64(l_buffer_cached_64k, "cached_64k");
+    b.add_u64(l_buffer_live_4m, "live_4m");
+    b.add_u64(l_buffer_cached_4m, "cached_4m");
+    b.add_u64(l_buffer_total_alloc, "total_alloc");  // only with CEPH_BUFFER_TRACK
+    _buffer_perf = b.create_perf_counters();
+    _perf_counters_collection->add(_buffer_perf);
+  }
+
   // make logs flush on_exit()
   if (_conf->log_flush_on_exit)
     _log->set_flush_on_exit();
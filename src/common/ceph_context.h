@@ -24,6 +24,7 @@
 class AdminSocket;
 class CephContextServiceThread;
 class PerfCountersCollection;
+class PerfCounters;
 class md_config_obs_t;
 class md_config_t;
 class CephContextHook;
@@ -119,6 +120,7 @@ private:
   CephContextServiceThread *_service_thread;
 
   md_config_obs_t *_log_obs;
+  md_config_obs_t *_buffer_pool_obs;
 
   /* The admin socket associated with this context */
   AdminSocket *_admin_socket;
@@ -131,6 +133,10 @@ private:
 
   md_config_obs_t *_perf_counters_conf_obs;
 
+  /* raw buffer pool accounting, refreshed whenever perf counters are dumped */
+  PerfCounters *_buffer_perf;
+  void _refresh_buffer_perf();
+
   CephContextHook *_admin_hook;
 
   ceph::HeartbeatMap *_heartbeat_map;
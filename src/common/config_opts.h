@@ -24,6 +24,10 @@ OPTION(monmap, OPT_STR, "")
 OPTION(mon_host, OPT_STR, "")
 OPTION(lockdep, OPT_BOOL, false)
 OPTION(admin_socket, OPT_STR, "/var/run/ceph/$cluster-$name.asok")
+OPTION(perf_buffer_pool, OPT_BOOL, true)  // raw buffer pool accounting in the "buffer" perf counters
+OPTION(buffer_pool_depot_4k, OPT_INT, 256)  // free 4K raw buffer chunks kept for any thread to reuse
+OPTION(buffer_pool_depot_64k, OPT_INT, 16)  // ... 64K chunks
+OPTION(buffer_pool_depot_4m, OPT_INT, 2)    // ... 4M chunks
 
 OPTION(daemonize, OPT_BOOL, false)
 OPTION(pid_file, OPT_STR, "")
@@ -89,6 +93,8 @@ OPTION(keyfile, OPT_STR, "")
 OPTION(keyring, OPT_STR, "/etc/ceph/$cluster.$name.keyring,/etc/ceph/$cluster.keyring,/etc/ceph/keyring,/etc/ceph/keyring.bin")
 OPTION(heartbeat_interval, OPT_INT, 5)
 OPTION(heartbeat_file, OPT_STR, "")
+OPTION(ms_type, OPT_STR, "simple")  // simple or event
+OPTION(ms_event_workers, OPT_INT, 2)   // network threads for ms_type = event
 OPTION(ms_tcp_nodelay, OPT_BOOL, true)
 OPTION(ms_initial_backoff, OPT_DOUBLE, .2)
 OPTION(ms_max_backoff, OPT_DOUBLE, 15.0)
@@ -99,6 +105,8 @@ OPTION(ms_bind_ipv6, OPT_BOOL, false)
 OPTION(ms_rwthread_stack_bytes, OPT_U64, 1024 << 10)
 OPTION(ms_tcp_read_timeout, OPT_U64, 900)
 OPTION(ms_inject_socket_failures, OPT_U64, 0)
+OPTION(ms_rx_pool_bytes, OPT_U64, 0)   // page-aligned receive buffers each messenger keeps for reuse; 0 disables
+OPTION(ms_rx_pool_min_len, OPT_U64, 64 << 10) // only pool message data at least this big
 OPTION(mon_data, OPT_STR, "/var/lib/ceph/mon/$cluster-$id")
 OPTION(mon_initial_members, OPT_STR, "")    // list of initial cluster mon ids; if specified, need majority to form initial quorum and create new cluster
 OPTION(mon_sync_fs_threshold, OPT_INT, 5)   // sync() when writing this many objects; 0 to disable.
@@ -271,6 +279,7 @@ OPTION(osd_journal_size, OPT_INT, 1024)         // in mb
 OPTION(osd_max_write_size, OPT_INT, 90)
 OPTION(osd_max_pgls, OPT_U64, 1024) // max number of pgls entries to return
 OPTION(osd_client_message_size_cap, OPT_U64, 500*1024L*1024L) // client data allowed in-memory (in bytes)
+OPTION(osd_rx_pool_bytes, OPT_U64, 16 << 20)  // receive buffer pool of each of the client and cluster messengers
 OPTION(osd_stat_refresh_interval, OPT_DOUBLE, .5)
 OPTION(osd_pg_bits, OPT_INT, 6)  // bits per osd
 OPTION(osd_pgp_bits, OPT_INT, 6)  // bits per osd
@@ -283,16 +292,27 @@ OPTION(osd_pool_default_pg_num, OPT_INT, 8)
 OPTION(osd_pool_default_pgp_num, OPT_INT, 8)
 OPTION(osd_map_dedup, OPT_BOOL, true)
 OPTION(osd_map_cache_size, OPT_INT, 500)
+OPTION(osd_pg_skip_unchanged_maps, OPT_BOOL, true)  // don't step pgs through epochs that can't affect them
 OPTION(osd_map_cache_bl_size, OPT_INT, 50)
 OPTION(osd_map_cache_bl_inc_size, OPT_INT, 100)
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
 OPTION(osd_op_threads, OPT_INT, 2)    // 0 == no threading
+OPTION(osd_op_num_shards, OPT_INT, 2)  // op queue shards; each pg maps to exactly one
+OPTION(osd_op_num_threads_per_shard, OPT_INT, 1)
 OPTION(osd_disk_threads, OPT_INT, 1)
 OPTION(osd_recovery_threads, OPT_INT, 1)
+OPTION(osd_load_pgs_threads, OPT_INT, 4)  // threads reading pg state and logs at startup
 OPTION(osd_recover_clone_overlap, OPT_BOOL, true)   // preserve clone_overlap during recovery/migration
 OPTION(osd_backfill_scan_min, OPT_INT, 64)
 OPTION(osd_backfill_scan_max, OPT_INT, 512)
 OPTION(osd_op_thread_timeout, OPT_INT, 30)
+OPTION(osd_op_sched_client_weight, OPT_INT, 60)     // share of osd work for client io (0 == unscheduled)
+OPTION(osd_op_sched_recovery_weight, OPT_INT, 20)   // ... for recovery pushes
+OPTION(osd_op_sched_scrub_weight, OPT_INT, 10)      // ... for scrub (primary and replica)
+OPTION(osd_op_sched_snap_trim_weight, OPT_INT, 10)  // ... for snap trimming
+OPTION(osd_op_sched_min_cost, OPT_U64, 4096)        // cost (bytes) charged per op, at least
+OPTION(osd_op_sched_burst, OPT_U64, 4<<20)          // cost a class may run ahead of its share
+OPTION(osd_op_sched_max_wait, OPT_FLOAT, 1.0)       // max seconds background work waits for its share (0 == forever)
 OPTION(osd_backlog_thread_timeout, OPT_INT, 60*60*1)
 OPTION(osd_recovery_thread_timeout, OPT_INT, 30)
 OPTION(osd_snap_trim_thread_timeout, OPT_INT, 60*60*1)
@@ -313,10 +333,12 @@ OPTION(osd_min_down_reporters, OPT_INT, 1)   // number of OSDs who need to repor
 OPTION(osd_min_down_reports, OPT_INT, 3)     // number of times a down OSD must be reported for it to count
 OPTION(osd_default_data_pool_replay_window, OPT_INT, 45)
 OPTION(osd_preserve_trimmed_log, OPT_BOOL, false)
+OPTION(osd_log_dirty_extents, OPT_BOOL, true)  // log the data ranges each write changes, so recovery can push just those
 OPTION(osd_auto_mark_unfound_lost, OPT_BOOL, false)
 OPTION(osd_recovery_delay_start, OPT_FLOAT, 15)
 OPTION(osd_recovery_max_active, OPT_INT, 5)
 OPTION(osd_recovery_max_chunk, OPT_U64, 1<<20)  // max size of push chunk
+OPTION(osd_recovery_max_push_objects, OPT_INT, 64)  // small objects per batched push, 1 to send each alone
 OPTION(osd_recovery_forget_lost_objects, OPT_BOOL, false)   // off for now
 OPTION(osd_max_scrubs, OPT_INT, 1)
 OPTION(osd_scrub_load_threshold, OPT_FLOAT, 0.5)
@@ -324,6 +346,9 @@ OPTION(osd_scrub_min_interval, OPT_FLOAT, 300)
 OPTION(osd_scrub_max_interval, OPT_FLOAT, 60*60*24)   // once a day
 OPTION(osd_deep_scrub_interval, OPT_FLOAT, 60*60*24*7) // once a week
 OPTION(osd_deep_scrub_stride, OPT_INT, 524288)
+OPTION(osd_scrub_begin_hour, OPT_INT, 0)  // only schedule scrubs from this (local) hour...
+OPTION(osd_scrub_end_hour, OPT_INT, 24)   // ...up to this one; may wrap past midnight
+OPTION(osd_scrub_max_bytes_per_sec, OPT_U64, 0)  // deep scrub read budget, 0 for no limit
 OPTION(osd_auto_weight, OPT_BOOL, false)
 OPTION(osd_class_dir, OPT_STR, CEPH_LIBDIR "/rados-classes") // where rados plugins are stored
 OPTION(osd_check_for_log_corruption, OPT_BOOL, false)
@@ -345,6 +370,9 @@ OPTION(osd_op_history_duration, OPT_U32, 600) // Oldest completed op to track
 OPTION(osd_target_transaction_size, OPT_INT, 300)     // to adjust various transactions that batch smaller items
 OPTION(filestore, OPT_BOOL, false)
 OPTION(filestore_debug_omap_check, OPT_BOOL, 0) // Expensive debugging check on sync
+OPTION(filestore_omap_backend, OPT_STR, "leveldb")  // leveldb or memdb; used by mkfs, mount reads what mkfs recorded
+OPTION(filestore_omap_header_cache_size, OPT_INT, 1024)  // omap headers DBObjectMap keeps in memory
+OPTION(filestore_omap_batch_writes, OPT_BOOL, true)  // one kv write per transaction for omap key updates
 // Use omap for xattrs for attrs over
 OPTION(filestore_xattr_use_omap, OPT_BOOL, false)
 // filestore_max_inline_xattr_size or
@@ -360,6 +388,15 @@ OPTION(filestore_fsync_flushes_journal_data, OPT_BOOL, false)
 OPTION(filestore_fiemap, OPT_BOOL, false)     // (try to) use fiemap
 OPTION(filestore_flusher, OPT_BOOL, true)
 OPTION(filestore_flusher_max_fds, OPT_INT, 512)
+OPTION(filestore_fd_cache_size, OPT_INT, 128)    // open object fds to keep around
+OPTION(filestore_fd_cache_shards, OPT_INT, 16)   // ... split this many ways
+OPTION(filestore_xattr_cache_size, OPT_INT, 10000) // objects whose attrs we cache (0 to disable)
+OPTION(filestore_xattr_cache_shards, OPT_INT, 16) // ... split this many ways
+OPTION(filestore_readahead_max, OPT_INT, 1 << 20)  // bytes to read ahead of a sequential reader (0 to disable)
+OPTION(filestore_readahead_min_seq, OPT_INT, 2)    // ... once it has made this many sequential reads
+OPTION(filestore_read_cache_size, OPT_U64, 0)      // bytes of object data to cache (0 to disable)
+OPTION(filestore_read_cache_max_read, OPT_INT, 65536) // ... from reads no larger than this
+OPTION(filestore_read_cache_shards, OPT_INT, 16)   // ... split this many ways
 OPTION(filestore_flush_min, OPT_INT, 65536)
 OPTION(filestore_sync_flush, OPT_BOOL, false)
 OPTION(filestore_journal_parallel, OPT_BOOL, false)
@@ -369,6 +406,8 @@ OPTION(filestore_queue_max_ops, OPT_INT, 500)
 OPTION(filestore_queue_max_bytes, OPT_INT, 100 << 20)
 OPTION(filestore_queue_committing_max_ops, OPT_INT, 500)        // this is ON TOP of filestore_queue_max_*
 OPTION(filestore_queue_committing_max_bytes, OPT_INT, 100 << 20) //  "
+OPTION(filestore_queue_max_ops_per_osr, OPT_INT, 0)    // per sequencer (pg) share of the above; 0 = no limit
+OPTION(filestore_queue_max_bytes_per_osr, OPT_INT, 0)  //  "
 OPTION(filestore_op_threads, OPT_INT, 2)
 OPTION(filestore_op_thread_timeout, OPT_INT, 60)
 OPTION(filestore_op_thread_suicide_timeout, OPT_INT, 180)
@@ -376,6 +415,7 @@ OPTION(filestore_commit_timeout, OPT_FLOAT, 600)
 OPTION(filestore_fiemap_threshold, OPT_INT, 4096)
 OPTION(filestore_merge_threshold, OPT_INT, 10)
 OPTION(filestore_split_multiple, OPT_INT, 2)
+OPTION(filestore_split_async, OPT_BOOL, true)   // split full index dirs in a background thread, a subdir at a time
 OPTION(filestore_update_to, OPT_INT, 1000)
 OPTION(filestore_blackhole, OPT_BOOL, false)     // drop any new transactions on the floor
 OPTION(filestore_dump_file, OPT_STR, "")         // file onto which store transaction dumps
@@ -383,9 +423,13 @@ OPTION(filestore_kill_at, OPT_INT, 0)            // inject a failure at the n'th
 OPTION(filestore_fail_eio, OPT_BOOL, true)       // fail/crash on EIO
 OPTION(journal_dio, OPT_BOOL, true)
 OPTION(journal_aio, OPT_BOOL, false)
+OPTION(journal_aio_max_inflight, OPT_INT, 16)   // aio writes to keep in flight at once
+OPTION(journal_aio_max_inflight_bytes, OPT_INT, 64 << 20)  // ... and at most this many bytes; 0 for no limit
 OPTION(journal_block_align, OPT_BOOL, true)
 OPTION(journal_max_write_bytes, OPT_INT, 10 << 20)
 OPTION(journal_max_write_entries, OPT_INT, 100)
+OPTION(journal_batch_window_us, OPT_INT, 0)   // max usec to hold a write back to group more entries into it; 0 disables
+OPTION(journal_batch_min_bytes, OPT_INT, 128 << 10)  // ... unless this many bytes are already queued
 OPTION(journal_queue_max_ops, OPT_INT, 500)
 OPTION(journal_queue_max_bytes, OPT_INT, 100 << 20)
 OPTION(journal_align_min_size, OPT_INT, 64 << 10)  // align data payloads >= this.
@@ -0,0 +1,46 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdint.h>
+
+#include "include/crc32c.h"
+#include "common/crc32c_intel.h"
+#include "common/sctp_crc32.h"
+
+/*
+ * Runtime dispatch for ceph_crc32c_le().  The first call probes the
+ * cpu and points ceph_crc32c_func at the best implementation; every
+ * thread that races on the first call picks the same one, so the
+ * unlocked store is harmless.
+ */
+
+ceph_crc32c_func_t ceph_choose_crc32(void)
+{
+  if (ceph_crc32c_intel_supported())
+    return ceph_crc32c_intel;
+  return ceph_crc32c_sctp;
+}
+
+static uint32_t ceph_crc32c_choose(uint32_t crc, unsigned char const *data, unsigned length);
+
+static ceph_crc32c_func_t ceph_crc32c_func = ceph_crc32c_choose;
+
+static uint32_t ceph_crc32c_choose(uint32_t crc, unsigned char const *data, unsigned length)
+{
+  ceph_crc32c_func = ceph_choose_crc32();
+  return ceph_crc32c_func(crc, data, length);
+}
+
+uint32_t ceph_crc32c_le(uint32_t crc, unsigned char const *data, unsigned length)
+{
+  return ceph_crc32c_func(crc, data, length);
+}
@@ -0,0 +1,91 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "common/crc32c_intel.h"
+
+/*
+ * The SSE4.2 crc32 instruction computes exactly the (reflected,
+ * non-inverted) crc32c update that ceph_crc32c_le() is defined as, so
+ * we can feed it 8 (or 4) bytes at a time and finish the tail a byte
+ * at a time.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+
+int ceph_crc32c_intel_supported(void)
+{
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return 0;
+  return (ecx & bit_SSE4_2) != 0;
+}
+
+static inline uint32_t crc32c_u8(uint32_t crc, uint8_t v)
+{
+  __asm__("crc32b %1, %0" : "+r" (crc) : "rm" (v));
+  return crc;
+}
+
+uint32_t ceph_crc32c_intel(uint32_t crc, unsigned char const *data, unsigned length)
+{
+  // align to a word boundary so the bulk loads below don't straddle
+  // cache lines
+  while (length && ((uintptr_t)data & (sizeof(long) - 1))) {
+    crc = crc32c_u8(crc, *data++);
+    length--;
+  }
+
+#if defined(__x86_64__)
+  {
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+      uint64_t v;
+      memcpy(&v, data, 8);
+      __asm__("crc32q %1, %0" : "+r" (crc64) : "rm" (v));
+      data += 8;
+      length -= 8;
+    }
+    crc = (uint32_t)crc64;
+  }
+#else
+  while (length >= 4) {
+    uint32_t v;
+    memcpy(&v, data, 4);
+    __asm__("crc32l %1, %0" : "+r" (crc) : "rm" (v));
+    data += 4;
+    length -= 4;
+  }
+#endif
+
+  while (length--)
+    crc = crc32c_u8(crc, *data++);
+  return crc;
+}
+
+#else
+
+int ceph_crc32c_intel_supported(void)
+{
+  return 0;
+}
+
+uint32_t ceph_crc32c_intel(uint32_t crc, unsigned char const *data, unsigned length)
+{
+  return 0;  // never chosen; see ceph_crc32c_intel_supported()
+}
+
+#endif
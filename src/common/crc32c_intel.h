@@ -0,0 +1,18 @@
+#ifndef CEPH_COMMON_CRC32C_INTEL_H
+#define CEPH_COMMON_CRC32C_INTEL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* true if the cpu has the SSE4.2 crc32 instruction */
+extern int ceph_crc32c_intel_supported(void);
+
+/* crc32c using the SSE4.2 crc32 instruction; only call if supported */
+extern uint32_t ceph_crc32c_intel(uint32_t crc, unsigned char const *data, unsigned length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -19,8 +19,10 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <map>
+#include <math.h>
 #include <sstream>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <string>
 
@@ -91,110 +93,210 @@ void PerfCountersCollection::write_json_to_buf(bufferlist& bl, bool schema)
 
 // ---------------------------
 
+// which stripe of slots this thread updates; assigned round robin
+static __thread int perf_stripe = -1;
+static unsigned perf_next_stripe = 0;
+
+static inline uint64_t atomic_read_u64(const uint64_t *p)
+{
+  return __sync_fetch_and_add(const_cast<uint64_t *>(p), 0);
+}
+
+static inline void atomic_set_u64(uint64_t *p, uint64_t v)
+{
+  uint64_t old;
+  do {
+    old = *(volatile uint64_t *)p;
+  } while (!__sync_bool_compare_and_swap(p, old, v));
+}
+
+static inline void atomic_add_double(uint64_t *p, double v)
+{
+  union { uint64_t u; double d; } o, n;
+  do {
+    o.u = *(volatile uint64_t *)p;
+    n.d = o.d + v;
+  } while (!__sync_bool_compare_and_swap(p, o.u, n.u));
+}
+
+static inline uint64_t double_bits(double d)
+{
+  union { uint64_t u; double d; } v;
+  v.d = d;
+  return v.u;
+}
+
+static inline double bits_double(uint64_t u)
+{
+  union { uint64_t u; double d; } v;
+  v.u = u;
+  return v.d;
+}
+
+/// log2 bucket for v: 0 -> 0, [2^(i-1), 2^i) -> i, capped at n-1
+static inline unsigned hist_bucket(uint64_t v, unsigned n)
+{
+  unsigned b = v ? 64 - __builtin_clzll(v) : 0;
+  return b < n ? b : n - 1;
+}
+
 PerfCounters::~PerfCounters()
 {
+  for (perf_counter_data_vec_t::iterator d = m_data.begin(); d != m_data.end(); ++d)
+    delete[] d->hist;
+  free(m_slots);
 }
 
-void PerfCounters::inc(int idx, uint64_t amt)
+PerfCounters::perf_counter_slot_d *PerfCounters::get_slot(int idx)
 {
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
-  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  if (perf_stripe < 0)
+    perf_stripe = __sync_fetch_and_add(&perf_next_stripe, 1) % NUM_STRIPES;
+  return &m_slots[perf_stripe * m_stripe_len + (idx - m_lower_bound - 1)];
+}
+
+void PerfCounters::read_slot(int i, uint64_t *val, uint64_t *avgcount) const
+{
+  const perf_counter_data_any_d& data(m_data[i]);
+  uint64_t u = 0, c = 0;
+  double d = 0;
+  for (int s = 0; s < NUM_STRIPES; s++) {
+    const perf_counter_slot_d& slot(m_slots[s * m_stripe_len + i]);
+    if (data.type & PERFCOUNTER_FLOAT)
+      d += bits_double(atomic_read_u64(&slot.val));
+    else
+      u += atomic_read_u64(&slot.val);
+    c += atomic_read_u64(&slot.avgcount);
+  }
+  *val = (data.type & PERFCOUNTER_FLOAT) ? double_bits(d) : u;
+  *avgcount = c;
+}
+
+void PerfCounters::inc(int idx, uint64_t amt)
+{
+  perf_counter_slot_d *slot = get_slot(idx);
+  const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_U64))
     return;
-  data.u.u64 += amt;
+  __sync_fetch_and_add(&slot->val, amt);
   if (data.type & PERFCOUNTER_LONGRUNAVG)
-    data.avgcount++;
+    __sync_fetch_and_add(&slot->avgcount, 1);
 }
 
 void PerfCounters::set(int idx, uint64_t amt)
 {
-  Mutex::Locker lck(m_lock);
-  assert(idx > m_lower_bound);
-  assert(idx < m_upper_bound);
-  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  perf_counter_slot_d *slot = get_slot(idx);
+  int i = idx - m_lower_bound - 1;
+  const perf_counter_data_any_d& data(m_data[i]);
   if (!(data.type & PERFCOUNTER_U64))
     return;
-  data.u.u64 = amt;
+  // the value lives in stripe 0; clear everyone else's share
+  for (int s = 0; s < NUM_STRIPES; s++)
+    atomic_set_u64(&m_slots[s * m_stripe_len + i].val, s ? 0 : amt);
   if (data.type & PERFCOUNTER_LONGRUNAVG)
-    data.avgcount++;
+    __sync_fetch_and_add(&slot->avgcount, 1);
 }
 
 uint64_t PerfCounters::get(int idx) const
 {
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
-  const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
-  if (!(data.type & PERFCOUNTER_U64))
+  int i = idx - m_lower_bound - 1;
+  if (!(m_data[i].type & PERFCOUNTER_U64))
     return 0;
-  return data.u.u64;
+  uint64_t val, avgcount;
+  read_slot(i, &val, &avgcount);
+  return val;
 }
 
 void PerfCounters::finc(int idx, double amt)
 {
-  Mutex::Locker lck(m_lock);
-  assert(idx > m_lower_bound);
-  assert(idx < m_upper_bound);
-  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  perf_counter_slot_d *slot = get_slot(idx);
+  const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_FLOAT))
     return;
-  data.u.dbl += amt;
+  atomic_add_double(&slot->val, amt);
   if (data.type & PERFCOUNTER_LONGRUNAVG)
-    data.avgcount++;
+    __sync_fetch_and_add(&slot->avgcount, 1);
 }
 
 void PerfCounters::fset(int idx, double amt)
 {
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
-  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  int i = idx - m_lower_bound - 1;
+  const perf_counter_data_any_d& data(m_data[i]);
   if (!(data.type & PERFCOUNTER_FLOAT))
     return;
-  data.u.dbl = amt;
   if (data.type & PERFCOUNTER_LONGRUNAVG)
     assert(0);
+  for (int s = 0; s < NUM_STRIPES; s++)
+    atomic_set_u64(&m_slots[s * m_stripe_len + i].val, double_bits(s ? 0.0 : amt));
 }
 
-double PerfCounters::fget(int idx) const
+double PerfCounters::fget(int idx, uint64_t *avgcount) const
 {
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
-  const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
-  if (!(data.type & PERFCOUNTER_FLOAT))
+  int i = idx - m_lower_bound - 1;
+  if (avgcount)
+    *avgcount = 0;
+  if (!(m_data[i].type & PERFCOUNTER_FLOAT))
     return 0.0;
-  return data.u.dbl;
+  uint64_t val, count;
+  read_slot(i, &val, &count);
+  if (avgcount)
+    *avgcount = count;
+  return bits_double(val);
+}
+
+void PerfCounters::hinc(int idx, uint64_t x, uint64_t y)
+{
+  assert(idx > m_lower_bound);
+  assert(idx < m_upper_bound);
+  const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  if (!(data.type & PERFCOUNTER_HISTOGRAM))
+    return;
+  unsigned b = hist_bucket(y, data.hist_y) * data.hist_x + hist_bucket(x, data.hist_x);
+  __sync_fetch_and_add(&data.hist[b], 1);
+}
+
+uint64_t PerfCounters::hget(int idx, unsigned xb, unsigned yb) const
+{
+  assert(idx > m_lower_bound);
+  assert(idx < m_upper_bound);
+  const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  if (!(data.type & PERFCOUNTER_HISTOGRAM))
+    return 0;
+  assert(xb < data.hist_x);
+  assert(yb < data.hist_y);
+  return atomic_read_u64(&data.hist[yb * data.hist_x + xb]);
 }
 
 void PerfCounters::write_json_to_buf(bufferlist& bl, bool schema)
 {
   char buf[512];
-  Mutex::Locker lck(m_lock);
 
   snprintf(buf, sizeof(buf), "\"%s\":{", m_name.c_str());
   bl.append(buf);
 
-  perf_counter_data_vec_t::const_iterator d = m_data.begin();
-  perf_counter_data_vec_t::const_iterator d_end = m_data.end();
-  if (d == d_end) {
-    bl.append('}');
-    return;
-  }
-  while (true) {
-    const perf_counter_data_any_d &data(*d);
+  for (unsigned i = 0; i < m_data.size(); i++) {
+    const perf_counter_data_any_d &data(m_data[i]);
+    if (i)
+      bl.append(',');
     buf[0] = '\0';
-    if (schema)
+    if (schema) {
       data.write_schema_json(buf, sizeof(buf));
-    else
-      data.write_json(buf, sizeof(buf));
-
+    } else if (data.type & PERFCOUNTER_HISTOGRAM) {
+      data.write_hist_json(bl);
+      continue;
+    } else {
+      uint64_t val, avgcount;
+      read_slot(i, &val, &avgcount);
+      data.write_json(buf, sizeof(buf), val, avgcount);
+    }
     bl.append(buf);
-    if (++d == d_end)
-      break;
-    bl.append(',');
   }
   bl.append('}');
 }
@@ -210,18 +312,32 @@ PerfCounters::PerfCounters(CephContext *cct, const std::string &name,
     m_lower_bound(lower_bound),
     m_upper_bound(upper_bound),
     m_name(name.c_str()),
-    m_lock_name(std::string("PerfCounters::") + name.c_str()),
-    m_lock(m_lock_name.c_str())
+    m_slots(NULL),
+    m_stripe_len(0)
 {
   m_data.resize(upper_bound - lower_bound - 1);
+
+  // pad each stripe out to whole cache lines so that threads on
+  // different stripes don't share any
+  const size_t line = 64 / sizeof(perf_counter_slot_d);
+  m_stripe_len = (m_data.size() + line - 1) / line * line;
+  size_t bytes = NUM_STRIPES * m_stripe_len * sizeof(perf_counter_slot_d);
+  if (bytes == 0)
+    bytes = 64;
+  void *p;
+  int r = ::posix_memalign(&p, 64, bytes);
+  assert(r == 0);
+  memset(p, 0, bytes);
+  m_slots = (perf_counter_slot_d *)p;
 }
 
 PerfCounters::perf_counter_data_any_d::perf_counter_data_any_d()
   : name(NULL),
     type(PERFCOUNTER_NONE),
-    avgcount(0)
+    hist_x(0),
+    hist_y(0),
+    hist(NULL)
 {
-  memset(&u, 0, sizeof(u));
 }
 
 void  PerfCounters::perf_counter_data_any_d::write_schema_json(char *buf, size_t buf_sz) const
@@ -229,18 +345,19 @@ void  PerfCounters::perf_counter_data_any_d::write_schema_json(char *buf, size_t
   snprintf(buf, buf_sz, "\"%s\":{\"type\":%d}", name, type);
 }
 
-void  PerfCounters::perf_counter_data_any_d::write_json(char *buf, size_t buf_sz) const
+void  PerfCounters::perf_counter_data_any_d::write_json(char *buf, size_t buf_sz,
+							uint64_t val, uint64_t avgcount) const
 {
   if (type & PERFCOUNTER_LONGRUNAVG) {
     if (type & PERFCOUNTER_U64) {
       snprintf(buf, buf_sz, "\"%s\":{\"avgcount\":%" PRId64 ","
 	      "\"sum\":%" PRId64 "}", 
-	      name, avgcount, u.u64);
+	      name, avgcount, val);
     }
     else if (type & PERFCOUNTER_FLOAT) {
       snprintf(buf, buf_sz, "\"%s\":{\"avgcount\":%" PRId64 ","
 	      "\"sum\":%g}",
-	      name, avgcount, u.dbl);
+	      name, avgcount, bits_double(val));
     }
     else {
       assert(0);
@@ -249,10 +366,10 @@ void  PerfCounters::perf_counter_data_any_d::write_json(char *buf, size_t buf_sz
   else {
     if (type & PERFCOUNTER_U64) {
       snprintf(buf, buf_sz, "\"%s\":%" PRId64,
-	       name, u.u64);
+	       name, val);
     }
     else if (type & PERFCOUNTER_FLOAT) {
-      snprintf(buf, buf_sz, "\"%s\":%g", name, u.dbl);
+      snprintf(buf, buf_sz, "\"%s\":%g", name, bits_double(val));
     }
     else {
       assert(0);
@@ -260,6 +377,59 @@ void  PerfCounters::perf_counter_data_any_d::write_json(char *buf, size_t buf_sz
   }
 }
 
+void PerfCounters::perf_counter_data_any_d::write_hist_json(bufferlist& bl) const
+{
+  // snapshot, so that the totals and the buckets agree
+  vector<uint64_t> snap(hist_x * hist_y);
+  vector<uint64_t> xsum(hist_x);
+  uint64_t count = 0;
+  for (unsigned b = 0; b < snap.size(); b++) {
+    snap[b] = atomic_read_u64(&hist[b]);
+    xsum[b % hist_x] += snap[b];
+    count += snap[b];
+  }
+
+  ostringstream ss;
+  ss << "\"" << name << "\":{\"count\":" << count;
+
+  // report each percentile as the upper bound of the bucket it falls in,
+  // or -1 if that is the last bucket, which has none
+  static const struct { const char *name; double frac; } pct[] = {
+    { "p50", .5 }, { "p99", .99 }, { "p999", .999 }
+  };
+  for (unsigned p = 0; p < sizeof(pct) / sizeof(pct[0]); p++) {
+    uint64_t want = (uint64_t)ceil(pct[p].frac * (double)count);
+    uint64_t seen = 0;
+    unsigned b = 0;
+    while (b + 1 < hist_x && seen + xsum[b] < want)
+      seen += xsum[b++];
+    ss << ",\"" << pct[p].name << "\":";
+    if (!count)
+      ss << 0;
+    else if (b + 1 == hist_x)
+      ss << -1;
+    else
+      ss << (b ? (1ull << b) - 1 : 0);
+  }
+
+  ss << ",\"buckets\":[";
+  for (unsigned y = 0; y < hist_y; y++) {
+    if (y)
+      ss << ",";
+    if (hist_y > 1)
+      ss << "[";
+    for (unsigned x = 0; x < hist_x; x++) {
+      if (x)
+	ss << ",";
+      ss << snap[y * hist_x + x];
+    }
+    if (hist_y > 1)
+      ss << "]";
+  }
+  ss << "]}";
+  bl.append(ss.str());
+}
+
 PerfCountersBuilder::PerfCountersBuilder(CephContext *cct, const std::string &name,
                   int first, int last)
   : m_perf_counters(new PerfCounters(cct, name, first, last))
@@ -298,6 +468,20 @@ void PerfCountersBuilder::add_fl_avg(int idx, const char *name)
   add_impl(idx, name, PERFCOUNTER_FLOAT | PERFCOUNTER_LONGRUNAVG);
 }
 
+void PerfCountersBuilder::add_histogram(int idx, const char *name,
+					unsigned x_buckets, unsigned y_buckets)
+{
+  assert(x_buckets > 0 && x_buckets <= 64);
+  assert(y_buckets > 0 && y_buckets <= 64);
+  add_impl(idx, name, PERFCOUNTER_HISTOGRAM);
+  PerfCounters::perf_counter_data_any_d
+    &data(m_perf_counters->m_data[idx - m_perf_counters->m_lower_bound - 1]);
+  data.hist_x = x_buckets;
+  data.hist_y = y_buckets;
+  data.hist = new uint64_t[x_buckets * y_buckets];
+  memset(data.hist, 0, sizeof(uint64_t) * x_buckets * y_buckets);
+}
+
 void PerfCountersBuilder::add_impl(int idx, const char *name, int ty)
 {
   assert(idx > m_perf_counters->m_lower_bound);
@@ -35,6 +35,7 @@ enum perfcounter_type_d
   PERFCOUNTER_U64 = 0x2,
   PERFCOUNTER_LONGRUNAVG = 0x4,
   PERFCOUNTER_COUNTER = 0x8,
+  PERFCOUNTER_HISTOGRAM = 0x10,
 };
 
 /*
@@ -60,6 +61,20 @@ enum perfcounter_type_d
  * For the floating-point average, it returns the current value and
  * the "avgcount" member when read off. avgcount is incremented when you call
  * finc. Calling fset on an average is an error and will assert out.
+ *
+ * A histogram counts samples in log2 buckets: bucket 0 holds 0, bucket i
+ * holds [2^(i-1), 2^i), and the last bucket also takes everything larger.
+ * It can have a second (y) axis, bucketed the same way, e.g. to see
+ * latency against request size.  Use hinc(idx, x, y) to add a sample.
+ * It is dumped as the sample count, p50/p99/p999 upper bounds along x
+ * (-1 for the open-ended last bucket), and the raw buckets (one row per
+ * y bucket).
+ *
+ * Updates don't take a lock.  Each thread adds into one of a few stripes
+ * of per-counter slots with atomic ops, and readers sum the stripes, so
+ * hot counters don't bounce a lock or cache line between cpus.  A reader
+ * may see a sum and its avgcount that are one update apart, and set()
+ * racing with inc() from another thread may lose the inc.
  */
 class PerfCounters
 {
@@ -72,7 +87,11 @@ public:
 
   void fset(int idx, double v);
   void finc(int idx, double v);
-  double fget(int idx) const;
+  /// @param avgcount if not NULL, gets the number of finc()s of an average
+  double fget(int idx, uint64_t *avgcount = NULL) const;
+
+  void hinc(int idx, uint64_t x, uint64_t y = 0);
+  uint64_t hget(int idx, unsigned xb, unsigned yb = 0) const;
 
   void write_json_to_buf(ceph::bufferlist& bl, bool schema);
 
@@ -91,29 +110,38 @@ private:
   struct perf_counter_data_any_d {
     perf_counter_data_any_d();
     void write_schema_json(char *buf, size_t buf_sz) const;
-    void  write_json(char *buf, size_t buf_sz) const;
+    void write_json(char *buf, size_t buf_sz,
+		    uint64_t val, uint64_t avgcount) const;
+    void write_hist_json(ceph::bufferlist& bl) const;
 
     const char *name;
     enum perfcounter_type_d type;
-    union {
-      uint64_t u64;
-      double dbl;
-    } u;
-    uint64_t avgcount;
+    unsigned hist_x, hist_y;  ///< histogram buckets per axis
+    uint64_t *hist;           ///< hist_y rows of hist_x buckets
   };
   typedef std::vector<perf_counter_data_any_d> perf_counter_data_vec_t;
 
+  /** One stripe's copy of a counter; u64 or double bits in val */
+  struct perf_counter_slot_d {
+    uint64_t val;
+    uint64_t avgcount;
+  };
+  static const int NUM_STRIPES = 8;
+
+  perf_counter_slot_d *get_slot(int idx);
+  void read_slot(int i, uint64_t *val, uint64_t *avgcount) const;
+
   CephContext *m_cct;
   int m_lower_bound;
   int m_upper_bound;
   std::string m_name;
-  const std::string m_lock_name;
-
-  /** Protects m_data */
-  mutable Mutex m_lock;
 
   perf_counter_data_vec_t m_data;
 
+  /** NUM_STRIPES runs of m_stripe_len slots, each cache line aligned */
+  perf_counter_slot_d *m_slots;
+  size_t m_stripe_len;
+
   friend class PerfCountersBuilder;
 };
 
@@ -172,6 +200,8 @@ public:
   void add_u64_avg(int key, const char *name);
   void add_fl(int key, const char *name);
   void add_fl_avg(int key, const char *name);
+  void add_histogram(int key, const char *name,
+		     unsigned x_buckets, unsigned y_buckets = 1);
   PerfCounters* create_perf_counters();
 private:
   PerfCountersBuilder(const PerfCountersBuilder &rhs);
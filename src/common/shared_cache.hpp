@@ -61,7 +61,11 @@ class SharedLRU {
 
   void remove(K key) {
     Mutex::Locker l(lock);
-    weak_refs.erase(key);
+    // the key may have been clear()ed and re-added since this value
+    // was; only drop the weak ref if it is still ours.
+    typename map<K, WeakVPtr>::iterator i = weak_refs.find(key);
+    if (i != weak_refs.end() && i->second.expired())
+      weak_refs.erase(i);
     cond.Signal();
   }
 
@@ -78,13 +82,45 @@ class SharedLRU {
 
 public:
   SharedLRU(size_t max_size = 20) : lock("SharedLRU::lock"), max_size(max_size) {}
+  ~SharedLRU() {
+    // drop our refs while weak_refs is still around for Cleanup
+    contents.clear();
+    lru.clear();
+  }
 
   void set_size(size_t new_size) {
     list<VPtr> to_release;
     {
       Mutex::Locker l(lock);
       max_size = new_size;
-      trim_cache(to_release);
+      trim_cache(&to_release);
+    }
+  }
+
+  /// forget key; existing refs stay valid but later lookups miss
+  void clear(K key) {
+    VPtr val; // release any ref outside the lock
+    {
+      Mutex::Locker l(lock);
+      typename map<K, typename list<pair<K, VPtr> >::iterator>::iterator i =
+	contents.find(key);
+      if (i != contents.end()) {
+	val = i->second->second;
+	lru.erase(i->second);
+	contents.erase(i);
+      }
+      weak_refs.erase(key);
+    }
+  }
+
+  /// forget everything
+  void clear() {
+    list<pair<K, VPtr> > to_release;
+    {
+      Mutex::Locker l(lock);
+      to_release.swap(lru);
+      contents.clear();
+      weak_refs.clear();
     }
   }
 
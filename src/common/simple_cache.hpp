@@ -37,6 +37,10 @@ class SimpleLRU {
   }
 
   void _add(K key, V value) {
+    typename map<K, typename list<pair<K, V> >::iterator>::iterator p =
+      contents.find(key);
+    if (p != contents.end())
+      lru.erase(p->second);
     lru.push_front(make_pair(key, value));
     contents[key] = lru.begin();
     trim_cache();
@@ -89,6 +93,16 @@ public:
     Mutex::Locker l(lock);
     _add(key, value);
   }
+
+  void clear(K key) {
+    Mutex::Locker l(lock);
+    typename map<K, typename list<pair<K, V> >::iterator>::iterator p =
+      contents.find(key);
+    if (p == contents.end())
+      return;
+    lru.erase(p->second);
+    contents.erase(p);
+  }
 };
 
 #endif
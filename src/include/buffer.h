@@ -106,6 +106,25 @@ public:
 
   static int get_total_alloc();
 
+  /*
+   * raw buffer pool accounting, per size class
+   */
+  static const unsigned POOL_NUM_CLASSES = 3;
+  struct pool_stats_t {
+    unsigned chunk_size;
+    uint64_t live;      ///< chunks in use
+    uint64_t cached;    ///< free chunks kept for reuse
+    uint64_t allocs;    ///< chunks handed out, ever
+    uint64_t hits;      ///< ... of which were reused
+  };
+  static void get_pool_stats(pool_stats_t stats[POOL_NUM_CLASSES]);
+  /// most free chunks of class c the shared depot may keep
+  static void set_pool_depot_max(unsigned c, unsigned n);
+  /// free depot chunks left unused since the last call
+  static void trim_pool();
+  /// bytes of raw buffer data allocated and not yet freed, pooled or not
+  static uint64_t get_live_bytes();
+
 private:
  
   /* hack for memory utilization debugging. */
@@ -417,6 +436,7 @@ public:
     ssize_t read_fd(int fd, size_t len);
     int write_file(const char *fn, int mode=0644);
     int write_fd(int fd) const;
+    int write_fd(int fd, uint64_t offset) const;
     __u32 crc32c(__u32 crc) {
       for (std::list<ptr>::const_iterator it = _buffers.begin(); 
 	   it != _buffers.end(); 
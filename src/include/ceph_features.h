@@ -24,6 +24,9 @@
 #define CEPH_FEATURE_INDEP_PG_MAP   (1<<17)
 #define CEPH_FEATURE_CRUSH_TUNABLES (1<<18)
 #define CEPH_FEATURE_CHUNKY_SCRUB   (1<<19)
+#define CEPH_FEATURE_PGPUSH         (1<<20)
+#define CEPH_FEATURE_DELTA_PUSH     (1<<21)
+#define CEPH_FEATURE_COMPACT_TXN    (1<<22)
 
 /*
  * Features supported.  Should be everything above.
@@ -48,7 +51,10 @@
 	 CEPH_FEATURE_MONENC |		 \
 	 CEPH_FEATURE_INDEP_PG_MAP |	 \
 	 CEPH_FEATURE_CRUSH_TUNABLES |	 \
-	 CEPH_FEATURE_CHUNKY_SCRUB)
+	 CEPH_FEATURE_CHUNKY_SCRUB |	 \
+	 CEPH_FEATURE_PGPUSH |		 \
+	 CEPH_FEATURE_DELTA_PUSH |	 \
+	 CEPH_FEATURE_COMPACT_TXN)
 
 #define CEPH_FEATURES_SUPPORTED_DEFAULT  CEPH_FEATURES_ALL
 
@@ -5,7 +5,16 @@
 extern "C" {
 #endif
 
-uint32_t ceph_crc32c_le(uint32_t crc, unsigned char const *data, unsigned length);
+typedef uint32_t (*ceph_crc32c_func_t)(uint32_t crc, unsigned char const *data, unsigned length);
+
+/*
+ * pick the fastest crc32c implementation this cpu supports (SSE4.2
+ * crc32 instruction if available, otherwise portable slice-by-8).
+ * ceph_crc32c_le() does this automatically on first use.
+ */
+extern ceph_crc32c_func_t ceph_choose_crc32(void);
+
+extern uint32_t ceph_crc32c_le(uint32_t crc, unsigned char const *data, unsigned length);
 
 #ifdef __cplusplus
 }
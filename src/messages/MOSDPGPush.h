@@ -0,0 +1,90 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*- 
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software 
+ * Foundation.  See file COPYING.
+ * 
+ */
+
+#ifndef CEPH_MOSDPGPUSH_H
+#define CEPH_MOSDPGPUSH_H
+
+#include "msg/Message.h"
+#include "osd/osd_types.h"
+
+/*
+ * a batch of object pushes from the primary to a replica, applied in
+ * one transaction, and the replica's ack naming the objects it applied
+ */
+class MOSDPGPush : public Message {
+public:
+  enum {
+    OP_PUSH = 1,
+    OP_PUSH_REPLY = 2,
+  };
+  const char *get_op_name(int o) const {
+    switch (o) {
+    case OP_PUSH: return "push";
+    case OP_PUSH_REPLY: return "push_reply";
+    default: return "???";
+    }
+  }
+
+  __u32 op;
+  epoch_t map_epoch;
+  pg_t pgid;
+  vector<PushOp> pushes;       // OP_PUSH
+  vector<hobject_t> replies;   // OP_PUSH_REPLY
+
+  uint64_t get_push_bytes() const {
+    uint64_t bytes = 0;
+    for (vector<PushOp>::const_iterator p = pushes.begin();
+	 p != pushes.end();
+	 ++p)
+      bytes += p->length();
+    return bytes;
+  }
+
+  virtual void decode_payload() {
+    bufferlist::iterator p = payload.begin();
+    ::decode(op, p);
+    ::decode(map_epoch, p);
+    ::decode(pgid, p);
+    ::decode(pushes, p);
+    ::decode(replies, p);
+  }
+
+  virtual void encode_payload(uint64_t features) {
+    ::encode(op, payload);
+    ::encode(map_epoch, payload);
+    ::encode(pgid, payload);
+    ::encode(pushes, payload);
+    ::encode(replies, payload);
+  }
+
+  MOSDPGPush() : Message(MSG_OSD_PG_PUSH) {}
+  MOSDPGPush(__u32 o, epoch_t e, pg_t p)
+    : Message(MSG_OSD_PG_PUSH),
+      op(o),
+      map_epoch(e),
+      pgid(p) {
+  }
+private:
+  ~MOSDPGPush() {}
+
+public:
+  const char *get_type_name() const { return "pg_push"; }
+  void print(ostream& out) const {
+    out << "pg_push(" << get_op_name(op)
+	<< " " << pgid
+	<< " " << (op == OP_PUSH ? pushes.size() : replies.size()) << " objects"
+	<< " e " << map_epoch
+	<< ")";
+  }
+};
+
+#endif
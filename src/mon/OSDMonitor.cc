@@ -1745,7 +1745,8 @@ int OSDMonitor::prepare_new_pool(MPoolOp *m)
  * @return 0 in all cases. That's silly.
  */
 int OSDMonitor::prepare_new_pool(string& name, uint64_t auid, int crush_rule,
-                                 unsigned pg_num, unsigned pgp_num)
+                                 unsigned pg_num, unsigned pgp_num,
+				 uint64_t expected_num_objects)
 {
   for (map<int64_t,string>::iterator p = pending_inc.new_pool_names.begin();
        p != pending_inc.new_pool_names.end();
@@ -1769,6 +1770,7 @@ int OSDMonitor::prepare_new_pool(string& name, uint64_t auid, int crush_rule,
   pending_inc.new_pools[pool].set_pgp_num(pgp_num ? pgp_num : g_conf->osd_pool_default_pgp_num);
   pending_inc.new_pools[pool].last_change = pending_inc.epoch;
   pending_inc.new_pools[pool].auid = auid;
+  pending_inc.new_pools[pool].expected_num_objects = expected_num_objects;
   pending_inc.new_pool_names[pool] = name;
   return 0;
 }
@@ -2443,13 +2445,14 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
       else if (m->cmd[2] == "create" && m->cmd.size() >= 4) {
         int pg_num = 0;
         int pgp_num = 0;
+        uint64_t expected_num_objects = 0;
         if (m->cmd.size() > 4) { // try to parse out pg_num and pgp_num
           const char *start = m->cmd[4].c_str();
           char *end = (char*)start;
           pgp_num = pg_num = strtol(start, &end, 10);
           if (*end != '\0') { // failed to parse
             err = -EINVAL;
-            ss << "usage: osd pool create <poolname> [pg_num [pgp_num]]";
+            ss << "usage: osd pool create <poolname> [pg_num [pgp_num [expected_num_objects]]]";
             goto out;
           } else if (m->cmd.size() > 5) { // check for pgp_num too
             start = m->cmd[5].c_str();
@@ -2457,7 +2460,17 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
             pgp_num = strtol(start, &end, 10);
             if (*end != '\0') { // failed to parse
               err = -EINVAL;
-              ss << "usage: osd pool create <poolname> [pg_num [pgp_num]]";
+              ss << "usage: osd pool create <poolname> [pg_num [pgp_num [expected_num_objects]]]";
+              goto out;
+            }
+          }
+          if (m->cmd.size() > 6) { // and the expected object count
+            start = m->cmd[6].c_str();
+            end = (char *)start;
+            expected_num_objects = strtoull(start, &end, 10);
+            if (*end != '\0') { // failed to parse
+              err = -EINVAL;
+              ss << "usage: osd pool create <poolname> [pg_num [pgp_num [expected_num_objects]]]";
               goto out;
             }
           }
@@ -2471,7 +2484,7 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 
         err = prepare_new_pool(m->cmd[3], 0,  // auid=0 for admin created pool
 			       -1,            // default crush rule
-			       pg_num, pgp_num);
+			       pg_num, pgp_num, expected_num_objects);
         if (err < 0 && err != -EEXIST) {
           goto out;
         }
@@ -116,7 +116,8 @@ private:
   bool prepare_pool_op_delete(MPoolOp *m);
   bool prepare_pool_op_auid(MPoolOp *m);
   int prepare_new_pool(string& name, uint64_t auid, int crush_rule,
-                       unsigned pg_num, unsigned pgp_num);
+                       unsigned pg_num, unsigned pgp_num,
+		       uint64_t expected_num_objects = 0);
   int prepare_new_pool(MPoolOp *m);
   
   bool prepare_set_flag(MMonCommand *m, int flag);
@@ -0,0 +1,1121 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+#include "EventMessenger.h"
+
+#include "common/config.h"
+#include "common/errno.h"
+
+#define dout_subsys ceph_subsys_ms
+
+
+/*******************
+ * EventWorker
+ */
+
+#undef dout_prefix
+#define dout_prefix *_dout << "-- " << msgr->get_myaddr() << " worker." << id << " "
+
+EventWorker::EventWorker(EventMessenger *m, unsigned i)
+  : msgr(m), id(i), epfd(-1),
+    lock("EventWorker::lock"),
+    done(false), wake_signaled(false)
+{
+  wake_fds[0] = wake_fds[1] = -1;
+}
+
+EventWorker::~EventWorker()
+{
+  assert(pipes.empty());
+  while (!wakeups.empty()) {
+    wakeups.front()->put();
+    wakeups.pop_front();
+  }
+  if (epfd >= 0)
+    ::close(epfd);
+  if (wake_fds[0] >= 0)
+    ::close(wake_fds[0]);
+  if (wake_fds[1] >= 0)
+    ::close(wake_fds[1]);
+}
+
+int EventWorker::init()
+{
+  epfd = ::epoll_create(1024);
+  if (epfd < 0) {
+    int r = -errno;
+    lderr(msgr->cct) << "unable to create epoll fd: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  if (::pipe(wake_fds) < 0) {
+    int r = -errno;
+    lderr(msgr->cct) << "unable to create wakeup pipe: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  ::fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+  ::fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (::epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fds[0], &ev) < 0) {
+    int r = -errno;
+    lderr(msgr->cct) << "unable to add wakeup pipe to epoll: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  return 0;
+}
+
+void *EventWorker::entry()
+{
+  ldout(msgr->cct,10) << "entry start" << dendl;
+  struct epoll_event events[128];
+
+  lock.Lock();
+  while (!done) {
+    lock.Unlock();
+
+    int timeout = 1000;
+    if (!timers.empty()) {
+      utime_t now = ceph_clock_now(msgr->cct);
+      utime_t first = timers.begin()->first;
+      if (first <= now) {
+	timeout = 0;
+      } else {
+	first -= now;
+	int ms = first.sec() * 1000 + first.usec() / 1000 + 1;
+	if (ms < timeout)
+	  timeout = ms;
+      }
+    }
+
+    int n = ::epoll_wait(epfd, events, 128, timeout);
+    if (n < 0 && errno != EINTR) {
+      int r = errno;
+      lderr(msgr->cct) << "epoll_wait failed: " << cpp_strerror(r) << dendl;
+    }
+    for (int i = 0; i < n; i++) {
+      void *ptr = events[i].data.ptr;
+      if (ptr == NULL) {
+	char buf[64];
+	while (::read(wake_fds[0], buf, sizeof(buf)) > 0) ;
+      } else if (ptr == (void*)msgr) {
+	do_accept();
+      } else {
+	run_pipe((EventPipe*)ptr);
+      }
+    }
+
+    do_wakeups();
+    do_timers();
+    do_sweep();
+
+    // only now, when no event in this batch can still refer to them
+    while (!reap_queue.empty()) {
+      EventPipe *p = reap_queue.front();
+      reap_queue.pop_front();
+      p->reap();
+    }
+
+    lock.Lock();
+  }
+  lock.Unlock();
+  ldout(msgr->cct,10) << "entry done" << dendl;
+  return 0;
+}
+
+void EventWorker::stop()
+{
+  ldout(msgr->cct,10) << "stop" << dendl;
+  lock.Lock();
+  done = true;
+  lock.Unlock();
+  char c = 1;
+  int r = ::write(wake_fds[1], &c, 1);
+  r++; // placate gcc
+  if (is_started())
+    join();
+}
+
+void EventWorker::run_pipe(EventPipe *p)
+{
+  if (p->reaped)
+    return;
+  if (p->run()) {
+    p->reaped = true;
+    reap_queue.push_back(p);
+  }
+}
+
+void EventWorker::wakeup(EventPipe *p)
+{
+  lock.Lock();
+  if (!p->wake_queued) {
+    p->wake_queued = true;
+    wakeups.push_back((EventPipe*)p->get());
+  }
+  bool kick = !wake_signaled;
+  wake_signaled = true;
+  lock.Unlock();
+  if (kick) {
+    char c = 1;
+    int r = ::write(wake_fds[1], &c, 1);
+    r++; // placate gcc
+  }
+}
+
+void EventWorker::do_wakeups()
+{
+  list<EventPipe*> ls;
+  lock.Lock();
+  ls.swap(wakeups);
+  wake_signaled = false;
+  for (list<EventPipe*>::iterator p = ls.begin(); p != ls.end(); ++p)
+    (*p)->wake_queued = false;
+  lock.Unlock();
+
+  while (!ls.empty()) {
+    EventPipe *p = ls.front();
+    ls.pop_front();
+    run_pipe(p);
+    p->put();
+  }
+}
+
+void EventWorker::do_timers()
+{
+  utime_t now = ceph_clock_now(msgr->cct);
+  while (!timers.empty() && timers.begin()->first <= now) {
+    EventPipe *p = timers.begin()->second;
+    timers.erase(timers.begin());
+    p->timer_at = utime_t();
+    run_pipe(p);
+  }
+}
+
+/*
+ * fault sessions we have not heard from in ms_tcp_read_timeout, like
+ * the SimpleMessenger's reader does when its poll() times out.
+ */
+void EventWorker::do_sweep()
+{
+  int64_t timeout = msgr->cct->_conf->ms_tcp_read_timeout;
+  utime_t now = ceph_clock_now(msgr->cct);
+  if (!timeout || now - last_sweep < utime_t(1, 0))
+    return;
+  last_sweep = now;
+
+  utime_t cutoff = now;
+  cutoff -= utime_t(timeout, 0);
+  vector<EventPipe*> idle;
+  for (set<EventPipe*>::iterator p = pipes.begin(); p != pipes.end(); ++p)
+    if ((*p)->sd >= 0 && (*p)->last_rx < cutoff)
+      idle.push_back(*p);
+
+  for (vector<EventPipe*>::iterator p = idle.begin(); p != idle.end(); ++p) {
+    ldout(msgr->cct,2) << "sweep " << *p << " idle since " << (*p)->last_rx << dendl;
+    (*p)->lock.Lock();
+    errno = ETIMEDOUT;
+    if ((*p)->state == EventPipe::STATE_ACCEPTING)
+      (*p)->stop();
+    else
+      (*p)->fault();
+    (*p)->lock.Unlock();
+    run_pipe(*p);
+  }
+}
+
+void EventWorker::do_accept()
+{
+  const md_config_t *conf = msgr->cct->_conf;
+  while (true) {
+    entity_addr_t addr;
+    socklen_t slen = sizeof(addr.ss_addr());
+    int sd = ::accept(msgr->listen_sd, (sockaddr*)&addr.ss_addr(), &slen);
+    if (sd < 0) {
+      if (errno == EINTR)
+	continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+	int r = errno;
+	ldout(msgr->cct,0) << "accept failed: " << cpp_strerror(r) << dendl;
+      }
+      break;
+    }
+    ldout(msgr->cct,10) << "accepted incoming on sd " << sd << dendl;
+
+    ::fcntl(sd, F_SETFL, O_NONBLOCK);
+    if (conf->ms_tcp_nodelay) {
+      int flag = 1;
+      int r = ::setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(flag));
+      if (r < 0) {
+	r = errno;
+	ldout(msgr->cct,0) << "couldn't set TCP_NODELAY: " << cpp_strerror(r) << dendl;
+      }
+    }
+    msgr->add_accept_pipe(sd);
+  }
+}
+
+int EventWorker::add_socket(EventPipe *p)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  ev.data.ptr = p;
+  if (::epoll_ctl(epfd, EPOLL_CTL_ADD, p->sd, &ev) < 0) {
+    int r = -errno;
+    ldout(msgr->cct,0) << "add_socket " << p->sd << " failed: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  return 0;
+}
+
+void EventWorker::del_socket(int sd)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ::epoll_ctl(epfd, EPOLL_CTL_DEL, sd, &ev);
+}
+
+int EventWorker::add_listener(int sd)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = msgr;
+  if (::epoll_ctl(epfd, EPOLL_CTL_ADD, sd, &ev) < 0)
+    return -errno;
+  return 0;
+}
+
+void EventWorker::del_listener(int sd)
+{
+  del_socket(sd);
+}
+
+void EventWorker::add_timer(EventPipe *p, utime_t when)
+{
+  cancel_timer(p);
+  p->timer_at = when;
+  timers.insert(make_pair(when, p));
+}
+
+void EventWorker::cancel_timer(EventPipe *p)
+{
+  if (p->timer_at != utime_t()) {
+    timers.erase(make_pair(p->timer_at, p));
+    p->timer_at = utime_t();
+  }
+}
+
+void EventWorker::adopt(EventPipe *p)
+{
+  pipes.insert(p);
+  p->adopted = true;
+}
+
+void EventWorker::forget(EventPipe *p)
+{
+  cancel_timer(p);
+  pipes.erase(p);
+}
+
+
+/*******************
+ * EventMessenger
+ */
+
+#undef dout_prefix
+#define dout_prefix _prefix(_dout, this)
+static ostream& _prefix(std::ostream *_dout, EventMessenger *msgr) {
+  return *_dout << "-- " << msgr->get_myaddr() << " ";
+}
+
+EventMessenger::EventMessenger(CephContext *cct, entity_name_t name,
+			       string mname, uint64_t _nonce)
+  : Messenger(cct, name),
+    dispatch_thread(this),
+    my_type(name.type()),
+    nonce(_nonce),
+    lock("EventMessenger::lock"), need_addr(true), did_bind(false),
+    listen_sd(-1),
+    global_seq(0),
+    next_worker(0),
+    cluster_protocol(0),
+    policy_lock("EventMessenger::policy_lock"),
+    dispatch_throttler(cct, string("msgr_dispatch_throttler-") + mname, cct->_conf->ms_dispatch_throttle_bytes),
+    rx_pool(cct),
+    local_connection(new Connection),
+    dispatch_lock("EventMessenger::dispatch_lock"),
+    dispatch_stop(false),
+    dispatch_qlen(0)
+{
+  pthread_spin_init(&global_seq_lock, PTHREAD_PROCESS_PRIVATE);
+  init_local_connection();
+  int n = cct->_conf->ms_event_workers;
+  if (n < 1)
+    n = 1;
+  for (int i = 0; i < n; i++)
+    workers.push_back(new EventWorker(this, i));
+}
+
+EventMessenger::~EventMessenger()
+{
+  assert(!did_bind); // either we didn't bind or we shut down
+  assert(rank_pipe.empty());
+  assert(pipes.empty());
+  for (unsigned i = 0; i < workers.size(); i++)
+    delete workers[i];
+  delete local_connection;
+}
+
+void EventMessenger::ready()
+{
+  ldout(cct,10) << "ready " << get_myaddr() << dendl;
+  dispatch_thread.create();
+}
+
+int EventMessenger::shutdown()
+{
+  ldout(cct,10) << "shutdown " << get_myaddr() << dendl;
+  dispatch_lock.Lock();
+  dispatch_stop = true;
+  dispatch_cond.Signal();
+  dispatch_lock.Unlock();
+  mark_down_all();
+  return 0;
+}
+
+void EventMessenger::set_addr_unknowns(entity_addr_t &addr)
+{
+  if (my_inst.addr.is_blank_ip()) {
+    int port = my_inst.addr.get_port();
+    my_inst.addr.addr = addr.addr;
+    my_inst.addr.set_port(port);
+  }
+}
+
+int EventMessenger::get_proto_version(int peer_type, bool connect)
+{
+  // set reply protocol version
+  if (peer_type == my_type) {
+    // internal
+    return cluster_protocol;
+  } else {
+    // public
+    if (connect) {
+      switch (peer_type) {
+      case CEPH_ENTITY_TYPE_OSD: return CEPH_OSDC_PROTOCOL;
+      case CEPH_ENTITY_TYPE_MDS: return CEPH_MDSC_PROTOCOL;
+      case CEPH_ENTITY_TYPE_MON: return CEPH_MONC_PROTOCOL;
+      }
+    } else {
+      switch (my_type) {
+      case CEPH_ENTITY_TYPE_OSD: return CEPH_OSDC_PROTOCOL;
+      case CEPH_ENTITY_TYPE_MDS: return CEPH_MDSC_PROTOCOL;
+      case CEPH_ENTITY_TYPE_MON: return CEPH_MONC_PROTOCOL;
+      }
+    }
+  }
+  return 0;
+}
+
+void EventMessenger::dispatch_throttle_release(uint64_t msize)
+{
+  if (msize) {
+    ldout(cct,10) << "dispatch_throttle_release " << msize << " to dispatch throttler "
+	    << dispatch_throttler.get_current() << "/"
+	    << dispatch_throttler.get_max() << dendl;
+    dispatch_throttler.put(msize);
+  }
+}
+
+int EventMessenger::bind_socket(entity_addr_t &bind_addr, int avoid_port1, int avoid_port2)
+{
+  const md_config_t *conf = cct->_conf;
+  ldout(cct,10) << "bind " << bind_addr << dendl;
+
+  int family;
+  switch (bind_addr.get_family()) {
+  case AF_INET:
+  case AF_INET6:
+    family = bind_addr.get_family();
+    break;
+
+  default:
+    // bind_addr is empty
+    family = conf->ms_bind_ipv6 ? AF_INET6 : AF_INET;
+  }
+
+  listen_sd = ::socket(family, SOCK_STREAM, 0);
+  if (listen_sd < 0) {
+    int r = -errno;
+    lderr(cct) << "bind unable to create socket: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  ::fcntl(listen_sd, F_SETFL, O_NONBLOCK);
+
+  // use whatever user specified (if anything)
+  entity_addr_t listen_addr = bind_addr;
+  listen_addr.set_family(family);
+
+  int rc = -1;
+  if (listen_addr.get_port()) {
+    // reuse addr+port when possible
+    int on = 1;
+    rc = ::setsockopt(listen_sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (rc < 0) {
+      rc = -errno;
+      lderr(cct) << "bind unable to setsockopt: " << cpp_strerror(rc) << dendl;
+      goto fail;
+    }
+    rc = ::bind(listen_sd, (struct sockaddr *) &listen_addr.ss_addr(), listen_addr.addr_size());
+    if (rc < 0) {
+      rc = -errno;
+      lderr(cct) << "bind unable to bind to " << bind_addr.ss_addr()
+		 << ": " << cpp_strerror(rc) << dendl;
+      goto fail;
+    }
+  } else {
+    // try a range of ports
+    for (int port = CEPH_PORT_START; port <= CEPH_PORT_LAST; port++) {
+      if (port == avoid_port1 || port == avoid_port2)
+	continue;
+      listen_addr.set_port(port);
+      rc = ::bind(listen_sd, (struct sockaddr *) &listen_addr.ss_addr(), listen_addr.addr_size());
+      if (rc == 0)
+	break;
+    }
+    if (rc < 0) {
+      rc = -errno;
+      lderr(cct) << "bind unable to bind to " << bind_addr.ss_addr()
+		 << " on any port in range " << CEPH_PORT_START << "-" << CEPH_PORT_LAST
+		 << ": " << cpp_strerror(rc) << dendl;
+      goto fail;
+    }
+  }
+
+  {
+    // what port did we get?
+    socklen_t llen = sizeof(listen_addr.ss_addr());
+    ::getsockname(listen_sd, (sockaddr*)&listen_addr.ss_addr(), &llen);
+  }
+  ldout(cct,10) << "bind bound to " << listen_addr << dendl;
+
+  rc = ::listen(listen_sd, 128);
+  if (rc < 0) {
+    rc = -errno;
+    lderr(cct) << "bind unable to listen on " << listen_addr
+	       << ": " << cpp_strerror(rc) << dendl;
+    goto fail;
+  }
+
+  set_myaddr(bind_addr);
+  if (bind_addr != entity_addr_t())
+    learned_addr(bind_addr);
+
+  if (get_myaddr().get_port() == 0) {
+    listen_addr.nonce = nonce;
+    set_myaddr(listen_addr);
+  }
+
+  init_local_connection();
+
+  ldout(cct,1) << "bind my_inst.addr is " << get_myaddr()
+	       << " need_addr=" << need_addr << dendl;
+  return 0;
+
+ fail:
+  ::close(listen_sd);
+  listen_sd = -1;
+  return rc;
+}
+
+int EventMessenger::bind(entity_addr_t bind_addr)
+{
+  lock.Lock();
+  if (started) {
+    ldout(cct,10) << "rank.bind already started" << dendl;
+    lock.Unlock();
+    return -1;
+  }
+  ldout(cct,10) << "rank.bind " << bind_addr << dendl;
+  lock.Unlock();
+
+  int r = bind_socket(bind_addr, 0, 0);
+  if (r >= 0)
+    did_bind = true;
+  return r;
+}
+
+int EventMessenger::rebind(int avoid_port)
+{
+  ldout(cct,1) << "rebind avoid " << avoid_port << dendl;
+  mark_down_all();
+  assert(did_bind);
+
+  workers[0]->del_listener(listen_sd);
+  ::close(listen_sd);
+  listen_sd = -1;
+
+  // invalidate our previously learned address.
+  lock.Lock();
+  need_addr = true;
+  lock.Unlock();
+
+  entity_addr_t addr = get_myaddr();
+  int old_port = addr.get_port();
+  addr.set_port(0);
+
+  ldout(cct,10) << " will try " << addr << dendl;
+  int r = bind_socket(addr, old_port, avoid_port);
+  if (r == 0)
+    r = workers[0]->add_listener(listen_sd);
+  return r;
+}
+
+int EventMessenger::start()
+{
+  lock.Lock();
+  ldout(cct,1) << "messenger.start" << dendl;
+
+  // register at least one entity, first!
+  assert(my_type >= 0);
+
+  assert(!started);
+  started = true;
+
+  if (!did_bind)
+    my_inst.addr.nonce = nonce;
+
+  lock.Unlock();
+
+  for (unsigned i = 0; i < workers.size(); i++) {
+    int r = workers[i]->init();
+    if (r < 0)
+      return r;
+    workers[i]->create();
+  }
+
+  if (did_bind) {
+    int r = workers[0]->add_listener(listen_sd);
+    if (r < 0) {
+      lderr(cct) << "start unable to listen: " << cpp_strerror(r) << dendl;
+      return r;
+    }
+  }
+  return 0;
+}
+
+void EventMessenger::wait()
+{
+  lock.Lock();
+  if (!started) {
+    lock.Unlock();
+    return;
+  }
+  lock.Unlock();
+
+  ldout(cct,10) << "wait: waiting for dispatch queue" << dendl;
+  if (dispatch_thread.is_started())
+    dispatch_thread.join();
+  ldout(cct,10) << "wait: dispatch queue is stopped" << dendl;
+
+  if (did_bind) {
+    workers[0]->del_listener(listen_sd);
+    ::close(listen_sd);
+    listen_sd = -1;
+    did_bind = false;
+  }
+
+  // close all pipes, and wait for the workers to reap them
+  lock.Lock();
+  ldout(cct,10) << "wait: closing pipes" << dendl;
+  while (!pipes.empty()) {
+    for (set<EventPipe*>::iterator p = pipes.begin(); p != pipes.end(); ++p) {
+      (*p)->unregister_pipe();
+      (*p)->lock.Lock();
+      if ((*p)->state != EventPipe::STATE_CLOSED)
+	(*p)->stop();
+      (*p)->lock.Unlock();
+    }
+    ldout(cct,10) << "wait: waiting for " << pipes.size() << " pipes to close" << dendl;
+    reap_cond.Wait(lock);
+  }
+  lock.Unlock();
+
+  for (unsigned i = 0; i < workers.size(); i++)
+    workers[i]->stop();
+
+  discard_received(NULL);
+
+  ldout(cct,10) << "wait: done." << dendl;
+  ldout(cct,1) << "shutdown complete." << dendl;
+  started = false;
+  my_type = -1;
+}
+
+EventWorker *EventMessenger::pick_worker()
+{
+  return workers[next_worker.inc() % workers.size()];
+}
+
+void EventMessenger::add_accept_pipe(int sd)
+{
+  lock.Lock();
+  if (is_stopping()) {
+    lock.Unlock();
+    ::close(sd);
+    return;
+  }
+  EventPipe *p = new EventPipe(this, pick_worker(), EventPipe::STATE_ACCEPTING, NULL);
+  p->sd = sd;
+  pipes.insert(p);
+  reap_cond.Signal();
+  lock.Unlock();
+  p->worker->wakeup(p);
+}
+
+/* connect_rank
+ * NOTE: assumes messenger.lock held.
+ */
+EventPipe *EventMessenger::connect_rank(const entity_addr_t& addr,
+					int type,
+					Connection *con)
+{
+  assert(lock.is_locked());
+  assert(addr != my_inst.addr);
+
+  ldout(cct,10) << "connect_rank to " << addr << ", creating pipe and registering" << dendl;
+
+  EventPipe *pipe = new EventPipe(this, pick_worker(), EventPipe::STATE_CONNECTING, con);
+  pipe->lock.Lock();
+  pipe->set_peer_type(type);
+  pipe->set_peer_addr(addr);
+  pipe->policy = get_policy(type);
+  pipe->lock.Unlock();
+  pipe->register_pipe();
+  pipes.insert(pipe);
+  reap_cond.Signal();
+  pipe->worker->wakeup(pipe);
+  return pipe;
+}
+
+int EventMessenger::_send_message(Message *m, const entity_inst_t& dest,
+				  bool lazy)
+{
+  // set envelope
+  m->get_header().src = get_myname();
+
+  if (!m->get_priority()) m->set_priority(get_default_send_priority());
+
+  ldout(cct,1) << (lazy ? "lazy " : "") <<"--> " << dest.name << " "
+	  << dest.addr << " -- " << *m
+	  << " -- ?+" << m->get_data().length()
+	  << " " << m
+	  << dendl;
+
+  if (dest.addr == entity_addr_t()) {
+    ldout(cct,0) << (lazy ? "lazy_" : "") << "send_message message " << *m
+		 << " with empty dest " << dest.addr << dendl;
+    m->put();
+    return -EINVAL;
+  }
+
+  lock.Lock();
+  hash_map<entity_addr_t, EventPipe*>::iterator p = rank_pipe.find(dest.addr);
+  submit_message(m, (p != rank_pipe.end() ? p->second->connection_state : NULL),
+		 dest.addr, dest.name.type(), lazy);
+  lock.Unlock();
+  return 0;
+}
+
+int EventMessenger::_send_message(Message *m, Connection *con, bool lazy)
+{
+  //set envelope
+  m->get_header().src = get_myname();
+
+  if (!m->get_priority()) m->set_priority(get_default_send_priority());
+
+  ldout(cct,1) << (lazy ? "lazy " : "") << "--> " << con->get_peer_addr()
+      << " -- " << *m
+      << " -- ?+" << m->get_data().length()
+      << " " << m << " con " << con
+      << dendl;
+
+  lock.Lock();
+  submit_message(m, con, con->get_peer_addr(), con->get_peer_type(), lazy);
+  lock.Unlock();
+  return 0;
+}
+
+void EventMessenger::submit_message(Message *m, Connection *con,
+				    const entity_addr_t& dest_addr, int dest_type, bool lazy)
+{
+  // existing connection?
+  if (con) {
+    EventPipe *pipe = NULL;
+    bool ok = con->try_get_pipe((RefCountedObject**)&pipe);
+    if (!ok) {
+      ldout(cct,0) << "submit_message " << *m << " remote, " << dest_addr
+		   << ", failed lossy con, dropping message " << m << dendl;
+      m->put();
+      return;
+    }
+    if (pipe) {
+      ldout(cct,20) << "submit_message " << *m << " remote, " << dest_addr << ", have pipe." << dendl;
+      pipe->send(m);
+      pipe->put();
+      return;
+    }
+  }
+
+  // local?
+  if (my_inst.addr == dest_addr) {
+    ldout(cct,20) << "submit_message " << *m << " local" << dendl;
+    m->set_connection(local_connection->get());
+    queue_received(m);
+    return;
+  }
+
+  // remote, no existing pipe.
+  const Policy& policy = get_policy(dest_type);
+  if (policy.server) {
+    ldout(cct,20) << "submit_message " << *m << " remote, " << dest_addr << ", lossy server for target type "
+		  << ceph_entity_type_name(dest_type) << ", no session, dropping." << dendl;
+    m->put();
+  } else if (lazy) {
+    ldout(cct,20) << "submit_message " << *m << " remote, " << dest_addr << ", lazy, dropping." << dendl;
+    m->put();
+  } else {
+    ldout(cct,20) << "submit_message " << *m << " remote, " << dest_addr << ", new pipe." << dendl;
+    EventPipe *pipe = connect_rank(dest_addr, dest_type, con);
+    pipe->send(m);
+  }
+}
+
+Connection *EventMessenger::get_connection(const entity_inst_t& dest)
+{
+  Mutex::Locker l(lock);
+  if (my_inst.addr == dest.addr) {
+    // local
+    return (Connection *)local_connection->get();
+  }
+
+  // remote
+  EventPipe *pipe = NULL;
+  hash_map<entity_addr_t, EventPipe*>::iterator p = rank_pipe.find(dest.addr);
+  if (p != rank_pipe.end()) {
+    pipe = p->second;
+    ldout(cct, 10) << "get_connection " << dest << " existing " << pipe << dendl;
+  } else {
+    pipe = connect_rank(dest.addr, dest.name.type(), NULL);
+    ldout(cct, 10) << "get_connection " << dest << " new " << pipe << dendl;
+  }
+  Mutex::Locker pl(pipe->lock);
+  return (Connection *)pipe->connection_state->get();
+}
+
+int EventMessenger::send_keepalive(const entity_inst_t& dest)
+{
+  int ret = 0;
+  lock.Lock();
+  if (my_inst.addr != dest.addr) {
+    hash_map<entity_addr_t, EventPipe*>::iterator p = rank_pipe.find(dest.addr);
+    if (p != rank_pipe.end()) {
+      ldout(cct,20) << "send_keepalive remote, " << dest.addr << ", have pipe." << dendl;
+      p->second->send_keepalive();
+    } else {
+      ldout(cct,20) << "send_keepalive no pipe for " << dest.addr << ", doing nothing." << dendl;
+      ret = -EINVAL;
+    }
+  }
+  lock.Unlock();
+  return ret;
+}
+
+int EventMessenger::send_keepalive(Connection *con)
+{
+  int ret = 0;
+  EventPipe *pipe = (EventPipe *)con->get_pipe();
+  if (pipe) {
+    ldout(cct,20) << "send_keepalive con " << con << ", have pipe." << dendl;
+    assert(pipe->msgr == this);
+    pipe->send_keepalive();
+    pipe->put();
+  } else {
+    ldout(cct,0) << "send_keepalive con " << con << ", no pipe." << dendl;
+    ret = -EPIPE;
+  }
+  return ret;
+}
+
+void EventMessenger::_mark_down(EventPipe *p)
+{
+  assert(lock.is_locked());
+  p->unregister_pipe();
+  p->lock.Lock();
+  p->stop();
+  p->lock.Unlock();
+}
+
+void EventMessenger::mark_down_all()
+{
+  ldout(cct,1) << "mark_down_all" << dendl;
+  lock.Lock();
+  while (!rank_pipe.empty()) {
+    hash_map<entity_addr_t,EventPipe*>::iterator it = rank_pipe.begin();
+    EventPipe *p = it->second;
+    ldout(cct,5) << "mark_down_all " << it->first << " " << p << dendl;
+    rank_pipe.erase(it);
+    _mark_down(p);
+  }
+  lock.Unlock();
+}
+
+void EventMessenger::mark_down(const entity_addr_t& addr)
+{
+  lock.Lock();
+  hash_map<entity_addr_t,EventPipe*>::iterator it = rank_pipe.find(addr);
+  if (it != rank_pipe.end()) {
+    ldout(cct,1) << "mark_down " << addr << " -- " << it->second << dendl;
+    _mark_down(it->second);
+  } else {
+    ldout(cct,1) << "mark_down " << addr << " -- pipe dne" << dendl;
+  }
+  lock.Unlock();
+}
+
+void EventMessenger::mark_down(Connection *con)
+{
+  lock.Lock();
+  EventPipe *p = (EventPipe *)con->get_pipe();
+  if (p) {
+    ldout(cct,1) << "mark_down " << con << " -- " << p << dendl;
+    assert(p->msgr == this);
+    _mark_down(p);
+    p->put();
+  } else {
+    ldout(cct,1) << "mark_down " << con << " -- pipe dne" << dendl;
+  }
+  lock.Unlock();
+}
+
+void EventMessenger::mark_down_on_empty(Connection *con)
+{
+  lock.Lock();
+  EventPipe *p = (EventPipe *)con->get_pipe();
+  if (p) {
+    assert(p->msgr == this);
+    p->lock.Lock();
+    p->unregister_pipe();
+    if (p->out_q.empty()) {
+      ldout(cct,1) << "mark_down_on_empty " << con << " -- " << p << " closing (queue is empty)" << dendl;
+      p->stop();
+    } else {
+      ldout(cct,1) << "mark_down_on_empty " << con << " -- " << p << " marking (queue is not empty)" << dendl;
+      p->close_on_empty = true;
+      p->worker->wakeup(p);
+    }
+    p->lock.Unlock();
+    p->put();
+  } else {
+    ldout(cct,1) << "mark_down_on_empty " << con << " -- pipe dne" << dendl;
+  }
+  lock.Unlock();
+}
+
+void EventMessenger::mark_disposable(Connection *con)
+{
+  lock.Lock();
+  EventPipe *p = (EventPipe *)con->get_pipe();
+  if (p) {
+    ldout(cct,1) << "mark_disposable " << con << " -- " << p << dendl;
+    assert(p->msgr == this);
+    p->lock.Lock();
+    p->policy.lossy = true;
+    p->lock.Unlock();
+    p->put();
+  } else {
+    ldout(cct,1) << "mark_disposable " << con << " -- pipe dne" << dendl;
+  }
+  lock.Unlock();
+}
+
+void EventMessenger::learned_addr(const entity_addr_t &peer_addr_for_me)
+{
+  // be careful here: multiple threads may block here, and readers of
+  // my_inst.addr do NOT hold any lock.
+  if (!need_addr)
+    return;
+
+  lock.Lock();
+  if (need_addr) {
+    entity_addr_t t = peer_addr_for_me;
+    t.set_port(my_inst.addr.get_port());
+    my_inst.addr.addr = t.addr;
+    ldout(cct,1) << "learned my addr " << my_inst.addr << dendl;
+    need_addr = false;
+    init_local_connection();
+  }
+  lock.Unlock();
+}
+
+void EventMessenger::init_local_connection()
+{
+  local_connection->peer_addr = my_inst.addr;
+  local_connection->peer_type = my_type;
+}
+
+
+/*******************
+ * dispatch
+ */
+
+void EventMessenger::queue_event(int what, Connection *con)
+{
+  Mutex::Locker l(dispatch_lock);
+  if (dispatch_stop)
+    return;
+  dispatch_events.push_back(make_pair(what, con->get()));
+  dispatch_cond.Signal();
+}
+
+void EventMessenger::queue_received(Message *m)
+{
+  dispatch_lock.Lock();
+  if (dispatch_stop) {
+    dispatch_lock.Unlock();
+    dispatch_throttle_release(m->get_dispatch_throttle_size());
+    m->put();
+    return;
+  }
+  dispatch_q[m->get_priority()].push_back(m);
+  dispatch_qlen.inc();
+  dispatch_cond.Signal();
+  dispatch_lock.Unlock();
+}
+
+/*
+ * drop undispatched messages that arrived on con (or all of them, if
+ * con is NULL), as the SimpleMessenger does when it discards a Pipe's
+ * IncomingQueue.
+ */
+void EventMessenger::discard_received(Connection *con)
+{
+  list<Message*> ls;
+  dispatch_lock.Lock();
+  for (map<int, list<Message*> >::iterator p = dispatch_q.begin();
+       p != dispatch_q.end(); ) {
+    for (list<Message*>::iterator q = p->second.begin(); q != p->second.end(); ) {
+      if (!con || (*q)->get_connection() == con) {
+	ls.push_back(*q);
+	p->second.erase(q++);
+	dispatch_qlen.dec();
+      } else {
+	++q;
+      }
+    }
+    if (p->second.empty())
+      dispatch_q.erase(p++);
+    else
+      ++p;
+  }
+  if (!con) {
+    while (!dispatch_events.empty()) {
+      dispatch_events.front().second->put();
+      dispatch_events.pop_front();
+    }
+  }
+  dispatch_lock.Unlock();
+
+  for (list<Message*>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    ldout(cct,20) << "  discard " << *p << dendl;
+    dispatch_throttle_release((*p)->get_dispatch_throttle_size());
+    (*p)->put();
+  }
+}
+
+/*
+ * Connection events are delivered first, then messages in priority
+ * order, FIFO within each priority.
+ */
+void EventMessenger::dispatch_entry()
+{
+  dispatch_lock.Lock();
+  while (!dispatch_stop) {
+    if (!dispatch_events.empty()) {
+      pair<int, Connection*> e = dispatch_events.front();
+      dispatch_events.pop_front();
+      dispatch_lock.Unlock();
+
+      switch (e.first) {
+      case D_CONNECT:
+	ms_deliver_handle_connect(e.second);
+	break;
+      case D_ACCEPT:
+	ms_deliver_handle_accept(e.second);
+	break;
+      case D_BAD_REMOTE_RESET:
+	ms_deliver_handle_remote_reset(e.second);
+	break;
+      case D_BAD_RESET:
+	ms_deliver_handle_reset(e.second);
+	break;
+      }
+      e.second->put();
+
+      dispatch_lock.Lock();
+      continue;
+    }
+
+    if (!dispatch_q.empty()) {
+      map<int, list<Message*> >::reverse_iterator p = dispatch_q.rbegin();
+      Message *m = p->second.front();
+      p->second.pop_front();
+      if (p->second.empty())
+	dispatch_q.erase(p->first);
+      dispatch_qlen.dec();
+      dispatch_lock.Unlock();
+
+      uint64_t msize = m->get_dispatch_throttle_size();
+      m->set_dispatch_throttle_size(0);  // clear it out, in case we requeue this message.
+
+      ldout(cct,1) << "<== " << m->get_source_inst()
+		   << " " << m->get_seq()
+		   << " ==== " << *m
+		   << " ==== " << m->get_payload().length() << "+" << m->get_middle().length()
+		   << "+" << m->get_data().length()
+		   << " (" << m->get_footer().front_crc << " " << m->get_footer().middle_crc
+		   << " " << m->get_footer().data_crc << ")"
+		   << " " << m << " con " << m->get_connection()
+		   << dendl;
+      ms_deliver_dispatch(m);
+
+      dispatch_throttle_release(msize);
+
+      ldout(cct,20) << "done calling dispatch on " << m << dendl;
+      dispatch_lock.Lock();
+      continue;
+    }
+
+    dispatch_cond.Wait(dispatch_lock);
+  }
+  dispatch_lock.Unlock();
+}
@@ -0,0 +1,278 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_EVENTMESSENGER_H
+#define CEPH_EVENTMESSENGER_H
+
+#include "include/types.h"
+
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+using namespace std;
+#include <ext/hash_map>
+using namespace __gnu_cxx;
+
+#include "common/Mutex.h"
+#include "include/atomic.h"
+#include "common/Cond.h"
+#include "common/Thread.h"
+#include "common/Throttle.h"
+
+#include "Messenger.h"
+#include "Message.h"
+#include "EventPipe.h"
+#include "RxBufferPool.h"
+
+class EventMessenger;
+
+/**
+ * An EventWorker is one of the EventMessenger's fixed pool of network
+ * threads.  It owns an epoll set holding the (non-blocking, edge
+ * triggered) sockets of the EventPipes assigned to it, and runs those
+ * pipes whenever their socket, a timer, or another thread asks it to.
+ * Worker 0 also owns the listening socket.
+ */
+class EventWorker : public Thread {
+  EventMessenger *msgr;
+  unsigned id;
+  int epfd;
+  int wake_fds[2];
+
+  Mutex lock;
+  bool done;
+  bool wake_signaled;
+  list<EventPipe*> wakeups;  ///< pipes with work queued by other threads
+
+  // worker thread only
+  set<EventPipe*> pipes;                     ///< pipes we have adopted
+  set<pair<utime_t, EventPipe*> > timers;
+  list<EventPipe*> reap_queue;
+  utime_t last_sweep;
+
+  void do_accept();
+  void do_wakeups();
+  void do_timers();
+  void do_sweep();
+  void run_pipe(EventPipe *p);
+
+public:
+  EventWorker(EventMessenger *m, unsigned i);
+  ~EventWorker();
+
+  int init();
+  void *entry();
+  void stop();
+
+  /// queue p to be run by this worker; any thread
+  void wakeup(EventPipe *p);
+
+  // worker thread only
+  int add_socket(EventPipe *p);
+  void del_socket(int sd);
+  void add_timer(EventPipe *p, utime_t when);
+  void cancel_timer(EventPipe *p);
+  void adopt(EventPipe *p);
+  void forget(EventPipe *p);
+
+  int add_listener(int sd);
+  void del_listener(int sd);
+};
+
+/*
+ * The EventMessenger is an alternative to the SimpleMessenger which
+ * multiplexes all of its connections over a small, fixed pool of epoll
+ * worker threads (ms_event_workers) rather than running a reader and a
+ * writer thread per connection.  It speaks the same wire protocol and
+ * implements the same Messenger interface, so daemons can switch between
+ * the two with ms_type.
+ *
+ * Incoming messages are delivered by a single dispatch thread in
+ * priority order, FIFO within a priority, like the SimpleMessenger's
+ * DispatchQueue.
+ *
+ * Lock ordering:
+ *
+ *   EventMessenger::lock
+ *       EventPipe::lock
+ *           EventWorker::lock, EventMessenger::dispatch_lock
+ */
+class EventMessenger : public Messenger {
+public:
+  EventMessenger(CephContext *cct, entity_name_t name,
+		 string mname, uint64_t _nonce);
+  virtual ~EventMessenger();
+
+  void set_addr_unknowns(entity_addr_t& addr);
+  int get_dispatch_queue_len() {
+    return dispatch_qlen.read();
+  }
+
+  void set_cluster_protocol(int p) {
+    assert(!started && !did_bind);
+    cluster_protocol = p;
+  }
+  void set_default_policy(Policy p) {
+    Mutex::Locker l(policy_lock);
+    default_policy = p;
+  }
+  void set_policy(int type, Policy p) {
+    Mutex::Locker l(policy_lock);
+    policy_map[type] = p;
+  }
+  void set_policy_throttler(int type, Throttle *t) {
+    Mutex::Locker l(policy_lock);
+    if (policy_map.count(type))
+      policy_map[type].throttler = t;
+    else
+      default_policy.throttler = t;
+  }
+  void set_rx_pool_bytes(uint64_t bytes) {
+    rx_pool.set_max_bytes(bytes);
+  }
+  Policy get_policy(int t) {
+    Mutex::Locker l(policy_lock);
+    if (policy_map.count(t))
+      return policy_map[t];
+    else
+      return default_policy;
+  }
+  Policy get_default_policy() {
+    Mutex::Locker l(policy_lock);
+    return default_policy;
+  }
+
+  int bind(entity_addr_t bind_addr);
+  int rebind(int avoid_port);
+
+  virtual int start();
+  virtual void wait();
+  virtual int shutdown();
+
+  virtual int send_message(Message *m, const entity_inst_t& dest) {
+    return _send_message(m, dest, false);
+  }
+  virtual int send_message(Message *m, Connection *con) {
+    return _send_message(m, con, false);
+  }
+  virtual int lazy_send_message(Message *m, const entity_inst_t& dest) {
+    return _send_message(m, dest, true);
+  }
+  virtual int lazy_send_message(Message *m, Connection *con) {
+    return _send_message(m, con, true);
+  }
+
+  virtual Connection *get_connection(const entity_inst_t& dest);
+  virtual int send_keepalive(const entity_inst_t& addr);
+  virtual int send_keepalive(Connection *con);
+  virtual void mark_down(const entity_addr_t& addr);
+  virtual void mark_down(Connection *con);
+  virtual void mark_down_on_empty(Connection *con);
+  virtual void mark_disposable(Connection *con);
+  virtual void mark_down_all();
+
+protected:
+  virtual void ready();
+
+private:
+  friend class EventPipe;
+  friend class EventWorker;
+
+  class DispatchThread : public Thread {
+    EventMessenger *msgr;
+  public:
+    DispatchThread(EventMessenger *m) : msgr(m) {}
+    void *entry() {
+      msgr->dispatch_entry();
+      return 0;
+    }
+  } dispatch_thread;
+
+  int my_type;
+  uint64_t nonce;
+  /// overall lock used for EventMessenger data structures
+  Mutex lock;
+  /// signaled when a pipe is reaped
+  Cond reap_cond;
+  bool need_addr;
+  bool did_bind;
+  int listen_sd;
+
+  __u32 global_seq;
+  pthread_spinlock_t global_seq_lock;
+
+  vector<EventWorker*> workers;
+  atomic_t next_worker;
+
+  /// registered (open or opening) sessions, by peer address
+  hash_map<entity_addr_t, EventPipe*> rank_pipe;
+  /// every pipe that has not been reaped yet
+  set<EventPipe*> pipes;
+
+  int cluster_protocol;
+
+  Mutex policy_lock;
+  Policy default_policy;
+  map<int, Policy> policy_map; // entity_name_t::type -> Policy
+
+  Throttle dispatch_throttler;
+
+  /// page-aligned buffers that large payloads are read into
+  RxBufferPool rx_pool;
+
+  /// con used for sending messages to ourselves
+  Connection *local_connection;
+
+  // dispatch queue
+  enum { D_CONNECT = 1, D_ACCEPT, D_BAD_REMOTE_RESET, D_BAD_RESET };
+  Mutex dispatch_lock;
+  Cond dispatch_cond;
+  bool dispatch_stop;
+  list<pair<int, Connection*> > dispatch_events;
+  map<int, list<Message*> > dispatch_q;
+  atomic_t dispatch_qlen;
+
+  int bind_socket(entity_addr_t& bind_addr, int avoid_port1, int avoid_port2);
+  EventWorker *pick_worker();
+  EventPipe *connect_rank(const entity_addr_t& addr, int type, Connection *con);
+  void add_accept_pipe(int sd);
+  int _send_message(Message *m, const entity_inst_t& dest, bool lazy);
+  int _send_message(Message *m, Connection *con, bool lazy);
+  void submit_message(Message *m, Connection *con,
+		      const entity_addr_t& addr, int dest_type, bool lazy);
+  void _mark_down(EventPipe *p);
+
+  void dispatch_entry();
+  void queue_event(int what, Connection *con);
+  void queue_received(Message *m);
+  void discard_received(Connection *con);
+  void dispatch_throttle_release(uint64_t msize);
+  bool is_stopping() {
+    Mutex::Locker l(dispatch_lock);
+    return dispatch_stop;
+  }
+
+  __u32 get_global_seq(__u32 old=0) {
+    pthread_spin_lock(&global_seq_lock);
+    if (old > global_seq)
+      global_seq = old;
+    __u32 ret = ++global_seq;
+    pthread_spin_unlock(&global_seq_lock);
+    return ret;
+  }
+  int get_proto_version(int peer_type, bool connect);
+  void init_local_connection();
+  void learned_addr(const entity_addr_t& peer_addr_for_me);
+};
+
+#endif
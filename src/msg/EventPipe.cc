@@ -0,0 +1,1687 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <limits.h>
+
+#include "Message.h"
+#include "EventPipe.h"
+#include "EventMessenger.h"
+
+#include "common/debug.h"
+#include "common/errno.h"
+#include "include/page.h"
+
+#define dout_subsys ceph_subsys_ms
+
+#undef dout_prefix
+#define dout_prefix _pipe_prefix(_dout)
+ostream& EventPipe::_pipe_prefix(std::ostream *_dout) {
+  return *_dout << "-- " << msgr->get_myinst().addr << " >> " << peer_addr << " eventpipe(" << this
+		<< " sd=" << sd << " :" << port
+		<< " pgs=" << peer_global_seq
+		<< " cs=" << connect_seq
+		<< " l=" << policy.lossy
+		<< ").";
+}
+
+/// most we read from one socket before letting the worker's other pipes run
+#define EVENTPIPE_READ_BUDGET   (4 << 20)
+/// most we encode into outbl before trying to write it
+#define EVENTPIPE_WRITE_BATCH   (64 << 10)
+
+
+/**************************************
+ * EventPipe
+ */
+
+EventPipe::EventPipe(EventMessenger *m, EventWorker *w, int st, Connection *con)
+  : msgr(m), worker(w),
+    sd(-1), port(0),
+    peer_type(-1),
+    lock("EventPipe::lock"),
+    state(st),
+    adopted(false), reaped(false), wake_queued(false),
+    connection_state(NULL),
+    keepalive(false),
+    close_on_empty(false),
+    connect_seq(0), peer_global_seq(0),
+    out_seq(0), in_seq(0), in_seq_acked(0),
+    in_state(IN_NONE), rx_off(0),
+    cseq(0), gseq(0), got_bad_auth(false), authorizer(NULL),
+    in_msg_size(0), in_throttler(NULL), in_dispatch_throttled(false),
+    in_data_got(0)
+{
+  if (con) {
+    connection_state = con->get();
+    connection_state->reset_pipe(this);
+  } else {
+    connection_state = new Connection();
+    connection_state->pipe = get();
+  }
+}
+
+EventPipe::~EventPipe()
+{
+  assert(out_q.empty());
+  assert(sent.empty());
+  assert(sd < 0);
+  delete authorizer;
+  if (connection_state)
+    connection_state->put();
+}
+
+void EventPipe::register_pipe()
+{
+  ldout(msgr->cct,10) << "register_pipe" << dendl;
+  assert(msgr->lock.is_locked());
+  assert(msgr->rank_pipe.count(peer_addr) == 0);
+  msgr->rank_pipe[peer_addr] = this;
+}
+
+void EventPipe::unregister_pipe()
+{
+  assert(msgr->lock.is_locked());
+  if (msgr->rank_pipe.count(peer_addr) &&
+      msgr->rank_pipe[peer_addr] == this) {
+    ldout(msgr->cct,10) << "unregister_pipe" << dendl;
+    msgr->rank_pipe.erase(peer_addr);
+  } else {
+    ldout(msgr->cct,10) << "unregister_pipe - not registered" << dendl;
+  }
+}
+
+void EventPipe::handle_ack(uint64_t seq)
+{
+  ldout(msgr->cct,15) << "got ack seq " << seq << dendl;
+  // trim sent list
+  while (!sent.empty() &&
+	 sent.front()->get_seq() <= seq) {
+    Message *m = sent.front();
+    sent.pop_front();
+    ldout(msgr->cct,10) << "got ack seq "
+			<< seq << " >= " << m->get_seq() << " on " << m << " " << *m << dendl;
+    m->put();
+  }
+
+  if (sent.empty() && close_on_empty) {
+    ldout(msgr->cct,10) << "got last ack, queue empty, closing" << dendl;
+    stop();
+  }
+}
+
+void EventPipe::requeue_sent(uint64_t max_acked)
+{
+  if (sent.empty())
+    return;
+
+  list<Message*>& rq = out_q[CEPH_MSG_PRIO_HIGHEST];
+  while (!sent.empty()) {
+    Message *m = sent.back();
+    if (m->get_seq() > max_acked) {
+      sent.pop_back();
+      ldout(msgr->cct,10) << "requeue_sent " << *m << " for resend seq " << out_seq
+			  << " (" << m->get_seq() << ")" << dendl;
+      rq.push_front(m);
+      out_seq--;
+    } else
+      sent.clear();
+  }
+}
+
+/*
+ * Must hold lock prior to calling.
+ */
+void EventPipe::discard_out_queue()
+{
+  ldout(msgr->cct,10) << "discard_queue" << dendl;
+
+  for (list<Message*>::iterator p = sent.begin(); p != sent.end(); p++) {
+    ldout(msgr->cct,20) << "  discard " << *p << dendl;
+    (*p)->put();
+  }
+  sent.clear();
+  for (map<int,list<Message*> >::iterator p = out_q.begin(); p != out_q.end(); p++)
+    for (list<Message*>::iterator r = p->second.begin(); r != p->second.end(); r++) {
+      ldout(msgr->cct,20) << "  discard " << *r << dendl;
+      (*r)->put();
+    }
+  out_q.clear();
+}
+
+/*
+ * Same policy as Pipe::fault(), except that instead of sleeping
+ * through the reconnect backoff we note when we may retry and let the
+ * worker come back to us then.  Worker thread only; lock held.
+ */
+void EventPipe::fault()
+{
+  const md_config_t *conf = msgr->cct->_conf;
+  assert(lock.is_locked());
+
+  char buf[80];
+  ldout(msgr->cct,2) << "fault " << errno << ": " << strerror_r(errno, buf, sizeof(buf)) << dendl;
+
+  if (state == STATE_CLOSED ||
+      state == STATE_CLOSING) {
+    ldout(msgr->cct,10) << "fault already closed|closing" << dendl;
+    if (state == STATE_CLOSING)
+      stop();
+    close_socket();
+    return;
+  }
+
+  close_socket();
+
+  // lossy channel?
+  if (policy.lossy) {
+    ldout(msgr->cct,10) << "fault on lossy channel, failing" << dendl;
+
+    stop();
+
+    // ugh
+    lock.Unlock();
+    msgr->lock.Lock();
+    lock.Lock();
+    unregister_pipe();
+    msgr->lock.Unlock();
+
+    msgr->discard_received(connection_state);
+    discard_out_queue();
+
+    // disconnect from Connection, and mark it failed.  future messages
+    // will be dropped.
+    assert(connection_state);
+    connection_state->clear_pipe(this);
+
+    msgr->queue_event(EventMessenger::D_BAD_RESET, connection_state);
+    return;
+  }
+
+  // requeue sent items
+  requeue_sent();
+
+  if (policy.standby && !is_queued()) {
+    ldout(msgr->cct,0) << "fault with nothing to send, going to standby" << dendl;
+    state = STATE_STANDBY;
+    return;
+  }
+
+  if (state != STATE_CONNECTING) {
+    if (policy.server) {
+      ldout(msgr->cct,0) << "fault, server, going to standby" << dendl;
+      state = STATE_STANDBY;
+    } else {
+      ldout(msgr->cct,0) << "fault, initiating reconnect" << dendl;
+      connect_seq++;
+      state = STATE_CONNECTING;
+    }
+    backoff = utime_t();
+    retry_at = utime_t();
+  } else if (backoff == utime_t()) {
+    ldout(msgr->cct,0) << "fault" << dendl;
+    backoff.set_from_double(conf->ms_initial_backoff);
+    retry_at = utime_t();
+  } else {
+    ldout(msgr->cct,10) << "fault waiting " << backoff << dendl;
+    retry_at = ceph_clock_now(msgr->cct);
+    retry_at += backoff;
+    backoff += backoff;
+    if (backoff > conf->ms_max_backoff)
+      backoff.set_from_double(conf->ms_max_backoff);
+  }
+}
+
+void EventPipe::was_session_reset()
+{
+  assert(lock.is_locked());
+
+  ldout(msgr->cct,10) << "was_session_reset" << dendl;
+  msgr->discard_received(connection_state);
+  discard_out_queue();
+
+  msgr->queue_event(EventMessenger::D_BAD_REMOTE_RESET, connection_state);
+
+  out_seq = 0;
+  in_seq = 0;
+  connect_seq = 0;
+}
+
+void EventPipe::stop()
+{
+  ldout(msgr->cct,10) << "stop" << dendl;
+  assert(lock.is_locked());
+  state = STATE_CLOSED;
+  worker->wakeup(this);
+}
+
+void EventPipe::send(Message *m)
+{
+  lock.Lock();
+  if (state == STATE_CLOSED) {
+    ldout(msgr->cct,10) << "send " << m << " " << *m << " on closed pipe, dropping" << dendl;
+    m->put();
+  } else {
+    out_q[m->get_priority()].push_back(m);
+    worker->wakeup(this);
+  }
+  lock.Unlock();
+}
+
+void EventPipe::_send_keepalive()
+{
+  assert(lock.is_locked());
+  keepalive = true;
+  worker->wakeup(this);
+}
+
+
+/*
+ * worker thread
+ */
+
+bool EventPipe::run()
+{
+  if (!adopted)
+    worker->adopt(this);
+
+  lock.Lock();
+  while (true) {
+    // standby?
+    if (state == STATE_STANDBY && sd < 0 && is_queued() && !policy.server) {
+      connect_seq++;
+      state = STATE_CONNECTING;
+    }
+
+    // connect?
+    if (state == STATE_CONNECTING && sd < 0) {
+      assert(!policy.server);
+      if (retry_at > ceph_clock_now(msgr->cct)) {
+	worker->add_timer(this, retry_at);
+	break;
+      }
+      if (start_connect() < 0) {
+	fault();
+	continue;
+      }
+    }
+
+    if (state == STATE_ACCEPTING && sd >= 0 && in_state == IN_NONE) {
+      if (start_accept() < 0) {
+	close_socket();
+	stop();
+      }
+    }
+
+    if (state == STATE_CLOSED || sd < 0)
+      break;
+
+    lock.Unlock();
+    int r = do_read();
+    if (r >= 0 && sd >= 0)
+      r = do_write();
+    lock.Lock();
+
+    if (r < 0) {
+      if (state == STATE_ACCEPTING) {
+	ldout(msgr->cct,10) << "accept failed, closing" << dendl;
+	close_socket();
+	stop();
+      } else {
+	fault();
+      }
+      continue;
+    }
+    break;
+  }
+
+  bool closed = (state == STATE_CLOSED);
+  lock.Unlock();
+  return closed;
+}
+
+void EventPipe::reap()
+{
+  ldout(msgr->cct,10) << "reap" << dendl;
+  lock.Lock();
+  close_socket();
+  lock.Unlock();
+  worker->forget(this);
+
+  msgr->lock.Lock();
+  lock.Lock();
+  unregister_pipe();
+  discard_out_queue();
+  lock.Unlock();
+  assert(msgr->pipes.count(this));
+  msgr->pipes.erase(this);
+  msgr->reap_cond.Signal();
+  msgr->lock.Unlock();
+
+  if (connection_state)
+    connection_state->clear_pipe(this);
+  put();
+}
+
+void EventPipe::close_socket()
+{
+  if (sd >= 0) {
+    ldout(msgr->cct,10) << "close_socket" << dendl;
+    worker->del_socket(sd);
+    ::close(sd);
+    sd = -1;
+  }
+  inbl.clear();
+  outbl.clear();
+  rx_buf = bufferptr();
+  rx_off = 0;
+  in_front.clear();
+  in_middle.clear();
+  in_data.clear();
+  in_state = IN_NONE;
+  release_throttle();
+}
+
+void EventPipe::release_throttle()
+{
+  if (in_throttler) {
+    ldout(msgr->cct,10) << "releasing " << in_msg_size << " to policy throttler "
+			<< in_throttler->get_current() << "/"
+			<< in_throttler->get_max() << dendl;
+    in_throttler->put(in_msg_size);
+    in_throttler = NULL;
+  }
+  if (in_dispatch_throttled) {
+    msgr->dispatch_throttle_release(in_msg_size);
+    in_dispatch_throttled = false;
+  }
+}
+
+int EventPipe::start_connect()
+{
+  assert(lock.is_locked());
+  const md_config_t *conf = msgr->cct->_conf;
+  char buf[80];
+
+  ldout(msgr->cct,10) << "connect " << connect_seq << dendl;
+  cseq = connect_seq;
+  gseq = msgr->get_global_seq();
+  got_bad_auth = false;
+
+  sd = ::socket(peer_addr.get_family(), SOCK_STREAM, 0);
+  if (sd < 0) {
+    lderr(msgr->cct) << "connect couldn't created socket " << strerror_r(errno, buf, sizeof(buf)) << dendl;
+    return -1;
+  }
+  ::fcntl(sd, F_SETFL, O_NONBLOCK);
+
+  // disable Nagle algorithm?
+  if (conf->ms_tcp_nodelay) {
+    int flag = 1;
+    int r = ::setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(flag));
+    if (r < 0)
+      ldout(msgr->cct,0) << "connect couldn't set TCP_NODELAY: " << strerror_r(errno, buf, sizeof(buf)) << dendl;
+  }
+
+  ldout(msgr->cct,10) << "connecting to " << peer_addr << dendl;
+  int rc = ::connect(sd, (sockaddr*)&peer_addr.addr, peer_addr.addr_size());
+  if (rc < 0 && errno != EINPROGRESS) {
+    ldout(msgr->cct,2) << "connect error " << peer_addr
+		       << ", " << errno << ": " << strerror_r(errno, buf, sizeof(buf)) << dendl;
+    ::close(sd);
+    sd = -1;
+    return -1;
+  }
+  if (worker->add_socket(this) < 0) {
+    ::close(sd);
+    sd = -1;
+    return -1;
+  }
+  in_state = IN_CONNECTING;
+  last_rx = ceph_clock_now(msgr->cct);
+  return 0;
+}
+
+int EventPipe::start_accept()
+{
+  assert(lock.is_locked());
+  ldout(msgr->cct,10) << "accept" << dendl;
+
+  // peer's socket addr (they might not know their ip)
+  socklen_t len = sizeof(socket_addr.ss_addr());
+  int r = ::getpeername(sd, (sockaddr*)&socket_addr.ss_addr(), &len);
+  if (r < 0) {
+    char buf[80];
+    ldout(msgr->cct,0) << "accept failed to getpeername " << errno << " " << strerror_r(errno, buf, sizeof(buf)) << dendl;
+    return -1;
+  }
+
+  // announce myself, my addr, and the peer's addr
+  outbl.append(CEPH_BANNER, strlen(CEPH_BANNER));
+  ::encode(msgr->my_inst.addr, outbl);
+  ::encode(socket_addr, outbl);
+  port = msgr->my_inst.addr.get_port();
+
+  if (worker->add_socket(this) < 0)
+    return -1;
+  in_state = IN_ACCEPT_BANNER;
+  last_rx = ceph_clock_now(msgr->cct);
+  ldout(msgr->cct,1) << "accept sd=" << sd << dendl;
+  return 0;
+}
+
+
+/*
+ * input
+ */
+
+int EventPipe::read_some(unsigned want)
+{
+  if (msgr->cct->_conf->ms_inject_socket_failures && sd >= 0) {
+    if (rand() % msgr->cct->_conf->ms_inject_socket_failures == 0) {
+      ldout(msgr->cct, 0) << "injecting socket failure" << dendl;
+      ::shutdown(sd, SHUT_RDWR);
+    }
+  }
+
+  if (!rx_buf.have_raw() || rx_off == rx_buf.length()) {
+    // size the buffer for what we are waiting for, so that a large
+    // front lands in one buffer (data has its own; see read_data())
+    if (want >= CEPH_PAGE_SIZE)
+      rx_buf = msgr->rx_pool.get((want + ~CEPH_PAGE_MASK) & CEPH_PAGE_MASK);
+    else
+      rx_buf = buffer::create(4096);
+    rx_off = 0;
+  }
+
+  int got = do_recv(rx_buf.c_str() + rx_off, rx_buf.length() - rx_off);
+  if (got <= 0)
+    return got;
+  inbl.push_back(bufferptr(rx_buf, rx_off, got));
+  rx_off += got;
+  return got;
+}
+
+/*
+ * @return bytes received, 0 if there is nothing to read yet, -1 on error
+ */
+int EventPipe::do_recv(char *buf, unsigned len)
+{
+  int got;
+  do {
+    got = ::recv(sd, buf, len, MSG_DONTWAIT);
+  } while (got < 0 && errno == EINTR);
+  if (got < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return 0;
+    ldout(msgr->cct,10) << "do_recv socket " << sd << " returned "
+			<< got << " errno " << errno << " " << cpp_strerror(errno) << dendl;
+    return -1;
+  }
+  if (got == 0) {
+    ldout(msgr->cct,10) << "do_recv socket " << sd << " got EOF" << dendl;
+    errno = ECONNRESET;
+    return -1;
+  }
+  last_rx = ceph_clock_now(msgr->cct);
+  return got;
+}
+
+/*
+ * Fill in_data: first with whatever we already read past the middle,
+ * then straight off the socket, so that the payload lands in its
+ * aligned buffers without another copy.
+ */
+int EventPipe::read_data()
+{
+  assert(in_state == IN_MSG_DATA);
+  unsigned left = in_header.data_len - in_data_got;
+  int got;
+  if (inbl.length()) {
+    bufferlist bl;
+    got = MIN(left, inbl.length());
+    inbl.splice(0, got, &bl);
+    unsigned off = in_data_got;
+    for (std::list<bufferptr>::const_iterator p = bl.buffers().begin();
+	 p != bl.buffers().end();
+	 ++p) {
+      in_data.copy_in(off, p->length(), p->c_str());
+      off += p->length();
+    }
+  } else {
+    // the buffer we are up to
+    std::list<bufferptr>::const_iterator p = in_data.buffers().begin();
+    unsigned off = in_data_got;
+    while (off >= p->length()) {
+      off -= p->length();
+      ++p;
+    }
+    got = do_recv((char*)p->c_str() + off, p->length() - off);
+    if (got <= 0)
+      return got;
+  }
+  in_data_got += got;
+  if (in_data_got == in_header.data_len) {
+    ldout(msgr->cct,20) << "got data " << in_data.length() << dendl;
+    in_state = IN_MSG_FOOTER;
+  }
+  return got;
+}
+
+/*
+ * how many bytes of input in_handle() wants for in_state
+ */
+unsigned EventPipe::in_need()
+{
+  switch (in_state) {
+  case IN_CONNECT_BANNER:
+    return strlen(CEPH_BANNER) + sizeof(entity_addr_t) * 2;
+  case IN_CONNECT_REPLY:
+    return sizeof(connect_reply);
+  case IN_CONNECT_REPLY_AUTH:
+    return connect_reply.authorizer_len;
+  case IN_ACCEPT_BANNER:
+    return strlen(CEPH_BANNER) + sizeof(entity_addr_t);
+  case IN_ACCEPT_CONNECT:
+    return sizeof(connect_msg);
+  case IN_ACCEPT_CONNECT_AUTH:
+    return connect_msg.authorizer_len;
+  case IN_CONNECT_SEQ:
+  case IN_ACCEPT_SEQ:
+  case IN_ACK:
+    return sizeof(ceph_le64);
+  case IN_TAG:
+    return 1;
+  case IN_MSG_HEADER:
+    if (connection_state->has_feature(CEPH_FEATURE_NOSRCADDR))
+      return sizeof(ceph_msg_header);
+    return sizeof(ceph_msg_header_old);
+  case IN_MSG_BODY:
+    return in_header.front_len + in_header.middle_len;
+  case IN_MSG_FOOTER:
+    return sizeof(ceph_msg_footer);
+  }
+  return 0;
+}
+
+int EventPipe::do_read()
+{
+  if (in_state == IN_NONE)
+    return 0;
+
+  if (in_state == IN_CONNECTING) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (::getsockopt(sd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+      return -1;
+    if (err) {
+      char buf[80];
+      errno = err;
+      ldout(msgr->cct,2) << "connect error " << peer_addr
+			 << ", " << err << ": " << strerror_r(err, buf, sizeof(buf)) << dendl;
+      return -1;
+    }
+    entity_addr_t a;
+    len = sizeof(a.ss_addr());
+    if (::getpeername(sd, (sockaddr*)&a.ss_addr(), &len) < 0) {
+      if (errno == ENOTCONN)
+	return 0;  // still in progress
+      return -1;
+    }
+    ldout(msgr->cct,20) << "connect connected, reading banner" << dendl;
+    in_state = IN_CONNECT_BANNER;
+  }
+
+  int budget = EVENTPIPE_READ_BUDGET;
+  while (sd >= 0) {
+    if (in_state == IN_MSG_THROTTLE) {
+      int r = throttle_message();
+      if (r < 0)
+	return r;
+      if (in_state == IN_MSG_THROTTLE)
+	break;  // a timer will bring us back
+      continue;
+    }
+
+    if (in_state == IN_MSG_DATA) {
+      if (budget <= 0) {
+	worker->wakeup(this);
+	break;
+      }
+      int got = read_data();
+      if (got < 0)
+	return -1;
+      if (got == 0)
+	break;
+      budget -= got;
+      continue;
+    }
+
+    unsigned need = in_need();
+    if (!need)
+      break;
+    if (inbl.length() >= need) {
+      int r = in_handle();
+      if (r < 0)
+	return r;
+      continue;
+    }
+
+    if (budget <= 0) {
+      // be fair to the worker's other pipes; come back later
+      worker->wakeup(this);
+      break;
+    }
+    int got = read_some(need - inbl.length());
+    if (got < 0)
+      return -1;
+    if (got == 0)
+      break;
+    budget -= got;
+  }
+  return 0;
+}
+
+int EventPipe::in_handle()
+{
+  unsigned need = in_need();
+  bufferlist bl;
+  if (need)
+    inbl.splice(0, need, &bl);
+
+  switch (in_state) {
+  case IN_CONNECT_BANNER:
+    {
+      char banner[strlen(CEPH_BANNER) + 1];
+      entity_addr_t paddr, peer_addr_for_me;
+      bl.copy(0, strlen(CEPH_BANNER), banner);
+      if (memcmp(banner, CEPH_BANNER, strlen(CEPH_BANNER))) {
+	ldout(msgr->cct,0) << "connect protocol error (bad banner) on peer " << peer_addr << dendl;
+	return -1;
+      }
+      bufferlist::iterator p = bl.begin();
+      p.advance(strlen(CEPH_BANNER));
+      ::decode(paddr, p);
+      ::decode(peer_addr_for_me, p);
+      port = peer_addr_for_me.get_port();
+
+      ldout(msgr->cct,20) << "connect read peer addr " << paddr << " on socket " << sd << dendl;
+      if (peer_addr != paddr) {
+	if (paddr.is_blank_ip() &&
+	    peer_addr.get_port() == paddr.get_port() &&
+	    peer_addr.get_nonce() == paddr.get_nonce()) {
+	  ldout(msgr->cct,0) << "connect claims to be "
+			     << paddr << " not " << peer_addr << " - presumably this is the same node!" << dendl;
+	} else {
+	  ldout(msgr->cct,0) << "connect claims to be "
+			     << paddr << " not " << peer_addr << " - wrong node!" << dendl;
+	  return -1;
+	}
+      }
+
+      ldout(msgr->cct,20) << "connect peer addr for me is " << peer_addr_for_me << dendl;
+      msgr->learned_addr(peer_addr_for_me);
+
+      outbl.append(CEPH_BANNER, strlen(CEPH_BANNER));
+      ::encode(msgr->my_inst.addr, outbl);
+      ldout(msgr->cct,10) << "connect sent my addr " << msgr->my_inst.addr << dendl;
+
+      send_connect_msg(false);
+    }
+    return 0;
+
+  case IN_CONNECT_REPLY:
+    bl.copy(0, sizeof(connect_reply), (char*)&connect_reply);
+    ldout(msgr->cct,20) << "connect got reply tag " << (int)connect_reply.tag
+			<< " connect_seq " << connect_reply.connect_seq
+			<< " global_seq " << connect_reply.global_seq
+			<< " proto " << connect_reply.protocol_version
+			<< " flags " << (int)connect_reply.flags
+			<< dendl;
+    if (connect_reply.authorizer_len) {
+      ldout(msgr->cct,10) << "reply.authorizer_len=" << connect_reply.authorizer_len << dendl;
+      in_state = IN_CONNECT_REPLY_AUTH;
+      return 0;
+    }
+    bl.clear();
+    return handle_connect_reply(bl);
+
+  case IN_CONNECT_REPLY_AUTH:
+    return handle_connect_reply(bl);
+
+  case IN_CONNECT_SEQ:
+    {
+      uint64_t newly_acked_seq = 0;
+      bl.copy(0, sizeof(newly_acked_seq), (char*)&newly_acked_seq);
+      lock.Lock();
+      if (state != STATE_CONNECTING) {
+	ldout(msgr->cct,0) << "connect got SEQ but no longer connecting" << dendl;
+	close_socket();
+	lock.Unlock();
+	return 0;
+      }
+      handle_ack(newly_acked_seq);
+      outbl.append((char*)&in_seq, sizeof(in_seq));
+      connect_ready();
+      lock.Unlock();
+    }
+    return 0;
+
+  case IN_ACCEPT_BANNER:
+    {
+      char banner[strlen(CEPH_BANNER) + 1];
+      bl.copy(0, strlen(CEPH_BANNER), banner);
+      if (memcmp(banner, CEPH_BANNER, strlen(CEPH_BANNER))) {
+	banner[strlen(CEPH_BANNER)] = 0;
+	ldout(msgr->cct,1) << "accept peer sent bad banner '" << banner << "' (should be '" << CEPH_BANNER << "')" << dendl;
+	return -1;
+      }
+      entity_addr_t addr;
+      bufferlist::iterator p = bl.begin();
+      p.advance(strlen(CEPH_BANNER));
+      ::decode(addr, p);
+
+      ldout(msgr->cct,10) << "accept peer addr is " << addr << dendl;
+      if (addr.is_blank_ip()) {
+	// peer apparently doesn't know what ip they have; figure it out for them.
+	int port = addr.get_port();
+	addr.addr = socket_addr.addr;
+	addr.set_port(port);
+	ldout(msgr->cct,0) << "accept peer addr is really " << addr
+			   << " (socket is " << socket_addr << ")" << dendl;
+      }
+      lock.Lock();
+      set_peer_addr(addr);  // so that connection_state gets set up
+      lock.Unlock();
+      in_state = IN_ACCEPT_CONNECT;
+    }
+    return 0;
+
+  case IN_ACCEPT_CONNECT:
+    bl.copy(0, sizeof(connect_msg), (char*)&connect_msg);
+    if (connect_msg.authorizer_len) {
+      in_state = IN_ACCEPT_CONNECT_AUTH;
+      return 0;
+    }
+    bl.clear();
+    return handle_accept_connect(bl);
+
+  case IN_ACCEPT_CONNECT_AUTH:
+    return handle_accept_connect(bl);
+
+  case IN_ACCEPT_SEQ:
+    {
+      uint64_t newly_acked_seq = 0;
+      bl.copy(0, sizeof(newly_acked_seq), (char*)&newly_acked_seq);
+      lock.Lock();
+      requeue_sent(newly_acked_seq);
+      in_state = IN_TAG;
+      lock.Unlock();
+    }
+    return 0;
+
+  case IN_TAG:
+    {
+      char tag = bl[0];
+      if (tag == CEPH_MSGR_TAG_KEEPALIVE) {
+	ldout(msgr->cct,20) << "got KEEPALIVE" << dendl;
+      } else if (tag == CEPH_MSGR_TAG_ACK) {
+	ldout(msgr->cct,20) << "got ACK" << dendl;
+	in_state = IN_ACK;
+      } else if (tag == CEPH_MSGR_TAG_MSG) {
+	ldout(msgr->cct,20) << "got MSG" << dendl;
+	in_state = IN_MSG_HEADER;
+      } else if (tag == CEPH_MSGR_TAG_CLOSE) {
+	ldout(msgr->cct,20) << "got CLOSE" << dendl;
+	lock.Lock();
+	if (state == STATE_CLOSING)
+	  stop();
+	else
+	  state = STATE_CLOSING;
+	in_state = IN_NONE;  // nothing more to read
+	lock.Unlock();
+      } else {
+	ldout(msgr->cct,0) << "bad tag " << (int)tag << dendl;
+	return -1;
+      }
+    }
+    return 0;
+
+  case IN_ACK:
+    {
+      ceph_le64 seq;
+      bl.copy(0, sizeof(seq), (char*)&seq);
+      lock.Lock();
+      if (state != STATE_CLOSED)
+	handle_ack(seq);
+      lock.Unlock();
+      in_state = IN_TAG;
+    }
+    return 0;
+
+  case IN_MSG_HEADER:
+    {
+      __u32 header_crc;
+      if (connection_state->has_feature(CEPH_FEATURE_NOSRCADDR)) {
+	bl.copy(0, sizeof(in_header), (char*)&in_header);
+	header_crc = ceph_crc32c_le(0, (unsigned char *)&in_header,
+				    sizeof(in_header) - sizeof(in_header.crc));
+      } else {
+	ceph_msg_header_old oldheader;
+	bl.copy(0, sizeof(oldheader), (char*)&oldheader);
+	// this is fugly
+	memcpy(&in_header, &oldheader, sizeof(in_header));
+	in_header.src = oldheader.src.name;
+	in_header.reserved = oldheader.reserved;
+	in_header.crc = oldheader.crc;
+	header_crc = ceph_crc32c_le(0, (unsigned char *)&oldheader,
+				    sizeof(oldheader) - sizeof(oldheader.crc));
+      }
+
+      ldout(msgr->cct,20) << "got envelope type=" << in_header.type
+			  << " src " << entity_name_t(in_header.src)
+			  << " front=" << in_header.front_len
+			  << " data=" << in_header.data_len
+			  << " off " << in_header.data_off
+			  << dendl;
+
+      // verify header crc
+      if (header_crc != in_header.crc) {
+	ldout(msgr->cct,0) << "got bad header crc " << header_crc << " != " << in_header.crc << dendl;
+	return -1;
+      }
+
+      recv_stamp = ceph_clock_now(msgr->cct);
+      in_msg_size = in_header.front_len + in_header.middle_len + in_header.data_len;
+      in_state = IN_MSG_THROTTLE;
+    }
+    return throttle_message();
+
+  case IN_MSG_BODY:
+    if (in_header.front_len) {
+      bl.splice(0, in_header.front_len, &in_front);
+      ldout(msgr->cct,20) << "got front " << in_front.length() << dendl;
+    }
+    if (in_header.middle_len) {
+      bl.splice(0, in_header.middle_len, &in_middle);
+      ldout(msgr->cct,20) << "got middle " << in_middle.length() << dendl;
+    }
+    start_msg_data();
+    return 0;
+
+  case IN_MSG_FOOTER:
+    return handle_message(bl);
+  }
+
+  assert(0 == "bad in_state");
+  return -1;
+}
+
+/*
+ * Reserve the message's size from the policy and dispatch throttlers,
+ * in that order, as Pipe::read_message() does.  We may not block the
+ * worker, so if either is full we stop reading this socket and poll
+ * again shortly.
+ */
+int EventPipe::throttle_message()
+{
+  assert(in_state == IN_MSG_THROTTLE);
+  if (in_msg_size) {
+    if (!in_throttler && policy.throttler) {
+      ldout(msgr->cct,10) << "wants " << in_msg_size << " from policy throttler "
+			  << policy.throttler->get_current() << "/"
+			  << policy.throttler->get_max() << dendl;
+      if (!policy.throttler->get_or_fail(in_msg_size))
+	goto wait;
+      in_throttler = policy.throttler;
+    }
+    if (!in_dispatch_throttled) {
+      ldout(msgr->cct,10) << "wants " << in_msg_size << " from dispatch throttler "
+			  << msgr->dispatch_throttler.get_current() << "/"
+			  << msgr->dispatch_throttler.get_max() << dendl;
+      if (!msgr->dispatch_throttler.get_or_fail(in_msg_size))
+	goto wait;
+      in_dispatch_throttled = true;
+    }
+  }
+  throttle_stamp = ceph_clock_now(msgr->cct);
+  if (in_header.front_len + in_header.middle_len)
+    in_state = IN_MSG_BODY;
+  else
+    start_msg_data();
+  return 0;
+
+ wait:
+  {
+    utime_t t = ceph_clock_now(msgr->cct);
+    t += utime_t(0, 10000000);
+    worker->add_timer(this, t);
+  }
+  return 0;
+}
+
+void EventPipe::start_msg_data()
+{
+  if (!in_header.data_len) {
+    in_state = IN_MSG_FOOTER;
+    return;
+  }
+  unsigned data_off = le32_to_cpu(in_header.data_off);
+  msgr->rx_pool.get_aligned(in_data, in_header.data_len, data_off);
+  in_data_got = 0;
+  in_state = IN_MSG_DATA;
+}
+
+int EventPipe::handle_message(bufferlist& bl)
+{
+  bufferlist front, middle, data;
+  ceph_msg_footer footer;
+
+  front.claim(in_front);
+  middle.claim(in_middle);
+  data.claim(in_data);
+  bl.copy(0, sizeof(footer), (char*)&footer);
+
+  in_state = IN_TAG;
+
+  if ((footer.flags & CEPH_MSG_FOOTER_COMPLETE) == 0) {
+    ldout(msgr->cct,0) << "got " << front.length() << " + " << middle.length() << " + " << data.length()
+		       << " byte message.. ABORTED" << dendl;
+    release_throttle();
+    return 0;
+  }
+
+  ldout(msgr->cct,20) << "got " << front.length() << " + " << middle.length() << " + " << data.length()
+		      << " byte message" << dendl;
+  Message *m = decode_message(msgr->cct, in_header, footer, front, middle, data);
+  if (!m) {
+    release_throttle();
+    return -1;
+  }
+
+  // the message now owns our throttle reservations
+  m->set_throttler(in_throttler);
+  m->set_dispatch_throttle_size(in_dispatch_throttled ? in_msg_size : 0);
+  in_throttler = NULL;
+  in_dispatch_throttled = false;
+
+  m->set_recv_stamp(recv_stamp);
+  m->set_throttle_stamp(throttle_stamp);
+  m->set_recv_complete_stamp(ceph_clock_now(msgr->cct));
+
+  lock.Lock();
+  if (state == STATE_CLOSED ||
+      state == STATE_CONNECTING) {
+    lock.Unlock();
+    msgr->dispatch_throttle_release(m->get_dispatch_throttle_size());
+    m->put();
+    return 0;
+  }
+
+  // check received seq#.  if it is old, drop the message.  see
+  // Pipe::reader() for why we let incoming messages skip ahead.
+  if (m->get_seq() <= in_seq) {
+    ldout(msgr->cct,0) << "got old message "
+		       << m->get_seq() << " <= " << in_seq << " " << m << " " << *m
+		       << ", discarding" << dendl;
+    lock.Unlock();
+    msgr->dispatch_throttle_release(m->get_dispatch_throttle_size());
+    m->put();
+    return 0;
+  }
+
+  m->set_connection(connection_state->get());
+
+  // note last received message; do_write() will ack it.
+  in_seq = m->get_seq();
+
+  ldout(msgr->cct,10) << "got message "
+		      << m->get_seq() << " " << m << " " << *m
+		      << dendl;
+  msgr->queue_received(m);
+  lock.Unlock();
+  return 0;
+}
+
+
+/*
+ * handshake
+ */
+
+void EventPipe::send_connect_msg(bool force_new_auth)
+{
+  delete authorizer;
+  authorizer = msgr->ms_deliver_get_authorizer(peer_type, force_new_auth);
+
+  lock.Lock();
+  connect_msg.features = policy.features_supported;
+  connect_msg.host_type = msgr->my_type;
+  connect_msg.global_seq = gseq;
+  connect_msg.connect_seq = cseq;
+  connect_msg.protocol_version = msgr->get_proto_version(peer_type, true);
+  connect_msg.authorizer_protocol = authorizer ? authorizer->protocol : 0;
+  connect_msg.authorizer_len = authorizer ? authorizer->bl.length() : 0;
+  connect_msg.flags = 0;
+  if (policy.lossy)
+    connect_msg.flags |= CEPH_MSG_CONNECT_LOSSY;  // this is fyi, actually, server decides!
+  lock.Unlock();
+
+  if (authorizer)
+    ldout(msgr->cct,10) << "connect.authorizer_len=" << connect_msg.authorizer_len
+			<< " protocol=" << connect_msg.authorizer_protocol << dendl;
+  ldout(msgr->cct,10) << "connect sending gseq=" << gseq << " cseq=" << cseq
+		      << " proto=" << connect_msg.protocol_version << dendl;
+
+  outbl.append((char*)&connect_msg, sizeof(connect_msg));
+  if (authorizer)
+    outbl.append(authorizer->bl);
+  in_state = IN_CONNECT_REPLY;
+}
+
+int EventPipe::handle_connect_reply(bufferlist& authorizer_reply)
+{
+  ceph_msg_connect_reply& reply = connect_reply;
+
+  if (authorizer) {
+    bufferlist::iterator iter = authorizer_reply.begin();
+    if (!authorizer->verify_reply(iter)) {
+      ldout(msgr->cct,0) << "failed verifying authorize reply" << dendl;
+      return -1;
+    }
+  }
+
+  lock.Lock();
+  if (state != STATE_CONNECTING) {
+    ldout(msgr->cct,0) << "connect got reply but no longer connecting" << dendl;
+    close_socket();
+    lock.Unlock();
+    return 0;
+  }
+
+  if (reply.tag == CEPH_MSGR_TAG_FEATURES) {
+    ldout(msgr->cct,0) << "connect protocol feature mismatch, my " << std::hex
+		       << connect_msg.features << " < peer " << reply.features
+		       << " missing " << (reply.features & ~policy.features_supported)
+		       << std::dec << dendl;
+    lock.Unlock();
+    return -1;
+  }
+
+  if (reply.tag == CEPH_MSGR_TAG_BADPROTOVER) {
+    ldout(msgr->cct,0) << "connect protocol version mismatch, my " << connect_msg.protocol_version
+		       << " != " << reply.protocol_version << dendl;
+    lock.Unlock();
+    return -1;
+  }
+
+  if (reply.tag == CEPH_MSGR_TAG_BADAUTHORIZER) {
+    ldout(msgr->cct,0) << "connect got BADAUTHORIZER" << dendl;
+    lock.Unlock();
+    if (got_bad_auth)
+      return -1;
+    got_bad_auth = true;
+    send_connect_msg(true);  // try harder
+    return 0;
+  }
+  if (reply.tag == CEPH_MSGR_TAG_RESETSESSION) {
+    ldout(msgr->cct,0) << "connect got RESETSESSION" << dendl;
+    was_session_reset();
+    cseq = 0;
+    lock.Unlock();
+    send_connect_msg(false);
+    return 0;
+  }
+  if (reply.tag == CEPH_MSGR_TAG_RETRY_GLOBAL) {
+    gseq = msgr->get_global_seq(reply.global_seq);
+    ldout(msgr->cct,10) << "connect got RETRY_GLOBAL " << reply.global_seq
+			<< " chose new " << gseq << dendl;
+    lock.Unlock();
+    send_connect_msg(false);
+    return 0;
+  }
+  if (reply.tag == CEPH_MSGR_TAG_RETRY_SESSION) {
+    assert(reply.connect_seq > connect_seq);
+    ldout(msgr->cct,10) << "connect got RETRY_SESSION " << connect_seq
+			<< " -> " << reply.connect_seq << dendl;
+    cseq = connect_seq = reply.connect_seq;
+    lock.Unlock();
+    send_connect_msg(false);
+    return 0;
+  }
+
+  if (reply.tag == CEPH_MSGR_TAG_WAIT) {
+    ldout(msgr->cct,3) << "connect got WAIT (connection race)" << dendl;
+    state = STATE_WAIT;
+    close_socket();
+    lock.Unlock();
+    return 0;
+  }
+
+  if (reply.tag == CEPH_MSGR_TAG_READY ||
+      reply.tag == CEPH_MSGR_TAG_SEQ) {
+    uint64_t feat_missing = policy.features_required & ~(uint64_t)reply.features;
+    if (feat_missing) {
+      ldout(msgr->cct,1) << "missing required features " << std::hex << feat_missing << std::dec << dendl;
+      lock.Unlock();
+      return -1;
+    }
+
+    if (reply.tag == CEPH_MSGR_TAG_SEQ) {
+      ldout(msgr->cct,10) << "got CEPH_MSGR_TAG_SEQ, reading acked_seq and writing in_seq" << dendl;
+      in_state = IN_CONNECT_SEQ;
+    } else {
+      connect_ready();
+    }
+    lock.Unlock();
+    return 0;
+  }
+
+  // protocol error
+  ldout(msgr->cct,0) << "connect got bad tag " << (int)reply.tag << dendl;
+  lock.Unlock();
+  return -1;
+}
+
+void EventPipe::connect_ready()
+{
+  assert(lock.is_locked());
+  ceph_msg_connect_reply& reply = connect_reply;
+
+  // hooray!
+  peer_global_seq = reply.global_seq;
+  policy.lossy = reply.flags & CEPH_MSG_CONNECT_LOSSY;
+  state = STATE_OPEN;
+  connect_seq = cseq + 1;
+  assert(connect_seq == reply.connect_seq);
+  backoff = utime_t();
+  connection_state->set_features((unsigned)reply.features & (unsigned)connect_msg.features);
+  ldout(msgr->cct,10) << "connect success " << connect_seq << ", lossy = " << policy.lossy
+		      << ", features " << connection_state->get_features() << dendl;
+
+  msgr->queue_event(EventMessenger::D_CONNECT, connection_state);
+
+  delete authorizer;
+  authorizer = NULL;
+  in_state = IN_TAG;
+}
+
+/*
+ * this mirrors Pipe::accept(), except that each ceph_msg_connect the
+ * peer sends is handled by a separate call, and replies go out through
+ * outbl.
+ */
+int EventPipe::handle_accept_connect(bufferlist& authorizer)
+{
+  ceph_msg_connect& connect = connect_msg;
+  ceph_msg_connect_reply reply;
+  EventPipe *existing = 0;
+  bufferlist authorizer_reply;
+  bool authorizer_valid;
+  uint64_t feat_missing;
+  int reply_tag = 0;
+  uint64_t existing_seq = -1;
+
+  ldout(msgr->cct,20) << "accept got peer connect_seq " << connect.connect_seq
+		      << " global_seq " << connect.global_seq
+		      << dendl;
+
+  msgr->lock.Lock();
+  if (msgr->is_stopping())
+    goto shutting_down;
+
+  // note peer's type, flags
+  set_peer_type(connect.host_type);
+  policy = msgr->get_policy(connect.host_type);
+  ldout(msgr->cct,10) << "accept of host_type " << connect.host_type
+		      << ", policy.lossy=" << policy.lossy
+		      << dendl;
+
+  memset(&reply, 0, sizeof(reply));
+  reply.protocol_version = msgr->get_proto_version(peer_type, false);
+
+  // mismatch?
+  ldout(msgr->cct,10) << "accept my proto " << reply.protocol_version
+		      << ", their proto " << connect.protocol_version << dendl;
+  if (connect.protocol_version != reply.protocol_version) {
+    reply.tag = CEPH_MSGR_TAG_BADPROTOVER;
+    msgr->lock.Unlock();
+    goto reply;
+  }
+
+  feat_missing = policy.features_required & ~(uint64_t)connect.features;
+  if (feat_missing) {
+    ldout(msgr->cct,1) << "peer missing required features " << std::hex << feat_missing << std::dec << dendl;
+    reply.tag = CEPH_MSGR_TAG_FEATURES;
+    msgr->lock.Unlock();
+    goto reply;
+  }
+
+  msgr->lock.Unlock();
+  if (msgr->ms_deliver_verify_authorizer(connection_state, peer_type,
+					 connect.authorizer_protocol, authorizer,
+					 authorizer_reply, authorizer_valid) &&
+      !authorizer_valid) {
+    ldout(msgr->cct,0) << "accept bad authorizer" << dendl;
+    reply.tag = CEPH_MSGR_TAG_BADAUTHORIZER;
+    goto reply;
+  }
+  msgr->lock.Lock();
+  if (msgr->is_stopping())
+    goto shutting_down;
+
+  // existing?
+  if (msgr->rank_pipe.count(peer_addr)) {
+    existing = msgr->rank_pipe[peer_addr];
+    existing->lock.Lock();
+
+    if (connect.global_seq < existing->peer_global_seq) {
+      ldout(msgr->cct,10) << "accept existing " << existing << ".gseq " << existing->peer_global_seq
+			  << " > " << connect.global_seq << ", RETRY_GLOBAL" << dendl;
+      reply.tag = CEPH_MSGR_TAG_RETRY_GLOBAL;
+      reply.global_seq = existing->peer_global_seq;  // so we can send it below..
+      existing->lock.Unlock();
+      msgr->lock.Unlock();
+      goto reply;
+    } else {
+      ldout(msgr->cct,10) << "accept existing " << existing << ".gseq " << existing->peer_global_seq
+			  << " <= " << connect.global_seq << ", looks ok" << dendl;
+    }
+
+    if (existing->policy.lossy) {
+      ldout(msgr->cct,0) << "accept replacing existing (lossy) channel (new one lossy="
+			 << policy.lossy << ")" << dendl;
+      existing->was_session_reset();
+      goto replace;
+    }
+
+    ldout(msgr->cct,0) << "accept connect_seq " << connect.connect_seq
+		       << " vs existing " << existing->connect_seq
+		       << " state " << existing->get_state_name() << dendl;
+
+    if (connect.connect_seq == 0 && existing->connect_seq > 0) {
+      ldout(msgr->cct,0) << "accept peer reset, then tried to connect to us, replacing" << dendl;
+      if (policy.resetcheck)
+	existing->was_session_reset(); // this resets out_queue, msg_ and connect_seq #'s
+      goto replace;
+    }
+
+    if (connect.connect_seq < existing->connect_seq) {
+      // old attempt, or we sent READY but they didn't get it.
+      ldout(msgr->cct,10) << "accept existing " << existing << ".cseq " << existing->connect_seq
+			  << " > " << connect.connect_seq << ", RETRY_SESSION" << dendl;
+      goto retry_session;
+    }
+
+    if (connect.connect_seq == existing->connect_seq) {
+      // if the existing connection successfully opened, and/or
+      // subsequently went to standby, then the peer should bump
+      // their connect_seq and retry: this is not a connection race
+      // we need to resolve here.
+      if (existing->state == STATE_OPEN ||
+	  existing->state == STATE_STANDBY) {
+	ldout(msgr->cct,10) << "accept connection race, existing " << existing
+			    << ".cseq " << existing->connect_seq
+			    << " == " << connect.connect_seq
+			    << ", OPEN|STANDBY, RETRY_SESSION" << dendl;
+	goto retry_session;
+      }
+
+      // connection race?
+      if (peer_addr < msgr->my_inst.addr ||
+	  existing->policy.server) {
+	// incoming wins
+	ldout(msgr->cct,10) << "accept connection race, existing " << existing << ".cseq " << existing->connect_seq
+			    << " == " << connect.connect_seq << ", or we are server, replacing my attempt" << dendl;
+	if (!(existing->state == STATE_CONNECTING ||
+	      existing->state == STATE_WAIT))
+	  lderr(msgr->cct) << "accept race bad state, would replace, existing="
+			   << existing->get_state_name()
+			   << " " << existing << ".cseq=" << existing->connect_seq
+			   << " == " << connect.connect_seq
+			   << dendl;
+	assert(existing->state == STATE_CONNECTING ||
+	       existing->state == STATE_WAIT);
+	goto replace;
+      } else {
+	// our existing outgoing wins
+	ldout(msgr->cct,10) << "accept connection race, existing " << existing << ".cseq " << existing->connect_seq
+			    << " == " << connect.connect_seq << ", sending WAIT" << dendl;
+	assert(peer_addr > msgr->my_inst.addr);
+	if (!(existing->state == STATE_CONNECTING))
+	  lderr(msgr->cct) << "accept race bad state, would send wait, existing="
+			   << existing->get_state_name()
+			   << " " << existing << ".cseq=" << existing->connect_seq
+			   << " == " << connect.connect_seq
+			   << dendl;
+	assert(existing->state == STATE_CONNECTING);
+	// make sure our outgoing connection will follow through
+	existing->_send_keepalive();
+	reply.tag = CEPH_MSGR_TAG_WAIT;
+	existing->lock.Unlock();
+	msgr->lock.Unlock();
+	goto reply;
+      }
+    }
+
+    assert(connect.connect_seq > existing->connect_seq);
+    assert(connect.global_seq >= existing->peer_global_seq);
+    if (policy.resetcheck &&   // RESETSESSION only used by servers; peers do not reset each other
+	existing->connect_seq == 0) {
+      ldout(msgr->cct,0) << "accept we reset (peer sent cseq " << connect.connect_seq
+			 << ", " << existing << ".cseq = " << existing->connect_seq
+			 << "), sending RESETSESSION" << dendl;
+      reply.tag = CEPH_MSGR_TAG_RESETSESSION;
+      msgr->lock.Unlock();
+      existing->lock.Unlock();
+      goto reply;
+    }
+
+    // reconnect
+    ldout(msgr->cct,10) << "accept peer sent cseq " << connect.connect_seq
+			<< " > " << existing->connect_seq << dendl;
+    goto replace;
+  } // existing
+  else if (policy.resetcheck && connect.connect_seq > 0) {
+    // we reset, and they are opening a new session
+    ldout(msgr->cct,0) << "accept we reset (peer sent cseq " << connect.connect_seq << "), sending RESETSESSION" << dendl;
+    msgr->lock.Unlock();
+    reply.tag = CEPH_MSGR_TAG_RESETSESSION;
+    goto reply;
+  } else {
+    // new session
+    ldout(msgr->cct,10) << "accept new session" << dendl;
+    existing = NULL;
+    goto open;
+  }
+  assert(0);
+
+ retry_session:
+  reply.tag = CEPH_MSGR_TAG_RETRY_SESSION;
+  reply.connect_seq = existing->connect_seq + 1;
+  existing->lock.Unlock();
+  msgr->lock.Unlock();
+  goto reply;
+
+ reply:
+  // the peer will try again; wait for its next connect
+  reply.features = ((uint64_t)connect.features & policy.features_supported) | policy.features_required;
+  reply.authorizer_len = authorizer_reply.length();
+  outbl.append((char*)&reply, sizeof(reply));
+  if (reply.authorizer_len)
+    outbl.append(authorizer_reply);
+  in_state = IN_ACCEPT_CONNECT;
+  return 0;
+
+ replace:
+  if (connect.features & CEPH_FEATURE_RECONNECT_SEQ) {
+    reply_tag = CEPH_MSGR_TAG_SEQ;
+    existing_seq = existing->in_seq;
+  }
+  ldout(msgr->cct,10) << "accept replacing " << existing << dendl;
+  existing->stop();
+  existing->unregister_pipe();
+
+  if (!existing->policy.lossy) {
+    // drop my Connection, and take a ref to the existing one. do not
+    // clear existing->connection_state, since its worker may still
+    // dereference it.
+    connection_state->put();
+    connection_state = existing->connection_state->get();
+
+    // make existing Connection reference us
+    existing->connection_state->reset_pipe(this);
+
+    // undispatched messages stay queued on the (shared) Connection
+    in_seq = existing->in_seq;
+    in_seq_acked = in_seq;
+
+    // steal outgoing queue and out_seq
+    existing->requeue_sent();
+    out_seq = existing->out_seq;
+    ldout(msgr->cct,10) << "accept re-queuing on out_seq " << out_seq << " in_seq " << in_seq << dendl;
+    for (map<int, list<Message*> >::iterator p = existing->out_q.begin();
+	 p != existing->out_q.end();
+	 p++)
+      out_q[p->first].splice(out_q[p->first].begin(), p->second);
+    existing->out_q.clear();
+  }
+  existing->lock.Unlock();
+
+ open:
+  lock.Lock();
+  if (state == STATE_CLOSED) {
+    // wait() got to us first
+    lock.Unlock();
+    goto shutting_down;
+  }
+
+  // open
+  connect_seq = connect.connect_seq + 1;
+  peer_global_seq = connect.global_seq;
+  state = STATE_OPEN;
+  ldout(msgr->cct,10) << "accept success, connect_seq = " << connect_seq << ", sending READY" << dendl;
+
+  // send READY reply
+  reply.tag = (reply_tag ? reply_tag : CEPH_MSGR_TAG_READY);
+  reply.features = policy.features_supported;
+  reply.global_seq = msgr->get_global_seq();
+  reply.connect_seq = connect_seq;
+  reply.flags = 0;
+  reply.authorizer_len = authorizer_reply.length();
+  if (policy.lossy)
+    reply.flags = reply.flags | CEPH_MSG_CONNECT_LOSSY;
+
+  connection_state->set_features((int)reply.features & (int)connect.features);
+  ldout(msgr->cct,10) << "accept features " << connection_state->get_features() << dendl;
+
+  // notify
+  msgr->queue_event(EventMessenger::D_ACCEPT, connection_state);
+
+  // ok!
+  register_pipe();
+
+  outbl.append((char*)&reply, sizeof(reply));
+  if (reply.authorizer_len)
+    outbl.append(authorizer_reply);
+  if (reply_tag == CEPH_MSGR_TAG_SEQ) {
+    outbl.append((char*)&existing_seq, sizeof(existing_seq));
+    in_state = IN_ACCEPT_SEQ;
+  } else {
+    in_state = IN_TAG;
+  }
+  lock.Unlock();
+  msgr->lock.Unlock();
+  return 0;
+
+ shutting_down:
+  msgr->lock.Unlock();
+  lock.Lock();
+  close_socket();
+  stop();
+  lock.Unlock();
+  return 0;
+}
+
+
+/*
+ * output
+ */
+
+int EventPipe::do_write()
+{
+  while (true) {
+    lock.Lock();
+    if (state == STATE_CLOSING) {
+      ldout(msgr->cct,20) << "writing CLOSE tag" << dendl;
+      char tag = CEPH_MSGR_TAG_CLOSE;
+      outbl.append(&tag, 1);
+      write_some();  // we don't care if this succeeds
+      stop();
+      lock.Unlock();
+      return 0;
+    }
+
+    if (state == STATE_OPEN && in_state >= IN_TAG) {
+      while (outbl.length() < EVENTPIPE_WRITE_BATCH) {
+	// keepalive?
+	if (keepalive) {
+	  ldout(msgr->cct,10) << "write_keepalive" << dendl;
+	  char tag = CEPH_MSGR_TAG_KEEPALIVE;
+	  outbl.append(&tag, 1);
+	  keepalive = false;
+	}
+
+	// send ack?
+	if (in_seq > in_seq_acked) {
+	  ldout(msgr->cct,10) << "write_ack " << in_seq << dendl;
+	  char tag = CEPH_MSGR_TAG_ACK;
+	  ceph_le64 s;
+	  s = in_seq;
+	  outbl.append(&tag, 1);
+	  outbl.append((char*)&s, sizeof(s));
+	  in_seq_acked = in_seq;
+	}
+
+	// grab outgoing message
+	Message *m = _get_next_outgoing();
+	if (!m)
+	  break;
+	m->set_seq(++out_seq);
+	if (!policy.lossy || close_on_empty) {
+	  // put on sent list
+	  sent.push_back(m);
+	  m->get();
+	}
+	lock.Unlock();
+
+	ldout(msgr->cct,20) << "writer encoding " << m->get_seq() << " " << m << " " << *m << dendl;
+
+	// associate message with Connection (for benefit of encode_payload)
+	m->set_connection(connection_state->get());
+
+	// encode and copy out of *m
+	m->encode(connection_state->get_features(), !msgr->cct->_conf->ms_nocrc);
+
+	ldout(msgr->cct,20) << "writer sending " << m->get_seq() << " " << m << dendl;
+	append_message(m);
+	m->put();
+
+	lock.Lock();
+	if (state != STATE_OPEN)
+	  break;
+      }
+
+      if (close_on_empty && out_q.empty() && sent.empty()) {
+	ldout(msgr->cct,10) << "writer out and sent queues empty, closing" << dendl;
+	stop();
+      }
+    }
+    lock.Unlock();
+
+    if (!outbl.length())
+      return 0;
+    unsigned before = outbl.length();
+    int r = write_some();
+    if (r < 0)
+      return r;
+    if (outbl.length() || before < EVENTPIPE_WRITE_BATCH)
+      return 0;  // socket is full, or we have nothing more
+  }
+}
+
+/*
+ * write as much of outbl as the socket will take
+ */
+int EventPipe::write_some()
+{
+  char buf[80];
+  while (outbl.length()) {
+    struct iovec msgvec[IOV_MAX];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = msgvec;
+    unsigned len = 0;
+    for (list<bufferptr>::const_iterator p = outbl.buffers().begin();
+	 p != outbl.buffers().end() && msg.msg_iovlen < IOV_MAX;
+	 ++p) {
+      if (!p->length())
+	continue;
+      msgvec[msg.msg_iovlen].iov_base = (void*)p->c_str();
+      msgvec[msg.msg_iovlen].iov_len = p->length();
+      msg.msg_iovlen++;
+      len += p->length();
+    }
+
+    int r = ::sendmsg(sd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (r < 0) {
+      if (errno == EINTR)
+	continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+	return 0;
+      ldout(msgr->cct,1) << "write_some error " << strerror_r(errno, buf, sizeof(buf)) << dendl;
+      return -1;
+    }
+    if (r == 0) {
+      ldout(msgr->cct,10) << "write_some hmm sendmsg got r==0!" << dendl;
+      return 0;
+    }
+    ldout(msgr->cct,30) << "write_some wrote " << r << " of " << len << dendl;
+    outbl.splice(0, r);
+  }
+  return 0;
+}
+
+void EventPipe::append_message(Message *m)
+{
+  ceph_msg_header& header = m->get_header();
+  ceph_msg_footer& footer = m->get_footer();
+
+  // get envelope, buffers
+  header.front_len = m->get_payload().length();
+  header.middle_len = m->get_middle().length();
+  header.data_len = m->get_data().length();
+  footer.flags = CEPH_MSG_FOOTER_COMPLETE;
+  m->calc_header_crc();
+
+  ldout(msgr->cct,20)  << "append_message " << m << dendl;
+
+  // tag
+  char tag = CEPH_MSGR_TAG_MSG;
+  outbl.append(&tag, 1);
+
+  // envelope
+  if (connection_state->has_feature(CEPH_FEATURE_NOSRCADDR)) {
+    outbl.append((char*)&header, sizeof(header));
+  } else {
+    ceph_msg_header_old oldheader;
+    memcpy(&oldheader, &header, sizeof(header));
+    oldheader.src.name = header.src;
+    oldheader.src.addr = connection_state->get_peer_addr();
+    oldheader.orig_src = oldheader.src;
+    oldheader.reserved = header.reserved;
+    oldheader.crc = ceph_crc32c_le(0, (unsigned char*)&oldheader,
+				   sizeof(oldheader) - sizeof(oldheader.crc));
+    outbl.append((char*)&oldheader, sizeof(oldheader));
+  }
+
+  // payload (front+middle+data), by reference
+  outbl.append(m->get_payload());
+  outbl.append(m->get_middle());
+  outbl.append(m->get_data());
+
+  // footer
+  outbl.append((char*)&footer, sizeof(footer));
+}
@@ -0,0 +1,247 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSGR_EVENTPIPE_H
+#define CEPH_MSGR_EVENTPIPE_H
+
+#include "msg_types.h"
+#include "Messenger.h"
+#include "auth/Auth.h"
+
+class EventMessenger;
+class EventWorker;
+
+/**
+ * An EventPipe is the EventMessenger's counterpart of a Pipe: it owns
+ * one socket and carries one logical session over it, speaking exactly
+ * the same wire protocol.  Instead of a reader and a writer thread it
+ * is driven by the EventWorker it is assigned to, which calls run()
+ * whenever the socket becomes readable or writable, a timer fires, or
+ * another thread has queued work for it (wakeup()).  run() never
+ * blocks: it consumes whatever bytes are available, advances the
+ * protocol state machine as far as they allow, and writes as much of
+ * the outgoing queue as the socket will take.
+ *
+ * Everything the worker touches only from its own thread (the socket,
+ * in_state, the partial input and output buffers, handshake scratch
+ * state) is unlocked.  The session state shared with other threads
+ * (state, sequence numbers, out_q, sent, policy) is protected by lock,
+ * exactly as Pipe::pipe_lock protects it.
+ */
+class EventPipe : public RefCountedObject {
+public:
+  EventPipe(EventMessenger *m, EventWorker *w, int st, Connection *con);
+  ~EventPipe();
+
+  EventMessenger *msgr;
+  EventWorker *worker;
+  ostream& _pipe_prefix(std::ostream *_dout);
+
+  enum {
+    STATE_ACCEPTING,
+    STATE_CONNECTING,
+    STATE_OPEN,
+    STATE_STANDBY,
+    STATE_CLOSED,
+    STATE_CLOSING,
+    STATE_WAIT       // just wait for racing connection
+  };
+
+  static const char *get_state_name(int s) {
+    switch (s) {
+    case STATE_ACCEPTING: return "accepting";
+    case STATE_CONNECTING: return "connecting";
+    case STATE_OPEN: return "open";
+    case STATE_STANDBY: return "standby";
+    case STATE_CLOSED: return "closed";
+    case STATE_CLOSING: return "closing";
+    case STATE_WAIT: return "wait";
+    default: return "UNKNOWN";
+    }
+  }
+  const char *get_state_name() {
+    return get_state_name(state);
+  }
+
+  /// what the worker is waiting to read next (worker thread only)
+  enum {
+    IN_NONE,                ///< no socket
+    IN_CONNECTING,          ///< non-blocking connect() in progress
+    IN_CONNECT_BANNER,      ///< banner, peer addr, our addr as seen by peer
+    IN_CONNECT_REPLY,       ///< ceph_msg_connect_reply
+    IN_CONNECT_REPLY_AUTH,  ///< authorizer reply
+    IN_CONNECT_SEQ,         ///< peer's last acked seq (CEPH_MSGR_TAG_SEQ)
+    IN_ACCEPT_BANNER,       ///< banner and peer addr
+    IN_ACCEPT_CONNECT,      ///< ceph_msg_connect
+    IN_ACCEPT_CONNECT_AUTH, ///< authorizer
+    IN_ACCEPT_SEQ,          ///< peer's last acked seq (CEPH_MSGR_TAG_SEQ)
+    IN_TAG,                 ///< session is open: next tag
+    IN_ACK,
+    IN_MSG_HEADER,
+    IN_MSG_THROTTLE,        ///< header read, waiting for throttlers
+    IN_MSG_BODY,            ///< front and middle
+    IN_MSG_DATA,            ///< data, straight into in_data
+    IN_MSG_FOOTER,
+  };
+
+private:
+  int sd;
+  int port;
+  int peer_type;
+  entity_addr_t peer_addr;
+  Messenger::Policy policy;
+
+  Mutex lock;
+  int state;
+
+  /// true once the worker has taken over this pipe (worker thread only)
+  bool adopted;
+  /// true once the worker has queued us for reaping (worker thread only)
+  bool reaped;
+  /// true while queued for a wakeup (protected by worker->lock)
+  bool wake_queued;
+  /// pending timer, if any (worker thread only)
+  utime_t timer_at;
+  /// don't reconnect before this (worker thread only)
+  utime_t retry_at;
+  /// last time we read anything off the socket (worker thread only)
+  utime_t last_rx;
+
+  friend class EventMessenger;
+  friend class EventWorker;
+
+public:
+  Connection *connection_state;
+
+private:
+  utime_t backoff;         // backoff time
+
+  bool keepalive;
+  bool close_on_empty;
+
+  __u32 connect_seq, peer_global_seq;
+  uint64_t out_seq;
+  uint64_t in_seq, in_seq_acked;
+
+  map<int, list<Message*> > out_q;  // priority queue for outbound msgs
+  list<Message*> sent;
+
+  // worker-thread-only I/O state
+  int in_state;
+  bufferlist inbl;     ///< bytes received but not yet consumed
+  bufferptr rx_buf;    ///< buffer we are currently receiving into
+  unsigned rx_off;     ///< fill position in rx_buf
+  bufferlist outbl;    ///< bytes queued for the socket
+
+  // worker-thread-only handshake state
+  entity_addr_t socket_addr;  ///< peer's address, as seen by accept()
+  __u32 cseq, gseq;
+  bool got_bad_auth;
+  AuthAuthorizer *authorizer;
+  ceph_msg_connect connect_msg;
+  ceph_msg_connect_reply connect_reply;
+  bufferlist authorizer_buf;
+
+  // worker-thread-only state of the message being received
+  ceph_msg_header in_header;
+  uint64_t in_msg_size;
+  Throttle *in_throttler;   ///< policy throttler we have taken in_msg_size from
+  bool in_dispatch_throttled;
+  utime_t recv_stamp, throttle_stamp;
+  bufferlist in_front, in_middle;
+  bufferlist in_data;       ///< laid out like the sender's, see RxBufferPool::get_aligned()
+  unsigned in_data_got;     ///< bytes of in_data filled so far
+
+  bool is_queued() { return !out_q.empty() || keepalive; }
+
+  void set_peer_addr(const entity_addr_t& a) {
+    if (&peer_addr != &a)  // shut up valgrind
+      peer_addr = a;
+    connection_state->set_peer_addr(a);
+  }
+  void set_peer_type(int t) {
+    peer_type = t;
+    connection_state->set_peer_type(t);
+  }
+
+  void register_pipe();
+  void unregister_pipe();
+
+  void handle_ack(uint64_t seq);
+  void requeue_sent(uint64_t max_acked=0);
+  void discard_out_queue();
+  void was_session_reset();
+  void fault();
+
+  Message *_get_next_outgoing() {
+    Message *m = 0;
+    while (!m && !out_q.empty()) {
+      map<int, list<Message*> >::reverse_iterator p = out_q.rbegin();
+      if (!p->second.empty()) {
+	m = p->second.front();
+	p->second.pop_front();
+      }
+      if (p->second.empty())
+	out_q.erase(p->first);
+    }
+    return m;
+  }
+
+  // worker thread
+  int start_connect();
+  int start_accept();
+  void close_socket();
+  void release_throttle();
+  int do_read();
+  int do_recv(char *buf, unsigned len);
+  int read_some(unsigned want);
+  int read_data();
+  unsigned in_need();
+  int in_handle();
+  int do_write();
+  int write_some();
+  void append_message(Message *m);
+  void send_connect_msg(bool force_new_auth);
+  int handle_connect_reply(bufferlist& authorizer_reply);
+  void connect_ready();
+  int handle_accept_connect(bufferlist& authorizer);
+  int throttle_message();
+  void start_msg_data();
+  int handle_message(bufferlist& bl);
+
+public:
+  /**
+   * Advance the session as far as the socket allows.  Worker thread
+   * only; called without lock held.
+   *
+   * @return true if the pipe has closed and should be reaped
+   */
+  bool run();
+  /// tear down a closed pipe; worker thread only
+  void reap();
+
+  const entity_addr_t& get_peer_addr() { return peer_addr; }
+  int get_sd() { return sd; }
+
+  /// mark closed and let the worker tear us down. lock must be held.
+  void stop();
+
+  void send(Message *m);
+  void _send_keepalive();
+  void send_keepalive() {
+    lock.Lock();
+    _send_keepalive();
+    lock.Unlock();
+  }
+};
+
+#endif
@@ -70,6 +70,7 @@ using namespace std;
 #include "messages/MOSDScrub.h"
 #include "messages/MOSDRepScrub.h"
 #include "messages/MOSDPGScan.h"
+#include "messages/MOSDPGPush.h"
 #include "messages/MOSDPGBackfill.h"
 
 #include "messages/MRemoveSnaps.h"
@@ -420,6 +421,9 @@ Message *decode_message(CephContext *cct, ceph_msg_header& header, ceph_msg_foot
   case MSG_OSD_PG_BACKFILL:
     m = new MOSDPGBackfill;
     break;
+  case MSG_OSD_PG_PUSH:
+    m = new MOSDPGPush;
+    break;
    // auth
   case CEPH_MSG_AUTH:
     m = new MAuth;
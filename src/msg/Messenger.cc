@@ -3,11 +3,22 @@
 #include "Messenger.h"
 
 #include "SimpleMessenger.h"
+#include "EventMessenger.h"
+
+#include "common/config.h"
+#include "common/debug.h"
+
+#define dout_subsys ceph_subsys_ms
 
 Messenger *Messenger::create(CephContext *cct,
 			     entity_name_t name,
 			     string lname,
 			     uint64_t nonce)
 {
+  const string& type = cct->_conf->ms_type;
+  if (type == "event")
+    return new EventMessenger(cct, name, lname, nonce);
+  if (type != "simple")
+    lderr(cct) << "unrecognized ms_type '" << type << "', using simple" << dendl;
   return new SimpleMessenger(cct, name, lname, nonce);
 }
@@ -266,6 +266,14 @@ public:
    * you destroy the Messenger.
    */
   virtual void set_policy_throttler(int type, Throttle *t) = 0;
+  /**
+   * Set how many bytes of page-aligned buffers this Messenger keeps to
+   * receive large message data into (0 for none).  Overrides
+   * ms_rx_pool_bytes.  Messengers without a pool ignore it.
+   *
+   * @param bytes The pool size.
+   */
+  virtual void set_rx_pool_bytes(uint64_t bytes) {}
   /**
    * Set the default send priority
    *
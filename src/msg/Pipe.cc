@@ -1326,30 +1326,6 @@ void Pipe::unlock_maybe_reap()
   }
 }
 
-static void alloc_aligned_buffer(bufferlist& data, unsigned len, unsigned off)
-{
-  // create a buffer to read into that matches the data alignment
-  unsigned left = len;
-  unsigned head = 0;
-  if (off & ~CEPH_PAGE_MASK) {
-    // head
-    head = MIN(CEPH_PAGE_SIZE - (off & ~CEPH_PAGE_MASK), left);
-    bufferptr bp = buffer::create(head);
-    data.push_back(bp);
-    left -= head;
-  }
-  unsigned middle = left & CEPH_PAGE_MASK;
-  if (middle > 0) {
-    bufferptr bp = buffer::create_page_aligned(middle);
-    data.push_back(bp);
-    left -= middle;
-  }
-  if (left) {
-    bufferptr bp = buffer::create(left);
-    data.push_back(bp);
-  }
-}
-
 int Pipe::read_message(Message **pm)
 {
   int ret = -1;
@@ -1474,7 +1450,7 @@ int Pipe::read_message(Message **pm)
       } else {
 	if (!newbuf.length()) {
 	  ldout(msgr->cct,20) << "reader allocating new rx buffer at offset " << offset << dendl;
-	  alloc_aligned_buffer(newbuf, data_len, data_off);
+	  msgr->rx_pool.get_aligned(newbuf, data_len, data_off);
 	  blp = newbuf.begin();
 	  blp.advance(offset);
 	}
@@ -0,0 +1,131 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "RxBufferPool.h"
+#include "include/page.h"
+#include "common/config.h"
+#include "common/debug.h"
+
+#define dout_subsys ceph_subsys_ms
+#undef dout_prefix
+#define dout_prefix *_dout << "rx_pool "
+
+RxBufferPool::RxBufferPool(CephContext *cct_)
+  : cct(cct_),
+    lock("RxBufferPool::lock"),
+    max_bytes(cct->_conf->ms_rx_pool_bytes),
+    min_len(cct->_conf->ms_rx_pool_min_len),
+    bytes(0), hits(0), misses(0)
+{
+}
+
+RxBufferPool::~RxBufferPool()
+{
+  // buffers still in use stay alive through their other references
+  pool.clear();
+}
+
+bufferptr RxBufferPool::get(unsigned len)
+{
+  if (!max_bytes || len < min_len)
+    return buffer::create_page_aligned(len);
+
+  unsigned rounded = (len + ~CEPH_PAGE_MASK) & CEPH_PAGE_MASK;
+
+  Mutex::Locker l(lock);
+  std::list<bufferptr>& ls = pool[rounded];
+  unsigned scanned = 0;
+  for (std::list<bufferptr>::iterator p = ls.begin();
+       p != ls.end() && scanned < MAX_SCAN;
+       ++p, ++scanned) {
+    if (is_idle(*p)) {
+      // move to the back so that the next scan starts with the buffers
+      // that have been busy the longest
+      ls.splice(ls.end(), ls, p);
+      hits++;
+      ldout(cct, 20) << "get " << len << " reusing " << (void*)p->c_str() << dendl;
+      return bufferptr(*p, 0, len);
+    }
+  }
+
+  misses++;
+  bufferptr bp = buffer::create_page_aligned(rounded);
+  if (bytes + rounded > max_bytes)
+    trim(rounded > max_bytes ? 0 : max_bytes - rounded);  // may invalidate ls
+  if (bytes + rounded <= max_bytes) {
+    pool[rounded].push_back(bp);
+    bytes += rounded;
+    ldout(cct, 20) << "get " << len << " new " << (void*)bp.c_str()
+		   << ", pool now " << bytes << " bytes" << dendl;
+  } else {
+    ldout(cct, 20) << "get " << len << " unpooled, pool full at " << bytes << " bytes" << dendl;
+  }
+  return bufferptr(bp, 0, len);
+}
+
+void RxBufferPool::get_aligned(bufferlist& data, unsigned len, unsigned off)
+{
+  unsigned left = len;
+  unsigned head = 0;
+  if (off & ~CEPH_PAGE_MASK) {
+    // head
+    head = MIN(CEPH_PAGE_SIZE - (off & ~CEPH_PAGE_MASK), left);
+    data.push_back(buffer::create(head));
+    left -= head;
+  }
+  unsigned middle = left & CEPH_PAGE_MASK;
+  if (middle > 0) {
+    data.push_back(get(middle));
+    left -= middle;
+  }
+  if (left)
+    data.push_back(buffer::create(left));
+}
+
+/*
+ * drop idle buffers until we are at or below want bytes
+ */
+void RxBufferPool::trim(uint64_t want)
+{
+  assert(lock.is_locked());
+  std::map<unsigned, std::list<bufferptr> >::iterator p = pool.begin();
+  while (p != pool.end() && bytes > want) {
+    std::list<bufferptr>::iterator q = p->second.begin();
+    while (q != p->second.end() && bytes > want) {
+      if (is_idle(*q)) {
+	bytes -= p->first;
+	p->second.erase(q++);
+      } else {
+	++q;
+      }
+    }
+    if (p->second.empty())
+      pool.erase(p++);
+    else
+      ++p;
+  }
+  ldout(cct, 10) << "trim to " << want << ", pool now " << bytes << " bytes" << dendl;
+}
+
+void RxBufferPool::clear()
+{
+  Mutex::Locker l(lock);
+  trim(0);
+}
+
+void RxBufferPool::set_max_bytes(uint64_t max)
+{
+  Mutex::Locker l(lock);
+  max_bytes = max;
+  if (bytes > max_bytes)
+    trim(max_bytes);
+}
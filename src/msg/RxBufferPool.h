@@ -0,0 +1,98 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSG_RXBUFFERPOOL_H
+#define CEPH_MSG_RXBUFFERPOOL_H
+
+#include <map>
+#include <list>
+
+#include "include/buffer.h"
+#include "common/Mutex.h"
+
+class CephContext;
+
+/**
+ * A pool of page-aligned buffers that the messenger receives large
+ * message payloads into.
+ *
+ * The pool keeps its own reference to every buffer it hands out.  A
+ * buffer is free again once that is the only reference left, i.e. once
+ * the message, and whatever the OSD passed its data on to (transaction,
+ * journal), have all let go of it.  Nothing needs to be returned
+ * explicitly.
+ *
+ * Buffers are kept by page-rounded length, up to ms_rx_pool_bytes (or
+ * whatever set_max_bytes() says) in total; payloads smaller than
+ * ms_rx_pool_min_len are not pooled.
+ */
+class RxBufferPool {
+  CephContext *cct;
+  Mutex lock;
+  uint64_t max_bytes;
+  unsigned min_len;
+
+  uint64_t bytes;                          ///< total length of pooled buffers
+  std::map<unsigned, std::list<bufferptr> > pool;  ///< by rounded length
+  uint64_t hits, misses;
+
+  /// only look at this many buffers of a size before allocating another
+  static const unsigned MAX_SCAN = 32;
+
+  bool is_idle(const bufferptr& bp) const {
+    return bp.raw_nref() == 1;
+  }
+  void trim(uint64_t want);
+
+public:
+  explicit RxBufferPool(CephContext *cct);
+  ~RxBufferPool();
+
+  /**
+   * get a page-aligned buffer of (at least) len bytes
+   *
+   * @param len length
+   * @return a page-aligned buffer of exactly len bytes
+   */
+  bufferptr get(unsigned len);
+
+  /**
+   * fill data with buffers to receive a message's data payload into
+   *
+   * The payload is laid out to match its alignment on the sender
+   * (header.data_off), so that the page-aligned middle, which comes
+   * from the pool, can go all the way to an O_DIRECT journal write
+   * without being copied again.
+   */
+  void get_aligned(bufferlist& data, unsigned len, unsigned off);
+
+  /// drop all idle buffers
+  void clear();
+
+  /// keep at most max buffer bytes from now on; 0 disables the pool
+  void set_max_bytes(uint64_t max);
+
+  uint64_t get_bytes() {
+    Mutex::Locker l(lock);
+    return bytes;
+  }
+  uint64_t get_hits() {
+    Mutex::Locker l(lock);
+    return hits;
+  }
+  uint64_t get_misses() {
+    Mutex::Locker l(lock);
+    return misses;
+  }
+};
+
+#endif
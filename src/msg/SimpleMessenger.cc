@@ -48,6 +48,7 @@ SimpleMessenger::SimpleMessenger(CephContext *cct, entity_name_t name,
     cluster_protocol(0),
     policy_lock("SimpleMessenger::policy_lock"),
     dispatch_throttler(cct, string("msgr_dispatch_throttler-") + mname, cct->_conf->ms_dispatch_throttle_bytes),
+    rx_pool(cct),
     reaper_started(false), reaper_stop(false),
     timeout(0),
     local_connection(new Connection)
@@ -35,6 +35,7 @@ using namespace __gnu_cxx;
 #include "Message.h"
 #include "include/assert.h"
 #include "DispatchQueue.h"
+#include "RxBufferPool.h"
 
 #include "Pipe.h"
 #include "Accepter.h"
@@ -169,6 +170,9 @@ public:
     else
       default_policy.throttler = t;
   }
+  void set_rx_pool_bytes(uint64_t bytes) {
+    rx_pool.set_max_bytes(bytes);
+  }
   /**
    * Bind the SimpleMessenger to a specific address. If bind_addr
    * is not completely filled in the system will use the
@@ -515,6 +519,9 @@ private:
   /// Throttle preventing us from building up a big backlog waiting for dispatch
   Throttle dispatch_throttler;
 
+  /// page-aligned buffers that Pipes read large message data into
+  RxBufferPool rx_pool;
+
   bool reaper_started, reaper_stop;
   Cond reaper_cond;
 
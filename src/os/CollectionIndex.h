@@ -166,6 +166,18 @@ protected:
     vector<hobject_t> *ls ///< [out] Listed Objects
     ) = 0;
 
+  /**
+   * Lay out an empty collection for the number of objects expected
+   *
+   * Indexes that split directories as they fill can do the splitting
+   * up front instead.  Does nothing by default.
+   *
+   * @return Error Code, 0 for success
+   */
+  virtual int pre_split(
+    uint64_t expected_num_objs ///< [in] Objects expected in the collection
+    ) { return 0; }
+
   /// Virtual destructor
   virtual ~CollectionIndex() {}
 };
@@ -499,34 +499,74 @@ int DBObjectMap::DBObjectMapIteratorImpl::status()
   return r;
 }
 
+ObjectMap::Batch DBObjectMap::get_batch()
+{
+  return DBBatchRef(new DBBatch(db->get_transaction()));
+}
+
+int DBObjectMap::submit_batch(Batch batch)
+{
+  return _submit(std::tr1::static_pointer_cast<DBBatch>(batch));
+}
+
+int DBObjectMap::_submit(DBBatchRef b, bool sync)
+{
+  int r;
+  if (sync)
+    r = db->submit_transaction_sync(b->t);
+  else
+    r = db->submit_transaction(b->t);
+  if (r < 0)
+    return r;
+
+  if (b->headers.size() || b->removed.size()) {
+    Mutex::Locker l(cache_lock);
+    for (map<hobject_t, _Header>::iterator i = b->headers.begin();
+	 i != b->headers.end();
+	 ++i)
+      header_cache.add(i->first, i->second);
+    for (set<hobject_t>::iterator i = b->removed.begin();
+	 i != b->removed.end();
+	 ++i)
+      header_cache.clear(*i);
+    cache_gen++;
+  }
+  b->t = db->get_transaction();
+  b->headers.clear();
+  b->removed.clear();
+  return 0;
+}
+
 int DBObjectMap::set_keys(const hobject_t &hoid,
 			  const map<string, bufferlist> &set,
-			  const SequencerPosition *spos)
+			  const SequencerPosition *spos,
+			  Batch batch)
 {
-  KeyValueDB::Transaction t = db->get_transaction();
-  Header header = lookup_create_map_header(hoid, t);
+  DBBatchRef b = _get_batch(batch);
+  Header header = lookup_create_map_header(hoid, b);
   if (!header)
     return -EINVAL;
   if (check_spos(hoid, header, spos))
     return 0;
 
-  t->set(user_prefix(header), set);
+  b->t->set(user_prefix(header), set);
 
-  return db->submit_transaction(t);
+  return _finish(b, batch);
 }
 
 int DBObjectMap::set_header(const hobject_t &hoid,
 			    const bufferlist &bl,
-			    const SequencerPosition *spos)
+			    const SequencerPosition *spos,
+			    Batch batch)
 {
-  KeyValueDB::Transaction t = db->get_transaction();
-  Header header = lookup_create_map_header(hoid, t);
+  DBBatchRef b = _get_batch(batch);
+  Header header = lookup_create_map_header(hoid, b);
   if (!header)
     return -EINVAL;
   if (check_spos(hoid, header, spos))
     return 0;
-  _set_header(header, bl, t);
-  return db->submit_transaction(t);
+  _set_header(header, bl, b->t);
+  return _finish(b, batch);
 }
 
 void DBObjectMap::_set_header(Header header, const bufferlist &bl,
@@ -575,19 +615,19 @@ int DBObjectMap::_get_header(Header header,
 int DBObjectMap::clear(const hobject_t &hoid,
 		       const SequencerPosition *spos)
 {
-  KeyValueDB::Transaction t = db->get_transaction();
+  DBBatchRef b = _get_batch(Batch());
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
   if (check_spos(hoid, header, spos))
     return 0;
-  remove_map_header(hoid, header, t);
+  remove_map_header(hoid, header, b);
   assert(header->num_children > 0);
   header->num_children--;
-  int r = _clear(header, t);
+  int r = _clear(header, b->t);
   if (r < 0)
     return r;
-  return db->submit_transaction(t);
+  return _submit(b);
 }
 
 int DBObjectMap::_clear(Header header,
@@ -695,19 +735,30 @@ int DBObjectMap::need_parent(DBObjectMapIterator iter)
 
 int DBObjectMap::rm_keys(const hobject_t &hoid,
 			 const set<string> &to_clear,
-			 const SequencerPosition *spos)
+			 const SequencerPosition *spos,
+			 Batch batch)
 {
-  Header header = lookup_map_header(hoid);
+  DBBatchRef b = _get_batch(batch);
+  Header header = lookup_map_header(hoid, b.get());
   if (!header)
     return -ENOENT;
-  KeyValueDB::Transaction t = db->get_transaction();
   if (check_spos(hoid, header, spos))
     return 0;
-  t->rmkeys(user_prefix(header), to_clear);
   if (!header->parent) {
-    return db->submit_transaction(t);
+    b->t->rmkeys(user_prefix(header), to_clear);
+    return _finish(b, batch);
   }
 
+  // We read back the keys below, so anything pending must go first
+  if (batch) {
+    int r = _submit(b);
+    if (r < 0)
+      return r;
+    b = _get_batch(Batch());
+  }
+  KeyValueDB::Transaction t = b->t;
+  t->rmkeys(user_prefix(header), to_clear);
+
   // Copy up keys from parent around to_clear
   int keep_parent;
   {
@@ -762,10 +813,10 @@ int DBObjectMap::rm_keys(const hobject_t &hoid,
     parent->num_children--;
     _clear(parent, t);
     header->parent = 0;
-    set_map_header(hoid, *header, t);
+    set_map_header(hoid, *header, b);
     t->rmkeys_by_prefix(complete_prefix(header));
   }
-  return db->submit_transaction(t);
+  return _submit(b);
 }
 
 int DBObjectMap::get(const hobject_t &hoid,
@@ -870,14 +921,14 @@ int DBObjectMap::set_xattrs(const hobject_t &hoid,
 			    const map<string, bufferlist> &to_set,
 			    const SequencerPosition *spos)
 {
-  KeyValueDB::Transaction t = db->get_transaction();
-  Header header = lookup_create_map_header(hoid, t);
+  DBBatchRef b = _get_batch(Batch());
+  Header header = lookup_create_map_header(hoid, b);
   if (!header)
     return -EINVAL;
   if (check_spos(hoid, header, spos))
     return 0;
-  t->set(xattr_prefix(header), to_set);
-  return db->submit_transaction(t);
+  b->t->set(xattr_prefix(header), to_set);
+  return _submit(b);
 }
 
 int DBObjectMap::remove_xattrs(const hobject_t &hoid,
@@ -901,11 +952,12 @@ int DBObjectMap::clone(const hobject_t &hoid,
   if (hoid == target)
     return 0;
 
-  KeyValueDB::Transaction t = db->get_transaction();
+  DBBatchRef b = _get_batch(Batch());
+  KeyValueDB::Transaction t = b->t;
   {
     Header destination = lookup_map_header(target);
     if (destination) {
-      remove_map_header(target, destination, t);
+      remove_map_header(target, destination, b);
       if (check_spos(target, destination, spos))
 	return 0;
       destination->num_children--;
@@ -915,7 +967,7 @@ int DBObjectMap::clone(const hobject_t &hoid,
 
   Header parent = lookup_map_header(hoid);
   if (!parent)
-    return db->submit_transaction(t);
+    return _submit(b);
 
   Header source = generate_new_header(hoid, parent);
   Header destination = generate_new_header(target, parent);
@@ -924,8 +976,8 @@ int DBObjectMap::clone(const hobject_t &hoid,
 
   parent->num_children = 2;
   set_header(parent, t);
-  set_map_header(hoid, *source, t);
-  set_map_header(target, *destination, t);
+  set_map_header(hoid, *source, b);
+  set_map_header(target, *destination, b);
 
   map<string, bufferlist> to_set;
   KeyValueDB::Iterator xattr_iter = db->get_iterator(xattr_prefix(parent));
@@ -936,7 +988,7 @@ int DBObjectMap::clone(const hobject_t &hoid,
   t->set(xattr_prefix(source), to_set);
   t->set(xattr_prefix(destination), to_set);
   t->rmkeys_by_prefix(xattr_prefix(parent));
-  return db->submit_transaction(t);
+  return _submit(b);
 }
 
 int DBObjectMap::upgrade()
@@ -1046,8 +1098,8 @@ int DBObjectMap::init(bool do_upgrade)
 
 int DBObjectMap::sync(const hobject_t *hoid,
 		      const SequencerPosition *spos) {
-  KeyValueDB::Transaction t = db->get_transaction();
-  write_state(t);
+  DBBatchRef b = _get_batch(Batch());
+  write_state(b->t);
   if (hoid) {
     assert(spos);
     Header header = lookup_map_header(*hoid);
@@ -1055,10 +1107,10 @@ int DBObjectMap::sync(const hobject_t *hoid,
       dout(10) << "hoid: " << *hoid << " setting spos to "
 	       << *spos << dendl;
       header->spos = *spos;
-      set_map_header(*hoid, *header, t);
+      set_map_header(*hoid, *header, b);
     }
   }
-  return db->submit_transaction_sync(t);
+  return _submit(b, true);
 }
 
 int DBObjectMap::write_state(KeyValueDB::Transaction _t) {
@@ -1073,11 +1125,30 @@ int DBObjectMap::write_state(KeyValueDB::Transaction _t) {
 }
 
 
-DBObjectMap::Header DBObjectMap::_lookup_map_header(const hobject_t &hoid)
+DBObjectMap::Header DBObjectMap::_lookup_map_header(const hobject_t &hoid,
+						    DBBatch *b)
 {
   while (map_header_in_use.count(hoid))
     header_cond.Wait(header_lock);
 
+  if (b) {
+    if (b->removed.count(hoid))
+      return Header();
+    map<hobject_t, _Header>::iterator p = b->headers.find(hoid);
+    if (p != b->headers.end())
+      return Header(new _Header(p->second),
+		    RemoveMapHeaderOnDelete(this, hoid));
+  }
+
+  uint64_t ticket;
+  {
+    Mutex::Locker l(cache_lock);
+    _Header cached;
+    if (header_cache.lookup(hoid, &cached))
+      return Header(new _Header(cached), RemoveMapHeaderOnDelete(this, hoid));
+    ticket = cache_gen;
+  }
+
   map<string, bufferlist> out;
   set<string> to_get;
   to_get.insert(map_header_key(hoid));
@@ -1090,6 +1161,10 @@ DBObjectMap::Header DBObjectMap::_lookup_map_header(const hobject_t &hoid)
   Header ret(new _Header(), RemoveMapHeaderOnDelete(this, hoid));
   bufferlist::iterator iter = out.begin()->second.begin();
   ret->decode(iter);
+
+  Mutex::Locker l(cache_lock);
+  if (ticket == cache_gen)
+    header_cache.add(hoid, *ret);
   return ret;
 }
 
@@ -1144,13 +1219,13 @@ DBObjectMap::Header DBObjectMap::lookup_parent(Header input)
 
 DBObjectMap::Header DBObjectMap::lookup_create_map_header(
   const hobject_t &hoid,
-  KeyValueDB::Transaction t)
+  DBBatchRef b)
 {
   Mutex::Locker l(header_lock);
-  Header header = _lookup_map_header(hoid);
+  Header header = _lookup_map_header(hoid, b.get());
   if (!header) {
     header = _generate_new_header(hoid, Header());
-    set_map_header(hoid, *header, t);
+    set_map_header(hoid, *header, b);
   }
   return header;
 }
@@ -1177,24 +1252,28 @@ void DBObjectMap::set_header(Header header, KeyValueDB::Transaction t)
 
 void DBObjectMap::remove_map_header(const hobject_t &hoid,
 				    Header header,
-				    KeyValueDB::Transaction t)
+				    DBBatchRef b)
 {
   dout(20) << "remove_map_header: removing " << header->seq
 	   << " hoid " << hoid << dendl;
   set<string> to_remove;
   to_remove.insert(map_header_key(hoid));
-  t->rmkeys(HOBJECT_TO_SEQ, to_remove);
+  b->t->rmkeys(HOBJECT_TO_SEQ, to_remove);
+  b->headers.erase(hoid);
+  b->removed.insert(hoid);
 }
 
 void DBObjectMap::set_map_header(const hobject_t &hoid, _Header header,
-				 KeyValueDB::Transaction t)
+				 DBBatchRef b)
 {
   dout(20) << "set_map_header: setting " << header.seq
 	   << " hoid " << hoid << " parent seq "
 	   << header.parent << dendl;
   map<string, bufferlist> to_set;
   header.encode(to_set[map_header_key(hoid)]);
-  t->set(HOBJECT_TO_SEQ, to_set);
+  b->t->set(HOBJECT_TO_SEQ, to_set);
+  b->removed.erase(hoid);
+  b->headers[hoid] = header;
 }
 
 bool DBObjectMap::check_spos(const hobject_t &hoid,
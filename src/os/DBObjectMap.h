@@ -17,6 +17,7 @@
 #include "osd/osd_types.h"
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/simple_cache.hpp"
 
 /**
  * DBObjectMap: Implements ObjectMap in terms of KeyValueDB
@@ -51,6 +52,10 @@
  * the complete set, we have to check the parent if we don't find it in the
  * key set.  During rm_keys, we copy keys from the parent and update the
  * complete set to reflect the change @see rm_keys.
+ *
+ * Leaf headers (HOBJECT_TO_SEQ) are cached.  Writes may be collected in
+ * an ObjectMap::Batch; set_keys, set_header and rm_keys on an object with
+ * no parent only add to it, while the other mutators submit it first.
  */
 class DBObjectMap : public ObjectMap {
 public:
@@ -69,20 +74,29 @@ public:
   set<uint64_t> in_use;
   set<hobject_t> map_header_in_use;
 
-  DBObjectMap(KeyValueDB *db) : db(db),
-				header_lock("DBOBjectMap")
+  DBObjectMap(KeyValueDB *db, size_t header_cache_size = 128) :
+    db(db),
+    header_lock("DBOBjectMap"),
+    cache_lock("DBObjectMap::cache_lock"),
+    cache_gen(0),
+    header_cache(header_cache_size)
     {}
 
+  Batch get_batch();
+  int submit_batch(Batch batch);
+
   int set_keys(
     const hobject_t &hoid,
     const map<string, bufferlist> &set,
-    const SequencerPosition *spos=0
+    const SequencerPosition *spos=0,
+    Batch batch=Batch()
     );
 
   int set_header(
     const hobject_t &hoid,
     const bufferlist &bl,
-    const SequencerPosition *spos=0
+    const SequencerPosition *spos=0,
+    Batch batch=Batch()
     );
 
   int get_header(
@@ -98,7 +112,8 @@ public:
   int rm_keys(
     const hobject_t &hoid,
     const set<string> &to_clear,
-    const SequencerPosition *spos=0
+    const SequencerPosition *spos=0,
+    Batch batch=Batch()
     );
 
   int get(
@@ -265,6 +280,16 @@ public:
     _Header() : seq(0), parent(0), num_children(1) {}
   };
 
+  /**
+   * Leaf headers recently read or written, keyed by object.  Only
+   * headers that are on disk are cached; cache_gen is bumped on every
+   * update so that a lookup that raced with one doesn't cache a stale
+   * header.
+   */
+  Mutex cache_lock;
+  uint64_t cache_gen;
+  SimpleLRU<hobject_t, _Header> header_cache;
+
   /// String munging (public for testing)
   static string hobject_key(const hobject_t &hoid);
   static string hobject_key_v0(coll_t c, const hobject_t &hoid);
@@ -274,6 +299,33 @@ private:
   /// Implicit lock on Header->seq
   typedef std::tr1::shared_ptr<_Header> Header;
 
+  /// Writes not yet submitted, and the leaf headers they change
+  class DBBatch : public BatchImpl {
+  public:
+    KeyValueDB::Transaction t;
+    map<hobject_t, _Header> headers;  ///< leaf headers set in t
+    set<hobject_t> removed;           ///< leaf headers removed in t
+    DBBatch(KeyValueDB::Transaction t) : t(t) {}
+  };
+  typedef std::tr1::shared_ptr<DBBatch> DBBatchRef;
+
+  /// The caller's batch, or a new one for a single op
+  DBBatchRef _get_batch(Batch batch) {
+    if (batch)
+      return std::tr1::static_pointer_cast<DBBatch>(batch);
+    return DBBatchRef(new DBBatch(db->get_transaction()));
+  }
+
+  /// Submit b, unless it belongs to the caller
+  int _finish(DBBatchRef b, Batch batch) {
+    if (batch)
+      return 0;
+    return _submit(b);
+  }
+
+  /// Submit b, update the header cache, and leave b empty
+  int _submit(DBBatchRef b, bool sync = false);
+
   string map_header_key(const hobject_t &hoid);
   string header_key(uint64_t seq);
   string complete_prefix(Header header);
@@ -368,11 +420,11 @@ private:
   /// Remove leaf node corresponding to hoid in c
   void remove_map_header(const hobject_t &hoid,
 			 Header header,
-			 KeyValueDB::Transaction t);
+			 DBBatchRef b);
 
   /// Set leaf node for c and hoid to the value of header
   void set_map_header(const hobject_t &hoid, _Header header,
-		      KeyValueDB::Transaction t);
+		      DBBatchRef b);
 
   /// Set leaf node for c and hoid to the value of header
   bool check_spos(const hobject_t &hoid,
@@ -381,7 +433,7 @@ private:
 
   /// Lookup or create header for c hoid
   Header lookup_create_map_header(const hobject_t &hoid,
-				  KeyValueDB::Transaction t);
+				  DBBatchRef b);
 
   /**
    * Generate new header for c hoid with new seq number
@@ -394,11 +446,11 @@ private:
     return _generate_new_header(hoid, parent);
   }
 
-  /// Lookup leaf header for c hoid
-  Header _lookup_map_header(const hobject_t &hoid);
-  Header lookup_map_header(const hobject_t &hoid) {
+  /// Lookup leaf header for c hoid, as changed by b if given
+  Header _lookup_map_header(const hobject_t &hoid, DBBatch *b = 0);
+  Header lookup_map_header(const hobject_t &hoid, DBBatch *b = 0) {
     Mutex::Locker l(header_lock);
-    return _lookup_map_header(hoid);
+    return _lookup_map_header(hoid, b);
   }
 
   /// Lookup header node for input
@@ -0,0 +1,147 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_FDCACHE_H
+#define CEPH_FDCACHE_H
+
+#include <tr1/memory>
+#include <errno.h>
+#include <unistd.h>
+#include "common/Mutex.h"
+#include "common/shared_cache.hpp"
+#include "common/simple_spin.h"
+#include "include/compat.h"
+#include "include/assert.h"
+#include "os/hobject.h"
+#include "osd/osd_types.h"
+
+/**
+ * FDCache
+ *
+ * Cache of open object fds, keyed by (collection, object), so that hot
+ * objects don't pay for an index lookup and an open()/close() on every
+ * operation.  Split into shards (by object hash) so that lookups from
+ * many threads don't all serialize on one lock.
+ *
+ * An fd stays open as long as either the cache or some caller holds a
+ * ref to it.  Anything that makes a (collection, object) name refer to
+ * a different file (unlink, collection rename) must clear() it after
+ * the change.  An open that misses takes a ticket before looking the
+ * name up, so that it doesn't cache an fd for a file removed meanwhile.
+ */
+class FDCache {
+public:
+  /**
+   * FD
+   *
+   * Wrapper for an fd.  Destructor closes the fd.
+   *
+   * Also carries the object's read-ahead state, which so lives as long
+   * as the fd stays cached.
+   */
+  class FD {
+  public:
+    const int fd;
+
+    /// sequential read detection; see FileStore::_readahead()
+    struct ReadAhead {
+      simple_spinlock_t lock;
+      uint64_t next;        ///< where a sequential read would start
+      unsigned seq;         ///< sequential reads in a row
+      uint64_t start, end;  ///< range advised WILLNEED so far
+      ReadAhead() : lock(SIMPLE_SPINLOCK_INITIALIZER), next(0), seq(0),
+		    start(0), end(0) {}
+    } ra;
+
+    FD(int _fd) : fd(_fd) {
+      assert(_fd >= 0);
+    }
+    int operator*() const {
+      return fd;
+    }
+    ~FD() {
+      TEMP_FAILURE_RETRY(::close(fd));
+    }
+  };
+  typedef std::tr1::shared_ptr<FD> FDRef;
+  typedef pair<coll_t, hobject_t> key_t;
+
+private:
+  struct Shard {
+    Mutex lock;     ///< orders add() against clear()
+    uint64_t gen;   ///< bumped by every clear
+    SharedLRU<key_t, FD> lru;
+    Shard() : lock("FDCache::Shard::lock"), gen(0) {}
+  };
+  const int num_shards;
+  Shard *shards;
+
+  Shard& get_shard(const hobject_t& oid) {
+    return shards[oid.hash % num_shards];
+  }
+
+public:
+  FDCache(size_t size, int nshards)
+    : num_shards(nshards > 0 ? nshards : 1),
+      shards(new Shard[num_shards]) {
+    set_size(size);
+  }
+  ~FDCache() {
+    delete[] shards;
+  }
+
+  void set_size(size_t size) {
+    size_t per_shard = (size + num_shards - 1) / num_shards;
+    for (int i = 0; i < num_shards; ++i)
+      shards[i].lru.set_size(per_shard);
+  }
+
+  FDRef lookup(coll_t cid, const hobject_t& oid) {
+    return get_shard(oid).lru.lookup(make_pair(cid, oid));
+  }
+
+  /// take before looking oid up on a miss
+  uint64_t get_ticket(const hobject_t& oid) {
+    Shard &s = get_shard(oid);
+    Mutex::Locker l(s.lock);
+    return s.gen;
+  }
+
+  /// take ownership of fd; cache it unless the shard was cleared since ticket
+  FDRef add(coll_t cid, const hobject_t& oid, int fd, uint64_t ticket) {
+    Shard &s = get_shard(oid);
+    Mutex::Locker l(s.lock);
+    if (s.gen != ticket)
+      return FDRef(new FD(fd));
+    return s.lru.add(make_pair(cid, oid), new FD(fd));
+  }
+
+  /// forget oid; holders of an existing ref keep a usable fd
+  void clear(coll_t cid, const hobject_t& oid) {
+    Shard &s = get_shard(oid);
+    Mutex::Locker l(s.lock);
+    s.gen++;
+    s.lru.clear(make_pair(cid, oid));
+  }
+
+  /// forget everything
+  void clear() {
+    for (int i = 0; i < num_shards; ++i) {
+      Mutex::Locker l(shards[i].lock);
+      shards[i].gen++;
+      shards[i].lru.clear();
+    }
+  }
+};
+typedef FDCache::FDRef FDRef;
+
+#endif
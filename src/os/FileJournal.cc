@@ -96,7 +96,7 @@ int FileJournal::_open(bool forwrite, bool create)
 
 #ifdef HAVE_LIBAIO
   aio_ctx = 0;
-  ret = io_setup(128, &aio_ctx);
+  ret = io_setup(AIO_MAX_EVENTS, &aio_ctx);
   if (ret < 0) {
     ret = errno;
     derr << "FileJournal::_open: unable to setup io_context " << cpp_strerror(ret) << dendl;
@@ -1111,24 +1111,22 @@ void FileJournal::write_thread_entry()
 	dout(20) << "write_thread_entry woke up" << dendl;
 	continue;
       }
+      wait_for_batch();
     }
     
 #ifdef HAVE_LIBAIO
     if (aio) {
       Mutex::Locker locker(aio_lock);
-      // should we back off to limit aios in flight?  try to do this
-      // adaptively so that we submit larger aios once we have lots of
-      // them in flight.
-      int exp = MIN(aio_num * 2, 24);
-      long unsigned min_new = 1ull << exp;
-      long unsigned cur = throttle_bytes.get_current();
-      dout(20) << "write_thread_entry aio throttle: aio num " << aio_num << " bytes " << aio_bytes
-	      << " ... exp " << exp << " min_new " << min_new
-	       << " ... pending " << cur << dendl;
-      if (cur < min_new) {
-	dout(20) << "write_thread_entry deferring until more aios complete: "
-		 << aio_num << " aios with " << aio_bytes << " bytes needs " << min_new
-		 << " bytes to start a new aio (currently " << cur << " pending)" << dendl;
+      // keep up to journal_aio_max_inflight writes in flight.  each one
+      // covers its own region of the journal, and check_aio_completion()
+      // still advances journaled_seq strictly in order.  a write may be
+      // split into up to three aios (header, and both sides of a wrap).
+      int max_num = MIN(g_conf->journal_aio_max_inflight, AIO_MAX_EVENTS - 2);
+      int max_bytes = g_conf->journal_aio_max_inflight_bytes;
+      if (aio_num >= MAX(max_num, 1) ||
+	  (max_bytes && aio_num && aio_bytes >= max_bytes)) {
+	dout(20) << "write_thread_entry " << aio_num << " aios with " << aio_bytes
+		 << " bytes in flight, waiting for completions" << dendl;
 	aio_cond.Wait(aio_lock);
 	dout(20) << "write_thread_entry woke up" << dendl;
 	continue;
@@ -1150,8 +1148,11 @@ void FileJournal::write_thread_entry()
     }
     assert(r == 0);
 
-    logger->inc(l_os_j_wr);
-    logger->inc(l_os_j_wr_bytes, bl.length());
+    if (logger) {
+      logger->inc(l_os_j_wr);
+      logger->inc(l_os_j_wr_bytes, bl.length());
+      logger->hinc(l_os_j_batch_hist, bl.length(), orig_ops);
+    }
 
 #ifdef HAVE_LIBAIO
     if (aio)
@@ -1167,6 +1168,53 @@ void FileJournal::write_thread_entry()
   dout(10) << "write_thread_entry finish" << dendl;
 }
 
+/*
+ * Group commit.  Under moderate load the write thread tends to find
+ * only one or two entries queued, and issues a small write for each.
+ * If entries are arriving faster than the batch window, hold the
+ * write back for up to that long (or until journal_batch_min_bytes
+ * are queued) so that they go out as one larger write.  The window
+ * shrinks when waiting gains us nothing and grows back when it does;
+ * at low load we never wait at all.
+ */
+void FileJournal::wait_for_batch()
+{
+  assert(queue_lock.is_locked());
+  double max_window = (double)g_conf->journal_batch_window_us / 1000000.0;
+  if (max_window <= 0)
+    return;
+  if (batch_window <= 0 || batch_window > max_window)
+    batch_window = max_window;
+
+  int64_t min_bytes = g_conf->journal_batch_min_bytes;
+  unsigned max_ents = g_conf->journal_max_write_entries;
+  if (submit_interval > batch_window ||
+      throttle_bytes.get_current() >= min_bytes ||
+      (max_ents && writeq.size() >= max_ents))
+    return;
+
+  size_t before = writeq.size();
+  utime_t start = ceph_clock_now(g_ceph_context);
+  utime_t until = start;
+  until += batch_window;
+  dout(20) << "wait_for_batch " << before << " queued, waiting up to " << batch_window
+	   << " (submit interval " << submit_interval << ")" << dendl;
+  if (logger)
+    logger->inc(l_os_j_batch_wait);
+  while (!write_stop &&
+	 throttle_bytes.get_current() < min_bytes &&
+	 (!max_ents || writeq.size() < max_ents) &&
+	 ceph_clock_now(g_ceph_context) < until)
+    queue_cond.WaitUntil(queue_lock, until);
+
+  if (writeq.size() == before)
+    batch_window = MAX(batch_window / 2, max_window / 16);
+  else
+    batch_window = MIN(batch_window * 2, max_window);
+  dout(20) << "wait_for_batch " << writeq.size() << " queued after "
+	   << (ceph_clock_now(g_ceph_context) - start) << ", window now " << batch_window << dendl;
+}
+
 #ifdef HAVE_LIBAIO
 void FileJournal::do_aio_write(bufferlist& bl)
 {
@@ -1247,9 +1295,9 @@ void FileJournal::do_aio_write(bufferlist& bl)
  */
 int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
 {
-  Mutex::Locker locker(aio_lock);
   align_bl(pos, bl);
 
+  aio_lock.Lock();
   dout(20) << "write_aio_bl " << pos << "~" << bl.length() << " seq " << seq << dendl;
   
   aio_queue.push_back(aio_info(bl, pos, seq));
@@ -1270,13 +1318,21 @@ int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
 
   aio_num++;
   aio_bytes += aio.len;
+  if (logger) {
+    logger->set(l_os_j_aio_inflight, aio_num);
+    logger->set(l_os_j_aio_inflight_bytes, aio_bytes);
+  }
+  uint64_t len = aio.len;
+  aio_lock.Unlock();
 
+  // io_submit may block; don't hold up completions while it does.  aio
+  // stays put in aio_queue until it completes.
   iocb *piocb = &aio.iocb;
   int attempts = 10;
-  do {
+  while (true) {
     int r = io_submit(aio_ctx, 1, &piocb);
     if (r < 0) {
-      derr << "io_submit to " << aio.off << "~" << aio.len
+      derr << "io_submit to " << pos << "~" << len
 	   << " got " << cpp_strerror(r) << dendl;
       if (r == -EAGAIN && attempts-- > 0) {
 	usleep(500);
@@ -1284,8 +1340,11 @@ int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
       }
       assert(0 == "io_submit got unexpected error");
     }
-  } while (false);
-  pos += aio.len;
+    break;
+  }
+  pos += len;
+
+  Mutex::Locker locker(aio_lock);
   write_finish_cond.Signal();
   return 0;
 }
@@ -1308,8 +1367,8 @@ void FileJournal::write_finish_thread_entry()
     }
     
     dout(20) << "write_finish_thread_entry waiting for aio(s)" << dendl;
-    io_event event[16];
-    int r = io_getevents(aio_ctx, 1, 16, event, NULL);
+    io_event event[AIO_MAX_EVENTS];
+    int r = io_getevents(aio_ctx, 1, AIO_MAX_EVENTS, event, NULL);
     if (r < 0) {
       if (r == -EINTR) {
 	dout(0) << "io_getevents got " << cpp_strerror(r) << dendl;
@@ -1363,6 +1422,10 @@ void FileJournal::check_aio_completion()
     aio_bytes -= p->len;
     aio_queue.erase(p++);
   }
+  if (logger) {
+    logger->set(l_os_j_aio_inflight, aio_num);
+    logger->set(l_os_j_aio_inflight_bytes, aio_bytes);
+  }
 
   if (completed_something) {
     // kick finisher?  
@@ -1399,9 +1462,16 @@ void FileJournal::submit_entry(uint64_t seq, bufferlist& e, int alignment,
 	   << " (" << oncommit << ")" << dendl;
   assert(e.length() > 0);
 
+  utime_t now = ceph_clock_now(g_ceph_context);
+  if (last_submit != utime_t()) {
+    double d = now - last_submit;
+    submit_interval = submit_interval * .9 + d * .1;
+  }
+  last_submit = now;
+
   completions.push_back(
     completion_item(
-      seq, oncommit, ceph_clock_now(g_ceph_context), osd_op));
+      seq, oncommit, now, osd_op));
 
   if (full_state == FULL_NOTFULL) {
     if (osd_op)
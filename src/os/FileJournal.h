@@ -64,6 +64,9 @@ public:
   bool plug_journal_completions;
   deque<write_item> writeq;
   deque<completion_item> completions;
+  utime_t last_submit;      ///< when the last entry was submitted
+  double submit_interval;   ///< moving average of seconds between submits
+  double batch_window;      ///< current group commit window, in seconds
   bool writeq_empty();
   write_item &peek_write();
   void pop_write();
@@ -174,6 +177,9 @@ private:
   off64_t read_pos;       // 
 
 #ifdef HAVE_LIBAIO
+  /// size of our aio context
+  static const int AIO_MAX_EVENTS = 128;
+
   /// state associated with an in-flight aio request
   /// Protected by aio_lock
   struct aio_info {
@@ -246,6 +252,7 @@ private:
   void start_writer();
   void stop_writer();
   void write_thread_entry();
+  void wait_for_batch();
 
   void queue_completions_thru(uint64_t seq);
 
@@ -294,6 +301,8 @@ private:
     queue_lock("FileJournal::queue_lock"),
     journaled_seq(0),
     plug_journal_completions(false),
+    submit_interval(1.0),
+    batch_window(0),
     fn(f),
     zero_buf(NULL),
     max_size(0), block_size(0),
@@ -63,11 +63,12 @@
 #include "common/run_cmd.h"
 #include "common/safe_io.h"
 #include "common/perf_counters.h"
+#include "common/admin_socket.h"
 #include "common/sync_filesystem.h"
 #include "common/fd.h"
 #include "HashIndex.h"
 #include "DBObjectMap.h"
-#include "LevelDBStore.h"
+#include "KeyValueDB.h"
 
 #include "common/ceph_crypto.h"
 using ceph::crypto::SHA1;
@@ -274,15 +275,27 @@ int FileStore::lfn_stat(coll_t cid, const hobject_t& oid, struct stat *buf)
   return r;
 }
 
-int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode,
-			IndexedPath *path,
-			Index *index) {
+int FileStore::lfn_open(coll_t cid, const hobject_t& oid, bool create,
+			FDRef *outfd, Index *index)
+{
+  assert(outfd);
+  *outfd = fdcache.lookup(cid, oid);
+  if (*outfd) {
+    if (logger)
+      logger->inc(l_os_fdcache_hit);
+    return 0;
+  }
+  if (logger)
+    logger->inc(l_os_fdcache_miss);
+  uint64_t ticket = fdcache.get_ticket(oid);
+
   Index index2;
-  IndexedPath path2;
-  if (!path)
-    path = &path2;
+  IndexedPath path;
   int fd, exist;
   int r = 0;
+  int flags = O_RDWR;
+  if (create)
+    flags |= O_CREAT;
   if (!index) {
     index = &index2;
   }
@@ -294,53 +307,39 @@ int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode
 	 << ": " << cpp_strerror(-r) << dendl;
     goto fail;
   }
-  r = (*index)->lookup(oid, path, &exist);
+  r = (*index)->lookup(oid, &path, &exist);
   if (r < 0) {
     derr << "could not find " << oid << " in index: "
 	 << cpp_strerror(-r) << dendl;
     goto fail;
   }
 
-  r = ::open((*path)->path(), flags, mode);
+  r = ::open(path->path(), flags, 0644);
   if (r < 0) {
     r = -errno;
-    dout(10) << "error opening file " << (*path)->path() << " with flags="
-	     << flags << " and mode=" << mode << ": " << cpp_strerror(-r) << dendl;
+    dout(10) << "error opening file " << path->path() << " with flags="
+	     << flags << ": " << cpp_strerror(-r) << dendl;
     goto fail;
   }
   fd = r;
 
-  if ((flags & O_CREAT) && (!exist)) {
-    r = (*index)->created(oid, (*path)->path());
+  if (create && (!exist)) {
+    r = (*index)->created(oid, path->path());
     if (r < 0) {
       TEMP_FAILURE_RETRY(::close(fd));
-      derr << "error creating " << oid << " (" << (*path)->path()
+      derr << "error creating " << oid << " (" << path->path()
 	   << ") in index: " << cpp_strerror(-r) << dendl;
       goto fail;
     }
   }
-  return fd;
+  *outfd = fdcache.add(cid, oid, fd, ticket);
+  return 0;
 
  fail:
   assert(!m_filestore_fail_eio || r != -EIO);
   return r;
 }
 
-int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode, IndexedPath *path)
-{
-  return lfn_open(cid, oid, flags, mode, path, 0);
-}
-
-int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode)
-{
-  return lfn_open(cid, oid, flags, mode, 0, 0);
-}
-
-int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags)
-{
-  return lfn_open(cid, oid, flags, 0);
-}
-
 int FileStore::lfn_link(coll_t c, coll_t cid, const hobject_t& o) 
 {
   Index index_new, index_old;
@@ -385,6 +384,9 @@ int FileStore::lfn_link(coll_t c, coll_t cid, const hobject_t& o)
   if (r < 0)
     return -errno;
 
+  // o is now reachable under another name
+  xattr_cache.clear(o);
+
   r = index_new->created(o, path_new->path());
   if (r < 0) {
     assert(!m_filestore_fail_eio || r != -EIO);
@@ -420,6 +422,8 @@ int FileStore::lfn_unlink(coll_t cid, const hobject_t& o,
       r = object_map->clear(o, &spos);
       if (r < 0 && r != -ENOENT) {
 	assert(!m_filestore_fail_eio || r != -EIO);
+	xattr_cache.clear(o);
+	read_cache.clear(o);
 	return r;
       }
     } else {
@@ -430,7 +434,11 @@ int FileStore::lfn_unlink(coll_t cid, const hobject_t& o,
 	object_map->sync(&o, &spos);
     }
   }
-  return index->unlink(o);
+  r = index->unlink(o);
+  fdcache.clear(cid, o);
+  xattr_cache.clear(o);
+  read_cache.clear(o);
+  return r;
 }
 
 static void get_raw_xattr_name(const char *name, int i, char *raw_name, int raw_len)
@@ -721,13 +729,20 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   ioctl_fiemap(false),
   fsid_fd(-1), op_fd(-1),
   basedir_fd(-1), current_fd(-1),
-  index_manager(do_update),
+  index_manager(do_update, g_conf->filestore_split_async),
+  fdcache(g_conf->filestore_fd_cache_size, g_conf->filestore_fd_cache_shards),
+  xattr_cache(g_conf->filestore_xattr_cache_size,
+	      g_conf->filestore_xattr_cache_shards),
+  read_cache(g_conf->filestore_read_cache_size,
+	     g_conf->filestore_read_cache_shards),
   ondisk_finisher(g_ceph_context),
   lock("FileStore::lock"),
   force_sync(false), sync_epoch(0),
   sync_entry_timeo_lock("sync_entry_timeo_lock"),
   timer(g_ceph_context, sync_entry_timeo_lock),
   stop(false), sync_thread(this),
+  osr_lock("FileStore::osr_lock"),
+  osr_hook(NULL),
   default_osr("default"),
   op_queue_len(0), op_queue_bytes(0), op_finisher(g_ceph_context), next_finish(0),
   op_tp(g_ceph_context, "FileStore::op_tp", g_conf->filestore_op_threads, "filestore_op_threads"),
@@ -760,6 +775,8 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   m_filestore_queue_max_bytes(g_conf->filestore_queue_max_bytes),
   m_filestore_queue_committing_max_ops(g_conf->filestore_queue_committing_max_ops),
   m_filestore_queue_committing_max_bytes(g_conf->filestore_queue_committing_max_bytes),
+  m_filestore_queue_max_ops_per_osr(g_conf->filestore_queue_max_ops_per_osr),
+  m_filestore_queue_max_bytes_per_osr(g_conf->filestore_queue_max_bytes_per_osr),
   m_filestore_do_dump(false),
   m_filestore_dump_fmt(true)
 {
@@ -803,6 +820,22 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   plb.add_fl_avg(l_os_commit_lat, "commitcycle_latency");
   plb.add_u64_counter(l_os_j_full, "journal_full");
 
+  // journal group commit: how often we held a write back, and a
+  // histogram of bytes (x) against entries (y) per journal write
+  plb.add_u64_counter(l_os_j_batch_wait, "journal_batch_wait");
+  plb.add_histogram(l_os_j_batch_hist, "journal_batch_hist", 32, 10);
+  plb.add_u64(l_os_j_aio_inflight, "journal_aio_inflight");
+  plb.add_u64(l_os_j_aio_inflight_bytes, "journal_aio_inflight_bytes");
+  plb.add_u64_counter(l_os_fdcache_hit, "fdcache_hit");
+  plb.add_u64_counter(l_os_fdcache_miss, "fdcache_miss");
+  plb.add_u64_counter(l_os_xattr_cache_hit, "xattr_cache_hit");
+  plb.add_u64_counter(l_os_xattr_cache_miss, "xattr_cache_miss");
+  plb.add_u64_counter(l_os_readahead, "readahead");
+  plb.add_u64_counter(l_os_readahead_bytes, "readahead_bytes");
+  plb.add_u64_counter(l_os_readahead_hit, "readahead_hit");
+  plb.add_u64_counter(l_os_read_cache_hit, "read_cache_hit");
+  plb.add_u64_counter(l_os_read_cache_miss, "read_cache_miss");
+
   logger = plb.create_perf_counters();
 }
 
@@ -1107,18 +1140,34 @@ int FileStore::mkfs()
   }
 
   {
-    leveldb::Options options;
-    options.create_if_missing = true;
-    leveldb::DB *db;
-    leveldb::Status status = leveldb::DB::Open(options, omap_dir, &db);
-    if (status.ok()) {
-      delete db;
-      dout(1) << "leveldb db exists/created" << dendl;
-    } else {
-      derr << "mkfs failed to create leveldb: " << status.ToString() << dendl;
+    string backend;
+    ret = read_omap_backend(&backend);
+    if (ret < 0) {
+      derr << "mkfs: failed to read omap_backend: " << cpp_strerror(ret) << dendl;
+      goto close_fsid_fd;
+    }
+    if (ret == 0)
+      backend = g_conf->filestore_omap_backend;
+    KeyValueDB *omap_store = KeyValueDB::create(backend, omap_dir);
+    if (!omap_store) {
+      derr << "mkfs: unknown omap backend '" << backend << "'" << dendl;
+      ret = -EINVAL;
+      goto close_fsid_fd;
+    }
+    stringstream err;
+    ret = omap_store->init(err);
+    delete omap_store;
+    if (ret) {
+      derr << "mkfs failed to create " << backend << ": " << err.str() << dendl;
       ret = -1;
       goto close_fsid_fd;
     }
+    ret = write_omap_backend(backend);
+    if (ret < 0) {
+      derr << "mkfs: failed to write omap_backend: " << cpp_strerror(ret) << dendl;
+      goto close_fsid_fd;
+    }
+    dout(1) << backend << " db exists/created" << dendl;
   }
 
   // journal?
@@ -1648,6 +1697,40 @@ int FileStore::write_version_stamp()
   return 0;
 }
 
+/// @return 1 and the backend if recorded, 0 if not, or -errno
+int FileStore::read_omap_backend(string *backend)
+{
+  char fn[PATH_MAX];
+  snprintf(fn, sizeof(fn), "%s/omap_backend", basedir.c_str());
+  bufferlist bl;
+  string err;
+  int r = bl.read_file(fn, &err);
+  if (r == -ENOENT)
+    return 0;
+  if (r < 0)
+    return r;
+  backend->assign(bl.c_str(), bl.length());
+  size_t end = backend->find_first_of(" \t\n");
+  if (end != string::npos)
+    backend->resize(end);
+  return 1;
+}
+
+int FileStore::write_omap_backend(const string &backend)
+{
+  char fn[PATH_MAX];
+  snprintf(fn, sizeof(fn), "%s/omap_backend", basedir.c_str());
+  int fd = ::open(fn, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0)
+    return -errno;
+  string s = backend + "\n";
+  int ret = safe_write(fd, s.c_str(), s.length());
+  if (ret == 0 && ::fsync(fd) < 0)
+    ret = -errno;
+  TEMP_FAILURE_RETRY(::close(fd));
+  return ret;
+}
+
 int FileStore::read_op_seq(uint64_t *seq)
 {
   int op_fd = ::open(current_op_seq_fn.c_str(), O_CREAT|O_RDWR, 0644);
@@ -1681,6 +1764,20 @@ int FileStore::write_op_seq(int fd, uint64_t seq)
   return ret;
 }
 
+class OpSequencerSocketHook : public AdminSocketHook {
+  FileStore *store;
+public:
+  OpSequencerSocketHook(FileStore *fs) : store(fs) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    JSONFormatter jf(true);
+    store->dump_op_sequencers(&jf);
+    jf.flush(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
 int FileStore::mount() 
 {
   int ret;
@@ -1936,14 +2033,34 @@ int FileStore::mount()
   }
 
   {
-    LevelDBStore *omap_store = new LevelDBStore(omap_dir);
+    string backend;
+    ret = read_omap_backend(&backend);
+    if (ret < 0) {
+      derr << "FileStore::mount: failed to read omap_backend: "
+	   << cpp_strerror(ret) << dendl;
+      goto close_current_fd;
+    }
+    if (ret == 0)
+      backend = "leveldb";  // made before the backend was recorded
+    if (backend != g_conf->filestore_omap_backend)
+      dout(0) << "mount: omap is on " << backend << ", not "
+	      << g_conf->filestore_omap_backend << " (filestore_omap_backend"
+	      << " only applies to mkfs)" << dendl;
+    KeyValueDB *omap_store = KeyValueDB::create(backend, omap_dir);
+    if (!omap_store) {
+      derr << "FileStore::mount: unknown omap backend '" << backend << "'" << dendl;
+      ret = -EINVAL;
+      goto close_current_fd;
+    }
     stringstream err;
     if (omap_store->init(err)) {
-      derr << "Error initializing leveldb: " << err.str() << dendl;
+      derr << "Error initializing " << backend << ": " << err.str() << dendl;
+      delete omap_store;
       ret = -1;
       goto close_current_fd;
     }
-    DBObjectMap *dbomap = new DBObjectMap(omap_store);
+    DBObjectMap *dbomap = new DBObjectMap(omap_store,
+					  g_conf->filestore_omap_header_cache_size);
     ret = dbomap->init(do_update);
     if (ret < 0) {
       derr << "Error initializing DBObjectMap: " << ret << dendl;
@@ -2053,6 +2170,7 @@ int FileStore::mount()
   journal_start();
 
   op_tp.start();
+  index_manager.start_split_thread();
   flusher_thread.create();
   op_finisher.start();
   ondisk_finisher.start();
@@ -2063,6 +2181,15 @@ int FileStore::mount()
 
   g_ceph_context->_conf->add_observer(this);
 
+  // only the first store in the process gets the command
+  osr_hook = new OpSequencerSocketHook(this);
+  if (g_ceph_context->get_admin_socket()->register_command(
+	"dump_op_sequencers", osr_hook,
+	"show per-sequencer (pg) filestore queue state and apply latencies")) {
+    delete osr_hook;
+    osr_hook = NULL;
+  }
+
   // all okay.
   return 0;
 
@@ -2086,6 +2213,12 @@ int FileStore::umount()
   
   g_ceph_context->_conf->remove_observer(this);
 
+  if (osr_hook) {
+    g_ceph_context->get_admin_socket()->unregister_command("dump_op_sequencers");
+    delete osr_hook;
+    osr_hook = NULL;
+  }
+
   start_sync();
 
   lock.Lock();
@@ -2095,6 +2228,7 @@ int FileStore::umount()
   lock.Unlock();
   sync_thread.join();
   op_tp.stop();
+  index_manager.stop_split_thread();
   flusher_thread.join();
 
   journal_stop();
@@ -2120,8 +2254,22 @@ int FileStore::umount()
     TEMP_FAILURE_RETRY(::close(basedir_fd));
     basedir_fd = -1;
   }
+  fdcache.clear();
+  xattr_cache.clear();
+  read_cache.clear();
   object_map.reset();
 
+  {
+    // Sequencers can outlive us (the OSD drops its PGs after deleting
+    // the store)
+    Mutex::Locker l(osr_lock);
+    for (set<OpSequencer*>::iterator p = osr_set.begin();
+	 p != osr_set.end();
+	 ++p)
+      (*p)->store = NULL;
+    osr_set.clear();
+  }
+
   {
     Mutex::Locker l(sync_entry_timeo_lock);
     timer.shutdown();
@@ -2205,14 +2353,15 @@ void FileStore::queue_op(OpSequencer *osr, Op *o)
   op_wq.queue(osr);
 }
 
-void FileStore::op_queue_reserve_throttle(Op *o)
+void FileStore::op_queue_reserve_throttle(OpSequencer *osr, Op *o)
 {
   op_tp.lock();
-  _op_queue_reserve_throttle(o, "op_queue_reserve_throttle");
+  _op_queue_reserve_throttle(osr, o, "op_queue_reserve_throttle");
   op_tp.unlock();
 }
 
-void FileStore::_op_queue_reserve_throttle(Op *o, const char *caller)
+void FileStore::_op_queue_reserve_throttle(OpSequencer *osr, Op *o,
+					   const char *caller)
 {
   // Do not call while holding the journal lock!
   uint64_t max_ops = m_filestore_queue_max_ops;
@@ -2235,19 +2384,36 @@ void FileStore::_op_queue_reserve_throttle(Op *o, const char *caller)
     op_tp.wait(op_throttle_cond);
   }
 
+  // keep one busy sequencer (pg) from filling the whole queue
+  uint64_t max_osr_ops = m_filestore_queue_max_ops_per_osr;
+  uint64_t max_osr_bytes = m_filestore_queue_max_bytes_per_osr;
+  while ((max_osr_ops && (osr->inflight_ops + 1) > max_osr_ops) ||
+	 (max_osr_bytes && osr->inflight_bytes
+	  && (osr->inflight_bytes + o->bytes) > max_osr_bytes)) {
+    dout(2) << caller << " waiting on " << *osr << ": "
+	    << osr->inflight_ops + 1 << " > " << max_osr_ops << " ops || "
+	    << osr->inflight_bytes + o->bytes << " > " << max_osr_bytes << dendl;
+    op_tp.wait(op_throttle_cond);
+  }
+
   op_queue_len++;
   op_queue_bytes += o->bytes;
+  osr->inflight_ops++;
+  osr->inflight_bytes += o->bytes;
 
   logger->set(l_os_oq_ops, op_queue_len);
   logger->set(l_os_oq_bytes, op_queue_bytes);
 }
 
-void FileStore::_op_queue_release_throttle(Op *o)
+void FileStore::_op_queue_release_throttle(OpSequencer *osr, Op *o)
 {
   // Called with op_tp lock!
   op_queue_len--;
   op_queue_bytes -= o->bytes;
-  op_throttle_cond.Signal();
+  osr->inflight_ops--;
+  osr->inflight_bytes -= o->bytes;
+  // waiters may be waiting on the global limit or on their own osr's
+  op_throttle_cond.SignalAll();
 
   logger->set(l_os_oq_ops, op_queue_len);
   logger->set(l_os_oq_bytes, op_queue_bytes);
@@ -2259,8 +2425,15 @@ void FileStore::_do_op(OpSequencer *osr)
   Op *o = osr->peek_queue();
 
   dout(5) << "_do_op " << o << " seq " << o->op << " " << *osr << "/" << osr->parent << " start" << dendl;
+  utime_t start = ceph_clock_now(g_ceph_context);
   int r = do_transactions(o->tls, o->op);
   op_apply_finish(o->op);
+  {
+    utime_t now = ceph_clock_now(g_ceph_context);
+    Mutex::Locker l(osr->stats->lock);
+    osr->stats->queue.add(start - o->start);
+    osr->stats->apply.add(now - start);
+  }
   dout(10) << "_do_op " << o << " seq " << o->op << " r = " << r
 	   << ", finisher " << o->onreadable << " " << o->onreadable_sync << dendl;
   
@@ -2277,11 +2450,26 @@ void FileStore::_finish_op(OpSequencer *osr)
   osr->apply_lock.Unlock();  // locked in _do_op
 
   // called with tp lock held
-  _op_queue_release_throttle(o);
+  _op_queue_release_throttle(osr, o);
 
   utime_t lat = ceph_clock_now(g_ceph_context);
   lat -= o->start;
   logger->finc(l_os_apply_lat, lat);
+  {
+    Mutex::Locker l(osr->stats->lock);
+    osr->stats->ops++;
+    osr->stats->bytes += o->bytes;
+    osr->stats->total.add(lat);
+  }
+
+  // more to do?  go to the back of the line, so that one busy sequencer
+  // can't starve the others.  (do this before the completions below;
+  // they may drop the last ref to osr.)
+  if (osr->has_queued()) {
+    op_queue.push_back(osr);
+    op_wq._wake();
+  } else
+    osr->in_op_queue = false;
 
   if (o->onreadable_sync) {
     o->onreadable_sync->finish(0);
@@ -2305,6 +2493,101 @@ struct C_JournaledAhead : public Context {
   }
 };
 
+void FileStore::register_osr(OpSequencer *osr)
+{
+  Mutex::Locker l(osr_lock);
+  osr_set.insert(osr);
+}
+
+void FileStore::unregister_osr(OpSequencer *osr)
+{
+  Mutex::Locker l(osr_lock);
+  osr_set.erase(osr);
+}
+
+void FileStore::OpSequencerStats::lat_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("count", count);
+  f->dump_float("avg", count ? (double)sum / (double)count : 0.0);
+  f->dump_float("max", (double)max);
+  f->dump_float("sum", (double)sum);
+}
+
+void FileStore::OpSequencerStats::dump(Formatter *f)
+{
+  Mutex::Locker l(lock);
+  f->dump_unsigned("ops", ops);
+  f->dump_unsigned("bytes", bytes);
+  f->open_object_section("queue_lat");
+  queue.dump(f);
+  f->close_section();
+  f->open_object_section("journal_lat");
+  journal.dump(f);
+  f->close_section();
+  f->open_object_section("apply_lat");
+  apply.dump(f);
+  f->close_section();
+  f->open_object_section("total_lat");
+  total.dump(f);
+  f->close_section();
+}
+
+void FileStore::dump_op_sequencers(Formatter *f)
+{
+  Mutex::Locker l(osr_lock);
+  op_tp.lock();
+
+  // busiest (most time spent applying) first
+  multimap<double, OpSequencer*> order;
+  for (set<OpSequencer*>::iterator p = osr_set.begin();
+       p != osr_set.end();
+       ++p) {
+    Mutex::Locker sl((*p)->stats->lock);
+    order.insert(make_pair(-(double)(*p)->stats->apply.sum, *p));
+  }
+
+  f->open_object_section("filestore");
+  f->dump_unsigned("op_queue_ops", op_queue_len);
+  f->dump_unsigned("op_queue_bytes", op_queue_bytes);
+  f->open_array_section("op_sequencers");
+  for (multimap<double, OpSequencer*>::iterator p = order.begin();
+       p != order.end();
+       ++p) {
+    OpSequencer *osr = p->second;
+    f->open_object_section("op_sequencer");
+    f->dump_string("name", osr->get_name());
+    f->dump_int("in_op_queue", osr->in_op_queue);
+    f->dump_unsigned("inflight_ops", osr->inflight_ops);
+    f->dump_unsigned("inflight_bytes", osr->inflight_bytes);
+    osr->stats->dump(f);
+    f->close_section();
+  }
+  f->close_section();
+  f->close_section();
+
+  op_tp.unlock();
+}
+
+/// note when an op was committed to the journal, for dump_op_sequencers
+struct C_OsrJournaled : public Context {
+  FileStore::OpSequencerStatsRef stats;
+  utime_t start;
+  Context *ondisk;
+
+  C_OsrJournaled(FileStore::OpSequencerStatsRef s, utime_t st, Context *c)
+    : stats(s), start(st), ondisk(c) { }
+  void finish(int r) {
+    utime_t lat = ceph_clock_now(g_ceph_context);
+    lat -= start;
+    {
+      Mutex::Locker l(stats->lock);
+      stats->journal.add(lat);
+    }
+    ondisk->finish(r);
+    delete ondisk;
+  }
+};
+
 int FileStore::queue_transaction(Sequencer *osr, Transaction *t)
 {
   list<Transaction*> tls;
@@ -2330,17 +2613,18 @@ int FileStore::queue_transactions(Sequencer *posr, list<Transaction*> &tls,
     osr = (OpSequencer *)posr->p;
     dout(5) << "queue_transactions existing " << *osr << "/" << osr->parent << dendl; //<< " w/ q " << osr->q << dendl;
   } else {
-    osr = new OpSequencer;
-    osr->parent = posr;
+    osr = new OpSequencer(this, posr);
     posr->p = osr;
     dout(5) << "queue_transactions new " << *osr << "/" << osr->parent << dendl;
   }
 
   if (journal && journal->is_writeable() && !m_filestore_journal_trailing) {
     Op *o = build_op(tls, onreadable, onreadable_sync, osd_op);
-    op_queue_reserve_throttle(o);
+    op_queue_reserve_throttle(osr, o);
     journal->throttle();
     o->op = op_submit_start();
+    if (ondisk)
+      ondisk = new C_OsrJournaled(osr->stats, o->start, ondisk);
 
     if (m_filestore_do_dump)
       dump_transactions(o->tls, o->op, osr);
@@ -2545,14 +2829,13 @@ int FileStore::_check_replay_guard(coll_t cid, hobject_t oid, const SequencerPos
   if (!replaying || btrfs_stable_commits)
     return 1;
 
-  int fd = lfn_open(cid, oid, 0);
-  if (fd < 0) {
+  FDRef fd;
+  int r = lfn_open(cid, oid, false, &fd);
+  if (r < 0) {
     dout(10) << "_check_replay_guard " << cid << " " << oid << " dne" << dendl;
     return 1;  // if file does not exist, there is no guard, and we can replay.
   }
-  int ret = _check_replay_guard(fd, spos);
-  TEMP_FAILURE_RETRY(::close(fd));
-  return ret;
+  return _check_replay_guard(**fd, spos);
 }
 
 int FileStore::_check_replay_guard(coll_t cid, const SequencerPosition& spos)
@@ -2621,12 +2904,21 @@ unsigned FileStore::_do_transaction(Transaction& t, uint64_t op_seq, int trans_n
   Transaction::iterator i = t.begin();
   
   SequencerPosition spos(op_seq, trans_num, 0);
+  ObjectMap::Batch omap_batch;  // runs of omap key updates, in one kv write
   while (i.have_op()) {
     int op = i.get_op();
     int r = 0;
 
     _inject_failure();
 
+    bool batchable = (op == Transaction::OP_OMAP_SETKEYS ||
+		      op == Transaction::OP_OMAP_RMKEYS ||
+		      op == Transaction::OP_OMAP_SETHEADER);
+    if (omap_batch && !batchable)
+      _omap_submit_batch(omap_batch);  // later ops may read what it wrote
+    else if (!omap_batch && batchable && g_conf->filestore_omap_batch_writes)
+      omap_batch = object_map->get_batch();
+
     switch (op) {
     case Transaction::OP_NOP:
       break;
@@ -2782,6 +3074,15 @@ unsigned FileStore::_do_transaction(Transaction& t, uint64_t op_seq, int trans_n
       }
       break;
 
+    case Transaction::OP_COLL_EXPECTED_OBJECTS:
+      {
+	coll_t cid = i.get_cid();
+	uint64_t num = i.get_length();
+	if (_check_replay_guard(cid, spos) > 0)
+	  r = _collection_expected_objects(cid, num);
+      }
+      break;
+
     case Transaction::OP_RMCOLL:
       {
 	coll_t cid = i.get_cid();
@@ -2866,7 +3167,7 @@ unsigned FileStore::_do_transaction(Transaction& t, uint64_t op_seq, int trans_n
 	hobject_t oid = i.get_oid();
 	map<string, bufferlist> aset;
 	i.get_attrset(aset);
-	r = _omap_setkeys(cid, oid, aset, spos);
+	r = _omap_setkeys(cid, oid, aset, spos, omap_batch);
       }
       break;
     case Transaction::OP_OMAP_RMKEYS:
@@ -2875,7 +3176,7 @@ unsigned FileStore::_do_transaction(Transaction& t, uint64_t op_seq, int trans_n
 	hobject_t oid = i.get_oid();
 	set<string> keys;
 	i.get_keyset(keys);
-	r = _omap_rmkeys(cid, oid, keys, spos);
+	r = _omap_rmkeys(cid, oid, keys, spos, omap_batch);
       }
       break;
     case Transaction::OP_OMAP_SETHEADER:
@@ -2884,7 +3185,7 @@ unsigned FileStore::_do_transaction(Transaction& t, uint64_t op_seq, int trans_n
 	hobject_t oid = i.get_oid();
 	bufferlist bl;
 	i.get_bl(bl);
-	r = _omap_setheader(cid, oid, bl, spos);
+	r = _omap_setheader(cid, oid, bl, spos, omap_batch);
       }
       break;
 
@@ -2966,6 +3267,9 @@ unsigned FileStore::_do_transaction(Transaction& t, uint64_t op_seq, int trans_n
     spos.op++;
   }
 
+  if (omap_batch)
+    _omap_submit_batch(omap_batch);
+
   _inject_failure();
 
   return 0;  // FIXME count errors
@@ -2998,40 +3302,116 @@ int FileStore::read(coll_t cid, const hobject_t& oid,
                     uint64_t offset, size_t len, bufferlist& bl)
 {
   int got;
+  bool to_eof = (len == 0);
 
   dout(15) << "read " << cid << "/" << oid << " " << offset << "~" << len << dendl;
 
-  int fd = lfn_open(cid, oid, O_RDONLY);
-  if (fd < 0) {
-    dout(10) << "FileStore::read(" << cid << "/" << oid << ") open error: " << cpp_strerror(fd) << dendl;
-    return fd;
+  bool cacheable = g_conf->filestore_read_cache_size > 0 &&
+    len <= (size_t)g_conf->filestore_read_cache_max_read;
+  uint64_t ticket = 0;
+  if (cacheable) {
+    bufferlist cached;
+    if (read_cache.lookup(cid, oid, offset, len, &cached)) {
+      if (logger)
+	logger->inc(l_os_read_cache_hit);
+      got = cached.length();
+      bl.claim_append(cached);
+      dout(10) << "FileStore::read " << cid << "/" << oid << " " << offset << "~"
+	       << got << "/" << len << " (cached)" << dendl;
+      return got;
+    }
+    if (logger)
+      logger->inc(l_os_read_cache_miss);
+    ticket = read_cache.get_ticket(oid);
+  }
+
+  FDRef fd;
+  int r = lfn_open(cid, oid, false, &fd);
+  if (r < 0) {
+    dout(10) << "FileStore::read(" << cid << "/" << oid << ") open error: " << cpp_strerror(r) << dendl;
+    return r;
   }
 
   if (len == 0) {
     struct stat st;
     memset(&st, 0, sizeof(struct stat));
-    int r = ::fstat(fd, &st);
+    int r = ::fstat(**fd, &st);
     assert(r == 0);
     len = st.st_size;
+    cacheable = cacheable &&
+      len <= (size_t)g_conf->filestore_read_cache_max_read;
+  } else if (g_conf->filestore_readahead_max > 0) {
+    if (_readahead(*fd, offset, len) && logger)
+      logger->inc(l_os_readahead_hit);
   }
 
   bufferptr bptr(len);  // prealloc space for entire read
-  got = safe_pread(fd, bptr.c_str(), len, offset);
+  got = safe_pread(**fd, bptr.c_str(), len, offset);
   if (got < 0) {
     dout(10) << "FileStore::read(" << cid << "/" << oid << ") pread error: " << cpp_strerror(got) << dendl;
-    TEMP_FAILURE_RETRY(::close(fd));
     assert(!m_filestore_fail_eio || got != -EIO);
     return got;
   }
   bptr.set_length(got);   // properly size the buffer
+  if (cacheable)
+    read_cache.add(cid, oid, offset, bptr, to_eof || (size_t)got < len, ticket);
   bl.push_back(bptr);   // put it in the target bufferlist
-  TEMP_FAILURE_RETRY(::close(fd));
 
   dout(10) << "FileStore::read " << cid << "/" << oid << " " << offset << "~"
 	   << got << "/" << len << dendl;
   return got;
 }
 
+/**
+ * Notice sequential reads of an object and ask the kernel to start
+ * reading ahead of them (posix_fadvise WILLNEED queues the reads and
+ * returns), keeping between a half and a whole window ahead.  The
+ * window starts at twice the read size and doubles, up to
+ * filestore_readahead_max.
+ *
+ * @return true if [off, off+len) was all within what we had advised
+ */
+bool FileStore::_readahead(FDCache::FD &fd, uint64_t off, size_t len)
+{
+  FDCache::FD::ReadAhead &ra = fd.ra;
+  uint64_t max = g_conf->filestore_readahead_max;
+  uint64_t adv_off = 0, adv_len = 0;
+
+  simple_spin_lock(&ra.lock);
+  bool hit = off >= ra.start && off + len <= ra.end;
+  if (off == ra.next) {
+    ra.seq++;
+  } else {
+    ra.seq = 0;
+    if (!hit)
+      ra.start = ra.end = 0;  // went elsewhere; start over
+  }
+  ra.next = off + len;
+  if (ra.seq >= (unsigned)g_conf->filestore_readahead_min_seq) {
+    uint64_t window = MIN(MAX((ra.end - ra.start) * 2, 2 * (uint64_t)len), max);
+    if (ra.end < off + len + window / 2) {
+      adv_off = MAX(ra.end, off + len);
+      adv_len = off + len + window - adv_off;
+      if (adv_off != ra.end)
+	ra.start = adv_off;
+      ra.end = adv_off + adv_len;
+    }
+  }
+  simple_spin_unlock(&ra.lock);
+
+  if (adv_len) {
+    dout(20) << "readahead fd " << *fd << " " << adv_off << "~" << adv_len << dendl;
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(*fd, adv_off, adv_len, POSIX_FADV_WILLNEED);
+#endif
+    if (logger) {
+      logger->inc(l_os_readahead);
+      logger->inc(l_os_readahead_bytes, adv_len);
+    }
+  }
+  return hit;
+}
+
 int FileStore::fiemap(coll_t cid, const hobject_t& oid,
                     uint64_t offset, size_t len,
                     bufferlist& bl)
@@ -3049,15 +3429,14 @@ int FileStore::fiemap(coll_t cid, const hobject_t& oid,
 
   dout(15) << "fiemap " << cid << "/" << oid << " " << offset << "~" << len << dendl;
 
-  int r;
-  int fd = lfn_open(cid, oid, O_RDONLY);
-  if (fd < 0) {
-    r = fd;
+  FDRef fd;
+  int r = lfn_open(cid, oid, false, &fd);
+  if (r < 0) {
     dout(10) << "read couldn't open " << cid << "/" << oid << ": " << cpp_strerror(r) << dendl;
   } else {
     uint64_t i;
 
-    r = do_fiemap(fd, offset, len, &fiemap);
+    r = do_fiemap(**fd, offset, len, &fiemap);
     if (r < 0)
       goto done;
 
@@ -3099,8 +3478,6 @@ int FileStore::fiemap(coll_t cid, const hobject_t& oid,
   }
 
 done:
-  if (fd >= 0)
-    TEMP_FAILURE_RETRY(::close(fd));
   if (r >= 0)
     ::encode(exomap, bl);
 
@@ -3124,6 +3501,7 @@ int FileStore::_truncate(coll_t cid, const hobject_t& oid, uint64_t size)
 {
   dout(15) << "truncate " << cid << "/" << oid << " size " << size << dendl;
   int r = lfn_truncate(cid, oid, size);
+  read_cache.clear(oid);
   dout(10) << "truncate " << cid << "/" << oid << " size " << size << " = " << r << dendl;
   return r;
 }
@@ -3133,14 +3511,8 @@ int FileStore::_touch(coll_t cid, const hobject_t& oid)
 {
   dout(15) << "touch " << cid << "/" << oid << dendl;
 
-  int flags = O_WRONLY|O_CREAT;
-  int fd = lfn_open(cid, oid, flags, 0644);
-  int r;
-  if (fd >= 0) {
-    TEMP_FAILURE_RETRY(::close(fd));
-    r = 0;
-  } else
-    r = fd;
+  FDRef fd;
+  int r = lfn_open(cid, oid, true, &fd);
   dout(10) << "touch " << cid << "/" << oid << " = " << r << dendl;
   return r;
 }
@@ -3152,46 +3524,30 @@ int FileStore::_write(coll_t cid, const hobject_t& oid,
   dout(15) << "write " << cid << "/" << oid << " " << offset << "~" << len << dendl;
   int r;
 
-  int64_t actual;
-
-  int flags = O_WRONLY|O_CREAT;
-  int fd = lfn_open(cid, oid, flags, 0644);
-  if (fd < 0) {
-    r = fd;
-    dout(0) << "write couldn't open " << cid << "/" << oid << " flags " << flags << ": "
+  FDRef fd;
+  r = lfn_open(cid, oid, true, &fd);
+  if (r < 0) {
+    dout(0) << "write couldn't open " << cid << "/" << oid << ": "
 	    << cpp_strerror(r) << dendl;
     goto out;
   }
-    
-  // seek
-  actual = ::lseek64(fd, offset, SEEK_SET);
-  if (actual < 0) {
-    r = -errno;
-    dout(0) << "write lseek64 to " << offset << " failed: " << cpp_strerror(r) << dendl;
-    goto out;
-  }
-  if (actual != (int64_t)offset) {
-    dout(0) << "write lseek64 to " << offset << " gave bad offset " << actual << dendl;
-    r = -EIO;
-    goto out;
-  }
 
-  // write
-  r = bl.write_fd(fd);
+  // write.  the fd may be shared, so don't touch its file offset.
+  r = bl.write_fd(**fd, offset);
+  read_cache.clear(oid);
   if (r == 0)
     r = bl.length();
 
   // flush?
   if ((ssize_t)len < m_filestore_flush_min ||
 #ifdef HAVE_SYNC_FILE_RANGE
-      !m_filestore_flusher || !queue_flusher(fd, offset, len)
+      !m_filestore_flusher || !queue_flusher(**fd, offset, len)
 #else
       true
 #endif
       ) {
     if (m_filestore_sync_flush)
-      ::sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WRITE);
-    TEMP_FAILURE_RETRY(::close(fd));
+      ::sync_file_range(**fd, offset, len, SYNC_FILE_RANGE_WRITE);
   }
 
  out:
@@ -3207,17 +3563,17 @@ int FileStore::_zero(coll_t cid, const hobject_t& oid, uint64_t offset, size_t l
 #ifdef CEPH_HAVE_FALLOCATE
 # if !defined(DARWIN) && !defined(__FreeBSD__)
   // first try to punch a hole.
-  int fd = lfn_open(cid, oid, O_RDONLY);
-  if (fd < 0) {
-    ret = -errno;
+  FDRef fd;
+  ret = lfn_open(cid, oid, false, &fd);
+  if (ret < 0) {
     goto out;
   }
 
   // first try fallocate
-  ret = fallocate(fd, FALLOC_FL_PUNCH_HOLE, offset, len);
+  ret = fallocate(**fd, FALLOC_FL_PUNCH_HOLE, offset, len);
   if (ret < 0)
     ret = -errno;
-  TEMP_FAILURE_RETRY(::close(fd));
+  read_cache.clear(oid);
 
   if (ret == 0)
     goto out;  // yay!
@@ -3250,52 +3606,54 @@ int FileStore::_clone(coll_t cid, const hobject_t& oldoid, const hobject_t& newo
   if (_check_replay_guard(cid, newoid, spos) < 0)
     return 0;
 
-  int o, n, r;
+  FDRef o, n;
+  int r;
   {
     Index index;
-    IndexedPath from, to;
-    o = lfn_open(cid, oldoid, O_RDONLY, 0, &from, &index);
-    if (o < 0) {
-      r = o;
-      goto out2;
+    r = lfn_open(cid, oldoid, false, &o, &index);
+    if (r < 0) {
+      goto out;
+    }
+    r = lfn_open(cid, newoid, true, &n, &index);
+    if (r < 0) {
+      goto out;
     }
-    n = lfn_open(cid, newoid, O_CREAT|O_TRUNC|O_WRONLY, 0644, &to, &index);
-    if (n < 0) {
-      r = n;
+    // newoid may have existed; its old attrs are no longer interesting
+    xattr_cache.clear(newoid);
+    r = ::ftruncate(**n, 0);
+    if (r < 0) {
+      r = -errno;
       goto out;
     }
     struct stat st;
-    ::fstat(o, &st);
-    r = _do_clone_range(o, n, 0, st.st_size, 0);
+    ::fstat(**o, &st);
+    r = _do_clone_range(**o, **n, 0, st.st_size, 0);
     if (r < 0) {
       r = -errno;
-      goto out3;
+      goto out;
     }
     dout(20) << "objectmap clone" << dendl;
     r = object_map->clone(oldoid, newoid, &spos);
     if (r < 0 && r != -ENOENT)
-      goto out3;
+      goto out;
   }
 
   {
     map<string, bufferptr> aset;
     r = _getattrs(cid, oldoid, aset);
     if (r < 0)
-      goto out3;
+      goto out;
 
     r = _setattrs(cid, newoid, aset, spos);
     if (r < 0)
-      goto out3;
+      goto out;
   }
 
   // clone is non-idempotent; record our work.
-  _set_replay_guard(n, spos, &newoid);
+  _set_replay_guard(**n, spos, &newoid);
 
- out3:
-  TEMP_FAILURE_RETRY(::close(n));
  out:
-  TEMP_FAILURE_RETRY(::close(o));
- out2:
+  read_cache.clear(newoid);
   dout(10) << "clone " << cid << "/" << oldoid << " -> " << cid << "/" << newoid << " = " << r << dendl;
   assert(!m_filestore_fail_eio || r != -EIO);
   return r;
@@ -3387,16 +3745,14 @@ int FileStore::_do_copy_range(int from, int to, uint64_t srcoff, uint64_t len, u
 {
   dout(20) << "_do_copy_range " << srcoff << "~" << len << " to " << dstoff << dendl;
   int r = 0;
-  ::lseek64(from, srcoff, SEEK_SET);
-  ::lseek64(to, dstoff, SEEK_SET);
-  
+  // use positioned io; these fds may be shared through the fd cache
   loff_t pos = srcoff;
   loff_t end = srcoff + len;
   int buflen = 4096*32;
   char buf[buflen];
   while (pos < end) {
     int l = MIN(end-pos, buflen);
-    r = ::read(from, buf, l);
+    r = ::pread(from, buf, l, pos);
     dout(25) << "  read from " << pos << "~" << l << " got " << r << dendl;
     if (r < 0) {
       r = -errno;
@@ -3413,7 +3769,7 @@ int FileStore::_do_copy_range(int from, int to, uint64_t srcoff, uint64_t len, u
     }
     int op = 0;
     while (op < r) {
-      int r2 = safe_write(to, buf+op, r-op);
+      int r2 = safe_pwrite(to, buf+op, r-op, dstoff + (pos - srcoff) + op);
       dout(25) << " write to " << to << " len " << (r-op)
 	       << " got " << r2 << dendl;
       if (r2 < 0) {
@@ -3443,26 +3799,22 @@ int FileStore::_clone_range(coll_t cid, const hobject_t& oldoid, const hobject_t
     return 0;
 
   int r;
-  int o, n;
-  o = lfn_open(cid, oldoid, O_RDONLY);
-  if (o < 0) {
-    r = o;
-    goto out2;
-  }
-  n = lfn_open(cid, newoid, O_CREAT|O_WRONLY, 0644);
-  if (n < 0) {
-    r = n;
+  FDRef o, n;
+  r = lfn_open(cid, oldoid, false, &o);
+  if (r < 0) {
+    goto out;
+  }
+  r = lfn_open(cid, newoid, true, &n);
+  if (r < 0) {
     goto out;
   }
-  r = _do_clone_range(o, n, srcoff, len, dstoff);
+  r = _do_clone_range(**o, **n, srcoff, len, dstoff);
+  read_cache.clear(newoid);
 
   // clone is non-idempotent; record our work.
-  _set_replay_guard(n, spos, &newoid);
+  _set_replay_guard(**n, spos, &newoid);
 
-  TEMP_FAILURE_RETRY(::close(n));
  out:
-  TEMP_FAILURE_RETRY(::close(o));
- out2:
   dout(10) << "clone_range " << cid << "/" << oldoid << " -> " << cid << "/" << newoid << " "
 	   << srcoff << "~" << len << " to " << dstoff << " = " << r << dendl;
   return r;
@@ -3474,6 +3826,12 @@ bool FileStore::queue_flusher(int fd, uint64_t off, uint64_t len)
   bool queued;
   lock.Lock();
   if (flusher_queue_len < m_filestore_flusher_max_fds) {
+    // the flusher closes what we give it; fd itself may be cached.
+    fd = ::dup(fd);
+    if (fd < 0) {
+      lock.Unlock();
+      return false;
+    }
     flusher_queue.push_back(sync_epoch);
     flusher_queue.push_back(fd);
     flusher_queue.push_back(off);
@@ -4049,14 +4407,27 @@ int FileStore::_getattrs(const char *fn, map<string,bufferptr>& aset, bool user_
 int FileStore::getattr(coll_t cid, const hobject_t& oid, const char *name, bufferptr &bp)
 {
   dout(15) << "getattr " << cid << "/" << oid << " '" << name << "'" << dendl;
+  if (xattr_cache.lookup(cid, oid, name, &bp)) {
+    if (logger)
+      logger->inc(l_os_xattr_cache_hit);
+    dout(10) << "getattr " << cid << "/" << oid << " '" << name << "' = "
+	     << bp.length() << " (cached)" << dendl;
+    return bp.length();
+  }
+  if (logger)
+    logger->inc(l_os_xattr_cache_miss);
+  uint64_t ticket = xattr_cache.get_ticket(oid);
+
   char n[ATTR_MAX_NAME_LEN];
   get_attrname(name, n, ATTR_MAX_NAME_LEN);
   int r = _getattr(cid, oid, n, bp);
+  bool from_omap = false;
   if (r == -ENODATA && g_conf->filestore_xattr_use_omap) {
     map<string, bufferlist> got;
     set<string> to_get;
     to_get.insert(string(name));
     Index index;
+    from_omap = true;
     r = get_index(cid, &index);
     if (r < 0) {
       dout(10) << __func__ << " could not get index r = " << r << dendl;
@@ -4076,6 +4447,9 @@ int FileStore::getattr(coll_t cid, const hobject_t& oid, const char *name, buffe
     r = 0;
   }
  out:
+  // only inline attrs are cached, so a hit returns what _getattr would
+  if (r >= 0 && !from_omap)
+    xattr_cache.add(cid, oid, name, bp, ticket);
   dout(10) << "getattr " << cid << "/" << oid << " '" << name << "' = " << r << dendl;
   assert(!m_filestore_fail_eio || r != -EIO);
   return r;
@@ -4150,8 +4524,10 @@ int FileStore::_setattrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>
 	if (inline_set.count(p->first)) {
 	  inline_set.erase(p->first);
 	  r = lfn_removexattr(cid, oid, n);
-	  if (r < 0)
+	  if (r < 0) {
+	    xattr_cache.clear(oid);
 	    return r;
+	  }
 	}
 	omap_set[p->first].push_back(p->second);
 	continue;
@@ -4162,8 +4538,10 @@ int FileStore::_setattrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>
 	if (inline_set.count(p->first)) {
 	  inline_set.erase(p->first);
 	  r = lfn_removexattr(cid, oid, n);
-	  if (r < 0)
+	  if (r < 0) {
+	    xattr_cache.clear(oid);
 	    return r;
+	  }
 	}
 	omap_set[p->first].push_back(p->second);
 	continue;
@@ -4190,21 +4568,38 @@ int FileStore::_setattrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>
     int r = get_index(cid, &index);
     if (r < 0) {
       dout(10) << __func__ << " could not get index r = " << r << dendl;
+      xattr_cache.clear(oid);
       return r;
     }
     r = object_map->remove_xattrs(oid, omap_remove, &spos);
     if (r < 0 && r != -ENOENT) {
       dout(10) << __func__ << " could not remove_xattrs r = " << r << dendl;
       assert(!m_filestore_fail_eio || r != -EIO);
+      xattr_cache.clear(oid);
       return r;
     }
     r = object_map->set_xattrs(oid, omap_set, &spos);
     if (r < 0) {
       dout(10) << __func__ << " could not set_xattrs r = " << r << dendl;
       assert(!m_filestore_fail_eio || r != -EIO);
+      xattr_cache.clear(oid);
       return r;
     }
   }
+  if (r < 0) {
+    xattr_cache.clear(oid);  // some may have been set; don't guess which
+  } else {
+    map<string, bufferptr> inline_aset;
+    for (map<string,bufferptr>::iterator p = aset.begin();
+	 p != aset.end();
+	 ++p) {
+      if (omap_set.count(p->first))
+	xattr_cache.rm(cid, oid, p->first);
+      else
+	inline_aset.insert(*p);
+    }
+    xattr_cache.set(cid, oid, inline_aset);
+  }
   dout(10) << "setattrs " << cid << "/" << oid << " = " << r << dendl;
   return r;
 }
@@ -4230,9 +4625,11 @@ int FileStore::_rmattr(coll_t cid, const hobject_t& oid, const char *name,
     if (r < 0 && r != -ENOENT) {
       dout(10) << __func__ << " could not remove_xattrs index r = " << r << dendl;
       assert(!m_filestore_fail_eio || r != -EIO);
+      xattr_cache.clear(oid);
       return r;
     }
   }
+  xattr_cache.rm(cid, oid, name);
   dout(10) << "rmattr " << cid << "/" << oid << " '" << name << "' = " << r << dendl;
   return r;
 }
@@ -4259,20 +4656,24 @@ int FileStore::_rmattrs(coll_t cid, const hobject_t& oid,
     r = get_index(cid, &index);
     if (r < 0) {
       dout(10) << __func__ << " could not get index r = " << r << dendl;
+      xattr_cache.clear(oid);
       return r;
     }
     r = object_map->get_all_xattrs(oid, &omap_attrs);
     if (r < 0 && r != -ENOENT) {
       dout(10) << __func__ << " could not get omap_attrs r = " << r << dendl;
       assert(!m_filestore_fail_eio || r != -EIO);
+      xattr_cache.clear(oid);
       return r;
     }
     r = object_map->remove_xattrs(oid, omap_attrs, &spos);
     if (r < 0 && r != -ENOENT) {
       dout(10) << __func__ << " could not remove omap_attrs r = " << r << dendl;
+      xattr_cache.clear(oid);
       return r;
     }
   }
+  xattr_cache.clear(oid);
   dout(10) << "rmattrs " << cid << "/" << oid << " = " << r << dendl;
   return r;
 }
@@ -4408,6 +4809,12 @@ int FileStore::_collection_rename(const coll_t &cid, const coll_t &ncid,
     return _collection_remove_recursive(cid, spos);
   }
 
+  // cached fds and attrs are keyed by the old collection name.  renames
+  // are rare; just start over.  fds go once the rename is done, so that
+  // a racing open can't cache one under the old name.
+  xattr_cache.clear();
+  read_cache.clear();
+
   int ret = 0;
   if (::rename(old_coll, new_coll)) {
     if (replaying && !btrfs_stable_commits &&
@@ -4420,6 +4827,7 @@ int FileStore::_collection_rename(const coll_t &cid, const coll_t &ncid,
 	     << ": ret = " << ret << dendl;
     return ret;
   }
+  fdcache.clear();
 
   if (ret >= 0) {
     int fd = ::open(new_coll, O_RDONLY);
@@ -4714,6 +5122,55 @@ int FileStore::_create_collection(coll_t c)
   return init_index(c);
 }
 
+int FileStore::_collection_expected_objects(coll_t c, uint64_t num)
+{
+  dout(15) << "collection_expected_objects " << c << " " << num << dendl;
+  Index index;
+  int r = get_index(c, &index);
+  if (r < 0)
+    return r;
+  r = index->pre_split(num);
+  dout(10) << "collection_expected_objects " << c << " " << num << " = " << r << dendl;
+  return r;
+}
+
+/*
+ * rmdir dir and any subdirs, as long as there is nothing but
+ * directories in it (e.g. the empty tree left by a pre-split).
+ */
+static int remove_empty_tree(const char *dir)
+{
+  DIR *d = ::opendir(dir);
+  if (!d)
+    return -errno;
+  int r = 0;
+  char buf[offsetof(struct dirent, d_name) + PATH_MAX + 1];
+  struct dirent *de;
+  while (::readdir_r(d, (struct dirent *)&buf, &de) == 0 && de) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+      continue;
+    char sub[PATH_MAX];
+    snprintf(sub, sizeof(sub), "%s/%s", dir, de->d_name);
+    bool is_dir = de->d_type == DT_DIR;
+    if (de->d_type == DT_UNKNOWN) {
+      // d_type not supported, must stat
+      struct stat st;
+      is_dir = ::stat(sub, &st) == 0 && S_ISDIR(st.st_mode);
+    }
+    if (!is_dir) {
+      r = -ENOTEMPTY;
+      break;
+    }
+    r = remove_empty_tree(sub);
+    if (r < 0)
+      break;
+  }
+  ::closedir(d);
+  if (r == 0 && ::rmdir(dir) < 0)
+    r = -errno;
+  return r;
+}
+
 int FileStore::_destroy_collection(coll_t c) 
 {
   char fn[PATH_MAX];
@@ -4722,6 +5179,8 @@ int FileStore::_destroy_collection(coll_t c)
   int r = ::rmdir(fn);
   if (r < 0)
     r = -errno;
+  if (r == -ENOTEMPTY)
+    r = remove_empty_tree(fn);
   dout(10) << "_destroy_collection " << fn << " = " << r << dendl;
   return r;
 }
@@ -4744,8 +5203,9 @@ int FileStore::_collection_add(coll_t c, coll_t oldcid, const hobject_t& o,
 
   // open guard on object so we don't any previous operations on the
   // new name that will modify the source inode.
-  int fd = lfn_open(oldcid, o, 0);
-  if (fd < 0) {
+  FDRef fd;
+  int r = lfn_open(oldcid, o, false, &fd);
+  if (r < 0) {
     // the source collection/object does not exist. If we are replaying, we
     // should be safe, so just return 0 and move on.
     assert(replaying);
@@ -4753,12 +5213,11 @@ int FileStore::_collection_add(coll_t c, coll_t oldcid, const hobject_t& o,
         << oldcid << "/" << o << " (dne, continue replay) " << dendl;
     return 0;
   }
-  assert(fd >= 0);
   if (dstcmp > 0) {      // if dstcmp == 0 the guard already says "in-progress"
-    _set_replay_guard(fd, spos, &o, true);
+    _set_replay_guard(**fd, spos, &o, true);
   }
 
-  int r = lfn_link(oldcid, c, o);
+  r = lfn_link(oldcid, c, o);
   if (replaying && !btrfs_stable_commits &&
       r == -EEXIST)    // crashed between link() and set_replay_guard()
     r = 0;
@@ -4767,9 +5226,8 @@ int FileStore::_collection_add(coll_t c, coll_t oldcid, const hobject_t& o,
 
   // close guard on object so we don't do this again
   if (r == 0) {
-    _close_replay_guard(fd, spos);
+    _close_replay_guard(**fd, spos);
   }
-  TEMP_FAILURE_RETRY(::close(fd));
 
   dout(10) << "collection_add " << c << "/" << o << " from " << oldcid << "/" << o << " = " << r << dendl;
   return r;
@@ -4803,24 +5261,26 @@ int FileStore::_omap_clear(coll_t cid, const hobject_t &hoid,
 
 int FileStore::_omap_setkeys(coll_t cid, const hobject_t &hoid,
 			     const map<string, bufferlist> &aset,
-			     const SequencerPosition &spos) {
+			     const SequencerPosition &spos,
+			     ObjectMap::Batch batch) {
   dout(15) << __func__ << " " << cid << "/" << hoid << dendl;
   IndexedPath path;
   int r = lfn_find(cid, hoid, &path);
   if (r < 0)
     return r;
-  return object_map->set_keys(hoid, aset, &spos);
+  return object_map->set_keys(hoid, aset, &spos, batch);
 }
 
 int FileStore::_omap_rmkeys(coll_t cid, const hobject_t &hoid,
 			    const set<string> &keys,
-			    const SequencerPosition &spos) {
+			    const SequencerPosition &spos,
+			    ObjectMap::Batch batch) {
   dout(15) << __func__ << " " << cid << "/" << hoid << dendl;
   IndexedPath path;
   int r = lfn_find(cid, hoid, &path);
   if (r < 0)
     return r;
-  r = object_map->rm_keys(hoid, keys, &spos);
+  r = object_map->rm_keys(hoid, keys, &spos, batch);
   if (r < 0 && r != -ENOENT)
     return r;
   return 0;
@@ -4828,14 +5288,26 @@ int FileStore::_omap_rmkeys(coll_t cid, const hobject_t &hoid,
 
 int FileStore::_omap_setheader(coll_t cid, const hobject_t &hoid,
 			       const bufferlist &bl,
-			       const SequencerPosition &spos)
+			       const SequencerPosition &spos,
+			       ObjectMap::Batch batch)
 {
   dout(15) << __func__ << " " << cid << "/" << hoid << dendl;
   IndexedPath path;
   int r = lfn_find(cid, hoid, &path);
   if (r < 0)
     return r;
-  return object_map->set_header(hoid, bl, &spos);
+  return object_map->set_header(hoid, bl, &spos, batch);
+}
+
+void FileStore::_omap_submit_batch(ObjectMap::Batch &batch)
+{
+  int r = object_map->submit_batch(batch);
+  if (r < 0) {
+    derr << __func__ << " failed to write omap batch: " << cpp_strerror(r)
+	 << dendl;
+    assert(0 == "omap batch write failed");
+  }
+  batch.reset();
 }
 
 
@@ -4851,6 +5323,9 @@ const char** FileStore::get_tracked_conf_keys() const
     "filestore_dump_file",
     "filestore_kill_at",
     "filestore_fail_eio",
+    "filestore_fd_cache_size",
+    "filestore_xattr_cache_size",
+    "filestore_read_cache_size",
     NULL
   };
   return KEYS;
@@ -4875,6 +5350,15 @@ void FileStore::handle_conf_change(const struct md_config_t *conf,
     m_filestore_kill_at.set(conf->filestore_kill_at);
     m_filestore_fail_eio = conf->filestore_fail_eio;
   }
+  if (changed.count("filestore_fd_cache_size")) {
+    fdcache.set_size(conf->filestore_fd_cache_size);
+  }
+  if (changed.count("filestore_xattr_cache_size")) {
+    xattr_cache.set_size(conf->filestore_xattr_cache_size);
+  }
+  if (changed.count("filestore_read_cache_size")) {
+    read_cache.set_size(conf->filestore_read_cache_size);
+  }
   if (changed.count("filestore_commit_timeout")) {
     Mutex::Locker l(sync_entry_timeo_lock);
     m_filestore_commit_timeout = conf->filestore_commit_timeout;
@@ -38,6 +38,9 @@ using namespace __gnu_cxx;
 #include "common/Mutex.h"
 #include "HashIndex.h"
 #include "IndexManager.h"
+#include "FDCache.h"
+#include "XattrCache.h"
+#include "ReadCache.h"
 #include "ObjectMap.h"
 #include "SequencerPosition.h"
 
@@ -49,6 +52,8 @@ using namespace __gnu_cxx;
 # define FALLOC_FL_PUNCH_HOLE 0x2
 #endif
 
+class AdminSocketHook;
+
 class FileStore : public JournalingObjectStore,
                   public md_config_obs_t
 {
@@ -84,6 +89,15 @@ private:
 
   // ObjectMap
   boost::scoped_ptr<ObjectMap> object_map;
+
+  // open object fds
+  FDCache fdcache;
+
+  // recently used object attrs
+  XattrCache xattr_cache;
+
+  // recently read object data (off unless filestore_read_cache_size)
+  ReadCache read_cache;
   
   Finisher ondisk_finisher;
 
@@ -122,6 +136,34 @@ private:
   void sync_fs(); // actuall sync underlying fs
 
   // -- op workqueue --
+
+  /// apply path latencies for one OpSequencer, for dump_op_sequencers
+  struct OpSequencerStats {
+    struct lat_t {
+      uint64_t count;
+      utime_t sum, max;
+      lat_t() : count(0) {}
+      void add(utime_t l) {
+	count++;
+	sum += l;
+	if (l > max)
+	  max = l;
+      }
+      void dump(Formatter *f) const;
+    };
+
+    Mutex lock;
+    uint64_t ops, bytes;
+    lat_t queue;    ///< submit -> apply start (includes journal, if writeahead)
+    lat_t journal;  ///< submit -> ondisk (committed to the journal)
+    lat_t apply;    ///< apply start -> applied
+    lat_t total;    ///< submit -> readable
+    OpSequencerStats()
+      : lock("FileStore::OpSequencerStats::lock"), ops(0), bytes(0) {}
+    void dump(Formatter *f);
+  };
+  typedef std::tr1::shared_ptr<OpSequencerStats> OpSequencerStatsRef;
+
   struct Op {
     utime_t start;
     uint64_t op;
@@ -138,6 +180,19 @@ private:
   public:
     Sequencer *parent;
     Mutex apply_lock;  // for apply mutual exclusion
+    FileStore *store;
+
+    // protected by op_tp lock
+    bool in_op_queue;  ///< in op_queue or being applied
+    uint64_t inflight_ops, inflight_bytes;  ///< reserved, not yet applied
+
+    /// may outlive us, in an ondisk completion
+    OpSequencerStatsRef stats;
+
+    bool has_queued() {
+      Mutex::Locker l(qlock);
+      return !q.empty();
+    }
     
     void queue_journal(uint64_t s) {
       Mutex::Locker l(qlock);
@@ -185,11 +240,19 @@ private:
       }
     }
 
-    OpSequencer()
+    OpSequencer(FileStore *fs, Sequencer *p)
       : qlock("FileStore::OpSequencer::qlock", false, false),
-	apply_lock("FileStore::OpSequencer::apply_lock", false, false) {}
+	parent(p),
+	apply_lock("FileStore::OpSequencer::apply_lock", false, false),
+	store(fs),
+	in_op_queue(false), inflight_ops(0), inflight_bytes(0),
+	stats(new OpSequencerStats) {
+      store->register_osr(this);
+    }
     ~OpSequencer() {
       assert(q.empty());
+      if (store)  // NULL once umount detached us; the store may be gone
+	store->unregister_osr(this);
     }
 
     const string& get_name() const {
@@ -199,7 +262,15 @@ private:
 
   friend ostream& operator<<(ostream& out, const OpSequencer& s);
 
+  // all live OpSequencers, for dump_op_sequencers
+  Mutex osr_lock;
+  set<OpSequencer*> osr_set;
+  void register_osr(OpSequencer *osr);
+  void unregister_osr(OpSequencer *osr);
+  AdminSocketHook *osr_hook;
+
   Sequencer default_osr;
+  /// round robin of sequencers with ops ready to apply; each at most once
   deque<OpSequencer*> op_queue;
   uint64_t op_queue_len, op_queue_bytes;
   Cond op_throttle_cond;
@@ -213,7 +284,12 @@ private:
       : ThreadPool::WorkQueue<OpSequencer>("FileStore::OpWQ", timeout, suicide_timeout, tp), store(fs) {}
 
     bool _enqueue(OpSequencer *osr) {
-      store->op_queue.push_back(osr);
+      // a sequencer's ops apply serially; don't hand the same one to a
+      // second thread just to have it block on apply_lock.
+      if (!osr->in_op_queue) {
+	osr->in_op_queue = true;
+	store->op_queue.push_back(osr);
+      }
       return true;
     }
     void _dequeue(OpSequencer *o) {
@@ -233,7 +309,7 @@ private:
       store->_do_op(osr);
     }
     void _process_finish(OpSequencer *osr) {
-      store->_finish_op(osr);
+      store->_finish_op(osr);  // requeues osr if it has more
     }
     void _clear() {
       assert(store->op_queue.empty());
@@ -246,11 +322,13 @@ private:
 	       Context *onreadable, Context *onreadable_sync,
 	       TrackedOpRef osd_op);
   void queue_op(OpSequencer *osr, Op *o);
-  void op_queue_reserve_throttle(Op *o);
-  void _op_queue_reserve_throttle(Op *o, const char *caller = 0);
-  void _op_queue_release_throttle(Op *o);
+  void op_queue_reserve_throttle(OpSequencer *osr, Op *o);
+  void _op_queue_reserve_throttle(OpSequencer *osr, Op *o,
+				  const char *caller = 0);
+  void _op_queue_release_throttle(OpSequencer *osr, Op *o);
   void _journaled_ahead(OpSequencer *osr, Op *o, Context *ondisk);
   friend class C_JournaledAhead;
+  friend struct C_OsrJournaled;
 
   // flusher thread
   Cond flusher_cond;
@@ -280,12 +358,8 @@ public:
   int lfn_listxattr(coll_t cid, const hobject_t& oid, char *names, size_t len);
   int lfn_truncate(coll_t cid, const hobject_t& oid, off_t length);
   int lfn_stat(coll_t cid, const hobject_t& oid, struct stat *buf);
-  int lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode,
-	       IndexedPath *path);
-  int lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode,
-	       IndexedPath *path, Index *index);
-  int lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode);
-  int lfn_open(coll_t cid, const hobject_t& oid, int flags);
+  int lfn_open(coll_t cid, const hobject_t& oid, bool create, FDRef *outfd,
+	       Index *index = 0);
   int lfn_link(coll_t c, coll_t cid, const hobject_t& o) ;
   int lfn_unlink(coll_t cid, const hobject_t& o, const SequencerPosition &spos);
 
@@ -301,6 +375,8 @@ public:
   int write_version_stamp();
   int version_stamp_is_valid(uint32_t *version);
   int update_version_stamp();
+  int read_omap_backend(string *backend);
+  int write_omap_backend(const string &backend);
   int read_op_seq(uint64_t *seq);
   int write_op_seq(int, uint64_t seq);
   int mount();
@@ -367,6 +443,7 @@ public:
   bool exists(coll_t cid, const hobject_t& oid);
   int stat(coll_t cid, const hobject_t& oid, struct stat *st);
   int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl);
+  bool _readahead(FDCache::FD &fd, uint64_t off, size_t len);
   int fiemap(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl);
 
   int _touch(coll_t cid, const hobject_t& oid);
@@ -454,11 +531,13 @@ public:
 
   int _create_collection(coll_t c);
   int _destroy_collection(coll_t c);
+  int _collection_expected_objects(coll_t c, uint64_t num);
   int _collection_add(coll_t c, coll_t ocid, const hobject_t& o,
 		      const SequencerPosition& spos);
   void dump_start(const std::string& file);
   void dump_stop();
   void dump_transactions(list<ObjectStore::Transaction*>& ls, uint64_t seq, OpSequencer *osr);
+  void dump_op_sequencers(Formatter *f);
 
 private:
   void _inject_failure();
@@ -468,11 +547,16 @@ private:
 		  const SequencerPosition &spos);
   int _omap_setkeys(coll_t cid, const hobject_t &hoid,
 		    const map<string, bufferlist> &aset,
-		    const SequencerPosition &spos);
+		    const SequencerPosition &spos,
+		    ObjectMap::Batch batch);
   int _omap_rmkeys(coll_t cid, const hobject_t &hoid, const set<string> &keys,
-		   const SequencerPosition &spos);
+		   const SequencerPosition &spos,
+		   ObjectMap::Batch batch);
   int _omap_setheader(coll_t cid, const hobject_t &hoid, const bufferlist &bl,
-		      const SequencerPosition &spos);
+		      const SequencerPosition &spos,
+		      ObjectMap::Batch batch);
+  /// write out and reset batch; an error here leaves the store inconsistent
+  void _omap_submit_batch(ObjectMap::Batch &batch);
 
   virtual const char** get_tracked_conf_keys() const;
   virtual void handle_conf_change(const struct md_config_t *conf,
@@ -501,6 +585,8 @@ private:
   int m_filestore_queue_max_bytes;
   int m_filestore_queue_committing_max_ops;
   int m_filestore_queue_committing_max_bytes;
+  int m_filestore_queue_max_ops_per_osr;
+  int m_filestore_queue_max_bytes_per_osr;
   bool m_filestore_do_dump;
   std::ofstream m_filestore_dump;
   JSONFormatter m_filestore_dump_fmt;
@@ -24,10 +24,14 @@
 
 const string HashIndex::SUBDIR_ATTR = "contents";
 const string HashIndex::IN_PROGRESS_OP_TAG = "in_progress_op";
+const string HashIndex::PRE_SPLIT_LEVELS_TAG = "pre_split_levels";
 
 int HashIndex::cleanup() {
+  int r = load_pre_split_levels();
+  if (r < 0)
+    return r;
   bufferlist bl;
-  int r = get_attr_path(vector<string>(), IN_PROGRESS_OP_TAG, bl);
+  r = get_attr_path(vector<string>(), IN_PROGRESS_OP_TAG, bl);
   if (r < 0) {
     // No in progress operations!
     return 0;
@@ -67,6 +71,10 @@ int HashIndex::_created(const vector<string> &path,
     return r;
 
   if (must_split(info)) {
+    if (split_queue) {
+      split_queue->queue_split(coll(), get_base_path(), path);
+      return 0;
+    }
     int r = initiate_split(path, info);
     if (r < 0)
       return r;
@@ -92,6 +100,14 @@ int HashIndex::_remove(const vector<string> &path,
   if (r < 0)
     return r;
   if (must_merge(info)) {
+    if (split_queue) {
+      // a background split owns the in progress tag until it is done;
+      // the merge can wait for a later remove
+      vector<string> op_path;
+      bool split;
+      if (get_in_progress_op(&op_path, &split) == 0)
+	return 0;
+    }
     r = initiate_merge(path, info);
     if (r < 0)
       return r;
@@ -143,6 +159,241 @@ int HashIndex::_collection_list_partial(const hobject_t &start,
   return list_by_hash(path, min_count, max_count, seq, next, ls);
 }
 
+int HashIndex::get_in_progress_op(vector<string> *path, bool *split) {
+  bufferlist bl;
+  int r = get_attr_path(vector<string>(), IN_PROGRESS_OP_TAG, bl);
+  if (r < 0)
+    return r;
+  bufferlist::iterator i = bl.begin();
+  InProgressOp in_progress(i);
+  *path = in_progress.path;
+  *split = in_progress.is_split();
+  return 0;
+}
+
+int HashIndex::pre_split(uint64_t expected_num_objs) {
+  uint64_t per_dir = (uint64_t)merge_threshold * 16 * split_multiplier;
+  if (per_dir == 0)
+    return 0;
+  int levels = 0;
+  uint64_t dirs = 1;
+  while (dirs * per_dir < expected_num_objs && levels < MAX_HASH_LEVEL) {
+    dirs *= 16;
+    ++levels;
+  }
+  if (levels == 0)
+    return 0;
+
+  // only lay out a collection nobody has used yet
+  vector<string> path;
+  subdir_info_s info;
+  int r = get_info(path, &info);
+  if (r < 0)
+    return r;
+  if (info.objs || info.subdirs)
+    return 0;
+  dout(10) << "pre_split " << coll() << " for " << expected_num_objs
+	   << " objects, " << levels << " levels" << dendl;
+  // record the depth first so that nothing merges away part of the tree
+  bufferlist bl;
+  ::encode((__u32)levels, bl);
+  r = add_attr_path(path, PRE_SPLIT_LEVELS_TAG, bl);
+  if (r < 0)
+    return r;
+  pre_split_levels = levels;
+  return create_tree(path, levels);
+}
+
+int HashIndex::load_pre_split_levels() {
+  if (pre_split_levels >= 0)
+    return 0;
+  bufferlist bl;
+  int r = get_attr_path(vector<string>(), PRE_SPLIT_LEVELS_TAG, bl);
+  if (r == -ENODATA) {
+    pre_split_levels = 0;
+    return 0;
+  }
+  if (r < 0)
+    return r;
+  __u32 levels;
+  bufferlist::iterator i = bl.begin();
+  ::decode(levels, i);
+  pre_split_levels = levels;
+  return 0;
+}
+
+int HashIndex::create_tree(const vector<string> &path, int levels) {
+  vector<string> child = path;
+  child.push_back("");
+  for (int i = 0; i < 16; ++i) {
+    child.back() = string(1, "0123456789ABCDEF"[i]);
+    int r = create_path(child);
+    if (r < 0 && r != -EEXIST)
+      return r;
+    if (levels > 1) {
+      r = create_tree(child, levels - 1);
+      if (r < 0)
+	return r;
+    } else {
+      subdir_info_s info;
+      info.hash_level = child.size();
+      r = set_info(child, info);
+      if (r < 0)
+	return r;
+    }
+  }
+  int r = fsync_dir(path);
+  if (r < 0)
+    return r;
+  // as with a split, info on path means everything below it is there
+  subdir_info_s info;
+  info.subdirs = 16;
+  info.hash_level = path.size();
+  return set_info(path, info);
+}
+
+int HashIndex::split_step(const vector<string> &path, bool *done) {
+  *done = false;
+  subdir_info_s info;
+  int r = get_info(path, &info);
+  if (r < 0)
+    return r;
+
+  vector<string> op_path;
+  bool split;
+  r = get_in_progress_op(&op_path, &split);
+  if (r == 0 && (!split || op_path != path)) {
+    // finish whatever else was going on first
+    r = cleanup();
+    if (r < 0)
+      return r;
+    r = get_info(path, &info);
+    if (r < 0)
+      return r;
+    r = -ENODATA;
+  }
+  if (r < 0) {
+    if (!must_split(info)) {
+      *done = true;
+      return 0;
+    }
+    dout(10) << "split_step " << coll() << " " << path << " starting, "
+	     << info.objs << " objects" << dendl;
+    r = initiate_split(path, info);
+    if (r < 0)
+      return r;
+  }
+
+  int level = info.hash_level;
+  map<string, hobject_t> objects;
+  r = list_objects(path, 0, 0, &objects);
+  if (r < 0)
+    return r;
+  set<string> subdirs;
+  r = list_subdirs(path, &subdirs);
+  if (r < 0)
+    return r;
+  map<string, map<string, hobject_t> > mapped;
+  for (map<string, hobject_t>::iterator i = objects.begin();
+       i != objects.end();
+       ++i) {
+    vector<string> new_path;
+    get_path_components(i->second, &new_path);
+    mapped[new_path[level]][i->first] = i->second;
+  }
+
+  // move one subdir's worth: one that exists (left over from a crash)
+  // or one big enough not to be merged straight back
+  for (map<string, map<string, hobject_t> >::iterator i = mapped.begin();
+       i != mapped.end();
+       ++i) {
+    bool exists = subdirs.count(i->first);
+    subdir_info_s info_new;
+    info_new.objs = i->second.size();
+    info_new.hash_level = level + 1;
+    if (!exists && must_merge(info_new))
+      continue;
+    dout(20) << "split_step " << coll() << " " << path << " moving "
+	     << i->second.size() << " objects to " << i->first << dendl;
+    return split_subdir(path, &info, i->first, i->second, &objects, exists);
+  }
+
+  // nothing left to move
+  info.objs = objects.size();
+  r = set_info(path, info);
+  if (r < 0)
+    return r;
+  r = fsync_dir(path);
+  if (r < 0)
+    return r;
+  dout(10) << "split_step " << coll() << " " << path << " done, "
+	   << info.objs << " objects stay" << dendl;
+  *done = true;
+  return end_split_or_merge(path);
+}
+
+int HashIndex::split_subdir(const vector<string> &path,
+			    subdir_info_s *info,
+			    const string &to_move,
+			    const map<string, hobject_t> &moving,
+			    map<string, hobject_t> *remaining,
+			    bool exists) {
+  vector<string> dst = path;
+  dst.push_back(to_move);
+  int r;
+  subdir_info_s dstinfo;
+  if (!exists || get_info(dst, &dstinfo) < 0) {
+    dstinfo = subdir_info_s();
+    dstinfo.hash_level = dst.size();
+  }
+  if (!exists) {
+    r = create_path(dst);
+    if (r < 0)
+      return r;
+    info->subdirs++;
+  }
+
+  for (map<string, hobject_t>::const_iterator j = moving.begin();
+       j != moving.end();
+       ++j) {
+    r = link_object(path, dst, j->second, j->first);
+    // May be a partially finished split
+    if (r < 0 && r != -EEXIST)
+      return r;
+  }
+  r = fsync_dir(dst);
+  if (r < 0)
+    return r;
+
+  // Presence of info must imply that all objects have been copied
+  map<string, hobject_t> in_dst;
+  r = list_objects(dst, 0, 0, &in_dst);
+  if (r < 0)
+    return r;
+  dstinfo.objs = in_dst.size();
+  r = set_info(dst, dstinfo);
+  if (r < 0)
+    return r;
+  r = fsync_dir(dst);
+  if (r < 0)
+    return r;
+
+  r = remove_objects(path, moving, remaining);
+  if (r < 0)
+    return r;
+  info->objs = remaining->size();
+  r = set_info(path, *info);
+  if (r < 0)
+    return r;
+  r = fsync_dir(path);
+  if (r < 0)
+    return r;
+
+  if (split_queue && must_split(dstinfo))
+    split_queue->queue_split(coll(), get_base_path(), dst);
+  return 0;
+}
+
 int HashIndex::start_split(const vector<string> &path) {
   bufferlist bl;
   InProgressOp op_tag(InProgressOp::SPLIT, path);
@@ -180,9 +431,14 @@ int HashIndex::set_info(const vector<string> &path, const subdir_info_s &info) {
 }
 
 bool HashIndex::must_merge(const subdir_info_s &info) {
-  return (info.hash_level > 0 &&
-	  info.objs < (unsigned)merge_threshold &&
-	  info.subdirs == 0);
+  if (!(info.hash_level > 0 &&
+	info.objs < (unsigned)merge_threshold &&
+	info.subdirs == 0))
+    return false;
+  // only worth the getxattr once a merge is otherwise due
+  if (load_pre_split_levels() < 0)
+    return false;
+  return (int)info.hash_level > pre_split_levels;
 }
 
 bool HashIndex::must_split(const subdir_info_s &info) {
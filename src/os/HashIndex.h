@@ -45,13 +45,24 @@
  * Subdirectories are created when the number of objects in a directory
  * exceed 32*merge_threshhold.  The number of objects in a directory 
  * is encoded as subdir_info_s in an xattr on the directory.
+ *
+ * If given a HashIndexSplitQueue, a directory that needs splitting is
+ * handed to it instead of being split inline by the create that pushed
+ * it over.  The queue's owner then calls split_step() repeatedly, with
+ * exclusive access to the index, to move one subdirectory's worth of
+ * objects at a time.  Between steps each object is in exactly one
+ * directory: a subdirectory that exists has all of its objects (and its
+ * info), so lookups and listings need not know a split is under way.
  */
+class HashIndexSplitQueue;
 class HashIndex : public LFNIndex {
 private:
   /// Attribute name for storing subdir info @see subdir_info_s
   static const string SUBDIR_ATTR;
   /// Attribute name for storing in progress op tag
   static const string IN_PROGRESS_OP_TAG;
+  /// Attribute name for storing the depth of a pre-split tree
+  static const string PRE_SPLIT_LEVELS_TAG;
   /// Size (bits) in object hash
   static const int PATH_HASH_LEN = 32;
   /// Max length of hashed path
@@ -65,6 +76,15 @@ private:
   int merge_threshold;
   int split_multiplier;
 
+  /// Where to send splits, or NULL to split inline
+  HashIndexSplitQueue *split_queue;
+
+  /**
+   * Subdirs at or above this level were laid out by pre_split() and are
+   * never merged; -1 until read from the root.
+   */
+  int pre_split_levels;
+
   /// Encodes current subdir state for determining when to split/merge.
   struct subdir_info_s {
     uint64_t objs;       ///< Objects in subdir.
@@ -134,15 +154,35 @@ public:
     const char *base_path, ///< [in] Path to the index root.
     int merge_at,          ///< [in] Merge threshhold.
     int split_multiple,	   ///< [in] Split threshhold.
-    uint32_t index_version)///< [in] Index version
+    uint32_t index_version,///< [in] Index version
+    HashIndexSplitQueue *split_queue = 0) ///< [in] Queue for background splits
     : LFNIndex(collection, base_path, index_version), merge_threshold(merge_at),
-      split_multiplier(split_multiple) {}
+      split_multiplier(split_multiple), split_queue(split_queue),
+      pre_split_levels(-1) {}
 
   /// @see CollectionIndex
   uint32_t collection_version() { return index_version; }
 
   /// @see CollectionIndex
   int cleanup();
+
+  /// @see CollectionIndex
+  int pre_split(uint64_t expected_num_objs);
+
+  /**
+   * Do the next batch of a background split of path
+   *
+   * Moves the objects bound for one subdirectory of path into it.
+   * Starts the split if it isn't in progress yet, and finishes it once
+   * nothing is left to move.  Sets *done when there is nothing more to
+   * do for path (including when it no longer needs splitting).
+   *
+   * @return Error Code, 0 on success
+   */
+  int split_step(
+    const vector<string> &path, ///< [in] Subdir being split
+    bool *done                  ///< [out] True if the split is finished
+    );
 	
 protected:
   int _init();
@@ -175,6 +215,21 @@ protected:
     hobject_t *next
     );
 private:
+  /// Read the in progress split or merge tag, -ENODATA if none
+  int get_in_progress_op(
+    vector<string> *path, ///< [out] path being split or merged
+    bool *split           ///< [out] true for split, false for merge
+    ); ///< @return Error Code, 0 on success
+
+  /// Read the pre-split depth into pre_split_levels if not yet known
+  int load_pre_split_levels(); ///< @return Error Code, 0 on success
+
+  /// Create an empty tree levels deep below path
+  int create_tree(
+    const vector<string> &path, ///< [in] Subdir to fill in
+    int levels                  ///< [in] Levels of subdirs to create
+    ); ///< @return Error Code, 0 on success
+
   /// Tag root directory at beginning of split
   int start_split(
     const vector<string> &path ///< [in] path to split
@@ -233,6 +288,16 @@ private:
     subdir_info_s info	       ///< [in] Info attached to path
     ); /// @return Error Code, 0 on success
 
+  /// Moves the objects of subdir to_move of path into it, @see split_step
+  int split_subdir(
+    const vector<string> &path,           ///< [in] Subdir being split
+    subdir_info_s *info,                  ///< [in,out] Info attached to path
+    const string &to_move,                ///< [in] Subdir to fill
+    const map<string, hobject_t> &moving, ///< [in] Objects bound for to_move
+    map<string, hobject_t> *remaining,    ///< [in,out] Objects in path
+    bool exists                           ///< [in] to_move already exists
+    ); /// @return Error Code, 0 on success
+
   /// Determine path components from hoid hash
   void get_path_components(
     const hobject_t &hoid, ///< [in] Object for which to get path components
@@ -279,4 +344,20 @@ private:
     ); ///< @return Error Code, 0 on success
 };
 
+/**
+ * Receives directories that a HashIndex wants split in the background.
+ *
+ * queue_split is called from inside an index operation, so it must not
+ * block on access to the index.
+ */
+class HashIndexSplitQueue {
+public:
+  virtual void queue_split(
+    coll_t c,                  ///< [in] Collection
+    const string &base_path,   ///< [in] Path to the index root
+    const vector<string> &path ///< [in] Subdir to split
+    ) = 0;
+  virtual ~HashIndexSplitQueue() {}
+};
+
 #endif
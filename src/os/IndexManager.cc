@@ -25,6 +25,7 @@
 #include "common/Cond.h"
 #include "common/config.h"
 #include "common/debug.h"
+#include "common/errno.h"
 #include "include/buffer.h"
 
 #include "IndexManager.h"
@@ -33,6 +34,10 @@
 #include "FlatIndex.h"
 #include "CollectionIndex.h"
 
+#define dout_subsys ceph_subsys_filestore
+#undef dout_prefix
+#define dout_prefix *_dout << "index_manager "
+
 int do_getxattr(const char *fn, const char *name, void *val, size_t size);
 int do_setxattr(const char *fn, const char *name, const void *val, size_t size);
 
@@ -67,7 +72,8 @@ void IndexManager::put_index(coll_t c) {
   Mutex::Locker l(lock);
   assert(col_indices.count(c));
   col_indices.erase(c);
-  cond.Signal();
+  // waiters may be after different collections
+  cond.SignalAll();
 }
 
 int IndexManager::init_index(coll_t c, const char *path, uint32_t version) {
@@ -101,7 +107,8 @@ int IndexManager::build_index(coll_t c, const char *path, Index *index) {
     case CollectionIndex::HOBJECT_WITH_POOL: {
       // Must be a HashIndex
       *index = Index(new HashIndex(c, path, g_conf->filestore_merge_threshold,
-				   g_conf->filestore_split_multiple, version), 
+				   g_conf->filestore_split_multiple, version,
+				   async_split ? this : 0),
 		     RemoveOnDelete(c, this));
       return 0;
     }
@@ -112,7 +119,8 @@ int IndexManager::build_index(coll_t c, const char *path, Index *index) {
     // No need to check
     *index = Index(new HashIndex(c, path, g_conf->filestore_merge_threshold,
 				 g_conf->filestore_split_multiple,
-				 CollectionIndex::HOBJECT_WITH_POOL), 
+				 CollectionIndex::HOBJECT_WITH_POOL,
+				 async_split ? this : 0),
 		   RemoveOnDelete(c, this));
     return 0;
   }
@@ -121,7 +129,7 @@ int IndexManager::build_index(coll_t c, const char *path, Index *index) {
 int IndexManager::get_index(coll_t c, const char *path, Index *index) {
   Mutex::Locker l(lock);
   while (1) {
-    if (!col_indices.count(c)) {
+    if (!col_indices.count(c) && !(split_waiting && split_coll == c)) {
       int r = build_index(c, path, index);
       if (r < 0)
 	return r;
@@ -129,8 +137,108 @@ int IndexManager::get_index(coll_t c, const char *path, Index *index) {
       col_indices[c] = (*index);
       break;
     } else {
+      waiters[c]++;
       cond.Wait(lock);
+      if (--waiters[c] == 0)
+	waiters.erase(c);
     }
   }
   return 0;
 }
+
+bool IndexManager::get_index_for_split(coll_t c, const char *path, Index *index) {
+  Mutex::Locker l(lock);
+  // take the next turn, or a busy collection would starve the split
+  split_waiting = true;
+  split_coll = c;
+  while (!split_stop && col_indices.count(c))
+    cond.Wait(lock);
+  split_waiting = false;
+  cond.SignalAll();
+  if (split_stop)
+    return false;
+  int r = build_index(c, path, index);
+  if (r < 0)
+    return false;
+  (*index)->set_ref(*index);
+  col_indices[c] = (*index);
+  return true;
+}
+
+void IndexManager::queue_split(coll_t c, const string &base_path,
+			       const vector<string> &path) {
+  Mutex::Locker l(lock);
+  if (!split_queued.insert(make_pair(c, path)).second)
+    return;
+  dout(10) << "queue_split " << c << " " << path << dendl;
+  split_queue.push_back(split_item_t(c, base_path, path));
+  split_cond.Signal();
+}
+
+int IndexManager::get_num_queued_splits() {
+  Mutex::Locker l(lock);
+  return split_queued.size();
+}
+
+void IndexManager::start_split_thread() {
+  if (!async_split)
+    return;
+  Mutex::Locker l(lock);
+  split_stop = false;
+  split_thread.create();
+}
+
+void IndexManager::stop_split_thread() {
+  if (!async_split)
+    return;
+  {
+    Mutex::Locker l(lock);
+    split_stop = true;
+    split_cond.Signal();
+    cond.SignalAll();
+  }
+  split_thread.join();
+  Mutex::Locker l(lock);
+  split_queue.clear();
+  split_queued.clear();
+}
+
+void IndexManager::split_entry() {
+  lock.Lock();
+  while (!split_stop) {
+    if (split_queue.empty()) {
+      split_cond.Wait(lock);
+      continue;
+    }
+    split_item_t item = split_queue.front();
+    split_queue.pop_front();
+    lock.Unlock();
+
+    int steps = 0;
+    while (1) {
+      Index index;
+      if (!get_index_for_split(item.c, item.base_path.c_str(), &index))
+	break;
+      HashIndex *hindex = dynamic_cast<HashIndex*>(index.get());
+      if (!hindex)
+	break;
+      bool done;
+      int r = hindex->split_step(item.path, &done);
+      index.reset();
+      steps++;
+      if (r < 0) {
+	derr << "split of " << item.c << " " << item.path
+	     << " failed: " << cpp_strerror(r) << dendl;
+	break;
+      }
+      if (done)
+	break;
+    }
+    dout(10) << "split_entry " << item.c << " " << item.path << " took "
+	     << steps << " steps" << dendl;
+
+    lock.Lock();
+    split_queued.erase(make_pair(item.c, item.path));
+  }
+  lock.Unlock();
+}
@@ -19,6 +19,7 @@
 
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/Thread.h"
 #include "common/config.h"
 #include "common/debug.h"
 
@@ -43,14 +44,51 @@ typedef std::tr1::shared_ptr<CollectionIndex> Index;
  * carry a reference to the parrent index.  Once all
  * shared_ptr<CollectionIndex> references have expired, the destructor
  * removes the weak_ptr from col_indices and wakes waiters.
+ *
+ * With async_split, HashIndexes queue the directories they want split
+ * here, and a background thread splits them one HashIndex::split_step
+ * at a time.  It only takes an index that nobody else is waiting for,
+ * so client ops wait for at most one step rather than a whole split.
  */
-class IndexManager {
+class IndexManager : public HashIndexSplitQueue {
   Mutex lock; ///< Lock for Index Manager
   Cond cond;  ///< Cond for waiters on col_indices
   bool upgrade;
 
   /// Currently in use CollectionIndices
   map<coll_t,std::tr1::weak_ptr<CollectionIndex> > col_indices;
+  /// Number of get_index callers blocked on each collection
+  map<coll_t,int> waiters;
+  /// Split thread wants split_coll next; get_index callers queue behind it
+  bool split_waiting;
+  coll_t split_coll;
+
+  /// Splits queued for the split thread
+  struct split_item_t {
+    coll_t c;
+    string base_path;
+    vector<string> path;
+    split_item_t(coll_t c, const string &b, const vector<string> &p)
+      : c(c), base_path(b), path(p) {}
+  };
+  bool async_split;
+  bool split_stop;
+  list<split_item_t> split_queue;
+  set<pair<coll_t, vector<string> > > split_queued; ///< dedups split_queue
+  Cond split_cond;  ///< Signals split thread on queue or stop
+
+  void split_entry();
+  struct SplitThread : public Thread {
+    IndexManager *im;
+    SplitThread(IndexManager *im) : im(im) {}
+    void *entry() {
+      im->split_entry();
+      return 0;
+    }
+  } split_thread;
+
+  /// Like get_index, but goes ahead of other waiters for c.  false if stopping.
+  bool get_index_for_split(coll_t c, const char *path, Index *index);
 
   /// Cleans up state for c @see RemoveOnDelete
   void put_index(
@@ -85,8 +123,31 @@ class IndexManager {
   int build_index(coll_t c, const char *path, Index *index);
 public:
   /// Constructor
-  IndexManager(bool upgrade) : lock("IndexManager lock"),
-			       upgrade(upgrade) {}
+  IndexManager(bool upgrade, bool async_split = false)
+    : lock("IndexManager lock"),
+      upgrade(upgrade),
+      split_waiting(false),
+      async_split(async_split),
+      split_stop(false),
+      split_thread(this) {}
+
+  /// Start the background split thread (if async_split)
+  void start_split_thread();
+
+  /**
+   * Stop the background split thread
+   *
+   * Queued splits are dropped, and a split in progress is left tagged
+   * for HashIndex::cleanup() to finish at the next mount.
+   */
+  void stop_split_thread();
+
+  /// @see HashIndexSplitQueue
+  void queue_split(coll_t c, const string &base_path,
+		   const vector<string> &path);
+
+  /// Number of splits waiting for the split thread
+  int get_num_queued_splits();
 
   /**
    * Reserve and return index for c
@@ -0,0 +1,15 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "KeyValueDB.h"
+#include "LevelDBStore.h"
+#include "MemDB.h"
+
+KeyValueDB *KeyValueDB::create(const string &type, const string &dir)
+{
+  if (type == "leveldb")
+    return new LevelDBStore(dir);
+  if (type == "memdb")
+    return new MemDB(dir);
+  return NULL;
+}
@@ -19,6 +19,17 @@ using std::string;
  */
 class KeyValueDB {
 public:
+  /**
+   * Creates a store of the given type ("leveldb" or "memdb") at dir
+   *
+   * The store must be init()ed before use.
+   * @return NULL for an unknown type
+   */
+  static KeyValueDB *create(const string &type, const string &dir);
+
+  /// Opens (creating if need be) the store, describing any error in out
+  virtual int init(ostream &out) { return 0; }
+
   class TransactionImpl {
   public:
     /// Set Keys
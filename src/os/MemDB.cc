@@ -0,0 +1,198 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#include "MemDB.h"
+
+#include <set>
+#include <map>
+#include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "include/compat.h"
+#include "include/encoding.h"
+#include "common/errno.h"
+using std::string;
+
+int MemDB::init(ostream &out)
+{
+  if (::mkdir(path.c_str(), 0755) < 0 && errno != EEXIST) {
+    int r = -errno;
+    out << "failed to create " << path << ": " << cpp_strerror(r) << std::endl;
+    return r;
+  }
+  return _load(out);
+}
+
+int MemDB::_load(ostream &out)
+{
+  string fn = path + "/memdb";
+  bufferlist bl;
+  string err;
+  int r = bl.read_file(fn.c_str(), &err);
+  if (r == -ENOENT)
+    return 0;  // new store
+  if (r < 0) {
+    out << "failed to read " << fn << ": " << err << std::endl;
+    return r;
+  }
+  mdb_ref m(new mdb_t);
+  try {
+    bufferlist::iterator p = bl.begin();
+    ::decode(*m, p);
+  } catch (buffer::error& e) {
+    out << "failed to decode " << fn << ": " << e.what() << std::endl;
+    return -EINVAL;
+  }
+  Mutex::Locker l(lock);
+  data = m;
+  return 0;
+}
+
+int MemDB::_save(ostream *out)
+{
+  Mutex::Locker l(save_lock);
+  mdb_ref m;
+  {
+    Mutex::Locker l(lock);
+    m = data;  // writers copy it rather than change it under us
+  }
+  bufferlist bl;
+  ::encode(*m, bl);
+  m.reset();
+
+  string fn = path + "/memdb";
+  string tmp = fn + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0)
+    return -errno;
+  int r = bl.write_fd(fd);
+  if (r == 0 && ::fsync(fd) < 0)
+    r = -errno;
+  TEMP_FAILURE_RETRY(::close(fd));
+  if (r == 0 && ::rename(tmp.c_str(), fn.c_str()) < 0)
+    r = -errno;
+  return r;
+}
+
+MemDB::mdb_t &MemDB::_mutable()
+{
+  if (!data.unique())
+    data.reset(new mdb_t(*data));
+  return *data;
+}
+
+int MemDB::submit_transaction(KeyValueDB::Transaction t)
+{
+  MemDBTransactionImpl *_t =
+    static_cast<MemDBTransactionImpl *>(t.get());
+  if (_t->ops.empty())
+    return 0;
+  Mutex::Locker l(lock);
+  mdb_t &m = _mutable();
+  for (list<MemDBTransactionImpl::Op>::iterator i = _t->ops.begin();
+       i != _t->ops.end();
+       ++i) {
+    switch (i->type) {
+    case MemDBTransactionImpl::SET:
+      m[make_pair(i->prefix, i->key)] = i->bl;
+      break;
+    case MemDBTransactionImpl::RMKEY:
+      m.erase(make_pair(i->prefix, i->key));
+      break;
+    case MemDBTransactionImpl::RMPREFIX:
+      {
+	mdb_t::iterator p = m.lower_bound(make_pair(i->prefix, string()));
+	while (p != m.end() && p->first.first == i->prefix)
+	  m.erase(p++);
+      }
+      break;
+    default:
+      assert(0);
+    }
+  }
+  return 0;
+}
+
+int MemDB::submit_transaction_sync(KeyValueDB::Transaction t)
+{
+  int r = submit_transaction(t);
+  if (r < 0)
+    return r;
+  return _save(NULL);
+}
+
+int MemDB::get(
+    const string &prefix,
+    const std::set<string> &keys,
+    std::map<string, bufferlist> *out)
+{
+  Mutex::Locker l(lock);
+  for (std::set<string>::const_iterator i = keys.begin();
+       i != keys.end();
+       ++i) {
+    mdb_t::iterator p = data->find(make_pair(prefix, *i));
+    if (p != data->end())
+      out->insert(make_pair(*i, p->second));
+  }
+  return 0;
+}
+
+void MemDB::MemDBIteratorImpl::seek(int how, const std::pair<string, string> &k)
+{
+  if (db) {
+    Mutex::Locker l(db->lock);
+    _seek(*db->data, how, k);
+  } else {
+    _seek(*snap, how, k);
+  }
+}
+
+void MemDB::MemDBIteratorImpl::_seek(const mdb_t &m, int how,
+				     const std::pair<string, string> &k)
+{
+  mdb_t::const_iterator p;
+  switch (how) {
+  case FIRST:
+    p = m.begin();
+    break;
+  case LAST:
+  case LAST_IN:
+    if (how == LAST) {
+      p = m.end();
+    } else {
+      string past = k.first;
+      past.push_back(0);
+      p = m.lower_bound(make_pair(past, string()));
+    }
+    if (p == m.begin())
+      p = m.end();
+    else
+      --p;
+    break;
+  case LOWER:
+    p = m.lower_bound(k);
+    break;
+  case UPPER:
+  case NEXT:
+    p = m.upper_bound(k);
+    break;
+  case PREV:
+    p = m.lower_bound(k);
+    if (p == m.begin())
+      p = m.end();
+    else
+      --p;
+    break;
+  default:
+    assert(0);
+  }
+  ready = (p != m.end());
+  if (ready) {
+    cur = p->first;
+    cur_value = p->second;
+  } else {
+    cur_value.clear();
+  }
+}
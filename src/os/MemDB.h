@@ -0,0 +1,179 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef MEM_DB_H
+#define MEM_DB_H
+
+#include "include/types.h"
+#include "include/buffer.h"
+#include "KeyValueDB.h"
+#include "common/Mutex.h"
+#include <map>
+#include <set>
+#include <string>
+#include <tr1/memory>
+
+/**
+ * Keeps the whole KeyValueDB in memory
+ *
+ * For benchmarking DBObjectMap without an LSM engine underneath, and for
+ * small stores.  Thread safe.  Iterators are positioned by key, so they
+ * survive concurrent changes; snapshot iterators share the map, which is
+ * copied on the next write while any snapshot is open.
+ *
+ * submit_transaction_sync() writes an image of the whole store to
+ * <path>/memdb (by rename, so a crash leaves the previous image), and
+ * init() loads it.  Anything submitted since the last sync submit is lost
+ * on a crash, which is what FileStore expects of its omap between
+ * commits, but each sync costs a full copy of the store to disk.
+ */
+class MemDB : public KeyValueDB {
+public:
+  typedef std::map<std::pair<string, string>, bufferlist> mdb_t;
+  typedef std::tr1::shared_ptr<mdb_t> mdb_ref;
+
+private:
+  string path;
+  Mutex lock;        ///< guards data
+  mdb_ref data;      ///< shared with open snapshots
+  Mutex save_lock;   ///< orders image writes
+
+  /// lock held; the map, unshared so that we can modify it
+  mdb_t &_mutable();
+  int _save(ostream *out);
+  int _load(ostream &out);
+
+public:
+  MemDB(const string &path)
+    : path(path), lock("MemDB::lock"), data(new mdb_t),
+      save_lock("MemDB::save_lock") {}
+
+  /// Creates path if needed and loads the image, if any
+  int init(ostream &out);
+
+  class MemDBTransactionImpl : public KeyValueDB::TransactionImpl {
+  public:
+    enum { SET, RMKEY, RMPREFIX };
+    struct Op {
+      int type;
+      string prefix, key;
+      bufferlist bl;
+      Op(int type, const string &prefix, const string &key)
+	: type(type), prefix(prefix), key(key) {}
+    };
+    list<Op> ops;
+
+    void set(
+      const string &prefix,
+      const string &k,
+      const bufferlist &bl) {
+      ops.push_back(Op(SET, prefix, k));
+      ops.back().bl = bl;
+      ops.back().bl.rebuild();  // our own copy, as leveldb would keep
+    }
+    void rmkey(
+      const string &prefix,
+      const string &k) {
+      ops.push_back(Op(RMKEY, prefix, k));
+    }
+    void rmkeys_by_prefix(
+      const string &prefix) {
+      ops.push_back(Op(RMPREFIX, prefix, string()));
+    }
+  };
+
+  KeyValueDB::Transaction get_transaction() {
+    return std::tr1::shared_ptr< MemDBTransactionImpl >(
+      new MemDBTransactionImpl);
+  }
+
+  int submit_transaction(KeyValueDB::Transaction t);
+  int submit_transaction_sync(KeyValueDB::Transaction t);
+
+  int get(
+    const string &prefix,
+    const std::set<string> &key,
+    std::map<string, bufferlist> *out
+    );
+
+  class MemDBIteratorImpl : public KeyValueDB::WholeSpaceIteratorImpl {
+    MemDB *db;        ///< live iterator; NULL for a snapshot
+    mdb_ref snap;     ///< snapshot iterator
+    bool ready;
+    std::pair<string, string> cur;
+    bufferlist cur_value;
+
+    enum { FIRST, LAST, LAST_IN, LOWER, UPPER, NEXT, PREV };
+    void seek(int how, const std::pair<string, string> &k);
+    void _seek(const mdb_t &m, int how, const std::pair<string, string> &k);
+
+  public:
+    MemDBIteratorImpl(MemDB *db, mdb_ref snap)
+      : db(db), snap(snap), ready(false) {}
+
+    int seek_to_first() {
+      seek(FIRST, std::pair<string, string>());
+      return 0;
+    }
+    int seek_to_first(const string &prefix) {
+      seek(LOWER, make_pair(prefix, string()));
+      return 0;
+    }
+    int seek_to_last() {
+      seek(LAST, std::pair<string, string>());
+      return 0;
+    }
+    int seek_to_last(const string &prefix) {
+      seek(LAST_IN, make_pair(prefix, string()));
+      return 0;
+    }
+    int upper_bound(const string &prefix, const string &after) {
+      seek(UPPER, make_pair(prefix, after));
+      return 0;
+    }
+    int lower_bound(const string &prefix, const string &to) {
+      seek(LOWER, make_pair(prefix, to));
+      return 0;
+    }
+    bool valid() {
+      return ready;
+    }
+    int next() {
+      if (ready)
+	seek(NEXT, cur);
+      return 0;
+    }
+    int prev() {
+      if (ready)
+	seek(PREV, cur);
+      return 0;
+    }
+    string key() {
+      return ready ? cur.second : string();
+    }
+    pair<string,string> raw_key() {
+      return ready ? cur : make_pair(string(), string());
+    }
+    bufferlist value() {
+      return ready ? cur_value : bufferlist();
+    }
+    int status() {
+      return 0;
+    }
+  };
+
+  friend class MemDBIteratorImpl;
+
+protected:
+  WholeSpaceIterator _get_iterator() {
+    return std::tr1::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+      new MemDBIteratorImpl(this, mdb_ref()));
+  }
+
+  WholeSpaceIterator _get_snapshot_iterator() {
+    Mutex::Locker l(lock);
+    return std::tr1::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+      new MemDBIteratorImpl(NULL, data));
+  }
+};
+
+#endif
@@ -28,18 +28,41 @@
  */
 class ObjectMap {
 public:
+  /**
+   * Batch
+   *
+   * Collects the writes of several set_keys(), rm_keys() and
+   * set_header() calls (e.g., those of one ObjectStore transaction) so
+   * that they reach the backend as a single write.  Nothing added to a
+   * batch is visible until submit_batch(); the caller must submit before
+   * any other call that depends on it.
+   */
+  class BatchImpl {
+  public:
+    virtual ~BatchImpl() {}
+  };
+  typedef std::tr1::shared_ptr<BatchImpl> Batch;
+
+  /// @return a new batch, or null if this map doesn't batch writes
+  virtual Batch get_batch() { return Batch(); }
+
+  /// Submit the writes collected in batch
+  virtual int submit_batch(Batch batch) { return 0; }
+
   /// Set keys and values from specified map
   virtual int set_keys(
     const hobject_t &hoid,              ///< [in] object containing map
     const map<string, bufferlist> &set,  ///< [in] key to value map to set
-    const SequencerPosition *spos=0     ///< [in] sequencer position
+    const SequencerPosition *spos=0,    ///< [in] sequencer position
+    Batch batch=Batch()                 ///< [in] batch to add to, if any
     ) = 0;
 
   /// Set header
   virtual int set_header(
     const hobject_t &hoid,              ///< [in] object containing map
     const bufferlist &bl,               ///< [in] header to set
-    const SequencerPosition *spos=0     ///< [in] sequencer position
+    const SequencerPosition *spos=0,    ///< [in] sequencer position
+    Batch batch=Batch()                 ///< [in] batch to add to, if any
     ) = 0;
 
   /// Retrieve header
@@ -58,7 +81,8 @@ public:
   virtual int rm_keys(
     const hobject_t &hoid,              ///< [in] object containing map
     const set<string> &to_clear,        ///< [in] Keys to clear
-    const SequencerPosition *spos=0     ///< [in] sequencer position
+    const SequencerPosition *spos=0,    ///< [in] sequencer position
+    Batch batch=Batch()                 ///< [in] batch to add to, if any
     ) = 0;
 
   /// Get all keys and values
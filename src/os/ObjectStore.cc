@@ -221,6 +221,16 @@ void ObjectStore::Transaction::dump(ceph::Formatter *f)
       }
       break;
 
+    case Transaction::OP_COLL_EXPECTED_OBJECTS:
+      {
+	coll_t cid = i.get_cid();
+	uint64_t num = i.get_length();
+	f->dump_string("op_name", "coll_expected_objects");
+	f->dump_stream("collection") << cid;
+	f->dump_unsigned("num_objects", num);
+      }
+      break;
+
     case Transaction::OP_RMCOLL:
       {
 	coll_t cid = i.get_cid();
@@ -367,6 +377,203 @@ void ObjectStore::Transaction::dump(ceph::Formatter *f)
   f->close_section();
 }
 
+void ObjectStore::Transaction::encode_legacy(bufferlist& bl)
+{
+  if (use_tbl) {
+    encode(bl);
+    return;
+  }
+
+  bufferlist t;
+  uint32_t data_off_in_tbl = 0;
+  iterator i = begin();
+  while (i.have_op()) {
+    __u32 op = i.get_op();
+    ::encode(op, t);
+    switch (op) {
+    case OP_NOP:
+    case OP_STARTSYNC:
+      break;
+
+    case OP_TOUCH:
+    case OP_REMOVE:
+    case OP_RMATTRS:
+    case OP_COLL_REMOVE:
+    case OP_OMAP_CLEAR:
+      ::encode(i.get_cid(), t);
+      ::encode(i.get_oid(), t);
+      break;
+
+    case OP_WRITE:
+      {
+	::encode(i.get_cid(), t);
+	::encode(i.get_oid(), t);
+	::encode(i.get_length(), t);
+	::encode(i.get_length(), t);
+	bufferlist data;
+	i.get_bl(data);
+	if (largest_data_len && !data_off_in_tbl &&
+	    data.length() == largest_data_len)
+	  data_off_in_tbl = t.length() + sizeof(__u32);
+	::encode(data, t);
+      }
+      break;
+
+    case OP_ZERO:
+    case OP_TRIMCACHE:
+      ::encode(i.get_cid(), t);
+      ::encode(i.get_oid(), t);
+      ::encode(i.get_length(), t);
+      ::encode(i.get_length(), t);
+      break;
+
+    case OP_TRUNCATE:
+      ::encode(i.get_cid(), t);
+      ::encode(i.get_oid(), t);
+      ::encode(i.get_length(), t);
+      break;
+
+    case OP_SETATTR:
+      {
+	::encode(i.get_cid(), t);
+	::encode(i.get_oid(), t);
+	::encode(i.get_attrname(), t);
+	bufferlist val;
+	i.get_bl(val);
+	::encode(val, t);
+      }
+      break;
+
+    case OP_SETATTRS:
+      {
+	::encode(i.get_cid(), t);
+	::encode(i.get_oid(), t);
+	map<string, bufferptr> aset;
+	i.get_attrset(aset);
+	::encode(aset, t);
+      }
+      break;
+
+    case OP_RMATTR:
+      ::encode(i.get_cid(), t);
+      ::encode(i.get_oid(), t);
+      ::encode(i.get_attrname(), t);
+      break;
+
+    case OP_CLONE:
+      ::encode(i.get_cid(), t);
+      ::encode(i.get_oid(), t);
+      ::encode(i.get_oid(), t);
+      break;
+
+    case OP_CLONERANGE:
+      ::encode(i.get_cid(), t);
+      ::encode(i.get_oid(), t);
+      ::encode(i.get_oid(), t);
+      ::encode(i.get_length(), t);
+      ::encode(i.get_length(), t);
+      break;
+
+    case OP_CLONERANGE2:
+      ::encode(i.get_cid(), t);
+      ::encode(i.get_oid(), t);
+      ::encode(i.get_oid(), t);
+      ::encode(i.get_length(), t);
+      ::encode(i.get_length(), t);
+      ::encode(i.get_length(), t);
+      break;
+
+    case OP_MKCOLL:
+    case OP_RMCOLL:
+      ::encode(i.get_cid(), t);
+      break;
+
+    case OP_COLL_EXPECTED_OBJECTS:
+      ::encode(i.get_cid(), t);
+      ::encode(i.get_length(), t);
+      break;
+
+    case OP_COLL_ADD:
+    case OP_COLL_MOVE:
+      ::encode(i.get_cid(), t);
+      ::encode(i.get_cid(), t);
+      ::encode(i.get_oid(), t);
+      break;
+
+    case OP_COLL_SETATTR:
+      {
+	::encode(i.get_cid(), t);
+	::encode(i.get_attrname(), t);
+	bufferlist val;
+	i.get_bl(val);
+	::encode(val, t);
+      }
+      break;
+
+    case OP_COLL_RMATTR:
+      ::encode(i.get_cid(), t);
+      ::encode(i.get_attrname(), t);
+      break;
+
+    case OP_COLL_SETATTRS:
+      {
+	::encode(i.get_cid(), t);
+	map<string, bufferptr> aset;
+	i.get_attrset(aset);
+	::encode(aset, t);
+      }
+      break;
+
+    case OP_COLL_RENAME:
+      ::encode(i.get_cid(), t);
+      ::encode(i.get_cid(), t);
+      break;
+
+    case OP_OMAP_SETKEYS:
+      {
+	::encode(i.get_cid(), t);
+	::encode(i.get_oid(), t);
+	map<string, bufferlist> aset;
+	i.get_attrset(aset);
+	::encode(aset, t);
+      }
+      break;
+
+    case OP_OMAP_RMKEYS:
+      {
+	::encode(i.get_cid(), t);
+	::encode(i.get_oid(), t);
+	set<string> keys;
+	i.get_keyset(keys);
+	::encode(keys, t);
+      }
+      break;
+
+    case OP_OMAP_SETHEADER:
+      {
+	::encode(i.get_cid(), t);
+	::encode(i.get_oid(), t);
+	bufferlist header;
+	i.get_bl(header);
+	::encode(header, t);
+      }
+      break;
+
+    default:
+      assert(0 == "unknown op");
+    }
+  }
+
+  ENCODE_START(6, 5, bl);
+  ::encode(ops, bl);
+  ::encode(pad_unused_bytes, bl);
+  ::encode(largest_data_len, bl);
+  ::encode(largest_data_off, bl);
+  ::encode(data_off_in_tbl, bl);
+  ::encode(t, bl);
+  ENCODE_FINISH(bl);
+}
+
 void ObjectStore::Transaction::generate_test_instances(list<ObjectStore::Transaction*>& o)
 {
   o.push_back(new Transaction);
@@ -67,6 +67,19 @@ enum {
   l_os_commit_len,
   l_os_commit_lat,
   l_os_j_full,
+  l_os_j_batch_wait,
+  l_os_j_batch_hist,
+  l_os_j_aio_inflight,
+  l_os_j_aio_inflight_bytes,
+  l_os_fdcache_hit,
+  l_os_fdcache_miss,
+  l_os_xattr_cache_hit,
+  l_os_xattr_cache_miss,
+  l_os_readahead,
+  l_os_readahead_bytes,
+  l_os_readahead_hit,
+  l_os_read_cache_hit,
+  l_os_read_cache_miss,
   l_os_last,
 };
 
@@ -152,17 +165,113 @@ public:
       OP_OMAP_SETKEYS = 32, // cid, attrset
       OP_OMAP_RMKEYS = 33,  // cid, keyset
       OP_OMAP_SETHEADER = 34, // cid, header
+      OP_COLL_EXPECTED_OBJECTS = 35, // cid, num objects
     };
 
   private:
+    /**
+     * Since v7 a transaction is encoded as
+     *
+     *  - op_bl: one fixed-size Op per op, back to back
+     *  - data_bl: the op's variable-length arguments (attr names and
+     *    values, write payloads, key sets), in op order
+     *  - colls, objects: each collection and object named in the
+     *    transaction, once; the Ops refer to them by index
+     *
+     * so that building and applying a transaction doesn't encode and
+     * decode the same coll_t and hobject_t over and over, and write
+     * payloads are only ever referenced, never copied.
+     *
+     * Older encodings (a single stream of individually encoded fields,
+     * in tbl) are still decoded, so that old journals replay.
+     */
+    struct Op {
+      ceph_le32 op;
+      ceph_le32 cid[2];  ///< indices into colls, in the order they are read
+      ceph_le32 oid[2];  ///< indices into objects, in the order they are read
+      ceph_le64 num[3];  ///< offsets, lengths, etc., in the order they are read
+    } __attribute__ ((packed));
+    static const __u32 NO_ID = (__u32)-1;
+
     uint64_t ops;
     uint64_t pad_unused_bytes;
+    /// largest write payload; its offset is within data_bl (tbl if use_tbl)
     uint32_t largest_data_len, largest_data_off, largest_data_off_in_tbl;
+    bufferlist op_bl;
+    bufferlist data_bl;
+    vector<coll_t> colls;
+    vector<hobject_t> objects;
+    /// reverse of colls/objects, for building; not encoded (see _index())
+    map<coll_t, __u32> coll_index;
+    map<hobject_t, __u32> object_index;
+
+    // decoded from a pre-v7 encoding
+    bool use_tbl;
     bufferlist tbl;
     bool sobject_encoding;
     int64_t pool_override;
     bool use_pool_override;
 
+    /// rebuild the reverse indices of a decoded transaction we add to
+    void _index() {
+      if (coll_index.size() < colls.size()) {
+	coll_index.clear();
+	for (__u32 i = 0; i < colls.size(); ++i)
+	  coll_index[colls[i]] = i;
+      }
+      if (object_index.size() < objects.size()) {
+	object_index.clear();
+	for (__u32 i = 0; i < objects.size(); ++i)
+	  object_index[objects[i]] = i;
+      }
+    }
+    __u32 _get_coll_id(const coll_t& c) {
+      _index();
+      map<coll_t, __u32>::iterator p = coll_index.lower_bound(c);
+      if (p != coll_index.end() && p->first == c)
+	return p->second;
+      __u32 id = colls.size();
+      colls.push_back(c);
+      coll_index.insert(p, make_pair(c, id));
+      return id;
+    }
+    __u32 _get_object_id(const hobject_t& o) {
+      _index();
+      map<hobject_t, __u32>::iterator p = object_index.lower_bound(o);
+      if (p != object_index.end() && p->first == o)
+	return p->second;
+      __u32 id = objects.size();
+      objects.push_back(o);
+      object_index.insert(p, make_pair(o, id));
+      return id;
+    }
+    Op _start_op(__u32 type) {
+      assert(!use_tbl);
+      Op o;
+      o.op = type;
+      o.cid[0] = o.cid[1] = NO_ID;
+      o.oid[0] = o.oid[1] = NO_ID;
+      o.num[0] = o.num[1] = o.num[2] = 0;
+      return o;
+    }
+    void _finish_op(const Op& o) {
+      op_bl.append((const char *)&o, sizeof(o));
+      ops++;
+    }
+    /// start an op on one object
+    Op _start_op(__u32 type, const coll_t& cid, const hobject_t& oid) {
+      Op o = _start_op(type);
+      o.cid[0] = _get_coll_id(cid);
+      o.oid[0] = _get_object_id(oid);
+      return o;
+    }
+    /// start an op on one collection
+    Op _start_op(__u32 type, const coll_t& cid) {
+      Op o = _start_op(type);
+      o.cid[0] = _get_coll_id(cid);
+      return o;
+    }
+
   public:
     void set_pool_override(int64_t pool) {
       pool_override = pool;
@@ -170,26 +279,64 @@ public:
 
     void swap(Transaction& other) {
       std::swap(ops, other.ops);
+      std::swap(pad_unused_bytes, other.pad_unused_bytes);
       std::swap(largest_data_len, other.largest_data_len);
       std::swap(largest_data_off, other.largest_data_off);
       std::swap(largest_data_off_in_tbl, other.largest_data_off_in_tbl);
+      op_bl.swap(other.op_bl);
+      data_bl.swap(other.data_bl);
+      colls.swap(other.colls);
+      objects.swap(other.objects);
+      coll_index.swap(other.coll_index);
+      object_index.swap(other.object_index);
+      std::swap(use_tbl, other.use_tbl);
       tbl.swap(other.tbl);
+      std::swap(sobject_encoding, other.sobject_encoding);
+      std::swap(pool_override, other.pool_override);
+      std::swap(use_pool_override, other.use_pool_override);
     }
 
     void append(Transaction& other) {
-      ops += other.ops;
+      assert(!use_tbl);
+      assert(!other.use_tbl);
       assert(pad_unused_bytes == 0);
       assert(other.pad_unused_bytes == 0);
+
+      // other's ids -> ours
+      vector<__u32> cmap(other.colls.size());
+      for (__u32 i = 0; i < other.colls.size(); ++i)
+	cmap[i] = _get_coll_id(other.colls[i]);
+      vector<__u32> omap(other.objects.size());
+      for (__u32 i = 0; i < other.objects.size(); ++i)
+	omap[i] = _get_object_id(other.objects[i]);
+
+      bufferlist::iterator p = other.op_bl.begin();
+      while (!p.end()) {
+	Op o;
+	p.copy(sizeof(o), (char *)&o);
+	for (int i = 0; i < 2; ++i) {
+	  if ((__u32)o.cid[i] != NO_ID)
+	    o.cid[i] = cmap[o.cid[i]];
+	  if ((__u32)o.oid[i] != NO_ID)
+	    o.oid[i] = omap[o.oid[i]];
+	}
+	op_bl.append((const char *)&o, sizeof(o));
+      }
+      ops += other.ops;
+
       if (other.largest_data_len > largest_data_len) {
 	largest_data_len = other.largest_data_len;
 	largest_data_off = other.largest_data_off;
-	largest_data_off_in_tbl = tbl.length() + other.largest_data_off_in_tbl;
+	largest_data_off_in_tbl = data_bl.length() + other.largest_data_off_in_tbl;
       }
-      tbl.append(other.tbl);
+      data_bl.append(other.data_bl);
     }
 
+    /// (approximate; the collection and object dictionaries aren't counted)
     uint64_t get_encoded_bytes() {
-      return 1 + 8 + 8 + 4 + 4 + 4 + 4 + tbl.length();
+      if (use_tbl)
+	return 1 + 8 + 8 + 4 + 4 + 4 + 4 + tbl.length();
+      return 1 + 8 + 8 + 4 + 4 + 4 + 4 + op_bl.length() + 4 + data_bl.length();
     }
 
     uint64_t get_num_bytes() {
@@ -201,7 +348,7 @@ public:
     }
     uint32_t get_data_offset() {
       if (largest_data_off_in_tbl) {
-	return largest_data_off_in_tbl +
+	uint32_t off =
 	  sizeof(__u8) +  // encode struct_v
 	  sizeof(__u8) +  // encode compat_v
 	  sizeof(__u32) + // encode len
@@ -209,8 +356,15 @@ public:
 	  sizeof(pad_unused_bytes) +
 	  sizeof(largest_data_len) +
 	  sizeof(largest_data_off) +
-	  sizeof(largest_data_off_in_tbl) +
-	  sizeof(__u32);  // tbl length
+	  sizeof(largest_data_off_in_tbl);
+	if (use_tbl)
+	  return off +
+	    sizeof(__u32) +  // tbl length
+	    largest_data_off_in_tbl;
+	return off +
+	  sizeof(__u32) + op_bl.length() +
+	  sizeof(__u32) +  // data_bl length
+	  largest_data_off_in_tbl;
       }
       return 0;  // none
     }
@@ -229,33 +383,74 @@ public:
     }
 
     // ---- iterator ----
+    /**
+     * Ops are read one at a time with get_op(), then that op's arguments
+     * with get_cid(), get_oid(), get_length(), etc., in the order the op
+     * was built with, whichever encoding the transaction came from.
+     */
     class iterator {
+      // v7+
+      bufferlist::iterator op_p, data_p;
+      const vector<coll_t> *colls;
+      const vector<hobject_t> *objects;
+      Op cur;
+      int cur_cid, cur_oid, cur_num;
+
+      // pre-v7
+      bool use_tbl;
       bufferlist::iterator p;
       bool sobject_encoding;
       int64_t pool_override;
       bool use_pool_override;
 
       iterator(Transaction *t)
-	: p(t->tbl.begin()),
+	: colls(&t->colls), objects(&t->objects),
+	  cur_cid(0), cur_oid(0), cur_num(0),
+	  use_tbl(t->use_tbl),
 	  sobject_encoding(t->sobject_encoding),
 	  pool_override(t->pool_override),
-	  use_pool_override(t->use_pool_override) {}
+	  use_pool_override(t->use_pool_override) {
+	if (use_tbl) {
+	  p = t->tbl.begin();
+	  return;
+	}
+	op_p = t->op_bl.begin();
+	data_p = t->data_bl.begin();
+      }
+
+      /// where the variable-length arguments come from
+      bufferlist::iterator& data() {
+	return use_tbl ? p : data_p;
+      }
 
       friend class Transaction;
 
     public:
       bool have_op() {
-	return !p.end();
+	if (use_tbl)
+	  return !p.end();
+	return !op_p.end();
       }
       int get_op() {
-	__u32 op;
-	::decode(op, p);
-	return op;
+	if (use_tbl) {
+	  __u32 op;
+	  ::decode(op, p);
+	  return op;
+	}
+	op_p.copy(sizeof(cur), (char *)&cur);
+	cur_cid = cur_oid = cur_num = 0;
+	return cur.op;
       }
       void get_bl(bufferlist& bl) {
-	::decode(bl, p);
+	::decode(bl, data());
       }
       hobject_t get_oid() {
+	if (!use_tbl) {
+	  assert(cur_oid < 2);
+	  __u32 id = cur.oid[cur_oid++];
+	  assert(id < objects->size());
+	  return (*objects)[id];
+	}
 	hobject_t hoid;
 	if (sobject_encoding) {
 	  sobject_t soid;
@@ -272,28 +467,38 @@ public:
 	return hoid;
       }
       coll_t get_cid() {
+	if (!use_tbl) {
+	  assert(cur_cid < 2);
+	  __u32 id = cur.cid[cur_cid++];
+	  assert(id < colls->size());
+	  return (*colls)[id];
+	}
 	coll_t c;
 	::decode(c, p);
 	return c;
       }
       uint64_t get_length() {
+	if (!use_tbl) {
+	  assert(cur_num < 3);
+	  return cur.num[cur_num++];
+	}
 	uint64_t len;
 	::decode(len, p);
 	return len;
       }
       string get_attrname() {
 	string s;
-	::decode(s, p);
+	::decode(s, data());
 	return s;
       }
       void get_attrset(map<string,bufferptr>& aset) {
-	::decode(aset, p);
+	::decode(aset, data());
       }
       void get_attrset(map<string,bufferlist>& aset) {
-	::decode(aset, p);
+	::decode(aset, data());
       }
       void get_keyset(set<string> &keys) {
-	::decode(keys, p);
+	::decode(keys, data());
       }
     };
 
@@ -303,148 +508,101 @@ public:
     // -----------------------------
 
     void start_sync() {
-      __u32 op = OP_STARTSYNC;
-      ::encode(op, tbl);
-      ops++;
+      _finish_op(_start_op(OP_STARTSYNC));
     }
     void nop() {
-      __u32 op = OP_NOP;
-      ::encode(op, tbl);
-      ops++;
+      _finish_op(_start_op(OP_NOP));
     }
     void touch(coll_t cid, const hobject_t& oid) {
-      __u32 op = OP_TOUCH;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
-      ops++;
+      _finish_op(_start_op(OP_TOUCH, cid, oid));
     }
     void write(coll_t cid, const hobject_t& oid, uint64_t off, uint64_t len, const bufferlist& data) {
-      __u32 op = OP_WRITE;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
-      ::encode(off, tbl);
-      ::encode(len, tbl);
+      Op o = _start_op(OP_WRITE, cid, oid);
+      o.num[0] = off;
+      o.num[1] = len;
       assert(len == data.length());
       if (data.length() > largest_data_len) {
 	largest_data_len = data.length();
 	largest_data_off = off;
-	largest_data_off_in_tbl = tbl.length() + sizeof(__u32);  // we are about to 
+	largest_data_off_in_tbl = data_bl.length() + sizeof(__u32);  // we are about to
       }
-      ::encode(data, tbl);
-      ops++;
+      ::encode(data, data_bl);
+      _finish_op(o);
     }
     void zero(coll_t cid, const hobject_t& oid, uint64_t off, uint64_t len) {
-      __u32 op = OP_ZERO;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
-      ::encode(off, tbl);
-      ::encode(len, tbl);
-      ops++;
+      Op o = _start_op(OP_ZERO, cid, oid);
+      o.num[0] = off;
+      o.num[1] = len;
+      _finish_op(o);
     }
     void truncate(coll_t cid, const hobject_t& oid, uint64_t off) {
-      __u32 op = OP_TRUNCATE;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
-      ::encode(off, tbl);
-      ops++;
+      Op o = _start_op(OP_TRUNCATE, cid, oid);
+      o.num[0] = off;
+      _finish_op(o);
     }
     void remove(coll_t cid, const hobject_t& oid) {
-      __u32 op = OP_REMOVE;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
-      ops++;
+      _finish_op(_start_op(OP_REMOVE, cid, oid));
     }
     void setattr(coll_t cid, const hobject_t& oid, const char* name, bufferlist& val) {
       string n(name);
       setattr(cid, oid, n, val);
     }
     void setattr(coll_t cid, const hobject_t& oid, const string& s, bufferlist& val) {
-      __u32 op = OP_SETATTR;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
-      ::encode(s, tbl);
-      ::encode(val, tbl);
-      ops++;
+      Op o = _start_op(OP_SETATTR, cid, oid);
+      ::encode(s, data_bl);
+      ::encode(val, data_bl);
+      _finish_op(o);
     }
     void setattrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>& attrset) {
-      __u32 op = OP_SETATTRS;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
-      ::encode(attrset, tbl);
-      ops++;
+      Op o = _start_op(OP_SETATTRS, cid, oid);
+      ::encode(attrset, data_bl);
+      _finish_op(o);
     }
     void rmattr(coll_t cid, const hobject_t& oid, const char *name) {
       string n(name);
       rmattr(cid, oid, n);
     }
     void rmattr(coll_t cid, const hobject_t& oid, const string& s) {
-      __u32 op = OP_RMATTR;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
-      ::encode(s, tbl);
-      ops++;
+      Op o = _start_op(OP_RMATTR, cid, oid);
+      ::encode(s, data_bl);
+      _finish_op(o);
     }
     void rmattrs(coll_t cid, const hobject_t& oid) {
-      __u32 op = OP_RMATTR;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
-      ops++;
+      _finish_op(_start_op(OP_RMATTRS, cid, oid));
     }
     void clone(coll_t cid, const hobject_t& oid, hobject_t noid) {
-      __u32 op = OP_CLONE;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
-      ::encode(noid, tbl);
-      ops++;
+      Op o = _start_op(OP_CLONE, cid, oid);
+      o.oid[1] = _get_object_id(noid);
+      _finish_op(o);
     }
     void clone_range(coll_t cid, const hobject_t& oid, hobject_t noid,
 		     uint64_t srcoff, uint64_t srclen, uint64_t dstoff) {
-      __u32 op = OP_CLONERANGE2;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
-      ::encode(noid, tbl);
-      ::encode(srcoff, tbl);
-      ::encode(srclen, tbl);
-      ::encode(dstoff, tbl);
-      ops++;
+      Op o = _start_op(OP_CLONERANGE2, cid, oid);
+      o.oid[1] = _get_object_id(noid);
+      o.num[0] = srcoff;
+      o.num[1] = srclen;
+      o.num[2] = dstoff;
+      _finish_op(o);
     }
     void create_collection(coll_t cid) {
-      __u32 op = OP_MKCOLL;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ops++;
+      _finish_op(_start_op(OP_MKCOLL, cid));
+    }
+    /// hint that cid (just created) will hold about num objects
+    void collection_expected_objects(coll_t cid, uint64_t num) {
+      Op o = _start_op(OP_COLL_EXPECTED_OBJECTS, cid);
+      o.num[0] = num;
+      _finish_op(o);
     }
     void remove_collection(coll_t cid) {
-      __u32 op = OP_RMCOLL;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ops++;
+      _finish_op(_start_op(OP_RMCOLL, cid));
     }
     void collection_add(coll_t cid, coll_t ocid, const hobject_t& oid) {
-      __u32 op = OP_COLL_ADD;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(ocid, tbl);
-      ::encode(oid, tbl);
-      ops++;
+      Op o = _start_op(OP_COLL_ADD, cid, oid);
+      o.cid[1] = _get_coll_id(ocid);
+      _finish_op(o);
     }
     void collection_remove(coll_t cid, const hobject_t& oid) {
-      __u32 op = OP_COLL_REMOVE;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
-      ops++;
+      _finish_op(_start_op(OP_COLL_REMOVE, cid, oid));
     }
     void collection_move(coll_t cid, coll_t oldcid, const hobject_t& oid) {
       collection_add(cid, oldcid, oid);
@@ -457,12 +615,10 @@ public:
       collection_setattr(cid, n, val);
     }
     void collection_setattr(coll_t cid, const string& name, bufferlist& val) {
-      __u32 op = OP_COLL_SETATTR;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(name, tbl);
-      ::encode(val, tbl);
-      ops++;
+      Op o = _start_op(OP_COLL_SETATTR, cid);
+      ::encode(name, data_bl);
+      ::encode(val, data_bl);
+      _finish_op(o);
     }
 
     void collection_rmattr(coll_t cid, const char* name) {
@@ -470,25 +626,19 @@ public:
       collection_rmattr(cid, n);
     }
     void collection_rmattr(coll_t cid, const string& name) {
-      __u32 op = OP_COLL_RMATTR;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(name, tbl);
-      ops++;
+      Op o = _start_op(OP_COLL_RMATTR, cid);
+      ::encode(name, data_bl);
+      _finish_op(o);
     }
     void collection_setattrs(coll_t cid, map<string,bufferptr>& aset) {
-      __u32 op = OP_COLL_SETATTRS;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(aset, tbl);
-      ops++;
+      Op o = _start_op(OP_COLL_SETATTRS, cid);
+      ::encode(aset, data_bl);
+      _finish_op(o);
     }
     void collection_rename(coll_t cid, coll_t ncid) {
-      __u32 op = OP_COLL_RENAME;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(ncid, tbl);
-      ops++;
+      Op o = _start_op(OP_COLL_RENAME, cid);
+      o.cid[1] = _get_coll_id(ncid);
+      _finish_op(o);
     }
 
     /// Remove omap from hoid
@@ -496,11 +646,7 @@ public:
       coll_t cid,           ///< [in] Collection containing hoid
       const hobject_t &hoid ///< [in] Object from which to remove omap
       ) {
-      __u32 op = OP_OMAP_CLEAR;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(hoid, tbl);
-      ops++;
+      _finish_op(_start_op(OP_OMAP_CLEAR, cid, hoid));
     }
     /// Set keys on hoid omap.  Replaces duplicate keys.
     void omap_setkeys(
@@ -508,12 +654,9 @@ public:
       const hobject_t &hoid,                ///< [in] Object to update
       const map<string, bufferlist> &attrset ///< [in] Replacement keys and values
       ) {
-      __u32 op = OP_OMAP_SETKEYS;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(hoid, tbl);
-      ::encode(attrset, tbl);
-      ops++;
+      Op o = _start_op(OP_OMAP_SETKEYS, cid, hoid);
+      ::encode(attrset, data_bl);
+      _finish_op(o);
     }
     /// Remove keys from hoid omap
     void omap_rmkeys(
@@ -521,12 +664,9 @@ public:
       const hobject_t &hoid,  ///< [in] Object from which to remove the omap
       const set<string> &keys ///< [in] Keys to clear
       ) {
-      __u32 op = OP_OMAP_RMKEYS;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(hoid, tbl);
-      ::encode(keys, tbl);
-      ops++;
+      Op o = _start_op(OP_OMAP_RMKEYS, cid, hoid);
+      ::encode(keys, data_bl);
+      _finish_op(o);
     }
 
     /// Set omap header
@@ -535,61 +675,95 @@ public:
       const hobject_t &hoid,  ///< [in] Object from which to remove the omap
       const bufferlist &bl    ///< [in] Header value
       ) {
-      __u32 op = OP_OMAP_SETHEADER;
-      ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(hoid, tbl);
-      ::encode(bl, tbl);
-      ops++;
+      Op o = _start_op(OP_OMAP_SETHEADER, cid, hoid);
+      ::encode(bl, data_bl);
+      _finish_op(o);
     }
 
     // etc.
     Transaction() :
       ops(0), pad_unused_bytes(0), largest_data_len(0), largest_data_off(0), largest_data_off_in_tbl(0),
+      use_tbl(false),
       sobject_encoding(false), pool_override(-1), use_pool_override(false) {}
     Transaction(bufferlist::iterator &dp) :
       ops(0), pad_unused_bytes(0), largest_data_len(0), largest_data_off(0), largest_data_off_in_tbl(0),
+      use_tbl(false),
       sobject_encoding(false), pool_override(-1), use_pool_override(false) {
       decode(dp);
     }
     Transaction(bufferlist &nbl) :
       ops(0), pad_unused_bytes(0), largest_data_len(0), largest_data_off(0), largest_data_off_in_tbl(0),
+      use_tbl(false),
       sobject_encoding(false), pool_override(-1), use_pool_override(false) {
       bufferlist::iterator dp = nbl.begin();
       decode(dp); 
     }
 
     void encode(bufferlist& bl) const {
-      ENCODE_START(6, 5, bl);
+      if (use_tbl) {
+	// as decoded; re-encode the same way
+	ENCODE_START(6, 5, bl);
+	::encode(ops, bl);
+	::encode(pad_unused_bytes, bl);
+	::encode(largest_data_len, bl);
+	::encode(largest_data_off, bl);
+	::encode(largest_data_off_in_tbl, bl);
+	::encode(tbl, bl);
+	ENCODE_FINISH(bl);
+	return;
+      }
+      ENCODE_START(7, 7, bl);
       ::encode(ops, bl);
       ::encode(pad_unused_bytes, bl);
       ::encode(largest_data_len, bl);
       ::encode(largest_data_off, bl);
       ::encode(largest_data_off_in_tbl, bl);
-      ::encode(tbl, bl);
+      ::encode(op_bl, bl);
+      ::encode(data_bl, bl);   // must follow op_bl; see get_data_offset()
+      ::encode(colls, bl);
+      ::encode(objects, bl);
       ENCODE_FINISH(bl);
     }
     void decode(bufferlist::iterator &bl) {
-      DECODE_START_LEGACY_COMPAT_LEN(6, 5, 5, bl);
+      DECODE_START_LEGACY_COMPAT_LEN(7, 5, 5, bl);
       DECODE_OLDEST(2);
-      if (struct_v < 4)
-	sobject_encoding = true;
-      else
-	sobject_encoding = false;
-      ::decode(ops, bl);
-      ::decode(pad_unused_bytes, bl);
-      if (struct_v >= 3) {
+      if (struct_v < 7) {
+	use_tbl = true;
+	if (struct_v < 4)
+	  sobject_encoding = true;
+	else
+	  sobject_encoding = false;
+	::decode(ops, bl);
+	::decode(pad_unused_bytes, bl);
+	if (struct_v >= 3) {
+	  ::decode(largest_data_len, bl);
+	  ::decode(largest_data_off, bl);
+	  ::decode(largest_data_off_in_tbl, bl);
+	}
+	::decode(tbl, bl);
+	if (struct_v < 6) {
+	  use_pool_override = true;
+	}
+      } else {
+	use_tbl = false;
+	::decode(ops, bl);
+	::decode(pad_unused_bytes, bl);
 	::decode(largest_data_len, bl);
 	::decode(largest_data_off, bl);
 	::decode(largest_data_off_in_tbl, bl);
+	::decode(op_bl, bl);
+	::decode(data_bl, bl);
+	::decode(colls, bl);
+	::decode(objects, bl);
+	coll_index.clear();
+	object_index.clear();
       }
-      ::decode(tbl, bl);
       DECODE_FINISH(bl);
-      if (struct_v < 6) {
-	use_pool_override = true;
-      }
     }
 
+    /// pre-v7 encoding of this transaction, as older versions wrote it
+    void encode_legacy(bufferlist& bl);
+
     void dump(ceph::Formatter *f);
     static void generate_test_instances(list<Transaction*>& o);
   };
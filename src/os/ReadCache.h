@@ -0,0 +1,114 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_READCACHE_H
+#define CEPH_READCACHE_H
+
+#include <map>
+#include <string.h>
+#include "include/buffer.h"
+#include "os/ShardedObjectLRU.h"
+
+struct ReadCacheExtent {
+  bufferptr bp;
+  bool eof;
+  ReadCacheExtent() : eof(false) {}
+};
+
+/**
+ * ReadCache
+ *
+ * Extents of object data recently read, keyed by (collection, object,
+ * offset), so that small reads of hot objects don't each cost a pread.
+ * Bounded by bytes.  Coherence follows ShardedObjectLRU: any change to
+ * an object's data must clear() it after the change is on disk, and a
+ * reader that misses passes the ticket it took beforehand to add().
+ *
+ * An extent read short because it hit the end of the object is marked
+ * eof, so that it can answer reads that run past its end.  Cached data
+ * is shared with callers and must not be modified.
+ */
+class ReadCache
+  : public ShardedObjectLRU<std::map<uint64_t, ReadCacheExtent> > {
+  typedef std::map<uint64_t, ReadCacheExtent> extents_t;
+
+public:
+  ReadCache(size_t size, int nshards)
+    : ShardedObjectLRU<extents_t>(size, nshards) {}
+
+  /**
+   * @param len bytes to read, 0 for all up to the end of the object
+   * @return true and append the data to *out if one cached extent has it
+   */
+  bool lookup(coll_t cid, const hobject_t& oid, uint64_t off, size_t len,
+	      bufferlist *out) {
+    Shard &s = get_shard(oid);
+    Mutex::Locker l(s.lock);
+    object_iter p;
+    extents_t *m = find(s, cid, oid, &p);
+    if (!m)
+      return false;
+    extents_t::iterator e = m->upper_bound(off);
+    if (e == m->begin())
+      return false;
+    --e;
+    uint64_t end = e->first + e->second.bp.length();
+    if (off > end)
+      return false;
+    size_t have = end - off;
+    if (len == 0 || len > have) {
+      if (!e->second.eof)
+	return false;
+      len = have;   // all there is
+    }
+    s.touch(p);
+    if (len)
+      out->push_back(bufferptr(e->second.bp, off - e->first, len));
+    return true;
+  }
+
+  /// cache bp, read from off, unless the shard changed since ticket
+  void add(coll_t cid, const hobject_t& oid, uint64_t off,
+	   const bufferptr& bp, bool eof, uint64_t ticket) {
+    Shard &s = get_shard(oid);
+    Mutex::Locker l(s.lock);
+    if (s.gen != ticket || bp.length() > s.max_cost ||
+	(!bp.length() && !eof))
+      return;
+    Object &o = s.get_or_create(oid);
+    extents_t &m = o.colls[cid];
+
+    // drop what the new extent overlaps
+    uint64_t end = off + bp.length();
+    extents_t::iterator e = m.upper_bound(off);
+    if (e != m.begin()) {
+      --e;
+      if (e->first + e->second.bp.length() <= off && e->first != off)
+	++e;
+    }
+    while (e != m.end() && (e->first < end || e->first == off)) {
+      s.uncharge(o, e->second.bp.length());
+      m.erase(e++);
+    }
+
+    // a private copy, so we don't pin the caller's (maybe larger) buffer
+    ReadCacheExtent &x = m[off];
+    x.bp = buffer::create(bp.length());
+    if (bp.length())
+      memcpy(x.bp.c_str(), bp.c_str(), bp.length());
+    x.eof = eof;
+    s.charge(o, bp.length());
+    s.trim();
+  }
+};
+
+#endif
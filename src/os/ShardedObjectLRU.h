@@ -0,0 +1,172 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_SHARDEDOBJECTLRU_H
+#define CEPH_SHARDEDOBJECTLRU_H
+
+#include <list>
+#include <map>
+#include "include/types.h"
+#include "include/assert.h"
+#include "common/Mutex.h"
+#include "os/hobject.h"
+#include "osd/osd_types.h"
+
+/**
+ * ShardedObjectLRU
+ *
+ * Scaffolding for FileStore's per-object caches (XattrCache, ReadCache):
+ * a V for each collection an object is cached under, split into shards
+ * by object hash, each with its own lock and LRU of objects.  Each
+ * object has a cost (charged by the subclass); a shard evicts least
+ * recently used objects to stay within its share of the total size.
+ *
+ * The same object may be hard linked into several collections, so any
+ * change to an object must drop what is cached for it in every
+ * collection, *after* the change is on disk.  A reader that misses must
+ * take a ticket with get_ticket() *before* reading from disk, and may
+ * only add what it read if the shard's gen still matches, so a slow
+ * reader can't put back data that a concurrent writer has replaced.
+ * Every mutation of a shard bumps gen.
+ */
+template <typename V>
+class ShardedObjectLRU {
+protected:
+  struct Object {
+    std::map<coll_t, V> colls;
+    size_t cost;
+    std::list<hobject_t>::iterator lru_pos;
+    Object() : cost(0) {}
+  };
+  typedef typename std::map<hobject_t, Object>::iterator object_iter;
+
+  struct Shard {
+    Mutex lock;
+    uint64_t gen;   ///< bumped by every mutation
+    size_t max_cost, cost;
+    std::map<hobject_t, Object> objects;
+    std::list<hobject_t> lru;  ///< front is most recently used
+    Shard()
+      : lock("ShardedObjectLRU::Shard::lock"), gen(0), max_cost(0), cost(0) {}
+
+    void touch(object_iter p) {
+      lru.splice(lru.begin(), lru, p->second.lru_pos);
+    }
+    /// @param created [out] set if oid wasn't cached yet
+    Object &get_or_create(const hobject_t& oid, bool *created = 0) {
+      object_iter p = objects.find(oid);
+      if (created)
+	*created = (p == objects.end());
+      if (p != objects.end()) {
+	touch(p);
+	return p->second;
+      }
+      lru.push_front(oid);
+      Object &o = objects[oid];
+      o.lru_pos = lru.begin();
+      return o;
+    }
+    void charge(Object &o, size_t c) {
+      o.cost += c;
+      cost += c;
+    }
+    void uncharge(Object &o, size_t c) {
+      assert(o.cost >= c && cost >= c);
+      o.cost -= c;
+      cost -= c;
+    }
+    void remove(object_iter p) {
+      cost -= p->second.cost;
+      lru.erase(p->second.lru_pos);
+      objects.erase(p);
+    }
+    void remove(const hobject_t& oid) {
+      object_iter p = objects.find(oid);
+      if (p != objects.end())
+	remove(p);
+    }
+    void trim() {
+      while (cost > max_cost && !lru.empty())
+	remove(objects.find(lru.back()));
+    }
+    void clear() {
+      gen++;
+      objects.clear();
+      lru.clear();
+      cost = 0;
+    }
+  };
+
+  const int num_shards;
+  Shard *shards;
+
+  Shard& get_shard(const hobject_t& oid) {
+    return shards[oid.hash % num_shards];
+  }
+
+  /// lock held; oid's V for cid, if cached
+  V *find(Shard &s, coll_t cid, const hobject_t& oid, object_iter *op) {
+    object_iter p = s.objects.find(oid);
+    if (p == s.objects.end())
+      return 0;
+    typename std::map<coll_t, V>::iterator q = p->second.colls.find(cid);
+    if (q == p->second.colls.end())
+      return 0;
+    *op = p;
+    return &q->second;
+  }
+
+  ShardedObjectLRU(size_t size, int nshards)
+    : num_shards(nshards > 0 ? nshards : 1),
+      shards(new Shard[num_shards]) {
+    set_size(size);
+  }
+  ~ShardedObjectLRU() {
+    delete[] shards;
+  }
+
+public:
+  /// @param size total cost; 0 disables the cache
+  void set_size(size_t size) {
+    size_t per_shard = (size + num_shards - 1) / num_shards;
+    for (int i = 0; i < num_shards; ++i) {
+      Mutex::Locker l(shards[i].lock);
+      shards[i].max_cost = per_shard;
+      shards[i].trim();
+    }
+  }
+
+  /// take before reading from disk on a miss
+  uint64_t get_ticket(const hobject_t& oid) {
+    Shard &s = get_shard(oid);
+    Mutex::Locker l(s.lock);
+    return s.gen;
+  }
+
+  /// forget everything about oid, in all collections
+  void clear(const hobject_t& oid) {
+    Shard &s = get_shard(oid);
+    Mutex::Locker l(s.lock);
+    s.gen++;
+    s.remove(oid);
+  }
+
+  /// forget everything
+  void clear() {
+    for (int i = 0; i < num_shards; ++i) {
+      Mutex::Locker l(shards[i].lock);
+      shards[i].clear();
+    }
+  }
+};
+
+#endif
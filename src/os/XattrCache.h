@@ -0,0 +1,128 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_XATTRCACHE_H
+#define CEPH_XATTRCACHE_H
+
+#include <map>
+#include <string>
+#include <string.h>
+#include "include/buffer.h"
+#include "os/ShardedObjectLRU.h"
+
+/**
+ * XattrCache
+ *
+ * Write-through cache of object attribute values, keyed by (collection,
+ * object, attr name), so that the attrs read on nearly every op ("_",
+ * "snapset") don't each cost a getxattr.  Bounded by the number of
+ * objects it holds.  Coherence follows ShardedObjectLRU: writers update
+ * the cache after changing an attr on disk, and a reader that misses
+ * passes the ticket it took beforehand to add().
+ *
+ * Cached bufferptrs are shared with callers and must not be modified.
+ */
+class XattrCache
+  : public ShardedObjectLRU<std::map<std::string, bufferptr> > {
+public:
+  typedef std::map<std::string, bufferptr> attrs_t;
+
+private:
+  /// private copy, so we don't pin (or alias) the caller's buffer
+  static bufferptr copy(const bufferptr& bp) {
+    bufferptr r = buffer::create(bp.length());
+    if (bp.length())
+      memcpy(r.c_str(), bp.c_str(), bp.length());
+    return r;
+  }
+
+  /// lock held; every cached object costs 1
+  Object &get_or_create(Shard &s, const hobject_t& oid) {
+    bool created;
+    Object &o = s.get_or_create(oid, &created);
+    if (created) {
+      s.charge(o, 1);
+      s.trim();  // o is most recently used, and max_cost is at least 1
+    }
+    return o;
+  }
+
+  /// lock held; attrs of oid in cid, dropping any other links' entries
+  attrs_t &get_for_write(Shard &s, coll_t cid, const hobject_t& oid) {
+    s.gen++;
+    Object &o = get_or_create(s, oid);
+    std::map<coll_t, attrs_t>::iterator p = o.colls.begin();
+    while (p != o.colls.end()) {
+      if (p->first == cid)
+	++p;
+      else
+	o.colls.erase(p++);
+    }
+    return o.colls[cid];
+  }
+
+public:
+  XattrCache(size_t size, int nshards)
+    : ShardedObjectLRU<attrs_t>(size, nshards) {}
+
+  /// @return true and set *out if name is cached for (cid, oid)
+  bool lookup(coll_t cid, const hobject_t& oid, const std::string& name,
+	      bufferptr *out) {
+    Shard &s = get_shard(oid);
+    Mutex::Locker l(s.lock);
+    object_iter p;
+    attrs_t *attrs = find(s, cid, oid, &p);
+    if (!attrs)
+      return false;
+    attrs_t::iterator r = attrs->find(name);
+    if (r == attrs->end())
+      return false;
+    s.touch(p);
+    *out = r->second;
+    return true;
+  }
+
+  /// cache a value read from disk, unless the shard changed since ticket
+  void add(coll_t cid, const hobject_t& oid, const std::string& name,
+	   const bufferptr& bp, uint64_t ticket) {
+    Shard &s = get_shard(oid);
+    Mutex::Locker l(s.lock);
+    if (s.gen != ticket || !s.max_cost)
+      return;
+    Object &o = get_or_create(s, oid);
+    o.colls[cid][name] = copy(bp);
+  }
+
+  /// write-through: aset was just stored on (cid, oid)
+  void set(coll_t cid, const hobject_t& oid, const attrs_t& aset) {
+    Shard &s = get_shard(oid);
+    Mutex::Locker l(s.lock);
+    s.gen++;
+    if (!s.max_cost)
+      return;
+    attrs_t &attrs = get_for_write(s, cid, oid);
+    for (attrs_t::const_iterator p = aset.begin(); p != aset.end(); ++p)
+      attrs[p->first] = copy(p->second);
+  }
+
+  /// name was just removed from (cid, oid)
+  void rm(coll_t cid, const hobject_t& oid, const std::string& name) {
+    Shard &s = get_shard(oid);
+    Mutex::Locker l(s.lock);
+    s.gen++;
+    if (!s.objects.count(oid))
+      return;
+    get_for_write(s, cid, oid).erase(name);
+  }
+};
+
+#endif
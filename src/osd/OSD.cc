@@ -70,6 +70,7 @@
 #include "messages/MOSDPGTrim.h"
 #include "messages/MOSDPGScan.h"
 #include "messages/MOSDPGBackfill.h"
+#include "messages/MOSDPGPush.h"
 #include "messages/MOSDPGMissing.h"
 
 #include "messages/MOSDAlive.h"
@@ -135,6 +136,7 @@ static CompatSet get_osd_compat_set() {
   ceph_osd_feature_incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_CATEGORIES);
   ceph_osd_feature_incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_HOBJECTPOOL);
   ceph_osd_feature_incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_BIGINFO);
+  ceph_osd_feature_incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_OMAPLOG);
   return CompatSet(ceph_osd_feature_compat, ceph_osd_feature_ro_compat,
 		   ceph_osd_feature_incompat);
 }
@@ -156,6 +158,8 @@ OSDService::OSDService(OSD *osd) :
   rep_scrub_wq(osd->rep_scrub_wq),
   class_handler(osd->class_handler),
   publish_lock("OSDService::publish_lock"),
+  op_sched(osd->client_messenger->cct, "osd_op_sched",
+	   g_conf->osd_op_sched_burst, g_conf->osd_op_sched_max_wait),
   sched_scrub_lock("OSDService::sched_scrub_lock"), scrubs_pending(0),
   scrubs_active(0),
   watch_lock("OSD::watch_lock"),
@@ -168,7 +172,16 @@ OSDService::OSDService(OSD *osd) :
   map_cache(g_conf->osd_map_cache_size),
   map_bl_cache(g_conf->osd_map_cache_size),
   map_bl_inc_cache(g_conf->osd_map_cache_size)
-{}
+{
+  sched_client = op_sched.add_class("client", g_conf->osd_op_sched_client_weight,
+				    false);
+  sched_recovery = op_sched.add_class("recovery",
+				      g_conf->osd_op_sched_recovery_weight, true);
+  sched_scrub = op_sched.add_class("scrub", g_conf->osd_op_sched_scrub_weight,
+				   true);
+  sched_snap_trim = op_sched.add_class("snap_trim",
+				       g_conf->osd_op_sched_snap_trim_weight, true);
+}
 
 void OSDService::need_heartbeat_peer_update()
 {
@@ -701,8 +714,9 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   finished_lock("OSD::finished_lock"),
   admin_ops_hook(NULL),
   historic_ops_hook(NULL),
-  op_queue_len(0),
-  op_wq(this, g_conf->osd_op_thread_timeout, &op_tp),
+  op_sched_hook(NULL),
+  op_wq(this, external_messenger->cct, g_conf->osd_op_thread_timeout,
+	g_conf->osd_op_num_shards, g_conf->osd_op_num_threads_per_shard),
   peering_wq(this, g_conf->osd_op_thread_timeout, &op_tp, 200),
   map_lock("OSD::map_lock"),
   peer_map_epoch_lock("OSD::peer_map_epoch_lock"),
@@ -793,6 +807,18 @@ public:
   }
 };
 
+class OpSchedSocketHook : public AdminSocketHook {
+  OSD *osd;
+public:
+  OpSchedSocketHook(OSD *o) : osd(o) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    osd->dump_op_sched(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
 int OSD::init()
 {
   Mutex::Locker lock(osd_lock);
@@ -806,11 +832,13 @@ int OSD::init()
 	  << (journal_path.empty() ? "(no journal)" : journal_path) << dendl;
   assert(store);  // call pre_init() first!
 
+  utime_t start = ceph_clock_now(g_ceph_context);
   int r = store->mount();
   if (r < 0) {
     derr << "OSD:init: unable to mount object store" << dendl;
     return r;
   }
+  utime_t mounted = ceph_clock_now(g_ceph_context);
 
   dout(2) << "boot" << dendl;
 
@@ -852,7 +880,12 @@ int OSD::init()
   bind_epoch = osdmap->get_epoch();
 
   // load up pgs (as they previously existed)
+  utime_t read_map = ceph_clock_now(g_ceph_context);
   load_pgs();
+  utime_t loaded = ceph_clock_now(g_ceph_context);
+  dout(0) << "init mounted store in " << (mounted - start)
+	  << ", read superblock and osdmap in " << (read_map - mounted)
+	  << ", loaded pgs in " << (loaded - read_map) << dendl;
 
   dout(2) << "superblock: i am osd." << superblock.whoami << dendl;
   assert_warn(whoami == superblock.whoami);
@@ -894,6 +927,7 @@ int OSD::init()
   osd_lock.Lock();
 
   op_tp.start();
+  op_wq.start();
   recovery_tp.start();
   disk_tp.start();
   command_tp.start();
@@ -921,6 +955,10 @@ int OSD::init()
   r = admin_socket->register_command("dump_historic_ops", historic_ops_hook,
                                          "show slowest recent ops");
   assert(r == 0);
+  op_sched_hook = new OpSchedSocketHook(this);
+  r = admin_socket->register_command("dump_op_scheduler", op_sched_hook,
+				     "show per-class op scheduler queues and service times");
+  assert(r == 0);
 
   return 0;
 }
@@ -942,15 +980,18 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_op_r,      "op_r");        // client reads
   osd_plb.add_u64_counter(l_osd_op_r_outb, "op_r_out_bytes");   // client read out bytes
   osd_plb.add_fl_avg(l_osd_op_r_lat,  "op_r_latency");    // client read latency
+  osd_plb.add_histogram(l_osd_op_r_lat_hist, "op_r_latency_hist", 28, 24);  // read usec x out bytes
   osd_plb.add_u64_counter(l_osd_op_w,      "op_w");        // client writes
   osd_plb.add_u64_counter(l_osd_op_w_inb,  "op_w_in_bytes");    // client write in bytes
   osd_plb.add_fl_avg(l_osd_op_w_rlat, "op_w_rlat");   // client write readable/applied latency
   osd_plb.add_fl_avg(l_osd_op_w_lat,  "op_w_latency");    // client write latency
+  osd_plb.add_histogram(l_osd_op_w_lat_hist, "op_w_latency_hist", 28, 24);  // write usec x in bytes
   osd_plb.add_u64_counter(l_osd_op_rw,     "op_rw");       // client rmw
   osd_plb.add_u64_counter(l_osd_op_rw_inb, "op_rw_in_bytes");   // client rmw in bytes
   osd_plb.add_u64_counter(l_osd_op_rw_outb,"op_rw_out_bytes");  // client rmw out bytes
   osd_plb.add_fl_avg(l_osd_op_rw_rlat,"op_rw_rlat");  // client rmw readable/applied latency
   osd_plb.add_fl_avg(l_osd_op_rw_lat, "op_rw_latency");   // client rmw latency
+  osd_plb.add_histogram(l_osd_op_rw_lat_hist, "op_rw_latency_hist", 28, 24);  // rmw usec x in bytes
 
   osd_plb.add_u64_counter(l_osd_sop,       "subop");         // subops
   osd_plb.add_u64_counter(l_osd_sop_inb,   "subop_in_bytes");     // subop in bytes
@@ -966,11 +1007,16 @@ void OSD::create_logger()
   osd_plb.add_fl_avg(l_osd_sop_push_lat, "subop_push_latency");
 
   osd_plb.add_u64_counter(l_osd_pull,      "pull");       // pull requests sent
+  osd_plb.add_u64_counter(l_osd_pull_inb,  "pull_in_bytes");  // pulled bytes
   osd_plb.add_u64_counter(l_osd_push,      "push");       // push messages
   osd_plb.add_u64_counter(l_osd_push_outb, "push_out_bytes");  // pushed bytes
+  osd_plb.add_u64_counter(l_osd_push_delta, "push_delta");  // pushes of changed extents only
+  osd_plb.add_u64_counter(l_osd_push_delta_savedb, "push_delta_saved_bytes");  // bytes they didn't push
 
   osd_plb.add_u64_counter(l_osd_rop, "recovery_ops");       // recovery ops (started)
 
+  osd_plb.add_u64_counter(l_osd_scrub_readb, "scrub_read_bytes");  // object data read by deep scrubs
+
   osd_plb.add_fl(l_osd_loadavg, "loadavg");
   osd_plb.add_u64(l_osd_buf, "buffer_bytes");       // total ceph::buffer bytes
 
@@ -983,6 +1029,10 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_map, "map_messages");           // osdmap messages
   osd_plb.add_u64_counter(l_osd_mape, "map_message_epochs");         // osdmap epochs
   osd_plb.add_u64_counter(l_osd_mape_dup, "map_message_epoch_dups"); // dup osdmap epochs
+  osd_plb.add_fl_avg(l_osd_map_apply_lat, "map_apply_latency");      // storing/applying an MOSDMap
+  osd_plb.add_fl_avg(l_osd_pg_adv_lat, "pg_map_advance_latency");    // advancing one pg to the latest map
+  osd_plb.add_u64_counter(l_osd_pg_adv_epochs, "pg_map_advance_epochs"); // epochs pgs stepped through
+  osd_plb.add_u64_counter(l_osd_pg_adv_skip, "pg_map_advance_skipped");  // ... that couldn't affect the pg
 
   logger = osd_plb.create_perf_counters();
   g_ceph_context->get_perfcounters_collection()->add(logger);
@@ -999,6 +1049,7 @@ void OSD::suicide(int exitcode)
   g_lockdep = 0;
 
   derr << " pausing thread pools" << dendl;
+  op_wq.pause();
   op_tp.pause();
   disk_tp.pause();
   recovery_tp.pause();
@@ -1045,13 +1096,17 @@ int OSD::shutdown()
   dout(10) << "no ops" << dendl;
 
   cct->get_admin_socket()->unregister_command("dump_ops_in_flight");
+  cct->get_admin_socket()->unregister_command("dump_op_scheduler");
   delete admin_ops_hook;
   delete historic_ops_hook;
+  delete op_sched_hook;
   admin_ops_hook = NULL;
   historic_ops_hook = NULL;
+  op_sched_hook = NULL;
 
   recovery_tp.stop();
   dout(10) << "recovery tp stopped" << dendl;
+  op_wq.stop();
   op_tp.stop();
   dout(10) << "op tp stopped" << dendl;
 
@@ -1284,6 +1339,11 @@ PG *OSD::_create_lock_pg(
 
   t.create_collection(coll_t(pgid));
 
+  const pg_pool_t *pool = createmap->get_pg_pool(pgid.pool());
+  if (pool && pool->expected_num_objects && pool->get_pg_num())
+    t.collection_expected_objects(coll_t(pgid),
+				  pool->expected_num_objects / pool->get_pg_num());
+
   if (newly_created) {
     /* This is weird, but all the peering code needs last_epoch_start
      * to be less than same_interval_since. Make it so!
@@ -1339,11 +1399,49 @@ PG *OSD::lookup_lock_raw_pg(pg_t pgid)
 }
 
 
+/*
+ * Reads pgs for load_pgs().  Each worker touches only its own pg, the
+ * store and the OSDService (which lock for themselves), and the osdmap,
+ * which can't change while load_pgs() waits with osd_lock held.
+ */
+struct OSD::LoadPGWQ : public ThreadPool::WorkQueue<PG> {
+  OSD *osd;
+  list<PG*> pgs;
+  LoadPGWQ(OSD *o, time_t ti, ThreadPool *tp)
+    : ThreadPool::WorkQueue<PG>("OSD::LoadPGWQ", ti, 0, tp), osd(o) {}
+
+  bool _enqueue(PG *pg) {
+    pgs.push_back(pg);
+    return true;
+  }
+  void _dequeue(PG *pg) {
+    pgs.remove(pg);
+  }
+  PG *_dequeue() {
+    if (pgs.empty())
+      return NULL;
+    PG *pg = pgs.front();
+    pgs.pop_front();
+    return pg;
+  }
+  void _process(PG *pg) {
+    osd->load_pg(pg);
+  }
+  void _clear() {
+    pgs.clear();
+  }
+  bool _empty() {
+    return pgs.empty();
+  }
+};
+
 void OSD::load_pgs()
 {
   assert(osd_lock.is_locked());
   dout(10) << "load_pgs" << dendl;
   assert(pg_map.empty());
+  utime_t start = ceph_clock_now(g_ceph_context);
+  vector<PG*> to_load;
 
   vector<coll_t> ls;
   int r = store->list_collections(ls);
@@ -1400,26 +1498,54 @@ void OSD::load_pgs()
     }
 
     PG *pg = _open_lock_pg(osdmap, pgid);
+    pg->unlock();
+    to_load.push_back(pg);
+  }
+  utime_t listed = ceph_clock_now(g_ceph_context);
+
+  // read pg state and logs, which is most of the work, in parallel
+  if (g_conf->osd_load_pgs_threads > 1) {
+    ThreadPool tp(g_ceph_context, "OSD::load_pgs_tp", g_conf->osd_load_pgs_threads);
+    LoadPGWQ wq(this, g_conf->osd_op_thread_timeout, &tp);
+    for (vector<PG*>::iterator p = to_load.begin(); p != to_load.end(); ++p)
+      wq.queue(*p);
+    tp.start();
+    wq.drain();
+    tp.stop();
+  } else {
+    for (vector<PG*>::iterator p = to_load.begin(); p != to_load.end(); ++p)
+      load_pg(*p);
+  }
+  utime_t loaded = ceph_clock_now(g_ceph_context);
 
-    // read pg state, log
-    pg->read_state(store);
+  build_past_intervals_parallel();
+  utime_t done = ceph_clock_now(g_ceph_context);
 
-    service.reg_last_pg_scrub(pg->info.pgid, pg->info.history.last_scrub_stamp);
+  dout(0) << "load_pgs " << to_load.size() << " pgs: listed in " << (listed - start)
+	  << ", read in " << (loaded - listed) << " with "
+	  << MAX(g_conf->osd_load_pgs_threads, 1) << " threads, past intervals in "
+	  << (done - loaded) << dendl;
+}
 
-    // generate state for current mapping
-    osdmap->pg_to_up_acting_osds(pgid, pg->up, pg->acting);
-    int role = osdmap->calc_pg_role(whoami, pg->acting);
-    pg->set_role(role);
+void OSD::load_pg(PG *pg)
+{
+  pg->lock();
 
-    PG::RecoveryCtx rctx(0, 0, 0, 0, 0, 0);
-    pg->handle_loaded(&rctx);
+  // read pg state, log
+  pg->read_state(store);
 
-    dout(10) << "load_pgs loaded " << *pg << " " << pg->log << dendl;
-    pg->unlock();
-  }
-  dout(10) << "load_pgs done" << dendl;
+  service.reg_last_pg_scrub(pg->info.pgid, pg->info.history.last_scrub_stamp);
 
-  build_past_intervals_parallel();
+  // generate state for current mapping
+  osdmap->pg_to_up_acting_osds(pg->info.pgid, pg->up, pg->acting);
+  int role = osdmap->calc_pg_role(whoami, pg->acting);
+  pg->set_role(role);
+
+  PG::RecoveryCtx rctx(0, 0, 0, 0, 0, 0);
+  pg->handle_loaded(&rctx);
+
+  dout(10) << "load_pgs loaded " << *pg << " " << pg->log << dendl;
+  pg->unlock();
 }
 
 
@@ -1527,6 +1653,7 @@ void OSD::build_past_intervals_parallel()
   int num = 0;
   for (map<PG*,pistate>::iterator i = pis.begin(); i != pis.end(); ++i) {
     PG *pg = i->first;
+    pg->dirty_big_info = true;
     pg->write_info(t);
 
     // don't let the transaction get too big
@@ -2129,6 +2256,13 @@ void OSD::check_ops_in_flight()
   return;
 }
 
+void OSD::dump_op_sched(ostream& ss)
+{
+  JSONFormatter jf(true);
+  service.op_sched.dump(&jf);
+  jf.flush(ss);
+}
+
 void OSD::dump_ops_in_flight(ostream& ss)
 {
   op_tracker.dump_ops_in_flight(ss);
@@ -3138,6 +3272,9 @@ void OSD::dispatch_op(OpRequestRef op)
   case MSG_OSD_PG_BACKFILL:
     handle_pg_backfill(op);
     break;
+  case MSG_OSD_PG_PUSH:
+    handle_pg_push(op);
+    break;
 
     // client ops
   case CEPH_MSG_OSD_OP:
@@ -3298,6 +3435,9 @@ bool OSDService::scrub_should_schedule()
     return false;
   */
 
+  if (!scrub_time_permit(ceph_clock_now(g_ceph_context)))
+    return false;
+
   if (getloadavg(loadavgs, 1) != 1) {
     dout(10) << "scrub_should_schedule couldn't read loadavgs\n" << dendl;
     return false;
@@ -3325,6 +3465,37 @@ bool OSDService::scrub_should_schedule()
   return loadavgs[0] < g_conf->osd_scrub_load_threshold;
 }
 
+bool OSDService::scrub_time_permit(utime_t now)
+{
+  struct tm bdt;
+  time_t tt = now.sec();
+  localtime_r(&tt, &bdt);
+  int begin = g_conf->osd_scrub_begin_hour;
+  int end = g_conf->osd_scrub_end_hour;
+  bool permit;
+  if (begin < end)
+    permit = bdt.tm_hour >= begin && bdt.tm_hour < end;
+  else
+    permit = bdt.tm_hour >= begin || bdt.tm_hour < end;  // wraps past midnight
+  if (!permit)
+    dout(20) << "scrub_time_permit hour " << bdt.tm_hour << " outside ["
+	     << begin << "," << end << ") = no" << dendl;
+  return permit;
+}
+
+void OSDService::scrub_charge(uint64_t bytes)
+{
+  logger->inc(l_osd_scrub_readb, bytes);
+  uint64_t rate = g_conf->osd_scrub_max_bytes_per_sec;
+  if (!rate)
+    return;
+  utime_t now = ceph_clock_now(g_ceph_context);
+  Mutex::Locker l(sched_scrub_lock);
+  if (scrub_pace_until < now)
+    scrub_pace_until = now;
+  scrub_pace_until += (double)bytes / (double)rate;
+}
+
 void OSD::sched_scrub()
 {
   assert(osd_lock.is_locked());
@@ -3494,6 +3665,7 @@ void OSD::handle_osd_map(MOSDMap *m)
     skip_maps = true;
   }
 
+  utime_t apply_start = ceph_clock_now(g_ceph_context);
   ObjectStore::Transaction t;
 
   // store new maps: queue for disk and put in the osdmap cache
@@ -3525,10 +3697,8 @@ void OSD::handle_osd_map(MOSDMap *m)
 
       OSDMap *o = new OSDMap;
       if (e > 1) {
-	bufferlist obl;
 	OSDMapRef prev = get_map(e - 1);
-	prev->encode(obl);
-	o->decode(obl);
+	o->deepish_copy_from(*prev);
       }
 
       OSDMap::Incremental inc;
@@ -3675,6 +3845,8 @@ void OSD::handle_osd_map(MOSDMap *m)
     shutdown();
     return;
   }
+  if (logger)
+    logger->finc(l_osd_map_apply_lat, ceph_clock_now(g_ceph_context) - apply_start);
   service.publish_superblock(superblock);
 
   clear_map_bl_cache_pins();
@@ -3747,23 +3919,64 @@ void OSD::check_osdmap_features()
 void OSD::advance_pg(epoch_t osd_epoch, PG *pg, PG::RecoveryCtx *rctx)
 {
   assert(pg->is_locked());
-  epoch_t next_epoch = pg->get_osdmap()->get_epoch() + 1;
+  epoch_t start_epoch = pg->get_osdmap()->get_epoch();
+  epoch_t next_epoch = start_epoch + 1;
   OSDMapRef lastmap = pg->get_osdmap();
 
   if (lastmap->get_epoch() == osd_epoch)
     return;
   assert(lastmap->get_epoch() < osd_epoch);
 
+  utime_t start = ceph_clock_now(g_ceph_context);
+  int skipped = 0;
   for (;
        next_epoch <= osd_epoch;
        ++next_epoch) {
     OSDMapRef nextmap = get_map(next_epoch);
     vector<int> newup, newacting;
     nextmap->pg_to_up_acting_osds(pg->info.pgid, newup, newacting);
-    pg->handle_advance_map(nextmap, lastmap, newup, newacting, rctx);
+    if (g_conf->osd_pg_skip_unchanged_maps &&
+	!pg_affected_by_map(pg, lastmap, nextmap, newup, newacting)) {
+      pg->handle_skip_map(nextmap, lastmap);
+      skipped++;
+    } else {
+      pg->handle_advance_map(nextmap, lastmap, newup, newacting, rctx);
+    }
     lastmap = nextmap;
   }
   pg->handle_activate_map(rctx);
+
+  if (skipped)
+    dout(20) << "advance_pg " << pg->info.pgid << " skipped " << skipped << " of "
+	     << (osd_epoch - start_epoch) << " epochs" << dendl;
+  if (logger) {
+    logger->inc(l_osd_pg_adv_epochs, osd_epoch - start_epoch);
+    logger->inc(l_osd_pg_adv_skip, skipped);
+    logger->finc(l_osd_pg_adv_lat, ceph_clock_now(g_ceph_context) - start);
+  }
+}
+
+/*
+ * Can stepping pg from lastmap to nextmap (the next epoch) do anything
+ * beyond updating its map reference?  The peering state machine only
+ * reacts to changes in the pg's up/acting sets, its pool, and the
+ * up/down/lost state of osds; if none of those moved, the epoch is
+ * not interval-relevant for this pg.
+ */
+bool OSD::pg_affected_by_map(PG *pg, const OSDMapRef& lastmap, const OSDMapRef& nextmap,
+			     const vector<int>& newup, const vector<int>& newacting)
+{
+  if (pg->acting_up_affected(newup, newacting))
+    return true;
+
+  epoch_t e = nextmap->get_epoch();
+  const pg_pool_t *pi = nextmap->get_pg_pool(pg->info.pgid.pool());
+  if (!pi ||
+      pi->get_last_change() >= e ||
+      pi->get_snap_epoch() >= e)
+    return true;
+
+  return service.map_changes_osds(lastmap, nextmap);
 }
 
 /** 
@@ -4047,6 +4260,24 @@ void OSDService::clear_map_bl_cache_pins()
   map_bl_cache.clear_pinned();
 }
 
+bool OSDService::map_changes_osds(const OSDMapRef& lastmap, const OSDMapRef& nextmap)
+{
+  epoch_t e = nextmap->get_epoch();
+  assert(lastmap->get_epoch() + 1 == e);
+
+  // every pg walking through this epoch asks the same question; only
+  // compare the maps once.
+  Mutex::Locker l(map_cache_lock);
+  map<epoch_t, bool>::iterator p = osd_change_epochs.find(e);
+  if (p != osd_change_epochs.end())
+    return p->second;
+  bool changed = !nextmap->osd_states_equal(*lastmap);
+  osd_change_epochs[e] = changed;
+  while (osd_change_epochs.size() > (unsigned)g_conf->osd_map_cache_size)
+    osd_change_epochs.erase(osd_change_epochs.begin());
+  return changed;
+}
+
 OSDMapRef OSDService::_add_map(OSDMap *o)
 {
   epoch_t e = o->get_epoch();
@@ -4855,6 +5086,32 @@ void OSD::handle_pg_backfill(OpRequestRef op)
   pg->unlock();
 }
 
+void OSD::handle_pg_push(OpRequestRef op)
+{
+  MOSDPGPush *m = (MOSDPGPush*)op->request;
+  assert(m->get_header().type == MSG_OSD_PG_PUSH);
+  dout(10) << "handle_pg_push " << *m << " from " << m->get_source() << dendl;
+
+  if (m->map_epoch < up_epoch) {
+    dout(3) << "push from before up" << dendl;
+    return;
+  }
+  if (!require_osd_peer(op))
+    return;
+  if (!require_same_or_newer_map(op, m->map_epoch))
+    return;
+
+  _share_map_incoming(m->get_source_inst(), m->map_epoch,
+		      (Session*)m->get_connection()->get_priv());
+
+  PG *pg = _have_pg(m->pgid) ? _lookup_lock_pg(m->pgid) : NULL;
+  if (!pg) {
+    return;
+  }
+  enqueue_op(pg, op);
+  pg->unlock();
+}
+
 
 /** PGQuery
  * from primary to replica | stray
@@ -5125,13 +5382,18 @@ void OSD::do_recovery(PG *pg)
   recovery_wq.lock();
   int max = g_conf->osd_recovery_max_active - recovery_ops_active;
   recovery_wq.unlock();
-  if (max == 0) {
+  if (max <= 0) {   // a batch of pushes may take us past max_active
     dout(10) << "do_recovery raced and failed to start anything; requeuing " << *pg << dendl;
     recovery_wq.queue(pg);
   } else {
+    // wait for our share before taking the pg lock; the pushes are
+    // charged by size as they are sent.
+    utime_t sched_start = service.op_sched.get(service.sched_recovery,
+					       g_conf->osd_op_sched_min_cost);
     pg->lock();
     if (pg->deleting || !(pg->is_active() && pg->is_primary())) {
       pg->unlock();
+      service.op_sched.put(service.sched_recovery, sched_start);
       return;
     }
     
@@ -5168,6 +5430,7 @@ void OSD::do_recovery(PG *pg)
     OSDMapRef curmap = pg->get_osdmap();
     pg->unlock();
     dispatch_context(rctx, pg, curmap);
+    service.op_sched.put(service.sched_recovery, sched_start);
   }
 }
 
@@ -5507,26 +5770,157 @@ void OSD::enqueue_op(PG *pg, OpRequestRef op)
   pg->queue_op(op);
 }
 
-bool OSD::OpWQ::_enqueue(PG *pg)
+// -- ShardedOpWQ --
+
+enum {
+  l_osd_shard_first = 10100,
+  l_osd_shard_opq,
+  l_osd_shard_op,
+  l_osd_shard_last,
+};
+
+ShardedOpWQ::ShardedOpWQ(OSD *o, CephContext *cct, time_t ti,
+			 unsigned num_shards, unsigned threads_per_shard)
+  : osd(o)
+{
+  if (num_shards < 1)
+    num_shards = 1;
+  for (unsigned i = 0; i < num_shards; ++i) {
+    char name[40];
+    snprintf(name, sizeof(name), "OSD::op_tp.%u", i);
+    ThreadPool *tp = new ThreadPool(cct, name, threads_per_shard,
+				    "osd_op_num_threads_per_shard");
+    pools.push_back(tp);
+    shards.push_back(new Shard(this, i, ti, tp));
+  }
+}
+
+ShardedOpWQ::~ShardedOpWQ()
+{
+  for (unsigned i = 0; i < shards.size(); ++i) {
+    delete shards[i];
+    delete pools[i];
+  }
+}
+
+ShardedOpWQ::Shard *ShardedOpWQ::get_shard(PG *pg)
+{
+  static hash<pg_t> H;
+  return shards[H(pg->info.pgid) % shards.size()];
+}
+
+void ShardedOpWQ::queue(PG *pg)
+{
+  get_shard(pg)->queue(pg);
+}
+
+void ShardedOpWQ::dequeue(PG *pg)
+{
+  get_shard(pg)->dequeue(pg);
+}
+
+void ShardedOpWQ::start()
+{
+  for (unsigned i = 0; i < shards.size(); ++i) {
+    char name[40];
+    snprintf(name, sizeof(name), "osd_op_shard.%u", i);
+    PerfCountersBuilder plb(g_ceph_context, name,
+			    l_osd_shard_first, l_osd_shard_last);
+    plb.add_u64(l_osd_shard_opq, "opq");        // entries queued on this shard
+    plb.add_u64_counter(l_osd_shard_op, "op");  // entries dequeued by this shard
+    shards[i]->logger = plb.create_perf_counters();
+    g_ceph_context->get_perfcounters_collection()->add(shards[i]->logger);
+
+    pools[i]->start();
+  }
+}
+
+void ShardedOpWQ::stop()
+{
+  for (unsigned i = 0; i < shards.size(); ++i) {
+    pools[i]->stop();
+    if (shards[i]->logger) {
+      g_ceph_context->get_perfcounters_collection()->remove(shards[i]->logger);
+      delete shards[i]->logger;
+      shards[i]->logger = NULL;
+    }
+  }
+}
+
+void ShardedOpWQ::pause()
+{
+  for (unsigned i = 0; i < pools.size(); ++i)
+    pools[i]->pause();
+}
+
+void ShardedOpWQ::drain()
+{
+  for (unsigned i = 0; i < shards.size(); ++i)
+    shards[i]->drain();
+}
+
+bool ShardedOpWQ::Shard::_enqueue(PG *pg)
 {
   pg->get();
-  osd->op_queue.push_back(pg);
-  osd->op_queue_len++;
-  osd->logger->set(l_osd_opq, osd->op_queue_len);
+  if (!pg->op_wq_item.is_on_list())
+    pqueue.push_back(&pg->op_wq_item);
+  pg->op_wq_refs++;
+  len++;
+  wq->total_len.inc();
+  wq->osd->service.op_sched.queued(wq->osd->service.sched_client);
+  if (logger)
+    logger->set(l_osd_shard_opq, len);
+  wq->osd->logger->set(l_osd_opq, wq->total_len.read());
   return true;
 }
 
-PG *OSD::OpWQ::_dequeue()
+void ShardedOpWQ::Shard::_dequeue(PG *pg)
+{
+  if (!pg->op_wq_item.remove_myself())
+    return;
+  assert(len >= pg->op_wq_refs);
+  len -= pg->op_wq_refs;
+  wq->total_len.sub(pg->op_wq_refs);
+  wq->osd->service.op_sched.dequeued(wq->osd->service.sched_client,
+				     pg->op_wq_refs);
+  while (pg->op_wq_refs) {
+    pg->op_wq_refs--;
+    pg->put();
+  }
+  if (logger)
+    logger->set(l_osd_shard_opq, len);
+  wq->osd->logger->set(l_osd_opq, wq->total_len.read());
+}
+
+PG *ShardedOpWQ::Shard::_dequeue()
 {
-  if (osd->op_queue.empty())
+  if (pqueue.empty())
     return NULL;
-  PG *pg = osd->op_queue.front();
-  osd->op_queue.pop_front();
-  osd->op_queue_len--;
-  osd->logger->set(l_osd_opq, osd->op_queue_len);
+  // hand out one entry and rotate the pg to the back, so a pg with a
+  // deep queue can't starve the others on this shard.  the pg keeps
+  // the ref taken in _enqueue.
+  PG *pg = pqueue.front();
+  assert(pg->op_wq_refs > 0);
+  if (--pg->op_wq_refs)
+    pg->op_wq_item.move_to_back();
+  else
+    pg->op_wq_item.remove_myself();
+  len--;
+  wq->total_len.dec();
+  wq->osd->service.op_sched.dequeued(wq->osd->service.sched_client);
+  if (logger) {
+    logger->set(l_osd_shard_opq, len);
+    logger->inc(l_osd_shard_op);
+  }
+  wq->osd->logger->set(l_osd_opq, wq->total_len.read());
   return pg;
 }
 
+void ShardedOpWQ::Shard::_process(PG *pg)
+{
+  wq->osd->dequeue_op(pg);
+}
+
 void OSDService::queue_for_peering(PG *pg)
 {
   peering_wq.queue(pg);
@@ -5594,11 +5988,17 @@ void OSD::dequeue_op(PG *pg)
 
   op->mark_reached_pg();
 
+  uint64_t cost = MAX(op->request->get_data().length(),
+		      (unsigned)g_conf->osd_op_sched_min_cost);
+  utime_t sched_start = service.op_sched.get(service.sched_client, cost);
+
   pg->do_request(op);
 
   // unlock and put pg
   pg->unlock();
   pg->put();
+
+  service.op_sched.put(service.sched_client, sched_start);
   
   //#warning foo
   //scrub_wq.queue(pg);
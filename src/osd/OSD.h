@@ -25,6 +25,7 @@
 #include "common/RWLock.h"
 #include "common/Timer.h"
 #include "common/WorkQueue.h"
+#include "common/WeightedScheduler.h"
 #include "common/LogClient.h"
 
 #include "os/ObjectStore.h"
@@ -67,15 +68,18 @@ enum {
   l_osd_op_r,
   l_osd_op_r_outb,
   l_osd_op_r_lat,
+  l_osd_op_r_lat_hist,
   l_osd_op_w,
   l_osd_op_w_inb,
   l_osd_op_w_rlat,
   l_osd_op_w_lat,
+  l_osd_op_w_lat_hist,
   l_osd_op_rw,
   l_osd_op_rw_inb,
   l_osd_op_rw_outb,
   l_osd_op_rw_rlat,
   l_osd_op_rw_lat,
+  l_osd_op_rw_lat_hist,
 
   l_osd_sop,
   l_osd_sop_inb,
@@ -90,11 +94,16 @@ enum {
   l_osd_sop_push_lat,
 
   l_osd_pull,
+  l_osd_pull_inb,
   l_osd_push,
   l_osd_push_outb,
+  l_osd_push_delta,
+  l_osd_push_delta_savedb,
 
   l_osd_rop,
 
+  l_osd_scrub_readb,
+
   l_osd_loadavg,
   l_osd_buf,
 
@@ -107,6 +116,10 @@ enum {
   l_osd_map,
   l_osd_mape,
   l_osd_mape_dup,
+  l_osd_map_apply_lat,
+  l_osd_pg_adv_lat,
+  l_osd_pg_adv_epochs,
+  l_osd_pg_adv_skip,
 
   l_osd_last,
 };
@@ -129,6 +142,7 @@ class AuthAuthorizeHandlerRegistry;
 
 class OpsFlightSocketHook;
 class HistoricOpsSocketHook;
+class OpSchedSocketHook;
 
 extern const coll_t meta_coll;
 
@@ -155,6 +169,70 @@ public:
 typedef std::tr1::shared_ptr<DeletingState> DeletingStateRef;
 
 class OSD;
+
+/**
+ * ShardedOpWQ - op queue split into independently locked shards
+ *
+ * Each PG hashes to exactly one shard, so the ops queued for a PG are
+ * still handed out in order, while PGs in different shards are serviced
+ * by disjoint threads that never share a queue lock.  Every shard is a
+ * ThreadPool of its own (lock, cond and workers).  Within a shard, PGs
+ * with queued work are kept on an xlist and serviced round-robin, so
+ * queueing, dequeueing and removing a PG are all O(1).
+ */
+class ShardedOpWQ {
+  struct Shard : public ThreadPool::WorkQueue<PG> {
+    ShardedOpWQ *wq;
+    unsigned index;
+    xlist<PG*> pqueue;  ///< pgs with queued entries, in service order
+    unsigned len;       ///< total queued entries in this shard
+    PerfCounters *logger;
+
+    Shard(ShardedOpWQ *w, unsigned i, time_t ti, ThreadPool *tp)
+      : ThreadPool::WorkQueue<PG>("OSD::OpWQ::Shard", ti, ti*10, tp),
+	wq(w), index(i), len(0), logger(NULL) {}
+
+    bool _enqueue(PG *pg);
+    void _dequeue(PG *pg);
+    bool _empty() {
+      return pqueue.empty();
+    }
+    PG *_dequeue();
+    void _process(PG *pg);
+    void _clear() {
+      assert(pqueue.empty());
+    }
+  };
+
+  OSD *osd;
+  vector<ThreadPool*> pools;
+  vector<Shard*> shards;
+  atomic_t total_len;
+
+  Shard *get_shard(PG *pg);
+
+public:
+  ShardedOpWQ(OSD *o, CephContext *cct, time_t ti,
+	      unsigned num_shards, unsigned threads_per_shard);
+  ~ShardedOpWQ();
+
+  void queue(PG *pg);
+  void dequeue(PG *pg);
+
+  void start();
+  void stop();
+  void pause();
+  void drain();
+
+  unsigned get_num_shards() const {
+    return shards.size();
+  }
+  /// total number of queued entries across all shards
+  uint64_t get_queue_len() const {
+    return total_len.read();
+  }
+};
+
 class OSDService {
 public:
   OSD *osd;
@@ -168,7 +246,7 @@ public:
   Messenger *&client_messenger;
   PerfCounters *&logger;
   MonClient   *&monc;
-  ThreadPool::WorkQueue<PG> &op_wq;
+  ShardedOpWQ &op_wq;
   ThreadPool::BatchWorkQueue<PG> &peering_wq;
   ThreadPool::WorkQueue<PG> &recovery_wq;
   ThreadPool::WorkQueue<PG> &snap_trim_wq;
@@ -200,13 +278,28 @@ public:
 
   int get_nodeid() const { return whoami; }
 
+  // -- op scheduling --
+  /// shares the OSD between client io and background work by weight
+  WeightedScheduler op_sched;
+  int sched_client, sched_recovery, sched_scrub, sched_snap_trim;
+
   // -- scrub scheduling --
   Mutex sched_scrub_lock;
   int scrubs_pending;
   int scrubs_active;
   set< pair<utime_t,pg_t> > last_scrub_pg;
+  utime_t scrub_pace_until;  ///< when the deep scrub reads so far fit the budget
 
   bool scrub_should_schedule();
+  bool scrub_time_permit(utime_t now);
+
+  /// account for deep scrub reads against osd_scrub_max_bytes_per_sec
+  void scrub_charge(uint64_t bytes);
+  /// may a new scrub chunk start now?
+  bool scrub_pace_ok(utime_t now) {
+    Mutex::Locker l(sched_scrub_lock);
+    return now >= scrub_pace_until;
+  }
 
   void reg_last_pg_scrub(pg_t pgid, utime_t t) {
     Mutex::Locker l(sched_scrub_lock);
@@ -280,6 +373,7 @@ public:
   SharedLRU<epoch_t, const OSDMap> map_cache;
   SimpleLRU<epoch_t, bufferlist> map_bl_cache;
   SimpleLRU<epoch_t, bufferlist> map_bl_inc_cache;
+  map<epoch_t, bool> osd_change_epochs;  // epoch -> changed any osd state/info
 
   OSDMapRef get_map(epoch_t e);
   OSDMapRef add_map(OSDMap *o) {
@@ -310,6 +404,9 @@ public:
 
   void clear_map_bl_cache_pins();
 
+  /// true if nextmap changes the state or info of any osd vs lastmap
+  bool map_changes_osds(const OSDMapRef& lastmap, const OSDMapRef& nextmap);
+
   void need_heartbeat_peer_update();
 
   void pg_stat_queue_enqueue(PG *pg);
@@ -546,39 +643,14 @@ private:
   OpsFlightSocketHook *admin_ops_hook;
   HistoricOpsSocketHook *historic_ops_hook;
 
-  // -- op queue --
-  list<PG*> op_queue;
-  int op_queue_len;
-
-  struct OpWQ : public ThreadPool::WorkQueue<PG> {
-    OSD *osd;
-    OpWQ(OSD *o, time_t ti, ThreadPool *tp)
-      : ThreadPool::WorkQueue<PG>("OSD::OpWQ", ti, ti*10, tp), osd(o) {}
+  // -- op scheduler --
+  void dump_op_sched(ostream& ss);
+  friend class OpSchedSocketHook;
+  OpSchedSocketHook *op_sched_hook;
 
-    bool _enqueue(PG *pg);
-    void _dequeue(PG *pg) {
-      for (list<PG*>::iterator i = osd->op_queue.begin();
-	   i != osd->op_queue.end();
-	   ) {
-	if (*i == pg) {
-	  osd->op_queue.erase(i++);
-	  pg->put();
-	} else {
-	  ++i;
-	}
-      }
-    }
-    bool _empty() {
-      return osd->op_queue.empty();
-    }
-    PG *_dequeue();
-    void _process(PG *pg) {
-      osd->dequeue_op(pg);
-    }
-    void _clear() {
-      assert(osd->op_queue.empty());
-    }
-  } op_wq;
+  // -- op queue --
+  friend class ShardedOpWQ;
+  ShardedOpWQ op_wq;
 
   void enqueue_op(PG *pg, OpRequestRef op);
   void dequeue_op(PG *pg);
@@ -686,6 +758,8 @@ private:
   void note_up_osd(int osd);
   
   void advance_pg(epoch_t advance_to, PG *pg, PG::RecoveryCtx *rctx);
+  bool pg_affected_by_map(PG *pg, const OSDMapRef& lastmap, const OSDMapRef& nextmap,
+			  const vector<int>& newup, const vector<int>& newacting);
   void advance_map(ObjectStore::Transaction& t, C_Contexts *tfin);
   void activate_map();
 
@@ -752,6 +826,8 @@ protected:
 		       bool primary);
   
   void load_pgs();
+  void load_pg(PG *pg);
+  struct LoadPGWQ;
   void build_past_intervals_parallel();
 
   void calc_priors_during(pg_t pgid, epoch_t start, epoch_t end, set<int>& pset);
@@ -901,6 +977,7 @@ protected:
   void handle_pg_scan(OpRequestRef op);
 
   void handle_pg_backfill(OpRequestRef op);
+  void handle_pg_push(OpRequestRef op);
 
   void handle_pg_remove(OpRequestRef op);
   void _remove_pg(PG *pg);
@@ -984,6 +1061,7 @@ protected:
       if (!pg->recovery_item.is_on_list()) {
 	pg->get();
 	osd->recovery_queue.push_back(&pg->recovery_item);
+	osd->service.op_sched.queued(osd->service.sched_recovery);
 
 	if (g_conf->osd_recovery_delay_start > 0) {
 	  osd->defer_recovery_until = ceph_clock_now(g_ceph_context);
@@ -994,8 +1072,10 @@ protected:
       return false;
     }
     void _dequeue(PG *pg) {
-      if (pg->recovery_item.remove_myself())
+      if (pg->recovery_item.remove_myself()) {
+	osd->service.op_sched.dequeued(osd->service.sched_recovery);
 	pg->put();
+      }
     }
     PG *_dequeue() {
       if (osd->recovery_queue.empty())
@@ -1006,12 +1086,14 @@ protected:
 
       PG *pg = osd->recovery_queue.front();
       osd->recovery_queue.pop_front();
+      osd->service.op_sched.dequeued(osd->service.sched_recovery);
       return pg;
     }
     void _queue_front(PG *pg) {
       if (!pg->recovery_item.is_on_list()) {
 	pg->get();
 	osd->recovery_queue.push_front(&pg->recovery_item);
+	osd->service.op_sched.queued(osd->service.sched_recovery);
       }
     }
     void _process(PG *pg) {
@@ -1022,6 +1104,7 @@ protected:
       while (!osd->recovery_queue.empty()) {
 	PG *pg = osd->recovery_queue.front();
 	osd->recovery_queue.pop_front();
+	osd->service.op_sched.dequeued(osd->service.sched_recovery);
 	pg->put();
       }
     }
@@ -1056,24 +1139,33 @@ protected:
 	return false;
       pg->get();
       osd->snap_trim_queue.push_back(&pg->snap_trim_item);
+      osd->service.op_sched.queued(osd->service.sched_snap_trim);
       return true;
     }
     void _dequeue(PG *pg) {
-      if (pg->snap_trim_item.remove_myself())
+      if (pg->snap_trim_item.remove_myself()) {
+	osd->service.op_sched.dequeued(osd->service.sched_snap_trim);
 	pg->put();
+      }
     }
     PG *_dequeue() {
       if (osd->snap_trim_queue.empty())
 	return NULL;
       PG *pg = osd->snap_trim_queue.front();
       osd->snap_trim_queue.pop_front();
+      osd->service.op_sched.dequeued(osd->service.sched_snap_trim);
       return pg;
     }
     void _process(PG *pg) {
+      utime_t start = osd->service.op_sched.get(osd->service.sched_snap_trim,
+						g_conf->osd_op_sched_min_cost);
       pg->snap_trimmer();
+      osd->service.op_sched.put(osd->service.sched_snap_trim, start);
       pg->put();
     }
     void _clear() {
+      osd->service.op_sched.dequeued(osd->service.sched_snap_trim,
+				     osd->snap_trim_queue.size());
       osd->snap_trim_queue.clear();
     }
   } snap_trim_wq;
@@ -1098,28 +1190,42 @@ protected:
       }
       pg->get();
       osd->scrub_queue.push_back(&pg->scrub_item);
+      osd->service.op_sched.queued(osd->service.sched_scrub);
       return true;
     }
     void _dequeue(PG *pg) {
       if (pg->scrub_item.remove_myself()) {
+	osd->service.op_sched.dequeued(osd->service.sched_scrub);
 	pg->put();
       }
     }
     PG *_dequeue() {
-      if (osd->scrub_queue.empty())
-	return NULL;
-      PG *pg = osd->scrub_queue.front();
-      osd->scrub_queue.pop_front();
-      return pg;
+      // pgs waiting to start their next chunk sit out while deep scrub
+      // is over its read budget; the rest (which may be blocking writes)
+      // go right away.  we're polled again within a couple of seconds.
+      bool pace_ok = osd->service.scrub_pace_ok(ceph_clock_now(g_ceph_context));
+      for (xlist<PG*>::iterator p = osd->scrub_queue.begin(); !p.end(); ++p) {
+	PG *pg = *p;
+	if (pg->scrubber.paced && !pace_ok)
+	  continue;
+	pg->scrub_item.remove_myself();
+	osd->service.op_sched.dequeued(osd->service.sched_scrub);
+	return pg;
+      }
+      return NULL;
     }
     void _process(PG *pg) {
+      utime_t start = osd->service.op_sched.get(osd->service.sched_scrub,
+						g_conf->osd_op_sched_min_cost);
       pg->scrub();
+      osd->service.op_sched.put(osd->service.sched_scrub, start);
       pg->put();
     }
     void _clear() {
       while (!osd->scrub_queue.empty()) {
 	PG *pg = osd->scrub_queue.front();
 	osd->scrub_queue.pop_front();
+	osd->service.op_sched.dequeued(osd->service.sched_scrub);
 	pg->put();
       }
     }
@@ -1198,6 +1304,9 @@ protected:
       return msg;
     }
     void _process(MOSDRepScrub *msg) {
+      // wait for our share before taking the pg lock
+      utime_t start = osd->service.op_sched.get(osd->service.sched_scrub,
+						g_conf->osd_op_sched_min_cost);
       osd->osd_lock.Lock();
       if (osd->_have_pg(msg->pgid)) {
 	PG *pg = osd->_lookup_lock_pg(msg->pgid);
@@ -1209,6 +1318,7 @@ protected:
 	msg->put();
 	osd->osd_lock.Unlock();
       }
+      osd->service.op_sched.put(osd->service.sched_scrub, start);
     }
     void _clear() {
       while (!rep_scrub_queue.empty()) {
@@ -16,6 +16,7 @@
 
 #include "common/config.h"
 #include "common/Formatter.h"
+#include "common/Thread.h"
 #include "include/ceph_features.h"
 
 #include "common/code_environment.h"
@@ -507,6 +508,7 @@ void OSDMap::set_max_osd(int m)
   osd_uuid->resize(m);
 
   calc_num_osds();
+  _invalidate_mappings();
 }
 
 int OSDMap::calc_num_osds()
@@ -645,6 +647,15 @@ void OSDMap::dedup(const OSDMap *o, OSDMap *n)
     n->osd_uuid = o->osd_uuid;
 }
 
+void OSDMap::deepish_copy_from(const OSDMap& o)
+{
+  *this = o;
+  // crush is only ever replaced, never modified, so it can stay shared
+  osd_addrs.reset(new addrs_s(*o.osd_addrs));
+  pg_temp.reset(new map<pg_t,vector<int> >(*o.pg_temp));
+  osd_uuid.reset(new vector<uuid_d>(*o.osd_uuid));
+}
+
 int OSDMap::apply_incremental(Incremental &inc)
 {
   if (inc.epoch == 1)
@@ -655,6 +666,7 @@ int OSDMap::apply_incremental(Incremental &inc)
   assert(inc.epoch == epoch+1);
   epoch++;
   modified = inc.modified;
+  _invalidate_mappings();
 
   // full map?
   if (inc.fullmap.length()) {
@@ -834,22 +846,129 @@ void OSDMap::_remove_nonexistent_osds(vector<int>& osds) const
     osds.resize(osds.size() - removed);
 }
 
-int OSDMap::_pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const
+void OSDMap::_calc_raw_osds(const CrushWrapper& cw, int ruleno, const pg_pool_t& pool,
+			    int64_t poolid, ps_t seed, vector<int>& osds) const
 {
   // map to osds[]
-  ps_t pps = pool.raw_pg_to_pps(pg);  // placement ps
-  unsigned size = pool.get_size();
-
-  // what crush rule?
-  int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
+  ps_t pps = seed + poolid;  // placement ps; see pg_pool_t::raw_pg_to_pps()
+  osds.clear();
   if (ruleno >= 0)
-    crush->do_rule(ruleno, pps, osds, size, osd_weight);
+    cw.do_rule(ruleno, pps, osds, pool.get_size(), osd_weight);
 
   _remove_nonexistent_osds(osds);
+}
+
+OSDMap::pool_mappings_t& OSDMap::_get_pool_mappings(int64_t poolid, const pg_pool_t& pool,
+						    int ruleno) const
+{
+  assert(mapping_cache->lock.is_locked());
+  pool_mappings_t& pm = mapping_cache->pools[poolid];
+  if (pm.pgp_num != pool.get_pgp_num() ||
+      pm.size != pool.get_size() ||
+      pm.ruleno != ruleno) {
+    // first use, or the pool was modified in place
+    pm.raw.clear();
+    pm.pgp_num = pool.get_pgp_num();
+    pm.size = pool.get_size();
+    pm.ruleno = ruleno;
+  }
+  return pm;
+}
 
+int OSDMap::_pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const
+{
+  ps_t seed = ceph_stable_mod(pg.ps(), pool.get_pgp_num(), pool.get_pgp_num_mask());
+
+  // what crush rule?
+  int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(), pool.get_size());
+
+  mapping_cache_t& mc = *mapping_cache;
+  {
+    Mutex::Locker l(mc.lock);
+    pool_mappings_t& pm = _get_pool_mappings(pg.pool(), pool, ruleno);
+    hash_map<ps_t, vector<int> >::iterator p = pm.raw.find(seed);
+    if (p != pm.raw.end()) {
+      osds = p->second;
+      return osds.size();
+    }
+  }
+
+  _calc_raw_osds(*crush, ruleno, pool, pg.pool(), seed, osds);
+
+  Mutex::Locker l(mc.lock);
+  _get_pool_mappings(pg.pool(), pool, ruleno).raw[seed] = osds;
   return osds.size();
 }
 
+/*
+ * CrushWrapper serializes do_rule() (the mapper caches bucket
+ * permutations in place), so each worker maps with its own copy of
+ * the crush map.
+ */
+struct PGMappingWorker : public Thread {
+  const OSDMap *osdmap;
+  const pg_pool_t *pool;
+  int64_t poolid;
+  int ruleno;
+  ps_t begin, end;
+  CrushWrapper cw;
+  vector< vector<int> > result;
+
+  PGMappingWorker(const OSDMap *o, const pg_pool_t *p, int64_t id, int r,
+		  ps_t b, ps_t e, bufferlist& crushbl)
+    : osdmap(o), pool(p), poolid(id), ruleno(r), begin(b), end(e) {
+    bufferlist::iterator bp = crushbl.begin();
+    cw.decode(bp);
+  }
+  void *entry() {
+    result.resize(end - begin);
+    for (ps_t seed = begin; seed < end; ++seed)
+      osdmap->_calc_raw_osds(cw, ruleno, *pool, poolid, seed, result[seed - begin]);
+    return 0;
+  }
+};
+
+void OSDMap::precompute_pg_mappings(int64_t poolid, int num_threads) const
+{
+  if (num_threads < 1)
+    num_threads = 1;
+
+  bufferlist crushbl;
+  crush->encode(crushbl);
+  mapping_cache_t& mc = *mapping_cache;
+
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
+       p != pools.end();
+       ++p) {
+    if (poolid >= 0 && p->first != poolid)
+      continue;
+    const pg_pool_t& pool = p->second;
+    int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(), pool.get_size());
+    ps_t num = pool.get_pgp_num();
+    ps_t per = (num + num_threads - 1) / num_threads;
+
+    vector<PGMappingWorker*> workers;
+    for (ps_t b = 0; b < num; b += per) {
+      PGMappingWorker *w = new PGMappingWorker(this, &pool, p->first, ruleno,
+					       b, MIN(b + per, num), crushbl);
+      w->create();
+      workers.push_back(w);
+    }
+
+    for (vector<PGMappingWorker*>::iterator q = workers.begin(); q != workers.end(); ++q)
+      (*q)->join();
+
+    Mutex::Locker l(mc.lock);
+    for (vector<PGMappingWorker*>::iterator q = workers.begin(); q != workers.end(); ++q) {
+      PGMappingWorker *w = *q;
+      pool_mappings_t& pm = _get_pool_mappings(p->first, pool, ruleno);
+      for (ps_t seed = w->begin; seed < w->end; ++seed)
+	pm.raw[seed].swap(w->result[seed - w->begin]);
+      delete w;
+    }
+  }
+}
+
 // pg -> (up osd list)
 void OSDMap::_raw_to_up_osds(pg_t pg, vector<int>& raw, vector<int>& up) const
 {
@@ -1055,6 +1174,8 @@ void OSDMap::decode(bufferlist::iterator& p)
   __u16 v;
   ::decode(v, p);
 
+  _invalidate_mappings();
+
   // base
   ::decode(fsid, p);
   ::decode(epoch, p);
@@ -84,6 +84,18 @@ struct osd_info_t {
 };
 WRITE_CLASS_ENCODER(osd_info_t)
 
+inline bool operator==(const osd_info_t& l, const osd_info_t& r) {
+  return l.last_clean_begin == r.last_clean_begin &&
+    l.last_clean_end == r.last_clean_end &&
+    l.up_from == r.up_from &&
+    l.up_thru == r.up_thru &&
+    l.down_at == r.down_at &&
+    l.lost_at == r.lost_at;
+}
+inline bool operator!=(const osd_info_t& l, const osd_info_t& r) {
+  return !(l == r);
+}
+
 ostream& operator<<(ostream& out, const osd_info_t& info);
 
 
@@ -183,12 +195,39 @@ private:
   epoch_t cluster_snapshot_epoch;
   string cluster_snapshot;
 
+  /*
+   * raw (crush) pg mappings for this map, per pool, keyed by placement
+   * seed.  filled lazily by _pg_to_osds() or in bulk by
+   * precompute_pg_mappings().  anything that changes crush, pools,
+   * weights or osd existence replaces it (see _invalidate_mappings());
+   * copies of a map share it until one of them changes.
+   */
+  struct pool_mappings_t {
+    unsigned pgp_num, size;
+    int ruleno;
+    hash_map<ps_t, vector<int> > raw;
+    pool_mappings_t() : pgp_num(0), size(0), ruleno(-1) {}
+  };
+  struct mapping_cache_t {
+    Mutex lock;
+    map<int64_t, pool_mappings_t> pools;
+    mapping_cache_t() : lock("OSDMap::mapping_cache_t::lock") {}
+  };
+  std::tr1::shared_ptr<mapping_cache_t> mapping_cache;
+
+  void _invalidate_mappings() {
+    mapping_cache.reset(new mapping_cache_t);
+  }
+  pool_mappings_t& _get_pool_mappings(int64_t poolid, const pg_pool_t& pool,
+				      int ruleno) const;
+
  public:
   std::tr1::shared_ptr<CrushWrapper> crush;       // hierarchical map
 
   friend class OSDMonitor;
   friend class PGMonitor;
   friend class MDS;
+  friend struct PGMappingWorker;
 
  public:
   OSDMap() : epoch(0), 
@@ -199,6 +238,7 @@ private:
 	     pg_temp(new map<pg_t,vector<int> >),
 	     osd_uuid(new vector<uuid_d>),
 	     cluster_snapshot_epoch(0),
+	     mapping_cache(new mapping_cache_t),
 	     crush(new CrushWrapper) {
     memset(&fsid, 0, sizeof(fsid));
   }
@@ -258,6 +298,7 @@ private:
   void set_state(int o, unsigned s) {
     assert(o < max_osd);
     osd_state[o] = s;
+    _invalidate_mappings();
   }
   void set_weightf(int o, float w) {
     set_weight(o, (int)((float)CEPH_OSD_IN * w));
@@ -267,6 +308,7 @@ private:
     osd_weight[o] = w;
     if (w)
       osd_state[o] |= CEPH_OSD_EXISTS;
+    _invalidate_mappings();
   }
   unsigned get_weight(int o) const {
     assert(o < max_osd);
@@ -369,6 +411,19 @@ private:
   /// try to re-use/reference addrs in oldmap from newmap
   static void dedup(const OSDMap *oldmap, OSDMap *newmap);
 
+  /**
+   * copy o, cloning the shared members apply_incremental() modifies in
+   * place.  much cheaper than an encode/decode round trip.
+   */
+  void deepish_copy_from(const OSDMap& o);
+
+  /// true if every osd has the same state and info in both maps
+  bool osd_states_equal(const OSDMap& o) const {
+    return max_osd == o.max_osd &&
+      osd_state == o.osd_state &&
+      osd_info == o.osd_info;
+  }
+
   // serialize, unserialize
 private:
   void encode_client_old(bufferlist& bl) const;
@@ -405,6 +460,9 @@ public:
   }
 
 private:
+  /// placement seed -> (raw osd list), bypassing the mapping cache
+  void _calc_raw_osds(const CrushWrapper& cw, int ruleno, const pg_pool_t& pool,
+		      int64_t poolid, ps_t seed, vector<int>& osds) const;
   /// pg -> (raw osd list)
   int _pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const;
   void _remove_nonexistent_osds(vector<int>& osds) const;
@@ -420,6 +478,12 @@ public:
   void pg_to_raw_up(pg_t pg, vector<int>& up) const;
   void pg_to_up_acting_osds(pg_t pg, vector<int>& up, vector<int>& acting) const;
 
+  /**
+   * fill the mapping cache for every pg in a pool (or all pools, if
+   * poolid < 0) using num_threads threads.
+   */
+  void precompute_pg_mappings(int64_t poolid, int num_threads) const;
+
   int64_t lookup_pg_pool_name(const char *name) {
     if (name_pool.count(name))
       return name_pool[name];
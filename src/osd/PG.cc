@@ -14,10 +14,12 @@
 
 #include "PG.h"
 #include "common/config.h"
+#include "common/errno.h"
 #include "OSD.h"
 #include "OpRequest.h"
 
 #include "common/Timer.h"
+#include "common/perf_counters.h"
 
 #include "messages/MOSDOp.h"
 #include "messages/MOSDPGNotify.h"
@@ -27,6 +29,7 @@
 #include "messages/MOSDPGTrim.h"
 #include "messages/MOSDPGScan.h"
 #include "messages/MOSDPGBackfill.h"
+#include "messages/MOSDPGPush.h"
 
 #include "messages/MOSDSubOp.h"
 #include "messages/MOSDSubOpReply.h"
@@ -62,8 +65,10 @@ PG::PG(OSDService *o, OSDMapRef curmap,
   osd(o), osdmap_ref(curmap), pool(_pool),
   _lock("PG::_lock"),
   ref(0), deleting(false), dirty_info(false), dirty_log(false),
+  dirty_big_info(true),
   info(p), coll(p), log_oid(loid), biginfo_oid(ioid),
   recovery_item(this), scrub_item(this), scrub_finalize_item(this), snap_trim_item(this), stat_queue_item(this),
+  op_wq_item(this), op_wq_refs(0),
   recovery_ops_active(0),
   waiting_on_backfill(0),
   role(0),
@@ -133,7 +138,7 @@ std::string PG::gen_prefix() const
   
 
 
-void PG::IndexedLog::trim(ObjectStore::Transaction& t, eversion_t s) 
+void PG::IndexedLog::trim(ObjectStore::Transaction& t, const hobject_t& log_oid, eversion_t s)
 {
   if (complete_to != log.end() &&
       complete_to->version <= s) {
@@ -141,14 +146,18 @@ void PG::IndexedLog::trim(ObjectStore::Transaction& t, eversion_t s)
 		    << " on " << *this << dendl;
   }
 
+  set<string> keys_to_rm;
   while (!log.empty()) {
     pg_log_entry_t &e = *log.begin();
     if (e.version > s)
       break;
     generic_dout(20) << "trim " << e << dendl;
+    keys_to_rm.insert(e.get_key_name());
     unindex(e);         // remove from index,
     log.pop_front();    // from log
   }
+  if (!keys_to_rm.empty() && !g_conf->osd_preserve_trimmed_log)
+    t.omap_rmkeys(coll_t::META_COLL, log_oid, keys_to_rm);
 
   // raise tail?
   if (tail < s)
@@ -833,6 +842,7 @@ void PG::generate_past_intervals()
 
   // record our work.
   dirty_info = true;
+  dirty_big_info = true;
 }
 
 /*
@@ -849,6 +859,7 @@ void PG::trim_past_intervals()
       return;
     dout(10) << __func__ << ": trimming " << pif->second << dendl;
     past_intervals.erase(pif++);
+    dirty_big_info = true;
   }
 }
 
@@ -1583,6 +1594,10 @@ void PG::do_request(OpRequestRef op)
     do_backfill(op);
     break;
 
+  case MSG_OSD_PG_PUSH:
+    do_push(op);
+    break;
+
   default:
     assert(0 == "bad message type in do_request");
   }
@@ -2033,6 +2048,7 @@ void PG::init(int role, vector<int>& newup, vector<int>& newacting, pg_history_t
 
   info.history = history;
   past_intervals.swap(pi);
+  dirty_big_info = true;
 
   info.stats.up = up;
   info.stats.acting = acting;
@@ -2046,20 +2062,31 @@ void PG::init(int role, vector<int>& newup, vector<int>& newacting, pg_history_t
 
 void PG::write_info(ObjectStore::Transaction& t)
 {
-  // pg state
-  bufferlist infobl;
-  __u8 struct_v = 4;
-  ::encode(struct_v, infobl);
-  t.collection_setattr(coll, "info", infobl);
- 
-  // potentially big stuff
-  bufferlist bigbl;
-  ::encode(past_intervals, bigbl);
-  ::encode(snap_collections, bigbl);
-  ::encode(info, bigbl);
-  dout(20) << "write_info bigbl " << bigbl.length() << dendl;
-  t.truncate(coll_t::META_COLL, biginfo_oid, 0);
-  t.write(coll_t::META_COLL, biginfo_oid, 0, bigbl.length(), bigbl);
+  // potentially big stuff; rarely changes
+  if (dirty_big_info) {
+    bufferlist infobl;
+    __u8 struct_v = 5;
+    ::encode(struct_v, infobl);
+    t.collection_setattr(coll, "info", infobl);
+
+    bufferlist bigbl;
+    ::encode(past_intervals, bigbl);
+    ::encode(snap_collections, bigbl);
+    dout(20) << "write_info bigbl " << bigbl.length() << dendl;
+    // creates biginfo for a new (or converted) pg; it is never removed
+    // after that, so the omap keys below always have an object to go on
+    t.touch(coll_t::META_COLL, biginfo_oid);
+    t.truncate(coll_t::META_COLL, biginfo_oid, 0);
+    t.write(coll_t::META_COLL, biginfo_oid, 0, bigbl.length(), bigbl);
+    dirty_big_info = false;
+  }
+
+  // pg state, which changes with every write: a key in biginfo's omap,
+  // so that it goes to the kv store along with the new log entries.
+  map<string,bufferlist> keys;
+  ::encode(info, keys["info"]);
+  dout(20) << "write_info info " << keys["info"].length() << dendl;
+  t.omap_setkeys(coll_t::META_COLL, biginfo_oid, keys);
 
   dirty_info = false;
 }
@@ -2068,36 +2095,32 @@ void PG::write_log(ObjectStore::Transaction& t)
 {
   dout(10) << "write_log" << dendl;
 
-  // assemble buffer
-  bufferlist bl;
-
-  // build buffer
-  ondisklog.tail = 0;
+  map<string,bufferlist> keys;
+  uint64_t pos = 0;
   for (list<pg_log_entry_t>::iterator p = log.log.begin();
        p != log.log.end();
        p++) {
-    uint64_t startoff = bl.length();
-
-    bufferlist ebl(sizeof(*p)*2);
-    ::encode(*p, ebl);
-    __u32 crc = ebl.crc32c(0);
-    ::encode(ebl, bl);
-    ::encode(crc, bl);
-
-    p->offset = startoff;
+    bufferlist bl(sizeof(*p) * 2);
+    p->encode_with_checksum(bl);
+    p->offset = pos;
+    pos += bl.length();
+    keys[p->get_key_name()].claim(bl);
   }
-  ondisklog.head = bl.length();
-  ondisklog.has_checksums = true;
 
-  // write it
-  t.remove(coll_t::META_COLL, log_oid );
-  t.write(coll_t::META_COLL, log_oid , 0, bl.length(), bl);
+  // start over, dropping any old-style log in the object data too
+  t.remove(coll_t::META_COLL, log_oid);
+  t.touch(coll_t::META_COLL, log_oid);
+  t.omap_setkeys(coll_t::META_COLL, log_oid, keys);
 
-  bufferlist blb(sizeof(ondisklog));
-  ::encode(ondisklog, blb);
+  OndiskLog omaplog;
+  bufferlist blb(sizeof(omaplog));
+  ::encode(omaplog, blb);
   t.collection_setattr(coll, "ondisklog", blb);
+
+  ondisklog.zero();
+  ondisklog.head = pos;
   
-  dout(10) << "write_log to " << ondisklog.tail << "~" << ondisklog.length() << dendl;
+  dout(10) << "write_log " << keys.size() << " keys" << dendl;
   dirty_log = false;
 }
 
@@ -2117,45 +2140,13 @@ void PG::trim(ObjectStore::Transaction& t, eversion_t trim_to)
     assert(trim_to <= info.last_complete);
 
     dout(10) << "trim " << log << " to " << trim_to << dendl;
-    log.trim(t, trim_to);
+    log.trim(t, log_oid, trim_to);
     info.log_tail = log.tail;
-    trim_ondisklog(t);
-  }
-}
 
-void PG::trim_ondisklog(ObjectStore::Transaction& t) 
-{
-  uint64_t new_tail;
-  if (log.empty()) {
-    new_tail = ondisklog.head;
-  } else {
-    new_tail = log.log.front().offset;
+    uint64_t new_tail = log.empty() ? ondisklog.head : log.log.front().offset;
+    if (new_tail > ondisklog.tail)
+      ondisklog.tail = new_tail;
   }
-  bool same_block = (new_tail & ~4095) == (ondisklog.tail & ~4095);
-  dout(15) << "trim_ondisklog tail " << ondisklog.tail << " -> " << new_tail
-	   << ", now " << new_tail << "~" << (ondisklog.head - new_tail)
-	   << " " << (same_block ? "(same block)" : "(different block)")
-	   << dendl;
-  assert(new_tail >= ondisklog.tail);
-  
-  if (same_block)
-    return;
-
-  ondisklog.tail = new_tail;
-
-  if (!g_conf->osd_preserve_trimmed_log) {
-    uint64_t zt = new_tail & ~4095;
-    if (zt > ondisklog.zero_to) {
-      t.zero(coll_t::META_COLL, log_oid, ondisklog.zero_to, zt - ondisklog.zero_to);
-      dout(15) << "trim_ondisklog zeroing from " << ondisklog.zero_to
-	       << " to " << zt << dendl;
-      ondisklog.zero_to = zt;
-    }
-  }
-
-  bufferlist blb(sizeof(ondisklog));
-  ::encode(ondisklog, blb);
-  t.collection_setattr(coll, "ondisklog", blb);
 }
 
 void PG::trim_peers()
@@ -2182,15 +2173,7 @@ void PG::add_log_entry(pg_log_entry_t& e, bufferlist& log_bl)
 
   // log mutation
   log.add(e);
-  if (ondisklog.has_checksums) {
-    bufferlist ebl(sizeof(e)*2);
-    ::encode(e, ebl);
-    __u32 crc = ebl.crc32c(0);
-    ::encode(ebl, log_bl);
-    ::encode(crc, log_bl);
-  } else {
-    ::encode(e, log_bl);
-  }
+  e.encode_with_checksum(log_bl);
   dout(10) << "add_log_entry " << e << dendl;
 }
 
@@ -2199,24 +2182,20 @@ void PG::append_log(vector<pg_log_entry_t>& logv, eversion_t trim_to, ObjectStor
 {
   dout(10) << "append_log " << log << " " << logv << dendl;
 
-  bufferlist bl;
+  map<string,bufferlist> keys;
   for (vector<pg_log_entry_t>::iterator p = logv.begin();
        p != logv.end();
        p++) {
-    p->offset = ondisklog.head + bl.length();
+    p->offset = ondisklog.head;
+    bufferlist &bl = keys[p->get_key_name()];
     add_log_entry(*p, bl);
+    ondisklog.head += bl.length();
   }
 
-  dout(10) << "append_log  " << ondisklog.tail << "~" << ondisklog.length()
-	   << " adding " << bl.length() << dendl;
-
-  t.write(coll_t::META_COLL, log_oid, ondisklog.head, bl.length(), bl );
-  ondisklog.head += bl.length();
-
-  bufferlist blb(sizeof(ondisklog));
-  ::encode(ondisklog, blb);
-  t.collection_setattr(coll, "ondisklog", blb);
-  dout(10) << "append_log  now " << ondisklog.tail << "~" << ondisklog.length() << dendl;
+  dout(10) << "append_log  adding " << keys.size() << " keys" << dendl;
+  // omap ops on a missing object are silently dropped
+  t.touch(coll_t::META_COLL, log_oid);
+  t.omap_setkeys(coll_t::META_COLL, log_oid, keys);
 
   trim(t, trim_to);
 
@@ -2234,8 +2213,6 @@ void PG::read_log(ObjectStore *store)
   bufferlist::iterator p = blb.begin();
   ::decode(ondisklog, p);
 
-  dout(10) << "read_log " << ondisklog.tail << "~" << ondisklog.length() << dendl;
-
   log.tail = info.log_tail;
 
   // In case of sobject_t based encoding, may need to list objects in the store
@@ -2243,8 +2220,10 @@ void PG::read_log(ObjectStore *store)
   bool listed_collection = false;
   vector<hobject_t> ls;
   
-  if (ondisklog.head > 0) {
-    // read
+  bool old_style = ondisklog.head > 0;
+  if (old_style) {
+    // an old-style log, in the object data
+    dout(10) << "read_log " << ondisklog.tail << "~" << ondisklog.length() << dendl;
     bufferlist bl;
     store->read(coll_t::META_COLL, log_oid, ondisklog.tail, ondisklog.length(), bl);
     if (bl.length() < ondisklog.length()) {
@@ -2356,6 +2335,36 @@ void PG::read_log(ObjectStore *store)
       for (map<eversion_t, pg_log_entry_t>::iterator p = m.begin(); p != m.end(); p++)
 	log.log.push_back(p->second);
     }
+  } else {
+    // one omap key per entry, in order
+    dout(10) << "read_log from omap" << dendl;
+    assert(log.empty());
+    ObjectMap::ObjectMapIterator p = store->get_omap_iterator(coll_t::META_COLL, log_oid);
+    if (p) {
+      for (p->seek_to_first(); p->valid(); p->next()) {
+	bufferlist bl = p->value();
+	bufferlist::iterator bp = bl.begin();
+	pg_log_entry_t e;
+	e.decode_with_checksum(bp);
+	e.offset = ondisklog.head;
+	dout(20) << "read_log " << e << dendl;
+
+	if (e.version <= log.tail) {
+	  // left behind by osd_preserve_trimmed_log
+	  dout(20) << "read_log  ignoring entry " << e.version << " below log.tail" << dendl;
+	  continue;
+	}
+	if (e.version > info.last_update) {
+	  osd->clog.error() << info.pgid << " log has entry " << e.version
+			    << " after " << info.last_update << "\n";
+	  dout(0) << "read_log *** entry " << e.version << " after last_update "
+		  << info.last_update << ", ignoring the rest" << dendl;
+	  break;
+	}
+	log.log.push_back(e);
+	ondisklog.head += bl.length();
+      }
+    }
   }
 
   log.head = info.last_update;
@@ -2390,6 +2399,13 @@ void PG::read_log(ObjectStore *store)
       }
     }
   }
+
+  if (old_style) {
+    dout(0) << "read_log converting log to omap" << dendl;
+    ObjectStore::Transaction t;
+    write_log(t);
+    store->apply_transaction(t);
+  }
   dout(10) << "read_log done" << dendl;
 }
 
@@ -2447,6 +2463,31 @@ bool PG::check_log_for_corruption(ObjectStore *store)
 	dout(30) << " " << pos << " " << e << dendl;
       }
     }
+  } else {
+    ObjectMap::ObjectMapIterator p = store->get_omap_iterator(coll_t::META_COLL, log_oid);
+    if (p)
+      p->seek_to_first();
+    for (; p && p->valid(); p->next()) {
+      pg_log_entry_t e;
+      try {
+	bufferlist bl = p->value();
+	bufferlist::iterator bp = bl.begin();
+	e.decode_with_checksum(bp);
+      }
+      catch (const buffer::error &err) {
+	dout(0) << "corrupt entry at key " << p->key() << dendl;
+	ss << "corrupt entry at key " << p->key();
+	ok = false;
+	break;
+      }
+      if (p->key() != e.get_key_name()) {
+	dout(0) << "entry " << e.version << " at key " << p->key() << dendl;
+	ss << "entry " << e.version << " at key " << p->key();
+	ok = false;
+	break;
+      }
+      dout(30) << " " << p->key() << " " << e << dendl;
+    }
   }
   if (!ok) {
     stringstream f;
@@ -2489,6 +2530,8 @@ void PG::read_state(ObjectStore *store)
   ::decode(struct_v, p);
   if (struct_v < 4)
     ::decode(info, p);
+  // rewrite biginfo in the current format on the next write_info
+  dirty_big_info = (struct_v < 5);
   if (struct_v < 2) {
     ::decode(past_intervals, p);
   
@@ -2515,9 +2558,29 @@ void PG::read_state(ObjectStore *store)
     }
   } else {
     ::decode(snap_collections, p);
-    if (struct_v >= 4)
+    if (struct_v == 4)
       ::decode(info, p);
   }
+  if (struct_v >= 5) {
+    set<string> keys;
+    keys.insert("info");
+    map<string,bufferlist> values;
+    int r = store->omap_get_values(coll_t::META_COLL, biginfo_oid, keys, &values);
+    if (r < 0 || !values.count("info")) {
+      derr << "read_state no info key on " << biginfo_oid << ": "
+	   << (r < 0 ? cpp_strerror(r) : string("not found")) << dendl;
+      assert(0 == "pg info missing");
+    }
+    try {
+      p = values["info"].begin();
+      ::decode(info, p);
+    }
+    catch (const buffer::error &e) {
+      derr << "read_state can't decode info on " << biginfo_oid << ": "
+	   << e.what() << dendl;
+      assert(0 == "pg info corrupt");
+    }
+  }
 
   try {
     read_log(store);
@@ -2542,6 +2605,7 @@ void PG::read_state(ObjectStore *store)
     t.create_collection(cr_log_coll);
     t.collection_move(cr_log_coll, coll_t::META_COLL, log_oid);
     t.touch(coll_t::META_COLL, log_oid);
+    t.omap_clear(coll_t::META_COLL, log_oid);
     write_info(t);
     store->apply_transaction(t);
 
@@ -2593,6 +2657,7 @@ coll_t PG::make_snap_collection(ObjectStore::Transaction& t, snapid_t s)
   coll_t c(info.pgid, s);
   if (!snap_collections.contains(s)) {
     snap_collections.insert(s);
+    dirty_big_info = true;
     write_info(t);
     dout(10) << "create_snap_collection " << c << ", set now " << snap_collections << dendl;
     t.create_collection(c);
@@ -2845,6 +2910,8 @@ void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep)
         }
         o.digest = h.digest();
         o.digest_present = true;
+        osd->op_sched.charge(osd->sched_scrub, pos);
+        osd->scrub_charge(pos);
       }
 
       dout(25) << "_scan_list  " << poid << dendl;
@@ -3027,9 +3094,8 @@ int PG::build_scrub_map_chunk(ScrubMap &map,
   // pg attrs
   osd->store->collection_getattrs(coll, map.attrs);
 
-  // log
-  osd->store->read(coll_t(), log_oid, 0, 0, map.logbl);
-  dout(10) << " done.  pg log is " << map.logbl.length() << " bytes" << dendl;
+  // no log: nothing compares it, and it would go out with every chunk
+  dout(10) << " done.  " << map.objects.size() << " objects" << dendl;
 
   return 0;
 }
@@ -3069,9 +3135,7 @@ void PG::build_scrub_map(ScrubMap &map)
   // pg attrs
   osd->store->collection_getattrs(coll, map.attrs);
 
-  // log
-  osd->store->read(coll_t(), log_oid, 0, 0, map.logbl);
-  dout(10) << " done.  pg log is " << map.logbl.length() << " bytes" << dendl;
+  dout(10) << " done." << dendl;
 }
 
 
@@ -3106,9 +3170,6 @@ void PG::build_inc_scrub_map(ScrubMap &map, eversion_t v)
   _scan_list(map, ls, false);
   // pg attrs
   osd->store->collection_getattrs(coll, map.attrs);
-
-  // log
-  osd->store->read(coll_t(), log_oid, 0, 0, map.logbl);
 }
 
 void PG::repair_object(const hobject_t& soid, ScrubMap::object *po, int bad_peer, int ok_peer)
@@ -3517,12 +3578,17 @@ void PG::chunky_scrub() {
         ++(osd->scrubs_active);
         osd->sched_scrub_lock.Unlock();
 
+        scrubber.stamp_start = ceph_clock_now(g_ceph_context);
+        scrubber.client_lat = osd->logger->fget(l_osd_op_lat,
+						&scrubber.client_ops);
+
         scrubber.start = hobject_t();
         scrubber.state = PG::Scrubber::NEW_CHUNK;
 
         break;
 
       case PG::Scrubber::NEW_CHUNK:
+        scrubber.paced = false;
         scrubber.primary_scrubmap = ScrubMap();
         scrubber.received_maps.clear();
 
@@ -3626,6 +3692,15 @@ void PG::chunky_scrub() {
           return;
         }
 
+        scrubber.objects += scrubber.primary_scrubmap.objects.size();
+        if (scrubber.deep) {
+          for (map<hobject_t,ScrubMap::object>::iterator p =
+                 scrubber.primary_scrubmap.objects.begin();
+               p != scrubber.primary_scrubmap.objects.end();
+               ++p)
+            scrubber.bytes += p->second.size;
+        }
+
         --scrubber.waiting_on;
         scrubber.waiting_on_whom.erase(osd->whoami);
 
@@ -3653,10 +3728,11 @@ void PG::chunky_scrub() {
         requeue_ops(waiting_for_active);
 
         if (scrubber.end < hobject_t::get_max()) {
-          // schedule another leg of the scrub
+          // schedule another leg of the scrub, when the read budget allows
           scrubber.start = scrubber.end;
 
           scrubber.state = PG::Scrubber::NEW_CHUNK;
+          scrubber.paced = true;
           osd->scrub_wq.queue(this);
           done = true;
         } else {
@@ -3953,6 +4029,8 @@ void PG::scrub_finish() {
       oss << "ok";
     if (repair)
       oss << ", " << scrubber.fixed << " fixed";
+    if (scrubber.stamp_start != utime_t())
+      scrub_print_stats(oss);
     oss << "\n";
     if (scrubber.errors)
       osd->clog.error(oss);
@@ -3985,6 +4063,35 @@ void PG::scrub_finish() {
   }
 }
 
+/*
+ * what the scrub cost: its rate, and client op latency on this osd
+ * while it ran against the average before it started
+ */
+void PG::scrub_print_stats(ostream& out)
+{
+  double elapsed = ceph_clock_now(g_ceph_context) - scrubber.stamp_start;
+  if (elapsed <= 0)
+    return;
+  out << ", " << scrubber.objects << " objects";
+  if (scrubber.deep)
+    out << " " << prettybyte_t(scrubber.bytes);
+  out << " in " << elapsed << "s (";
+  if (scrubber.deep)
+    out << prettybyte_t(scrubber.bytes / elapsed) << "/s, ";
+  out << (unsigned)(scrubber.objects / elapsed) << " objects/s)";
+
+  uint64_t ops;
+  double lat = osd->logger->fget(l_osd_op_lat, &ops);
+  if (ops > scrubber.client_ops) {
+    out << ", client op latency "
+	<< (lat - scrubber.client_lat) / (ops - scrubber.client_ops) * 1000.0
+	<< " ms";
+    if (scrubber.client_ops)
+      out << " vs " << scrubber.client_lat / scrubber.client_ops * 1000.0
+	  << " ms before";
+  }
+}
+
 void PG::share_pg_info()
 {
   dout(10) << "share_pg_info" << dendl;
@@ -4280,6 +4387,7 @@ void PG::start_peering_interval(const OSDMapRef lastmap,
     if (new_interval) {
       dout(10) << " noting past " << past_intervals.rbegin()->second << dendl;
       dirty_info = true;
+      dirty_big_info = true;
     }
   }
 
@@ -4537,6 +4645,18 @@ bool PG::can_discard_backfill(OpRequestRef op)
 
 }
 
+bool PG::can_discard_push(OpRequestRef op)
+{
+  MOSDPGPush *m = (MOSDPGPush *)op->request;
+  assert(m->get_header().type == MSG_OSD_PG_PUSH);
+
+  if (old_peering_msg(m->map_epoch, m->map_epoch)) {
+    dout(10) << " got old push, ignoring" << dendl;
+    return true;
+  }
+  return false;
+}
+
 bool PG::can_discard_request(OpRequestRef op)
 {
   switch (op->request->get_type()) {
@@ -4551,6 +4671,9 @@ bool PG::can_discard_request(OpRequestRef op)
 
   case MSG_OSD_PG_BACKFILL:
     return can_discard_backfill(op);
+
+  case MSG_OSD_PG_PUSH:
+    return can_discard_push(op);
   }
   return true;
 }
@@ -4577,6 +4700,10 @@ bool PG::must_delay_request(OpRequestRef op)
   case MSG_OSD_PG_BACKFILL:
     return !require_same_or_newer_map(
       static_cast<MOSDPGBackfill*>(op->request)->map_epoch);
+
+  case MSG_OSD_PG_PUSH:
+    return !require_same_or_newer_map(
+      static_cast<MOSDPGPush*>(op->request)->map_epoch);
   }
   assert(0);
   return false;
@@ -4696,6 +4823,19 @@ void PG::handle_advance_map(OSDMapRef osdmap, OSDMapRef lastmap,
   recovery_state.handle_event(evt, rctx);
 }
 
+/*
+ * move to an epoch that cannot affect us (see OSD::pg_affected_by_map)
+ * without running it through the state machine.
+ */
+void PG::handle_skip_map(OSDMapRef osdmap, OSDMapRef lastmap)
+{
+  assert(osdmap->get_epoch() == (lastmap->get_epoch() + 1));
+  assert(lastmap == osdmap_ref);
+  dout(20) << "handle_skip_map " << osdmap->get_epoch() << dendl;
+  osdmap_ref = osdmap;
+  pool.update(osdmap);
+}
+
 void PG::handle_activate_map(RecoveryCtx *rctx)
 {
   dout(10) << "handle_activate_map " << dendl;
@@ -264,7 +264,8 @@ public:
       caller_ops[e.reqid] = &(log.back());
     }
 
-    void trim(ObjectStore::Transaction &t, eversion_t s);
+    /// trim entries up to s, and remove their keys from the log object
+    void trim(ObjectStore::Transaction &t, const hobject_t& log_oid, eversion_t s);
 
     ostream& print(ostream& out) const;
   };
@@ -272,6 +273,16 @@ public:
 
   /**
    * OndiskLog - some info about how we store the log on disk.
+   *
+   * The log is kept as omap keys on log_oid, one per entry, named by
+   * eversion_t::get_key_name().  Older OSDs appended entries to the
+   * object's data instead, with tail~head giving the live part; a
+   * nonzero head in the ondisklog attr means a log in that format, which
+   * we convert when we read it.
+   *
+   * In memory, tail~head still counts the bytes of encoded entries in
+   * the log (each entry's offset is where it starts), for the log_size
+   * stats.  The attr is always written zeroed.
    */
   class OndiskLog {
   public:
@@ -399,6 +410,7 @@ public:
   list<OpRequestRef> op_queue;  // op queue
 
   bool dirty_info, dirty_log;
+  bool dirty_big_info;   ///< past_intervals or snap_collections changed
 
 public:
   // pg state
@@ -420,6 +432,8 @@ public:
   /* You should not use these items without taking their respective queue locks
    * (if they have one) */
   xlist<PG*>::item recovery_item, scrub_item, scrub_finalize_item, snap_trim_item, stat_queue_item;
+  xlist<PG*>::item op_wq_item;  ///< on our ShardedOpWQ shard (shard lock)
+  unsigned op_wq_refs;          ///< entries queued on our shard (shard lock)
   int recovery_ops_active;
   bool waiting_on_backfill;
 #ifdef DEBUG_RECOVERY_OIDS
@@ -779,7 +793,8 @@ public:
       block_writes(false), active(false), waiting_on(0),
       errors(0), fixed(0), active_rep_scrub(0),
       finalizing(false), is_chunky(false), state(INACTIVE),
-      deep(false)
+      deep(false), paced(false), objects(0), bytes(0),
+      client_lat(0), client_ops(0)
     {
     }
 
@@ -822,6 +837,17 @@ public:
     // deep scrub
     bool deep;
 
+    // pacing: queued to start a new chunk, which ScrubWQ holds back
+    // while the osd is over osd_scrub_max_bytes_per_sec
+    bool paced;
+
+    // for the summary at the end: what we scanned, and client op
+    // latency (sum, count) as of the start
+    utime_t stamp_start;
+    uint64_t objects, bytes;
+    double client_lat;
+    uint64_t client_ops;
+
     static const char *state_string(const PG::Scrubber::State& state) {
       const char *ret = NULL;
       switch( state )
@@ -860,6 +886,12 @@ public:
       errors = 0;
       fixed = 0;
       deep = false;
+      paced = false;
+      stamp_start = utime_t();
+      objects = 0;
+      bytes = 0;
+      client_lat = 0;
+      client_ops = 0;
     }
 
   } scrubber;
@@ -881,6 +913,7 @@ public:
   void scrub_compare_maps();
   void scrub_finalize();
   void scrub_finish();
+  void scrub_print_stats(ostream& out);
   void scrub_clear_state();
   bool scrub_gather_replica_maps();
   void _scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep);
@@ -1546,7 +1579,6 @@ public:
   void read_log(ObjectStore *store);
   bool check_log_for_corruption(ObjectStore *store);
   void trim(ObjectStore::Transaction& t, eversion_t v);
-  void trim_ondisklog(ObjectStore::Transaction& t);
   void trim_peers();
 
   std::string get_corrupt_pg_log_name() const;
@@ -1586,6 +1618,7 @@ public:
   bool can_discard_scan(OpRequestRef op);
   bool can_discard_subop(OpRequestRef op);
   bool can_discard_backfill(OpRequestRef op);
+  bool can_discard_push(OpRequestRef op);
   bool can_discard_request(OpRequestRef op);
 
   bool must_delay_request(OpRequestRef op);
@@ -1616,6 +1649,7 @@ public:
   void handle_advance_map(OSDMapRef osdmap, OSDMapRef lastmap,
 			  vector<int>& newup, vector<int>& newacting,
 			  RecoveryCtx *rctx);
+  void handle_skip_map(OSDMapRef osdmap, OSDMapRef lastmap);
   void handle_activate_map(RecoveryCtx *rctx);
   void handle_recovery_complete(RecoveryCtx *rctx);
   void handle_create(RecoveryCtx *rctx);
@@ -1633,6 +1667,7 @@ public:
   virtual void do_sub_op_reply(OpRequestRef op) = 0;
   virtual void do_scan(OpRequestRef op) = 0;
   virtual void do_backfill(OpRequestRef op) = 0;
+  virtual void do_push(OpRequestRef op) = 0;
   virtual void snap_trimmer() = 0;
 
   virtual int do_command(vector<string>& cmd, ostream& ss,
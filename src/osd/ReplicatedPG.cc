@@ -30,6 +30,7 @@
 #include "messages/MOSDPGTrim.h"
 #include "messages/MOSDPGScan.h"
 #include "messages/MOSDPGBackfill.h"
+#include "messages/MOSDPGPush.h"
 
 #include "messages/MOSDPing.h"
 #include "messages/MWatchNotify.h"
@@ -584,7 +585,9 @@ void ReplicatedPG::calc_trim_to()
 ReplicatedPG::ReplicatedPG(OSDService *o, OSDMapRef curmap,
 			   const PGPool &_pool, pg_t p, const hobject_t& oid,
 			   const hobject_t& ioid) :
-  PG(o, curmap, _pool, p, oid, ioid), temp_created(false),
+  PG(o, curmap, _pool, p, oid, ioid),
+  gather_pushes(false), pushes_started(0),
+  temp_created(false),
   temp_coll(coll_t::make_temp_coll(p)), snap_trimmer_machine(this)
 { 
   snap_trimmer_machine.initiate();
@@ -1019,21 +1022,26 @@ void ReplicatedPG::log_op_stats(OpContext *ctx)
   osd->logger->inc(l_osd_op_inb, inb);
   osd->logger->finc(l_osd_op_lat, latency);
 
+  uint64_t lat_usec = (uint64_t)latency.sec() * 1000000 + latency.usec();
+
   if (m->may_read() && m->may_write()) {
     osd->logger->inc(l_osd_op_rw);
     osd->logger->inc(l_osd_op_rw_inb, inb);
     osd->logger->inc(l_osd_op_rw_outb, outb);
     osd->logger->finc(l_osd_op_rw_rlat, rlatency);
     osd->logger->finc(l_osd_op_rw_lat, latency);
+    osd->logger->hinc(l_osd_op_rw_lat_hist, lat_usec, inb);
   } else if (m->may_read()) {
     osd->logger->inc(l_osd_op_r);
     osd->logger->inc(l_osd_op_r_outb, outb);
     osd->logger->finc(l_osd_op_r_lat, latency);
+    osd->logger->hinc(l_osd_op_r_lat_hist, lat_usec, outb);
   } else if (m->may_write()) {
     osd->logger->inc(l_osd_op_w);
     osd->logger->inc(l_osd_op_w_inb, inb);
     osd->logger->finc(l_osd_op_w_rlat, rlatency);
     osd->logger->finc(l_osd_op_w_lat, latency);
+    osd->logger->hinc(l_osd_op_w_lat_hist, lat_usec, inb);
   } else
     assert(0);
 
@@ -1249,6 +1257,26 @@ void ReplicatedPG::do_backfill(OpRequestRef op)
   }
 }
 
+void ReplicatedPG::do_push(OpRequestRef op)
+{
+  MOSDPGPush *m = (MOSDPGPush*)op->request;
+  assert(m->get_header().type == MSG_OSD_PG_PUSH);
+  dout(10) << "do_push " << *m << dendl;
+
+  switch (m->op) {
+  case MOSDPGPush::OP_PUSH:
+    if (!is_active())
+      waiting_for_active.push_back(op);
+    else
+      handle_pushes(op);
+    break;
+
+  case MOSDPGPush::OP_PUSH_REPLY:
+    handle_push_replies(op);
+    break;
+  }
+}
+
 /* Returns head of snap_trimq as snap_to_trim and the relevant objects as 
  * obs_to_trim */
 bool ReplicatedPG::get_obs_to_trim(snapid_t &snap_to_trim,
@@ -2057,6 +2085,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	    dout(10) << " truncate_seq " << op.extent.truncate_seq << " > current " << seq
 		     << ", truncating to " << op.extent.truncate_size << dendl;
 	    t.truncate(coll, soid, op.extent.truncate_size);
+	    ctx->mark_dirty(op.extent.truncate_size, -1);
 	    oi.truncate_seq = op.extent.truncate_seq;
 	    oi.truncate_size = op.extent.truncate_size;
 	    if (op.extent.truncate_size != oi.size) {
@@ -2074,6 +2103,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	bufferlist nbl;
 	bp.copy(op.extent.length, nbl);
 	t.write(coll, soid, op.extent.offset, op.extent.length, nbl);
+	ctx->mark_dirty(op.extent.offset, op.extent.length);
 	write_update_size_and_usage(ctx->delta_stats, oi, ssc->snapset, ctx->modified_ranges,
 				    op.extent.offset, op.extent.length, true);
 	if (!obs.exists) {
@@ -2094,6 +2124,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	  obs.exists = true;
 	}
 	t.write(coll, soid, op.extent.offset, op.extent.length, nbl);
+	ctx->mark_dirty(0, -1);
 	interval_set<uint64_t> ch;
 	if (oi.size > 0)
 	  ch.insert(0, oi.size);
@@ -2110,6 +2141,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 
     case CEPH_OSD_OP_ROLLBACK :
       result = _rollback_to(ctx, op);
+      ctx->dirty_extents_valid = false;
       break;
 
     case CEPH_OSD_OP_ZERO:
@@ -2117,6 +2149,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	assert(op.extent.length);
 	if (obs.exists) {
 	  t.zero(coll, soid, op.extent.offset, op.extent.length);
+	  ctx->mark_dirty(op.extent.offset, op.extent.length);
 	  interval_set<uint64_t> ch;
 	  ch.insert(op.extent.offset, op.extent.length);
 	  ctx->modified_ranges.union_of(ch);
@@ -2180,6 +2213,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	}
 
 	t.truncate(coll, soid, op.extent.offset);
+	ctx->mark_dirty(op.extent.offset, -1);
 	if (oi.size > op.extent.offset) {
 	  interval_set<uint64_t> trim;
 	  trim.insert(op.extent.offset, oi.size-op.extent.offset);
@@ -2221,6 +2255,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	t.clone_range(coll, src_obc->obs.oi.soid,
 		      obs.oi.soid, op.clonerange.src_offset,
 		      op.clonerange.length, op.clonerange.offset);
+	ctx->mark_dirty(op.clonerange.offset, op.clonerange.length);
 		      
 
 	write_update_size_and_usage(ctx->delta_stats, oi, ssc->snapset, ctx->modified_ranges,
@@ -2857,6 +2892,7 @@ inline int ReplicatedPG::_delete_head(OpContext *ctx)
     return -ENOENT;
   
   t.remove(coll, soid);
+  ctx->mark_dirty(0, -1);
 
   if (oi.size > 0) {
     interval_set<uint64_t> ch;
@@ -3397,6 +3433,11 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
     logopcode = pg_log_entry_t::DELETE;
   ctx->log.push_back(pg_log_entry_t(logopcode, soid, ctx->at_version, old_version,
 				ctx->reqid, ctx->mtime));
+  if (g_conf->osd_log_dirty_extents && logopcode == pg_log_entry_t::MODIFY &&
+      ctx->dirty_extents_valid) {
+    ctx->log.back().has_dirty_extents = true;
+    ctx->log.back().dirty_extents.swap(ctx->dirty_extents);
+  }
 
   // apply new object state.
   ctx->obc->obs = ctx->new_obs;
@@ -3764,13 +3805,23 @@ void ReplicatedPG::issue_repop(RepGather *repop, utime_t now,
       wr->set_data(repop->ctx->op->request->get_data());   // _copy_ bufferlist
     } else {
       // ship resulting transaction, log entries, and pg_stats
+      Connection *con = osd->cluster_messenger->get_connection(
+	get_osdmap()->get_cluster_inst(peer));
+      bool compact_txn = con->features & CEPH_FEATURE_COMPACT_TXN;
+      con->put();
       if (peer == backfill_target && soid >= backfill_pos) {
 	dout(10) << "issue_repop shipping empty opt to osd." << peer << ", object beyond backfill_pos "
 		 << backfill_pos << ", last_backfill is " << pinfo.last_backfill << dendl;
 	ObjectStore::Transaction t;
-	::encode(t, wr->get_data());
-      } else {
+	if (compact_txn)
+	  ::encode(t, wr->get_data());
+	else
+	  t.encode_legacy(wr->get_data());
+      } else if (compact_txn) {
 	::encode(repop->ctx->op_t, wr->get_data());
+      } else {
+	// peer predates the v7 encoding
+	repop->ctx->op_t.encode_legacy(wr->get_data());
       }
       ::encode(repop->ctx->log, wr->logbl);
 
@@ -4573,6 +4624,64 @@ void ReplicatedPG::calc_head_subsets(ObjectContext *obc, SnapSet& snapset, const
 	   << "  clone_subsets " << clone_subsets << dendl;
 }
 
+/*
+ * if our log has every write to head since the version peer has, and
+ * each recorded the data it changed, those ranges are all peer needs
+ */
+bool ReplicatedPG::calc_delta_subset(ObjectContext *obc, const hobject_t& head,
+				     int peer,
+				     interval_set<uint64_t>& data_subset,
+				     eversion_t *base)
+{
+  map<hobject_t, pg_missing_t::item>::const_iterator m =
+    peer_missing[peer].missing.find(head);
+  if (m == peer_missing[peer].missing.end())
+    return false;
+  eversion_t have = m->second.have;
+  if (have == eversion_t() || have < log.tail)
+    return false;
+
+  interval_set<uint64_t> dirty;
+  eversion_t oldest_prior;
+  for (list<pg_log_entry_t>::reverse_iterator p = log.log.rbegin();
+       p != log.log.rend() && p->version > have;
+       ++p) {
+    if (p->soid != head)
+      continue;
+    if (!p->is_modify() || !p->has_dirty_extents) {
+      dout(15) << "calc_delta_subset " << head << " no extents for " << *p << dendl;
+      return false;
+    }
+    dirty.union_of(p->dirty_extents);
+    oldest_prior = p->prior_version;
+  }
+  if (oldest_prior != have) {
+    dout(15) << "calc_delta_subset " << head << " log doesn't lead from " << have
+	     << " to " << obc->obs.oi.version << dendl;
+    return false;
+  }
+
+  interval_set<uint64_t> object;
+  if (obc->obs.oi.size)
+    object.insert(0, obc->obs.oi.size);
+  dirty.intersection_of(object);
+  if ((uint64_t)dirty.size() > g_conf->osd_recovery_max_chunk)
+    return false;
+
+  Connection *con = osd->cluster_messenger->get_connection(
+    get_osdmap()->get_cluster_inst(peer));
+  bool supported = con->features & CEPH_FEATURE_DELTA_PUSH;
+  con->put();
+  if (!supported)
+    return false;
+
+  dout(10) << "calc_delta_subset " << head << " " << have << " -> "
+	   << obc->obs.oi.version << " changed " << dirty << dendl;
+  data_subset.swap(dirty);
+  *base = have;
+  return true;
+}
+
 void ReplicatedPG::calc_clone_subsets(SnapSet& snapset, const hobject_t& soid,
 				      pg_missing_t& missing,
 				      const hobject_t &last_backfill,
@@ -4827,6 +4936,19 @@ void ReplicatedPG::push_to_replica(ObjectContext *obc, const hobject_t& soid, in
 		      peer_info[peer].last_backfill,
 		      data_subset, clone_subsets);
     put_snapset_context(ssc);
+
+    // or just what changed since the replica's version?
+    interval_set<uint64_t> delta_subset;
+    eversion_t delta_base;
+    if (calc_delta_subset(obc, soid, peer, delta_subset, &delta_base) &&
+	delta_subset.size() < data_subset.size()) {
+      dout(10) << "push_to_replica osd." << peer << " needs only " << delta_subset
+	       << " of " << soid << dendl;
+      map<hobject_t, interval_set<uint64_t> > no_clones;
+      push_start(obc, soid, peer, oi.version, delta_subset, no_clones,
+		 true, delta_base);
+      return;
+    }
   }
 
   push_start(obc, soid, peer, oi.version, data_subset, clone_subsets);
@@ -4848,7 +4970,8 @@ void ReplicatedPG::push_start(
   const hobject_t& soid, int peer,
   eversion_t version,
   interval_set<uint64_t> &data_subset,
-  map<hobject_t, interval_set<uint64_t> >& clone_subsets)
+  map<hobject_t, interval_set<uint64_t> >& clone_subsets,
+  bool delta, eversion_t delta_base)
 {
   peer_missing[peer].revise_have(soid, eversion_t());
   // take note.
@@ -4856,6 +4979,8 @@ void ReplicatedPG::push_start(
   pi.recovery_info.size = obc->obs.oi.size;
   pi.recovery_info.copy_subset = data_subset;
   pi.recovery_info.clone_subset = clone_subsets;
+  pi.recovery_info.delta = delta;
+  pi.recovery_info.delta_base = delta_base;
   pi.recovery_info.soid = soid;
   pi.recovery_info.oi = obc->obs.oi;
   pi.recovery_info.version = version;
@@ -4910,12 +5035,21 @@ void ReplicatedPG::submit_push_data(
   map<string, bufferlist> &omap_entries,
   ObjectStore::Transaction *t)
 {
+  // a delta patches our copy where it is, in this one transaction;
+  // anything else is built up in the temp collection
+  coll_t target = recovery_info.delta ? coll : get_temp_coll(t);
   if (first) {
     missing.revise_have(recovery_info.soid, eversion_t());
-    remove_object_with_snap_hardlinks(*t, recovery_info.soid);
-    t->remove(get_temp_coll(t), recovery_info.soid);
-    t->touch(get_temp_coll(t), recovery_info.soid);
-    t->omap_setheader(get_temp_coll(t), recovery_info.soid, omap_header);
+    if (recovery_info.delta) {
+      t->truncate(coll, recovery_info.soid, recovery_info.size);
+      t->rmattrs(coll, recovery_info.soid);
+      t->omap_clear(coll, recovery_info.soid);
+    } else {
+      remove_object_with_snap_hardlinks(*t, recovery_info.soid);
+      t->remove(target, recovery_info.soid);
+      t->touch(target, recovery_info.soid);
+    }
+    t->omap_setheader(target, recovery_info.soid, omap_header);
   }
   uint64_t off = 0;
   for (interval_set<uint64_t>::const_iterator p = intervals_included.begin();
@@ -4923,22 +5057,24 @@ void ReplicatedPG::submit_push_data(
        ++p) {
     bufferlist bit;
     bit.substr_of(data_included, off, p.get_len());
-    t->write(get_temp_coll(t), recovery_info.soid,
+    t->write(target, recovery_info.soid,
 	     p.get_start(), p.get_len(), bit);
     off += p.get_len();
   }
 
-  t->omap_setkeys(get_temp_coll(t), recovery_info.soid,
+  t->omap_setkeys(target, recovery_info.soid,
 		  omap_entries);
-  t->setattrs(get_temp_coll(t), recovery_info.soid,
+  t->setattrs(target, recovery_info.soid,
 	      attrs);
 }
 
 void ReplicatedPG::submit_push_complete(ObjectRecoveryInfo &recovery_info,
 					ObjectStore::Transaction *t)
 {
-  remove_object_with_snap_hardlinks(*t, recovery_info.soid);
-  t->collection_move(coll, get_temp_coll(t), recovery_info.soid);
+  if (!recovery_info.delta) {
+    remove_object_with_snap_hardlinks(*t, recovery_info.soid);
+    t->collection_move(coll, get_temp_coll(t), recovery_info.soid);
+  }
   for (map<hobject_t, interval_set<uint64_t> >::const_iterator p =
 	 recovery_info.clone_subset.begin();
        p != recovery_info.clone_subset.end();
@@ -5054,6 +5190,8 @@ void ReplicatedPG::handle_pull_response(OpRequestRef op)
   data_included = usable_intervals;
   data.claim(usable_data);
 
+  osd->logger->inc(l_osd_pull_inb, data.length());
+
   bool first = pi.recovery_progress.first;
   pi.recovery_progress = m->recovery_progress;
 
@@ -5156,6 +5294,19 @@ void ReplicatedPG::handle_push(OpRequestRef op)
   ObjectStore::Transaction *t = new ObjectStore::Transaction;
   Context *onreadable = new C_OSD_AppliedRecoveredObjectReplica(this, t);
   Context *onreadable_sync = 0;
+
+  if (m->recovery_info.delta && !have_delta_base(m->recovery_info)) {
+    // our copy isn't the one the delta was cut from (e.g. it holds a
+    // divergent write); have the primary send all of it instead
+    int r = osd->store->queue_transaction(osr.get(), t, onreadable, 0, 0);
+    assert(r == 0);
+    MOSDSubOpReply *reply = new MOSDSubOpReply(
+      m, -ESTALE, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
+    assert(entity_name_t::TYPE_OSD == m->get_connection()->peer_type);
+    osd->cluster_messenger->send_message(reply, m->get_connection());
+    return;
+  }
+
   submit_push_data(m->recovery_info,
 		   first,
 		   m->data_included,
@@ -5184,18 +5335,96 @@ void ReplicatedPG::handle_push(OpRequestRef op)
   osd->cluster_messenger->send_message(reply, m->get_connection());
 }
 
-int ReplicatedPG::send_push(int peer,
-			    ObjectRecoveryInfo recovery_info,
-			    ObjectRecoveryProgress progress,
-			    ObjectRecoveryProgress *out_progress)
+/*
+ * is our copy of the object at the version the delta applies to?
+ */
+bool ReplicatedPG::have_delta_base(const ObjectRecoveryInfo &recovery_info)
 {
-  ObjectRecoveryProgress new_progress = progress;
+  bufferlist bv;
+  int r = osd->store->getattr(coll, recovery_info.soid, OI_ATTR, bv);
+  if (r < 0) {
+    dout(10) << "have_delta_base " << recovery_info.soid << " has no object_info: "
+	     << cpp_strerror(r) << dendl;
+    return false;
+  }
+  object_info_t oi(bv);
+  if (oi.version != recovery_info.delta_base) {
+    dout(10) << "have_delta_base " << recovery_info.soid << " is at " << oi.version
+	     << ", delta is from " << recovery_info.delta_base << dendl;
+    return false;
+  }
+  return true;
+}
 
-  tid_t tid = osd->get_tid();
-  osd_reqid_t rid(osd->cluster_messenger->get_myname(), 0, tid);
-  MOSDSubOp *subop = new MOSDSubOp(rid, info.pgid, recovery_info.soid,
-				   false, 0, get_osdmap()->get_epoch(),
-				   tid, recovery_info.version);
+/*
+ * apply a batch of pushes from the primary in one transaction
+ */
+void ReplicatedPG::handle_pushes(OpRequestRef op)
+{
+  MOSDPGPush *m = (MOSDPGPush *)op->request;
+  dout(10) << "handle_pushes " << m->pushes.size() << " objects, "
+	   << m->get_push_bytes() << " bytes" << dendl;
+
+  op->mark_started();
+
+  // keep track of active pushes for scrub
+  ++active_pushes;
+
+  MOSDPGPush *reply = new MOSDPGPush(MOSDPGPush::OP_PUSH_REPLY,
+				     get_osdmap()->get_epoch(), info.pgid);
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+  for (vector<PushOp>::iterator p = m->pushes.begin();
+       p != m->pushes.end();
+       ++p) {
+    dout(15) << " push " << p->recovery_info << p->after_progress << dendl;
+    submit_push_data(p->recovery_info,
+		     p->before_progress.first,
+		     p->data_included,
+		     p->data,
+		     p->omap_header,
+		     p->attrset,
+		     p->omap_entries,
+		     t);
+    if (p->after_progress.data_complete && p->after_progress.omap_complete)
+      submit_push_complete(p->recovery_info, t);
+    reply->replies.push_back(p->soid);
+  }
+
+  int r = osd->store->
+    queue_transaction(osr.get(), t,
+		      new C_OSD_AppliedRecoveredObjectReplica(this, t),
+		      new C_OSD_CommittedPushedObject(
+			this, op,
+			info.history.same_interval_since,
+			info.last_complete),
+		      0);
+  assert(r == 0);
+
+  assert(entity_name_t::TYPE_OSD == m->get_connection()->peer_type);
+  osd->cluster_messenger->send_message(reply, m->get_connection());
+}
+
+void ReplicatedPG::handle_push_replies(OpRequestRef op)
+{
+  MOSDPGPush *m = (MOSDPGPush *)op->request;
+  dout(10) << "handle_push_replies " << *m << " from " << m->get_source() << dendl;
+
+  op->mark_started();
+
+  int peer = m->get_source().num();
+  for (vector<hobject_t>::iterator p = m->replies.begin();
+       p != m->replies.end();
+       ++p)
+    handle_push_reply(peer, *p);
+}
+
+int ReplicatedPG::build_push_op(int peer,
+				const ObjectRecoveryInfo &recovery_info,
+				const ObjectRecoveryProgress &progress,
+				ObjectRecoveryProgress *out_progress,
+				PushOp *out_op)
+{
+  ObjectRecoveryProgress new_progress = progress;
 
   dout(7) << "send_push_op " << recovery_info.soid
 	  << " v " << recovery_info.version
@@ -5204,16 +5433,13 @@ int ReplicatedPG::send_push(int peer,
 	  << " recovery_info: " << recovery_info
           << dendl;
 
-  subop->ops = vector<OSDOp>(1);
-  subop->ops[0].op.op = CEPH_OSD_OP_PUSH;
-
   if (progress.first) {
-    osd->store->omap_get_header(coll, recovery_info.soid, &subop->omap_header);
-    osd->store->getattrs(coll, recovery_info.soid, subop->attrset);
+    osd->store->omap_get_header(coll, recovery_info.soid, &out_op->omap_header);
+    osd->store->getattrs(coll, recovery_info.soid, out_op->attrset);
 
     // Debug
     bufferlist bv;
-    bv.push_back(subop->attrset[OI_ATTR]);
+    bv.push_back(out_op->attrset[OI_ATTR]);
     object_info_t oi(bv);
 
     if (oi.version != recovery_info.version) {
@@ -5222,7 +5448,6 @@ int ReplicatedPG::send_push(int peer,
 			<< recovery_info.version << " to osd." << peer
 			<< " failed because local copy is "
 			<< oi.version << "\n";
-      subop->put();
       return -1;
     }
 
@@ -5237,10 +5462,15 @@ int ReplicatedPG::send_push(int peer,
     for (iter->upper_bound(progress.omap_recovered_to);
 	 iter->valid();
 	 iter->next()) {
-      if (available < (iter->key().size() + iter->value().length()))
+      uint64_t len = iter->key().size() + iter->value().length();
+      if (available >= len) {
+	available -= len;
+      } else if (recovery_info.delta) {
+	available = 0;   // a delta is applied in place, so all in one op
+      } else {
 	break;
-      subop->omap_entries.insert(make_pair(iter->key(), iter->value()));
-      available -= (iter->key().size() + iter->value().length());
+      }
+      out_op->omap_entries.insert(make_pair(iter->key(), iter->value()));
     }
     if (!iter->valid())
       new_progress.omap_complete = true;
@@ -5248,12 +5478,15 @@ int ReplicatedPG::send_push(int peer,
       new_progress.omap_recovered_to = iter->key();
   }
 
-  subop->data_included.span_of(recovery_info.copy_subset,
-			       progress.data_recovered_to,
-			       available);
+  if (recovery_info.delta)
+    out_op->data_included = recovery_info.copy_subset;
+  else
+    out_op->data_included.span_of(recovery_info.copy_subset,
+				  progress.data_recovered_to,
+				  available);
 
-  for (interval_set<uint64_t>::iterator p = subop->data_included.begin();
-       p != subop->data_included.end();
+  for (interval_set<uint64_t>::iterator p = out_op->data_included.begin();
+       p != out_op->data_included.end();
        ++p) {
     bufferlist bit;
     osd->store->read(coll, recovery_info.soid,
@@ -5265,29 +5498,136 @@ int ReplicatedPG::send_push(int peer,
       p.set_len(bit.length());
       new_progress.data_complete = true;
     }
-    subop->ops[0].indata.claim_append(bit);
+    out_op->data.claim_append(bit);
   }
 
-  if (!subop->data_included.empty())
-    new_progress.data_recovered_to = subop->data_included.range_end();
+  if (!out_op->data_included.empty())
+    new_progress.data_recovered_to = out_op->data_included.range_end();
 
   if (new_progress.is_complete(recovery_info))
     new_progress.data_complete = true;
 
   osd->logger->inc(l_osd_push);
-  osd->logger->inc(l_osd_push_outb, subop->ops[0].indata.length());
-  
-  // send
-  subop->recovery_info = recovery_info;
-  subop->recovery_progress = new_progress;
-  subop->current_progress = progress;
-  osd->cluster_messenger->
-    send_message(subop, get_osdmap()->get_cluster_inst(peer));
+  osd->logger->inc(l_osd_push_outb, out_op->data.length());
+  if (recovery_info.delta) {
+    osd->logger->inc(l_osd_push_delta);
+    osd->logger->inc(l_osd_push_delta_savedb,
+		     recovery_info.size - out_op->data.length());
+  }
+  osd->op_sched.charge(osd->sched_recovery, out_op->data.length());
+
+  out_op->soid = recovery_info.soid;
+  out_op->version = recovery_info.version;
+  out_op->recovery_info = recovery_info;
+  out_op->before_progress = progress;
+  out_op->after_progress = new_progress;
   if (out_progress)
     *out_progress = new_progress;
   return 0;
 }
 
+int ReplicatedPG::send_push(int peer,
+			    ObjectRecoveryInfo recovery_info,
+			    ObjectRecoveryProgress progress,
+			    ObjectRecoveryProgress *out_progress)
+{
+  PushOp pop;
+  int r = build_push_op(peer, recovery_info, progress, out_progress, &pop);
+  if (r < 0)
+    return r;
+
+  // a whole object in one op may join a batch.  a delta may not: the
+  // replica can refuse one, and only a sub op reply can say so
+  if (gather_pushes && progress.first && !recovery_info.delta &&
+      pop.after_progress.data_complete && pop.after_progress.omap_complete &&
+      queue_push(peer, pop))
+    return 0;
+
+  send_push_op(peer, pop);
+  return 0;
+}
+
+void ReplicatedPG::send_push_op(int peer, PushOp &pop)
+{
+  tid_t tid = osd->get_tid();
+  osd_reqid_t rid(osd->cluster_messenger->get_myname(), 0, tid);
+  MOSDSubOp *subop = new MOSDSubOp(rid, info.pgid, pop.soid,
+				   false, 0, get_osdmap()->get_epoch(),
+				   tid, pop.version);
+  subop->ops = vector<OSDOp>(1);
+  subop->ops[0].op.op = CEPH_OSD_OP_PUSH;
+  subop->ops[0].indata.claim(pop.data);
+  subop->data_included.swap(pop.data_included);
+  subop->omap_header.claim(pop.omap_header);
+  subop->omap_entries.swap(pop.omap_entries);
+  subop->attrset.swap(pop.attrset);
+  subop->recovery_info = pop.recovery_info;
+  subop->recovery_progress = pop.after_progress;
+  subop->current_progress = pop.before_progress;
+  ++pushes_started;
+  osd->cluster_messenger->
+    send_message(subop, get_osdmap()->get_cluster_inst(peer));
+}
+
+/*
+ * add pop to peer's batch, sending the batch once it is full
+ *
+ * @return false if peer can't take batched pushes
+ */
+bool ReplicatedPG::queue_push(int peer, PushOp &pop)
+{
+  int max_objects = g_conf->osd_recovery_max_push_objects;
+  if (max_objects <= 1)
+    return false;
+
+  if (!pending_pushes.count(peer)) {
+    Connection *con = osd->cluster_messenger->get_connection(
+      get_osdmap()->get_cluster_inst(peer));
+    bool supported = con->features & CEPH_FEATURE_PGPUSH;
+    con->put();
+    if (!supported) {
+      dout(20) << "osd." << peer << " does not support batched pushes" << dendl;
+      return false;
+    }
+  }
+
+  uint64_t len = pop.length();
+  PushBatch &batch = pending_pushes[peer];
+  if (!batch.pushes.empty() &&
+      batch.bytes + len > g_conf->osd_recovery_max_chunk) {
+    send_pending_pushes(peer);
+    return queue_push(peer, pop);
+  }
+  if (batch.pushes.empty())
+    ++pushes_started;
+  batch.pushes.push_back(pop);
+  batch.bytes += len;
+  if ((int)batch.pushes.size() >= max_objects)
+    send_pending_pushes(peer);
+  return true;
+}
+
+void ReplicatedPG::send_pending_pushes(int peer)
+{
+  map<int, PushBatch>::iterator p = pending_pushes.find(peer);
+  if (p == pending_pushes.end())
+    return;
+  dout(10) << "send_pending_pushes " << p->second.pushes.size() << " objects, "
+	   << p->second.bytes << " bytes to osd." << peer << dendl;
+  MOSDPGPush *m = new MOSDPGPush(MOSDPGPush::OP_PUSH,
+				 get_osdmap()->get_epoch(), info.pgid);
+  m->pushes.swap(p->second.pushes);
+  pending_pushes.erase(p);
+  osd->cluster_messenger->
+    send_message(m, get_osdmap()->get_cluster_inst(peer));
+}
+
+void ReplicatedPG::send_pending_pushes()
+{
+  while (!pending_pushes.empty())
+    send_pending_pushes(pending_pushes.begin()->first);
+}
+
 void ReplicatedPG::send_push_op_blank(const hobject_t& soid, int peer)
 {
   // send a blank push back to the primary
@@ -5311,8 +5651,40 @@ void ReplicatedPG::sub_op_push_reply(OpRequestRef op)
   op->mark_started();
   
   int peer = reply->get_source().num();
-  const hobject_t& soid = reply->get_poid();
-  
+  if (reply->get_result() == -ESTALE)
+    push_whole_object(peer, reply->get_poid());
+  else
+    handle_push_reply(peer, reply->get_poid());
+}
+
+/*
+ * peer refused a delta push: it doesn't have the version the delta
+ * was cut from.  start over with the whole object.
+ */
+void ReplicatedPG::push_whole_object(int peer, const hobject_t& soid)
+{
+  if (pushing.count(soid) == 0 || pushing[soid].count(peer) == 0) {
+    dout(10) << "huh, i wasn't pushing " << soid << " to osd." << peer << dendl;
+    return;
+  }
+  PushInfo &pi = pushing[soid][peer];
+  dout(10) << "push_whole_object osd." << peer << " refused delta of " << soid
+	   << " from " << pi.recovery_info.delta_base << dendl;
+  pi.recovery_info.delta = false;
+  pi.recovery_info.delta_base = eversion_t();
+  pi.recovery_info.copy_subset.clear();
+  if (pi.recovery_info.size)
+    pi.recovery_info.copy_subset.insert(0, pi.recovery_info.size);
+  pi.recovery_info.clone_subset.clear();
+  pi.recovery_progress = ObjectRecoveryProgress();
+
+  ObjectRecoveryProgress new_progress;
+  send_push(peer, pi.recovery_info, pi.recovery_progress, &new_progress);
+  pi.recovery_progress = new_progress;
+}
+
+void ReplicatedPG::handle_push_reply(int peer, const hobject_t& soid)
+{
   if (pushing.count(soid) == 0) {
     dout(10) << "huh, i wasn't pushing " << soid << " to osd." << peer
 	     << ", or anybody else"
@@ -6285,6 +6657,7 @@ int ReplicatedPG::recover_object_replicas(const hobject_t& soid, eversion_t v)
   
   // who needs it?  
   bool started = false;
+  unsigned pushes_before = pushes_started;
   for (unsigned i=1; i<acting.size(); i++) {
     int peer = acting[i];
     if (peer_missing.count(peer) &&
@@ -6301,6 +6674,9 @@ int ReplicatedPG::recover_object_replicas(const hobject_t& soid, eversion_t v)
   obc->ondisk_read_unlock();
   put_object_context(obc);
 
+  // joining batches already begun doesn't count against max
+  if (started && pushes_started == pushes_before)
+    return 0;
   return 1;
 }
 
@@ -6309,6 +6685,10 @@ int ReplicatedPG::recover_replicas(int max)
   dout(10) << __func__ << "(" << max << ")" << dendl;
   int started = 0;
 
+  // small objects go out in batches, each counting as one op
+  assert(pending_pushes.empty());
+  gather_pushes = true;
+
   // this is FAR from an optimal recovery order.  pretty lame, really.
   for (unsigned i=1; i<acting.size(); i++) {
     int peer = acting[i];
@@ -6345,6 +6725,8 @@ int ReplicatedPG::recover_replicas(int max)
     }
   }
 
+  gather_pushes = false;
+  send_pending_pushes();
   return started;
 }
 
@@ -6953,6 +7335,7 @@ boost::statechart::result ReplicatedPG::RepColTrim::react(const SnapTrim&)
   int r = pg->osd->store->queue_transaction(NULL, t, new ObjectStore::C_DeleteTransaction(t));
   assert(r == 0);
   pg->snap_collections.erase(snap_to_trim);
+  pg->dirty_big_info = true;
   return discard_event();
 }
 
@@ -7060,6 +7443,7 @@ boost::statechart::result ReplicatedPG::WaitingOnReplicas::react(const SnapTrim&
   ObjectStore::Transaction *t = new ObjectStore::Transaction;
   dout(10) << "removing snap " << sn << " collection " << c << dendl;
   pg->snap_collections.erase(sn);
+  pg->dirty_big_info = true;
   pg->write_info(*t);
   t->remove_collection(c);
   int tr = pg->osd->store->queue_transaction(pg->osr.get(), t);
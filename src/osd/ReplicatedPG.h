@@ -365,6 +365,8 @@ public:
     vector<pg_log_entry_t> log;
 
     interval_set<uint64_t> modified_ranges;
+    interval_set<uint64_t> dirty_extents;  ///< for the log entry; see mark_dirty()
+    bool dirty_extents_valid;    ///< false once an op changes data we don't track
     ObjectContext *obc;          // For ref counting purposes
     map<hobject_t,ObjectContext*> src_obc;
     ObjectContext *clone_obc;    // if we created a clone
@@ -388,12 +390,24 @@ public:
       modify(false), user_modify(false),
       watch_connect(false), watch_disconnect(false),
       bytes_written(0), bytes_read(0),
+      dirty_extents_valid(true),
       obc(0), clone_obc(0), snapset_obc(0), data_off(0), reply(NULL), pg(_pg) { 
       if (_ssc) {
 	new_snapset = _ssc->snapset;
 	snapset = &_ssc->snapset;
       }
     }
+
+    /// note that data in [off, off+len) changed; len -1 for "to the end"
+    void mark_dirty(uint64_t off, uint64_t len) {
+      if (len == (uint64_t)-1)
+	len -= off;
+      if (!len)
+	return;
+      interval_set<uint64_t> ch;
+      ch.insert(off, len);
+      dirty_extents.union_of(ch);
+    }
     ~OpContext() {
       assert(!clone_obc);
       if (reply)
@@ -592,6 +606,19 @@ protected:
   };
   map<hobject_t, map<int, PushInfo> > pushing;
 
+  /*
+   * pushes of small objects that recover_replicas() gathers per peer,
+   * to go out as one MOSDPGPush each; see queue_push()
+   */
+  struct PushBatch {
+    vector<PushOp> pushes;
+    uint64_t bytes;
+    PushBatch() : bytes(0) {}
+  };
+  map<int, PushBatch> pending_pushes;
+  bool gather_pushes;
+  unsigned pushes_started;  ///< MOSDSubOp pushes sent plus batches begun
+
   // pull
   struct PullInfo {
     ObjectRecoveryProgress recovery_progress;
@@ -624,10 +651,23 @@ protected:
 			       bufferlist *data_usable);
   void handle_pull_response(OpRequestRef op);
   void handle_push(OpRequestRef op);
+  bool have_delta_base(const ObjectRecoveryInfo &recovery_info);
+  void handle_pushes(OpRequestRef op);
+  void handle_push_replies(OpRequestRef op);
+  void handle_push_reply(int peer, const hobject_t& soid);
+  int build_push_op(int peer,
+		    const ObjectRecoveryInfo &recovery_info,
+		    const ObjectRecoveryProgress &progress,
+		    ObjectRecoveryProgress *out_progress,
+		    PushOp *out_op);
   int send_push(int peer,
 		ObjectRecoveryInfo recovery_info,
 		ObjectRecoveryProgress progress,
 		ObjectRecoveryProgress *out_progress = 0);
+  void send_push_op(int peer, PushOp &pop);
+  bool queue_push(int peer, PushOp &pop);
+  void send_pending_pushes(int peer);
+  void send_pending_pushes();
   int send_pull(int peer,
 		ObjectRecoveryInfo recovery_info,
 		ObjectRecoveryProgress progress);
@@ -751,6 +791,8 @@ protected:
 			  const hobject_t &last_backfill,
 			  interval_set<uint64_t>& data_subset,
 			  map<hobject_t, interval_set<uint64_t> >& clone_subsets);
+  bool calc_delta_subset(ObjectContext *obc, const hobject_t& head, int peer,
+			 interval_set<uint64_t>& data_subset, eversion_t *base);
   void push_to_replica(ObjectContext *obc, const hobject_t& oid, int dest);
   void push_start(ObjectContext *obc,
 		  const hobject_t& oid, int dest);
@@ -758,7 +800,9 @@ protected:
 		  const hobject_t& soid, int peer,
 		  eversion_t version,
 		  interval_set<uint64_t> &data_subset,
-		  map<hobject_t, interval_set<uint64_t> >& clone_subsets);
+		  map<hobject_t, interval_set<uint64_t> >& clone_subsets,
+		  bool delta = false, eversion_t delta_base = eversion_t());
+  void push_whole_object(int peer, const hobject_t& soid);
   void send_push_op_blank(const hobject_t& soid, int peer);
 
   void finish_degraded_object(const hobject_t& oid);
@@ -944,6 +988,7 @@ public:
   void do_sub_op_reply(OpRequestRef op);
   void do_scan(OpRequestRef op);
   void do_backfill(OpRequestRef op);
+  void do_push(OpRequestRef op);
   bool get_obs_to_trim(snapid_t &snap_to_trim,
 		       coll_t &col_to_trim,
 		       vector<hobject_t> &obs_to_trim);
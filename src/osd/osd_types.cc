@@ -478,6 +478,7 @@ void pg_pool_t::dump(Formatter *f) const
   f->dump_int("pg_num", get_pg_num());
   f->dump_int("pg_placement_num", get_pgp_num());
   f->dump_unsigned("crash_replay_interval", get_crash_replay_interval());
+  f->dump_unsigned("expected_num_objects", expected_num_objects);
   f->dump_stream("last_change") << get_last_change();
   f->dump_unsigned("auid", get_auid());
   f->dump_string("snap_mode", is_pool_snaps_mode() ? "pool" : "selfmanaged");
@@ -682,7 +683,7 @@ void pg_pool_t::encode(bufferlist& bl, uint64_t features) const
     return;
   }
 
-  ENCODE_START(6, 5, bl);
+  ENCODE_START(7, 5, bl);
   ::encode(type, bl);
   ::encode(size, bl);
   ::encode(crush_ruleset, bl);
@@ -700,12 +701,13 @@ void pg_pool_t::encode(bufferlist& bl, uint64_t features) const
   ::encode(auid, bl);
   ::encode(flags, bl);
   ::encode(crash_replay_interval, bl);
+  ::encode(expected_num_objects, bl);
   ENCODE_FINISH(bl);
 }
 
 void pg_pool_t::decode(bufferlist::iterator& bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(6, 5, 5, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(7, 5, 5, bl);
   ::decode(type, bl);
   ::decode(size, bl);
   ::decode(crush_ruleset, bl);
@@ -749,6 +751,10 @@ void pg_pool_t::decode(bufferlist::iterator& bl)
     else
       crash_replay_interval = 0;
   }
+  if (struct_v >= 7)
+    ::decode(expected_num_objects, bl);
+  else
+    expected_num_objects = 0;
   DECODE_FINISH(bl);
   calc_pg_masks();
 }
@@ -769,6 +775,7 @@ void pg_pool_t::generate_test_instances(list<pg_pool_t*>& o)
   a.snap_epoch = 11;
   a.auid = 12;
   a.crash_replay_interval = 13;
+  a.expected_num_objects = 14;
   o.push_back(new pg_pool_t(a));
 
   a.snaps[3].name = "asdf";
@@ -797,6 +804,8 @@ ostream& operator<<(ostream& out, const pg_pool_t& p)
     out << " flags " << p.flags;
   if (p.crash_replay_interval)
     out << " crash_replay_interval " << p.crash_replay_interval;
+  if (p.expected_num_objects)
+    out << " expected_num_objects " << p.expected_num_objects;
   return out;
 }
 
@@ -1572,9 +1581,30 @@ void pg_query_t::generate_test_instances(list<pg_query_t*>& o)
 
 // -- pg_log_entry_t --
 
+void pg_log_entry_t::encode_with_checksum(bufferlist& bl) const
+{
+  bufferlist ebl(sizeof(*this)*2);
+  encode(ebl);
+  __u32 crc = ebl.crc32c(0);
+  ::encode(ebl, bl);
+  ::encode(crc, bl);
+}
+
+void pg_log_entry_t::decode_with_checksum(bufferlist::iterator& p)
+{
+  bufferlist bl;
+  ::decode(bl, p);
+  __u32 crc;
+  ::decode(crc, p);
+  if (crc != bl.crc32c(0))
+    throw buffer::malformed_input("bad checksum on pg_log_entry_t");
+  bufferlist::iterator q = bl.begin();
+  decode(q);
+}
+
 void pg_log_entry_t::encode(bufferlist &bl) const
 {
-  ENCODE_START(5, 4, bl);
+  ENCODE_START(6, 4, bl);
   ::encode(op, bl);
   ::encode(soid, bl);
   ::encode(version, bl);
@@ -1583,12 +1613,15 @@ void pg_log_entry_t::encode(bufferlist &bl) const
   ::encode(mtime, bl);
   if (op == CLONE)
     ::encode(snaps, bl);
+  ::encode(has_dirty_extents, bl);
+  if (has_dirty_extents)
+    ::encode(dirty_extents, bl);
   ENCODE_FINISH(bl);
 }
 
 void pg_log_entry_t::decode(bufferlist::iterator &bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(5, 4, 4, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(6, 4, 4, bl);
   ::decode(op, bl);
   if (struct_v < 2) {
     sobject_t old_soid;
@@ -1609,6 +1642,14 @@ void pg_log_entry_t::decode(bufferlist::iterator &bl)
     ::decode(snaps, bl);
   if (struct_v < 5)
     invalid_pool = true;
+  dirty_extents.clear();
+  if (struct_v >= 6) {
+    ::decode(has_dirty_extents, bl);
+    if (has_dirty_extents)
+      ::decode(dirty_extents, bl);
+  } else {
+    has_dirty_extents = false;
+  }
   DECODE_FINISH(bl);
 }
 
@@ -1620,6 +1661,8 @@ void pg_log_entry_t::dump(Formatter *f) const
   f->dump_stream("prior_version") << version;
   f->dump_stream("reqid") << reqid;
   f->dump_stream("mtime") << mtime;
+  if (has_dirty_extents)
+    f->dump_stream("dirty_extents") << dirty_extents;
 }
 
 void pg_log_entry_t::generate_test_instances(list<pg_log_entry_t*>& o)
@@ -1628,6 +1671,9 @@ void pg_log_entry_t::generate_test_instances(list<pg_log_entry_t*>& o)
   hobject_t oid(object_t("objname"), "key", 123, 456, 0);
   o.push_back(new pg_log_entry_t(MODIFY, oid, eversion_t(1,2), eversion_t(3,4),
 				 osd_reqid_t(entity_name_t::CLIENT(777), 8, 999), utime_t(8,9)));
+  o.push_back(new pg_log_entry_t(*o.back()));
+  o.back()->has_dirty_extents = true;
+  o.back()->dirty_extents.insert(4096, 4096);
 }
 
 ostream& operator<<(ostream& out, const pg_log_entry_t& e)
@@ -2427,7 +2473,7 @@ void ObjectRecoveryProgress::dump(Formatter *f) const
 
 void ObjectRecoveryInfo::encode(bufferlist &bl) const
 {
-  ENCODE_START(2, 1, bl);
+  ENCODE_START(4, 1, bl);
   ::encode(soid, bl);
   ::encode(version, bl);
   ::encode(size, bl);
@@ -2435,13 +2481,15 @@ void ObjectRecoveryInfo::encode(bufferlist &bl) const
   ::encode(ss, bl);
   ::encode(copy_subset, bl);
   ::encode(clone_subset, bl);
+  ::encode(delta, bl);
+  ::encode(delta_base, bl);
   ENCODE_FINISH(bl);
 }
 
 void ObjectRecoveryInfo::decode(bufferlist::iterator &bl,
 				int64_t pool)
 {
-  DECODE_START(2, bl);
+  DECODE_START(4, bl);
   ::decode(soid, bl);
   ::decode(version, bl);
   ::decode(size, bl);
@@ -2449,6 +2497,14 @@ void ObjectRecoveryInfo::decode(bufferlist::iterator &bl,
   ::decode(ss, bl);
   ::decode(copy_subset, bl);
   ::decode(clone_subset, bl);
+  if (struct_v >= 3)
+    ::decode(delta, bl);
+  else
+    delta = false;
+  if (struct_v >= 4)
+    ::decode(delta_base, bl);
+  else
+    delta_base = eversion_t();   // no base: the replica will refuse it
   DECODE_FINISH(bl);
 
   if (struct_v < 2) {
@@ -2474,6 +2530,10 @@ void ObjectRecoveryInfo::generate_test_instances(
   o.back()->soid = hobject_t(sobject_t("key", CEPH_NOSNAP));
   o.back()->version = eversion_t(0,0);
   o.back()->size = 100;
+  o.push_back(new ObjectRecoveryInfo(*o.back()));
+  o.back()->copy_subset.insert(0, 10);
+  o.back()->delta = true;
+  o.back()->delta_base = eversion_t(1,2);
 }
 
 
@@ -2494,6 +2554,8 @@ void ObjectRecoveryInfo::dump(Formatter *f) const
   }
   f->dump_stream("copy_subset") << copy_subset;
   f->dump_stream("clone_subset") << clone_subset;
+  f->dump_int("delta", delta);
+  f->dump_stream("delta_base") << delta_base;
 }
 
 ostream& operator<<(ostream& out, const ObjectRecoveryInfo &inf)
@@ -2503,13 +2565,121 @@ ostream& operator<<(ostream& out, const ObjectRecoveryInfo &inf)
 
 ostream &ObjectRecoveryInfo::print(ostream &out) const
 {
-  return out << "ObjectRecoveryInfo("
-	     << soid << "@" << version
-	     << ", copy_subset: " << copy_subset
-	     << ", clone_subset: " << clone_subset
+  out << "ObjectRecoveryInfo("
+      << soid << "@" << version
+      << ", copy_subset: " << copy_subset
+      << ", clone_subset: " << clone_subset;
+  if (delta)
+    out << ", delta from " << delta_base;
+  return out << ")";
+}
+
+// -- PushOp --
+
+uint64_t PushOp::length() const
+{
+  uint64_t len = data.length() + omap_header.length();
+  for (map<string, bufferlist>::const_iterator p = omap_entries.begin();
+       p != omap_entries.end();
+       ++p)
+    len += p->first.size() + p->second.length();
+  return len;
+}
+
+void PushOp::encode(bufferlist &bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(soid, bl);
+  ::encode(version, bl);
+  ::encode(data, bl);
+  ::encode(data_included, bl);
+  ::encode(omap_header, bl);
+  ::encode(omap_entries, bl);
+  ::encode(attrset, bl);
+  ::encode(recovery_info, bl);
+  ::encode(before_progress, bl);
+  ::encode(after_progress, bl);
+  ENCODE_FINISH(bl);
+}
+
+void PushOp::decode(bufferlist::iterator &bl)
+{
+  DECODE_START(1, bl);
+  ::decode(soid, bl);
+  ::decode(version, bl);
+  ::decode(data, bl);
+  ::decode(data_included, bl);
+  ::decode(omap_header, bl);
+  ::decode(omap_entries, bl);
+  ::decode(attrset, bl);
+  ::decode(recovery_info, bl);
+  ::decode(before_progress, bl);
+  ::decode(after_progress, bl);
+  DECODE_FINISH(bl);
+}
+
+void PushOp::generate_test_instances(list<PushOp*>& o)
+{
+  o.push_back(new PushOp);
+  o.push_back(new PushOp);
+  o.back()->soid = hobject_t(sobject_t("asdf", 2));
+  o.back()->version = eversion_t(3, 10);
+  o.back()->data.append("data");
+  o.back()->data_included.insert(0, 4);
+  o.back()->omap_entries["key"].append("value");
+  o.back()->attrset["_"] = buffer::copy("oi", 2);
+  o.back()->after_progress.first = false;
+  o.back()->after_progress.data_recovered_to = 4;
+  o.back()->after_progress.data_complete = true;
+  o.back()->after_progress.omap_complete = true;
+}
+
+void PushOp::dump(Formatter *f) const
+{
+  f->dump_stream("soid") << soid;
+  f->dump_stream("version") << version;
+  f->dump_int("data_len", data.length());
+  f->dump_stream("data_included") << data_included;
+  f->dump_int("omap_header_len", omap_header.length());
+  f->dump_int("omap_entries_len", omap_entries.size());
+  f->dump_int("attrset_len", attrset.size());
+  {
+    f->open_object_section("recovery_info");
+    recovery_info.dump(f);
+    f->close_section();
+  }
+  {
+    f->open_object_section("before_progress");
+    before_progress.dump(f);
+    f->close_section();
+  }
+  {
+    f->open_object_section("after_progress");
+    after_progress.dump(f);
+    f->close_section();
+  }
+}
+
+ostream &PushOp::print(ostream &out) const
+{
+  return out << "PushOp(" << soid
+	     << ", version: " << version
+	     << ", data_included: " << data_included
+	     << ", data_size: " << data.length()
+	     << ", omap_header_size: " << omap_header.length()
+	     << ", omap_entries_size: " << omap_entries.size()
+	     << ", attrset_size: " << attrset.size()
+	     << ", recovery_info: " << recovery_info
+	     << ", before_progress: " << before_progress
+	     << ", after_progress: " << after_progress
 	     << ")";
 }
 
+ostream& operator<<(ostream& out, const PushOp &op)
+{
+  return op.print(out);
+}
+
 // -- ScrubMap --
 
 void ScrubMap::merge_incr(const ScrubMap &l)
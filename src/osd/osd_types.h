@@ -38,6 +38,7 @@
 #define CEPH_OSD_FEATURE_INCOMPAT_CATEGORIES  CompatSet::Feature(5, "categories")
 #define CEPH_OSD_FEATURE_INCOMPAT_HOBJECTPOOL  CompatSet::Feature(6, "hobjectpool")
 #define CEPH_OSD_FEATURE_INCOMPAT_BIGINFO CompatSet::Feature(7, "biginfo")
+#define CEPH_OSD_FEATURE_INCOMPAT_OMAPLOG CompatSet::Feature(8, "omaplog")
 
 
 typedef hobject_t collection_list_handle_t;
@@ -448,6 +449,14 @@ public:
     version++;
   }
 
+  /// a string that sorts like the eversion_t does
+  string get_key_name() const {
+    char key[32];
+    snprintf(key, sizeof(key), "%010u.%020llu", epoch,
+	     (unsigned long long)version);
+    return string(key);
+  }
+
   void encode(bufferlist &bl) const {
     ::encode(version, bl);
     ::encode(epoch, bl);
@@ -624,6 +633,7 @@ public:
   epoch_t snap_epoch;       /// osdmap epoch of last snap
   uint64_t auid;            /// who owns the pg
   __u32 crash_replay_interval; /// seconds to allow clients to replay ACKed but unCOMMITted requests
+  uint64_t expected_num_objects; /// objects the pool is expected to hold (0 if unknown)
 
   /*
    * Pool snaps (global to this pool).  These define a SnapContext for
@@ -648,6 +658,7 @@ public:
       snap_seq(0), snap_epoch(0),
       auid(0),
       crash_replay_interval(0),
+      expected_num_objects(0),
       pg_num_mask(0), pgp_num_mask(0) { }
 
   void dump(Formatter *f) const;
@@ -1246,17 +1257,23 @@ struct pg_log_entry_t {
   bool invalid_hash; // only when decoding sobject_t based entries
   bool invalid_pool; // only when decoding pool-less hobject based entries
 
+  /// data ranges this modify changed, if recorded; ranges may run past
+  /// the end of the object (to -1 for "everything from here on")
+  bool has_dirty_extents;
+  interval_set<uint64_t> dirty_extents;
+
   uint64_t offset;   // [soft state] my offset on disk
       
   pg_log_entry_t()
-    : op(0), invalid_hash(false), invalid_pool(false), offset(0) {}
+    : op(0), invalid_hash(false), invalid_pool(false),
+      has_dirty_extents(false), offset(0) {}
   pg_log_entry_t(int _op, const hobject_t& _soid, 
 		 const eversion_t& v, const eversion_t& pv,
 		 const osd_reqid_t& rid, const utime_t& mt)
     : op(_op), soid(_soid), version(v),
       prior_version(pv),
       reqid(rid), mtime(mt), invalid_hash(false), invalid_pool(false),
-      offset(0) {}
+      has_dirty_extents(false), offset(0) {}
       
   bool is_clone() const { return op == CLONE; }
   bool is_modify() const { return op == MODIFY; }
@@ -1276,6 +1293,15 @@ struct pg_log_entry_t {
     return reqid != osd_reqid_t() && (op == MODIFY || op == DELETE);
   }
 
+  string get_key_name() const {
+    return version.get_key_name();
+  }
+
+  /// encoded, followed by a crc32c of the encoding
+  void encode_with_checksum(bufferlist& bl) const;
+  /// @throws buffer::malformed_input if the crc doesn't match
+  void decode_with_checksum(bufferlist::iterator& p);
+
   void encode(bufferlist &bl) const;
   void decode(bufferlist::iterator &bl);
   void dump(Formatter *f) const;
@@ -1741,8 +1767,12 @@ struct ObjectRecoveryInfo {
   SnapSet ss;
   interval_set<uint64_t> copy_subset;
   map<hobject_t, interval_set<uint64_t> > clone_subset;
+  /// copy_subset is all that changed since the peer's version: patch
+  /// its copy in place, in one op, rather than replacing it
+  bool delta;
+  eversion_t delta_base;  ///< version a delta applies to
 
-  ObjectRecoveryInfo() : size(0) { }
+  ObjectRecoveryInfo() : size(0), delta(false) { }
 
   static void generate_test_instances(list<ObjectRecoveryInfo*>& o);
   void encode(bufferlist &bl) const;
@@ -1781,6 +1811,35 @@ struct ObjectRecoveryProgress {
 WRITE_CLASS_ENCODER(ObjectRecoveryProgress)
 ostream& operator<<(ostream& out, const ObjectRecoveryProgress &prog);
 
+/*
+ * one step of pushing an object to a peer: the data, attrs and omap it
+ * carries, and the recovery progress before and after applying it
+ */
+struct PushOp {
+  hobject_t soid;
+  eversion_t version;
+  bufferlist data;
+  interval_set<uint64_t> data_included;
+  bufferlist omap_header;
+  map<string, bufferlist> omap_entries;
+  map<string, bufferptr> attrset;
+
+  ObjectRecoveryInfo recovery_info;
+  ObjectRecoveryProgress before_progress;
+  ObjectRecoveryProgress after_progress;
+
+  /// bytes of data and omap carried
+  uint64_t length() const;
+
+  static void generate_test_instances(list<PushOp*>& o);
+  void encode(bufferlist &bl) const;
+  void decode(bufferlist::iterator &bl);
+  ostream &print(ostream &out) const;
+  void dump(Formatter *f) const;
+};
+WRITE_CLASS_ENCODER(PushOp)
+ostream& operator<<(ostream& out, const PushOp &op);
+
 
 /*
  * summarize pg contents for purposes of a scrub
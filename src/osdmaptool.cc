@@ -36,6 +36,9 @@ void usage()
   cout << "   --export-crush <file>   write osdmap's crush map to <file>" << std::endl;
   cout << "   --import-crush <file>   replace osdmap's crush map with <file>" << std::endl;
   cout << "   --test-map-pg <pgid>    map a pgid to osds" << std::endl;
+  cout << "   --mark-up-in            mark osds up and in (but do not persist)" << std::endl;
+  cout << "   --test-map-pgs [--pool <poolid>] [--mapping-threads <n>]\n"
+       << "                           map all pgs, reporting pgs per osd and timings" << std::endl;
   exit(1);
 }
 
@@ -65,6 +68,10 @@ int main(int argc, const char **argv)
   std::string export_crush, import_crush, test_map_pg, test_map_object;
   list<entity_addr_t> add, rm;
   bool test_crush = false;
+  bool test_map_pgs = false;
+  bool mark_up_in = false;
+  int pool = -1;
+  int mapping_threads = 4;
   int range_first = -1;
   int range_last = -1;
 
@@ -111,6 +118,20 @@ int main(int argc, const char **argv)
       test_map_object = val;
     } else if (ceph_argparse_flag(args, i, "--test_crush", (char*)NULL)) {
       test_crush = true;
+    } else if (ceph_argparse_flag(args, i, "--test_map_pgs", (char*)NULL)) {
+      test_map_pgs = true;
+    } else if (ceph_argparse_flag(args, i, "--mark_up_in", (char*)NULL)) {
+      mark_up_in = true;
+    } else if (ceph_argparse_withint(args, i, &pool, &err, "--pool", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    } else if (ceph_argparse_withint(args, i, &mapping_threads, &err, "--mapping_threads", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
     } else if (ceph_argparse_withint(args, i, &range_first, &err, "--range_first", (char*)NULL)) {
     } else if (ceph_argparse_withint(args, i, &range_last, &err, "--range_last", (char*)NULL)) {
     } else {
@@ -195,6 +216,14 @@ int main(int argc, const char **argv)
     modified = true;
   }
 
+  if (mark_up_in) {
+    cout << "marking all OSDs up and in" << std::endl;
+    for (int i = 0; i < osdmap.get_max_osd(); i++) {
+      osdmap.set_state(i, osdmap.get_state(i) | CEPH_OSD_EXISTS | CEPH_OSD_UP);
+      osdmap.set_weight(i, CEPH_OSD_IN);
+    }
+  }
+
   if (!import_crush.empty()) {
     bufferlist cbl;
     std::string error;
@@ -296,9 +325,113 @@ int main(int argc, const char **argv)
     }
   }
 
+  if (test_map_pgs) {
+    if (pool >= 0 && !osdmap.have_pg_pool(pool)) {
+      cerr << me << ": there is no pool " << pool << std::endl;
+      exit(1);
+    }
+
+    // time against fresh copies so each pass starts with an empty
+    // mapping cache.
+    bufferlist mbl;
+    osdmap.encode(mbl);
+
+    OSDMap cold;
+    cold.decode(mbl);
+    unsigned total = 0;
+    vector<int> count(osdmap.get_max_osd());
+    vector<int> first_count(osdmap.get_max_osd());
+    vector<int> primary_count(osdmap.get_max_osd());
+    utime_t start = ceph_clock_now(g_ceph_context);
+    for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+	 p != osdmap.get_pools().end();
+	 ++p) {
+      if (pool >= 0 && p->first != pool)
+	continue;
+      cout << "pool " << p->first << " pg_num " << p->second.get_pg_num() << std::endl;
+      for (ps_t ps = 0; ps < p->second.get_pg_num(); ++ps) {
+	pg_t pgid(ps, p->first, -1);
+	vector<int> raw, up, acting;
+	cold.pg_to_osds(pgid, raw);
+	cold.pg_to_up_acting_osds(pgid, up, acting);
+	for (vector<int>::iterator q = raw.begin(); q != raw.end(); ++q)
+	  count[*q]++;
+	if (raw.size())
+	  first_count[raw[0]]++;
+	if (acting.size())
+	  primary_count[acting[0]]++;
+	total++;
+      }
+    }
+    utime_t cold_time = ceph_clock_now(g_ceph_context) - start;
+
+    // same pgs again, now answered from the mapping cache
+    start = ceph_clock_now(g_ceph_context);
+    for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+	 p != osdmap.get_pools().end();
+	 ++p) {
+      if (pool >= 0 && p->first != pool)
+	continue;
+      for (ps_t ps = 0; ps < p->second.get_pg_num(); ++ps) {
+	vector<int> raw, up, acting;
+	pg_t pgid(ps, p->first, -1);
+	cold.pg_to_osds(pgid, raw);
+	cold.pg_to_up_acting_osds(pgid, up, acting);
+      }
+    }
+    utime_t warm_time = ceph_clock_now(g_ceph_context) - start;
+
+    OSDMap bulk;
+    bulk.decode(mbl);
+    start = ceph_clock_now(g_ceph_context);
+    bulk.precompute_pg_mappings(pool, mapping_threads);
+    utime_t bulk_time = ceph_clock_now(g_ceph_context) - start;
+
+    // the bulk result had better match
+    for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+	 p != osdmap.get_pools().end();
+	 ++p) {
+      if (pool >= 0 && p->first != pool)
+	continue;
+      for (ps_t ps = 0; ps < p->second.get_pg_num(); ++ps) {
+	vector<int> a, b;
+	pg_t pgid(ps, p->first, -1);
+	cold.pg_to_osds(pgid, a);
+	bulk.pg_to_osds(pgid, b);
+	if (a != b) {
+	  cerr << me << ": " << pgid << " maps to " << a << " but bulk precompute got "
+	       << b << std::endl;
+	  exit(1);
+	}
+      }
+    }
+
+    unsigned min_count = total, max_count = 0, in = 0;
+    cout << "#osd\tcount\tfirst\tprimary" << std::endl;
+    for (int i = 0; i < osdmap.get_max_osd(); i++) {
+      if (!osdmap.exists(i))
+	continue;
+      cout << "osd." << i << "\t" << count[i] << "\t" << first_count[i]
+	   << "\t" << primary_count[i] << std::endl;
+      if (!osdmap.is_in(i))
+	continue;
+      in++;
+      min_count = MIN(min_count, (unsigned)count[i]);
+      max_count = MAX(max_count, (unsigned)count[i]);
+    }
+    cout << " in " << in << std::endl;
+    if (in)
+      cout << " min pgs per osd " << min_count << ", max " << max_count << std::endl;
+    cout << "mapped " << total << " pgs" << std::endl;
+    cout << " first pass (fills cache) " << cold_time << " s" << std::endl;
+    cout << " second pass (cached)     " << warm_time << " s" << std::endl;
+    cout << " bulk precompute with " << mapping_threads << " threads " << bulk_time
+	 << " s" << std::endl;
+  }
+
   if (!print && !print_json && !tree && !modified && 
       export_crush.empty() && import_crush.empty() && 
-      test_map_pg.empty() && test_map_object.empty()) {
+      test_map_pg.empty() && test_map_object.empty() && !test_map_pgs) {
     cerr << me << ": no action specified?" << std::endl;
     usage();
   }
@@ -0,0 +1,339 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <boost/scoped_ptr.hpp>
+
+#include "include/types.h"
+#include "include/buffer.h"
+#include "include/str_list.h"
+#include "common/Clock.h"
+#include "common/config.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "os/KeyValueDB.h"
+#include "os/DBObjectMap.h"
+#include "test/ObjectMap/KeyValueDBMemory.h"
+#include "test/common/LatencyStats.h"
+
+/*
+ * Drives DBObjectMap directly, without an OSD or a cluster (compare
+ * omapbench, which goes through librados), and reports ops/s and latency
+ * percentiles for each workload:
+ *
+ *  write   fill each object with --keys keys, --keys-per-op per set_keys,
+ *          submitting --ops-per-batch set_keys together
+ *  get     get_values of one random key of a random object
+ *  scan    iterate --scan-len keys from a random key of a random object
+ *  clone   clone a random object, then remove a key from the clone, which
+ *          copies up the parent's keys around it
+ *  rmkeys  remove one random key from a random object (after clone, most
+ *          objects have a parent, so this copies up too)
+ *
+ * ops/s is over the wall time of the workload, including building its
+ * arguments; clone and cow-rm, which alternate, count only their own ops.
+ */
+
+static void usage()
+{
+  cout << "usage: bench_object_map [options]\n"
+       << "  --backend mem|leveldb|memdb  key/value store (default mem, no disk)\n"
+       << "  --path dir                   where leveldb/memdb keep their files\n"
+       << "  --objects n                  objects (default 100)\n"
+       << "  --keys n                     keys per object (default 1000)\n"
+       << "  --keys-per-op n              keys per set_keys when writing (default 10)\n"
+       << "  --ops-per-batch n            set_keys per kv write when writing (default 1)\n"
+       << "  --key-size n                 bytes per key (default 16)\n"
+       << "  --value-size n               bytes per value (default 100)\n"
+       << "  --ops n                      ops per read/clone/rmkeys workload (default 10000)\n"
+       << "  --scan-len n                 keys per scan (default 32)\n"
+       << "  --header-cache n             DBObjectMap header cache size (default 128)\n"
+       << "  --workloads w,w,...          of write,get,scan,clone,rmkeys (default all)\n"
+       << "  --seed n                     random seed (default 0)\n";
+}
+
+/// latencies of one workload
+struct Stats : public LatencyStats {
+  string name;
+  utime_t start;
+  double elapsed;
+
+  Stats(const string &name) : name(name), elapsed(0) {}
+
+  void begin() {
+    start = ceph_clock_now(g_ceph_context);
+  }
+  void record(utime_t op_start) {
+    add(ceph_clock_now(g_ceph_context) - op_start);
+  }
+  void end() {
+    elapsed = ceph_clock_now(g_ceph_context) - start;
+  }
+  /// for interleaved workloads: only our own ops' time
+  void end_busy() {
+    elapsed = total();
+  }
+  void dump(ostream &out) {
+    if (count())
+      LatencyStats::dump(out, name, elapsed);
+  }
+};
+
+class Bench {
+  ObjectMap *db;
+  int objects, keys, keys_per_op, ops_per_batch, key_size, value_size;
+  int ops, scan_len;
+  int clones;
+  vector<hobject_t> oids;
+  bufferlist value;
+
+  string key(int i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%010d", i);
+    string k(buf);
+    if ((int)k.size() < key_size)
+      k.append(key_size - k.size(), 'k');
+    return k;
+  }
+  hobject_t &rand_oid() {
+    return oids[rand() % oids.size()];
+  }
+
+public:
+  Bench(ObjectMap *db, int objects, int keys, int keys_per_op,
+	int ops_per_batch, int key_size, int value_size, int ops,
+	int scan_len)
+    : db(db), objects(objects), keys(keys), keys_per_op(keys_per_op),
+      ops_per_batch(ops_per_batch), key_size(key_size),
+      value_size(value_size), ops(ops), scan_len(scan_len), clones(0) {
+    for (int i = 0; i < objects; ++i) {
+      char name[32];
+      snprintf(name, sizeof(name), "obj_%08d", i);
+      oids.push_back(hobject_t(sobject_t(name, CEPH_NOSNAP)));
+    }
+    value.append(string(value_size, 'v'));
+  }
+
+  void write(Stats &s) {
+    ObjectMap::Batch batch;
+    int pending = 0;
+    s.begin();
+    for (vector<hobject_t>::iterator o = oids.begin(); o != oids.end(); ++o) {
+      for (int k = 0; k < keys; k += keys_per_op) {
+	map<string, bufferlist> to_set;
+	for (int j = k; j < keys && j < k + keys_per_op; ++j)
+	  to_set[key(j)] = value;
+	utime_t t = ceph_clock_now(g_ceph_context);
+	if (ops_per_batch > 1 && !batch)
+	  batch = db->get_batch();
+	int r = db->set_keys(*o, to_set, 0, batch);
+	assert(r == 0);
+	if (batch && ++pending == ops_per_batch) {
+	  r = db->submit_batch(batch);
+	  assert(r == 0);
+	  batch.reset();
+	  pending = 0;
+	}
+	s.record(t);
+      }
+    }
+    if (batch)
+      db->submit_batch(batch);
+    s.end();
+  }
+
+  void get(Stats &s) {
+    s.begin();
+    for (int i = 0; i < ops; ++i) {
+      set<string> to_get;
+      to_get.insert(key(rand() % keys));
+      map<string, bufferlist> got;
+      utime_t t = ceph_clock_now(g_ceph_context);
+      db->get_values(rand_oid(), to_get, &got);
+      s.record(t);
+    }
+    s.end();
+  }
+
+  void scan(Stats &s) {
+    s.begin();
+    for (int i = 0; i < ops; ++i) {
+      hobject_t &oid = rand_oid();
+      string from = key(rand() % keys);
+      utime_t t = ceph_clock_now(g_ceph_context);
+      ObjectMap::ObjectMapIterator it = db->get_iterator(oid);
+      it->lower_bound(from);
+      for (int j = 0; j < scan_len && it->valid(); ++j) {
+	it->value();
+	it->next();
+      }
+      s.record(t);
+    }
+    s.end();
+  }
+
+  void clone(Stats &s, Stats &cow) {
+    for (int i = 0; i < ops; ++i) {
+      hobject_t &oid = rand_oid();
+      char name[32];
+      snprintf(name, sizeof(name), "clone_%08d", clones++);
+      hobject_t target(sobject_t(name, CEPH_NOSNAP));
+      utime_t t = ceph_clock_now(g_ceph_context);
+      int r = db->clone(oid, target);
+      assert(r == 0);
+      s.record(t);
+
+      set<string> to_rm;
+      to_rm.insert(key(rand() % keys));
+      t = ceph_clock_now(g_ceph_context);
+      db->rm_keys(target, to_rm);
+      cow.record(t);
+      db->clear(target);
+    }
+    s.end_busy();
+    cow.end_busy();
+  }
+
+  void rmkeys(Stats &s) {
+    s.begin();
+    for (int i = 0; i < ops; ++i) {
+      set<string> to_rm;
+      to_rm.insert(key(rand() % keys));
+      utime_t t = ceph_clock_now(g_ceph_context);
+      db->rm_keys(rand_oid(), to_rm);
+      s.record(t);
+    }
+    s.end();
+  }
+};
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  string backend = "mem", path, workloads = "write,get,scan,clone,rmkeys";
+  int objects = 100, keys = 1000, keys_per_op = 10, ops_per_batch = 1;
+  int key_size = 16, value_size = 100, ops = 10000, scan_len = 32;
+  int header_cache = 128, seed = 0;
+  std::ostringstream err;
+  string val;
+  for (std::vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage();
+      return 0;
+    } else if (ceph_argparse_witharg(args, i, &backend, "--backend", (char*)NULL)) {
+    } else if (ceph_argparse_witharg(args, i, &path, "--path", (char*)NULL)) {
+    } else if (ceph_argparse_witharg(args, i, &workloads, "--workloads", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &objects, &err, "--objects", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &keys, &err, "--keys", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &keys_per_op, &err, "--keys-per-op", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &ops_per_batch, &err, "--ops-per-batch", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &key_size, &err, "--key-size", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &value_size, &err, "--value-size", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &ops, &err, "--ops", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &scan_len, &err, "--scan-len", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &header_cache, &err, "--header-cache", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &seed, &err, "--seed", (char*)NULL)) {
+    } else {
+      cerr << "unrecognized argument " << *i << std::endl;
+      usage();
+      return 1;
+    }
+    if (!err.str().empty()) {
+      cerr << err.str() << std::endl;
+      return 1;
+    }
+  }
+  if (objects < 1 || keys < 1 || keys_per_op < 1 || ops_per_batch < 1) {
+    cerr << "--objects, --keys, --keys-per-op and --ops-per-batch must be positive"
+	 << std::endl;
+    return 1;
+  }
+
+  KeyValueDB *store;
+  if (backend == "mem") {
+    store = new KeyValueDBMemory();
+  } else {
+    if (path.empty()) {
+      cerr << "--backend " << backend << " needs --path" << std::endl;
+      return 1;
+    }
+    store = KeyValueDB::create(backend, path);
+    if (!store) {
+      cerr << "unknown backend " << backend << std::endl;
+      return 1;
+    }
+    if (store->init(cerr)) {
+      delete store;
+      return 1;
+    }
+  }
+  DBObjectMap *dbomap = new DBObjectMap(store, header_cache);
+  boost::scoped_ptr<ObjectMap> db(dbomap);
+  if (dbomap->init() < 0) {
+    cerr << "failed to init DBObjectMap" << std::endl;
+    return 1;
+  }
+  srand(seed);
+
+  Bench bench(db.get(), objects, keys, keys_per_op, ops_per_batch, key_size,
+	      value_size, ops, scan_len);
+  vector<Stats*> results;
+  set<string> todo;
+  get_str_set(workloads, todo);
+
+  // in this order, so that rmkeys doesn't thin out the others' keys
+  if (todo.count("write")) {
+    results.push_back(new Stats("write"));
+    bench.write(*results.back());
+  }
+  if (todo.count("get")) {
+    results.push_back(new Stats("get"));
+    bench.get(*results.back());
+  }
+  if (todo.count("scan")) {
+    results.push_back(new Stats("scan"));
+    bench.scan(*results.back());
+  }
+  if (todo.count("clone")) {
+    Stats *s = new Stats("clone");
+    Stats *cow = new Stats("cow-rm");
+    bench.clone(*s, *cow);
+    results.push_back(s);
+    results.push_back(cow);
+  }
+  if (todo.count("rmkeys")) {
+    results.push_back(new Stats("rmkeys"));
+    bench.rmkeys(*results.back());
+  }
+
+  cout << backend << ": " << objects << " objects x " << keys << " keys, "
+       << key_size << "+" << value_size << " bytes each" << std::endl;
+  LatencyStats::dump_header(cout);
+  for (vector<Stats*>::iterator i = results.begin(); i != results.end(); ++i) {
+    (*i)->dump(cout);
+    delete *i;
+  }
+  return 0;
+}
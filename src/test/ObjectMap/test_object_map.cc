@@ -10,6 +10,7 @@
 #include "os/DBObjectMap.h"
 #include "os/HashIndex.h"
 #include "os/LevelDBStore.h"
+#include "os/MemDB.h"
 #include <sys/types.h>
 #include "global/global_init.h"
 #include "common/ceph_argparse.h"
@@ -516,9 +517,12 @@ public:
     }
 
     string strpath(path);
+    char *backend = getenv("OBJECT_MAP_BACKEND");
+    string strbackend(backend ? backend : "leveldb");
 
-    cerr << "using path " << strpath << std::endl;;
-    LevelDBStore *store = new LevelDBStore(strpath);
+    cerr << "using " << strbackend << " at path " << strpath << std::endl;;
+    KeyValueDB *store = KeyValueDB::create(strbackend, strpath);
+    assert(store);
     assert(!store->init(cerr));
 
     db.reset(new DBObjectMap(store));
@@ -747,3 +751,133 @@ TEST_F(ObjectMapTest, RandomTest) {
     }
   }
 }
+
+TEST_F(ObjectMapTest, Batch) {
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+  hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
+  bufferlist bl, header;
+  bl.append("bar");
+  header.append("head");
+  map<string, bufferlist> to_set;
+  to_set["foo"] = bl;
+  to_set["foo2"] = bl;
+  tester.set_key(hoid2, "foo", "bar");
+
+  ObjectMap::Batch batch = db->get_batch();
+  ASSERT_EQ(0, db->set_header(hoid, header, 0, batch));
+  ASSERT_EQ(0, db->set_keys(hoid, to_set, 0, batch));  // same new header
+  set<string> to_rm;
+  to_rm.insert("foo2");
+  ASSERT_EQ(0, db->rm_keys(hoid, to_rm, 0, batch));
+  ASSERT_EQ(0, db->set_keys(hoid2, to_set, 0, batch));
+
+  string result;
+  if (batch) {
+    // nothing is visible until the batch is submitted
+    ASSERT_EQ(0, tester.get_key(hoid, "foo", &result));
+    ASSERT_EQ(0, tester.get_key(hoid2, "foo2", &result));
+  }
+  ASSERT_EQ(0, db->submit_batch(batch));
+
+  map<string, bufferlist> got;
+  bufferlist got_header;
+  db->get(hoid, &got_header, &got);
+  ASSERT_TRUE(header.contents_equal(got_header));
+  ASSERT_EQ(1u, got.size());
+  ASSERT_EQ(1, tester.get_key(hoid, "foo", &result));
+  ASSERT_EQ("bar", result);
+  ASSERT_EQ(1, tester.get_key(hoid2, "foo2", &result));
+
+  // removing a key a clone parent still holds goes around the batch
+  db->clone(hoid, hoid2);
+  batch = db->get_batch();
+  to_set.clear();
+  to_set["baz"] = bl;
+  ASSERT_EQ(0, db->set_keys(hoid, to_set, 0, batch));
+  to_rm.clear();
+  to_rm.insert("foo");
+  ASSERT_EQ(0, db->rm_keys(hoid, to_rm, 0, batch));
+  ASSERT_EQ(0, db->submit_batch(batch));
+  ASSERT_EQ(0, tester.get_key(hoid, "foo", &result));
+  ASSERT_EQ(1, tester.get_key(hoid, "baz", &result));
+  ASSERT_EQ(1, tester.get_key(hoid2, "foo", &result));
+  ASSERT_EQ(0, tester.get_key(hoid2, "baz", &result));
+
+  db->clear(hoid);
+  db->clear(hoid2);
+}
+
+TEST_F(ObjectMapTest, HeaderCache) {
+  // cached headers must follow clone and clear
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+  hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
+  string result;
+  for (unsigned i = 0; i < 3; ++i) {
+    tester.set_key(hoid, "foo", "bar" + num_str(i));
+    ASSERT_EQ(1, tester.get_key(hoid, "foo", &result));
+    ASSERT_EQ(0, db->clone(hoid, hoid2));
+    tester.set_key(hoid2, "foo", "baz");
+    ASSERT_EQ(1, tester.get_key(hoid, "foo", &result));
+    ASSERT_EQ("bar" + num_str(i), result);
+    ASSERT_EQ(1, tester.get_key(hoid2, "foo", &result));
+    ASSERT_EQ("baz", result);
+    ASSERT_EQ(0, db->clear(hoid));
+    ASSERT_EQ(0, tester.get_key(hoid, "foo", &result));
+    ASSERT_EQ(1, tester.get_key(hoid2, "foo", &result));
+  }
+  db->clear(hoid2);
+}
+
+TEST(MemDB, Reopen) {
+  char path[] = "/tmp/test_memdb.XXXXXX";
+  ASSERT_TRUE(mkdtemp(path) != NULL);
+  bufferlist bl;
+  bl.append("value");
+  {
+    MemDB db(path);
+    ASSERT_EQ(0, db.init(cerr));
+    KeyValueDB::Transaction t = db.get_transaction();
+    t->set("p", "synced", bl);
+    t->set("q", "synced", bl);
+    ASSERT_EQ(0, db.submit_transaction_sync(t));
+    t = db.get_transaction();
+    t->set("p", "unsynced", bl);
+    ASSERT_EQ(0, db.submit_transaction(t));
+
+    KeyValueDB::Iterator it = db.get_iterator("p");
+    it->seek_to_first();
+    ASSERT_TRUE(it->valid());
+    ASSERT_EQ("synced", it->key());
+    it->next();
+    ASSERT_TRUE(it->valid());
+    ASSERT_EQ("unsynced", it->key());
+    it->next();
+    ASSERT_FALSE(it->valid());
+  }
+  {
+    // only what was submitted with a sync survives
+    MemDB db(path);
+    ASSERT_EQ(0, db.init(cerr));
+    set<string> keys;
+    keys.insert("synced");
+    keys.insert("unsynced");
+    map<string, bufferlist> got;
+    ASSERT_EQ(0, db.get("p", keys, &got));
+    ASSERT_EQ(1u, got.size());
+    ASSERT_TRUE(bl.contents_equal(got["synced"]));
+
+    KeyValueDB::Transaction t = db.get_transaction();
+    t->rmkeys_by_prefix("p");
+    ASSERT_EQ(0, db.submit_transaction_sync(t));
+    KeyValueDB::Iterator it = db.get_iterator("p");
+    it->seek_to_first();
+    ASSERT_FALSE(it->valid());
+    it = db.get_iterator("q");
+    it->seek_to_last();
+    ASSERT_TRUE(it->valid());
+    ASSERT_EQ("synced", it->key());
+  }
+  string fn(path);
+  ::unlink((fn + "/memdb").c_str());
+  ::rmdir(path);
+}
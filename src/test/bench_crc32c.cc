@@ -0,0 +1,88 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "include/types.h"
+#include "include/crc32c.h"
+#include "common/crc32c_intel.h"
+#include "common/sctp_crc32.h"
+#include "common/Clock.h"
+#include "common/config.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+
+/*
+ * usage: bench_crc32c [total_mb [block_size ...]]
+ *
+ * Checksums total_mb of data in blocks of each size with the portable
+ * slice-by-8 implementation, the SSE4.2 one (if the cpu has it) and the
+ * dispatched ceph_crc32c_le(), and prints the throughput of each.
+ */
+
+static uint32_t run(ceph_crc32c_func_t f, unsigned char *buf, unsigned bs,
+		    uint64_t total, double *secs)
+{
+  uint32_t crc = -1;
+  utime_t start = ceph_clock_now(NULL);
+  for (uint64_t done = 0; done < total; done += bs)
+    crc = f(crc, buf, bs);
+  utime_t dur = ceph_clock_now(NULL) - start;
+  *secs = (double)dur;
+  return crc;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+
+  uint64_t total_mb = 256;
+  vector<unsigned> sizes;
+  if (args.size() > 0)
+    total_mb = atoi(args[0]);
+  for (unsigned i = 1; i < args.size(); i++)
+    sizes.push_back(atoi(args[i]));
+  if (sizes.empty()) {
+    sizes.push_back(64);
+    sizes.push_back(4096);
+    sizes.push_back(65536);
+    sizes.push_back(4 << 20);
+  }
+
+  unsigned max = 0;
+  for (unsigned i = 0; i < sizes.size(); i++)
+    if (sizes[i] > max)
+      max = sizes[i];
+  unsigned char *buf = new unsigned char[max];
+  for (unsigned i = 0; i < max; i++)
+    buf[i] = rand();
+
+  bool intel = ceph_crc32c_intel_supported();
+  cout << "sse4.2 crc32: " << (intel ? "yes" : "no")
+       << ", ceph_crc32c_le uses "
+       << (ceph_choose_crc32() == ceph_crc32c_intel ? "intel" : "sctp")
+       << std::endl;
+
+  uint64_t total = total_mb << 20;
+  for (unsigned i = 0; i < sizes.size(); i++) {
+    unsigned bs = sizes[i];
+    double secs;
+    cout << "block " << bs << ":";
+
+    uint32_t sctp = run(ceph_crc32c_sctp, buf, bs, total, &secs);
+    cout << "  sctp " << (double)total_mb / secs << " MB/s";
+    if (intel) {
+      uint32_t c = run(ceph_crc32c_intel, buf, bs, total, &secs);
+      cout << "  intel " << (double)total_mb / secs << " MB/s";
+      if (c != sctp)
+	cout << " (MISMATCH " << c << " != " << sctp << ")";
+    }
+    run(ceph_crc32c_le, buf, bs, total, &secs);
+    cout << "  ceph_crc32c_le " << (double)total_mb / secs << " MB/s" << std::endl;
+  }
+
+  delete[] buf;
+  return 0;
+}
@@ -0,0 +1,187 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "include/types.h"
+#include "os/ObjectStore.h"
+#include "common/Clock.h"
+#include "common/config.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+
+/*
+ * usage: bench_transaction [iterations [write_size]]
+ *
+ * Builds a transaction shaped like the one the OSD queues for a client
+ * write (data, object_info and snapset attrs, a pg log entry and the pg
+ * info attrs) and times encoding it, and decoding and walking it the way
+ * FileStore::_do_transaction does, in both the current and the legacy
+ * (v6) encoding.  The legacy builders are gone, so the legacy encode time
+ * is that of building a current transaction and converting it.
+ */
+
+typedef ObjectStore::Transaction Transaction;
+
+static void build(Transaction *t, unsigned i, bufferlist& data,
+		  bufferlist& oi, bufferlist& ss, bufferlist& entry)
+{
+  coll_t c("3.1f_head"), meta("meta");
+  char name[32];
+  snprintf(name, sizeof(name), "rb.0.1234.%012x", i % 1024);
+  hobject_t oid(object_t(name), "", CEPH_NOSNAP, i * 2654435761u, 3);
+  hobject_t log_oid(object_t("pglog_3.1f"), "", 0, 0, -1);
+  hobject_t info_oid(object_t("pginfo_3.1f"), "", 0, 0, -1);
+
+  t->write(c, oid, (i % 1024) * data.length(), data.length(), data);
+  t->setattr(c, oid, "_", oi);
+  t->setattr(c, oid, "snapset", ss);
+  map<string,bufferlist> keys;
+  char key[32];
+  snprintf(key, sizeof(key), "0000000012.%020u", i);
+  keys[key] = entry;
+  t->omap_setkeys(meta, log_oid, keys);
+  t->touch(meta, info_oid);
+  t->collection_setattr(c, "info", oi);
+  t->collection_setattr(c, "snap_collections", ss);
+}
+
+/// consume every argument, as the FileStore apply path does
+static uint64_t walk(Transaction& t)
+{
+  uint64_t sum = 0;
+  Transaction::iterator i = t.begin();
+  while (i.have_op()) {
+    int op = i.get_op();
+    switch (op) {
+    case Transaction::OP_WRITE:
+      {
+	i.get_cid();
+	i.get_oid();
+	sum += i.get_length();
+	sum += i.get_length();
+	bufferlist bl;
+	i.get_bl(bl);
+	sum += bl.length();
+      }
+      break;
+    case Transaction::OP_SETATTR:
+      {
+	i.get_cid();
+	i.get_oid();
+	sum += i.get_attrname().length();
+	bufferlist bl;
+	i.get_bl(bl);
+	sum += bl.length();
+      }
+      break;
+    case Transaction::OP_OMAP_SETKEYS:
+      {
+	i.get_cid();
+	i.get_oid();
+	map<string,bufferlist> aset;
+	i.get_attrset(aset);
+	sum += aset.size();
+      }
+      break;
+    case Transaction::OP_TOUCH:
+      i.get_cid();
+      i.get_oid();
+      break;
+    case Transaction::OP_COLL_SETATTR:
+      {
+	i.get_cid();
+	sum += i.get_attrname().length();
+	bufferlist bl;
+	i.get_bl(bl);
+	sum += bl.length();
+      }
+      break;
+    default:
+      assert(0 == "unexpected op");
+    }
+  }
+  return sum;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+
+  unsigned iterations = 100000;
+  unsigned write_size = 4096;
+  if (args.size() > 0)
+    iterations = atoi(args[0]);
+  if (args.size() > 1)
+    write_size = atoi(args[1]);
+
+  bufferlist data, oi, ss, entry;
+  data.append(buffer::create_page_aligned(write_size));
+  data.zero();
+  oi.append(string(230, 'o'));
+  ss.append(string(30, 's'));
+  entry.append(string(150, 'e'));
+
+  vector<bufferlist> v7(iterations), v6(iterations);
+  uint64_t v7_bytes = 0, v6_bytes = 0;
+
+  // warm up the allocator, so the first pass isn't charged for it
+  for (unsigned i = 0; i < iterations; i++) {
+    Transaction t;
+    build(&t, i, data, oi, ss, entry);
+    t.encode(v7[i]);
+    t.encode_legacy(v6[i]);
+  }
+  v7.clear();
+  v6.clear();
+  v7.resize(iterations);
+  v6.resize(iterations);
+
+  utime_t start = ceph_clock_now(NULL);
+  for (unsigned i = 0; i < iterations; i++) {
+    Transaction t;
+    build(&t, i, data, oi, ss, entry);
+    t.encode(v7[i]);
+  }
+  double v7_enc = ceph_clock_now(NULL) - start;
+
+  start = ceph_clock_now(NULL);
+  for (unsigned i = 0; i < iterations; i++) {
+    Transaction t;
+    build(&t, i, data, oi, ss, entry);
+    t.encode_legacy(v6[i]);
+  }
+  double v6_enc = ceph_clock_now(NULL) - start;
+
+  uint64_t sum = 0;
+  start = ceph_clock_now(NULL);
+  for (unsigned i = 0; i < iterations; i++) {
+    Transaction t(v7[i]);
+    sum += walk(t);
+    v7_bytes += v7[i].length();
+  }
+  double v7_dec = ceph_clock_now(NULL) - start;
+
+  start = ceph_clock_now(NULL);
+  for (unsigned i = 0; i < iterations; i++) {
+    Transaction t(v6[i]);
+    sum += walk(t);
+    v6_bytes += v6[i].length();
+  }
+  double v6_dec = ceph_clock_now(NULL) - start;
+
+  cout << iterations << " transactions, " << write_size << " byte writes"
+       << std::endl;
+  cout << "  current: " << (v7_bytes / iterations) << " bytes/txn"
+       << "  encode " << (v7_enc * 1000000 / iterations) << " us"
+       << "  decode+walk " << (v7_dec * 1000000 / iterations) << " us"
+       << std::endl;
+  cout << "  legacy:  " << (v6_bytes / iterations) << " bytes/txn"
+       << "  build+convert " << (v6_enc * 1000000 / iterations) << " us"
+       << "  decode+walk " << (v6_dec * 1000000 / iterations) << " us"
+       << std::endl;
+  cout << "  (checksum " << sum << ")" << std::endl;
+  return 0;
+}
@@ -5,6 +5,8 @@
 
 #include "gtest/gtest.h"
 #include "stdlib.h"
+#include <fcntl.h>
+#include <unistd.h>
 
 
 #define MAX_TEST 1000000
@@ -75,3 +77,140 @@ TEST(BufferList, TestCopyAll) {
   bl2.copy(0, BIG_SZ, (char*)big2);
   ASSERT_EQ(memcmp(big.get(), big2, BIG_SZ), 0);
 }
+
+TEST(BufferList, WriteFdOffset) {
+  char fn[] = "/tmp/bufferlist_write_fd.XXXXXX";
+  int fd = mkstemp(fn);
+  ASSERT_GE(fd, 0);
+  ::unlink(fn);
+
+  bufferlist bl;
+  bl.append("0123456789", 10);
+  bl.append("abcdef", 6);
+  ASSERT_EQ(0, bl.write_fd(fd, 4));
+  // positional: the file offset is untouched
+  ASSERT_EQ(0, ::lseek(fd, 0, SEEK_CUR));
+
+  char buf[20];
+  ASSERT_EQ(20, ::pread(fd, buf, sizeof(buf), 0));
+  ASSERT_EQ(0, memcmp(buf, "\0\0\0\0", 4));
+  ASSERT_EQ(0, memcmp(buf + 4, "0123456789abcdef", 16));
+  ::close(fd);
+}
+
+static void *pool_thread_entry(void *arg)
+{
+  // allocate on one thread, free on another
+  bufferptr *bp = (bufferptr *)arg;
+  *bp = bufferptr();
+  return NULL;
+}
+
+TEST(BufferPool, Reuse) {
+  buffer::pool_stats_t before[buffer::POOL_NUM_CLASSES];
+  buffer::pool_stats_t after[buffer::POOL_NUM_CLASSES];
+  buffer::get_pool_stats(before);
+
+  const char *p;
+  {
+    bufferptr a(buffer::create_page_aligned(4096));
+    ASSERT_TRUE(a.is_page_aligned());
+    p = a.c_str();
+  }
+  // the freed chunk is the first one this thread gets back, aligned or not
+  bufferptr b(buffer::create(4000));
+  ASSERT_EQ(p, b.c_str());
+  ASSERT_TRUE(b.is_page_aligned());
+
+  // too small a fraction of any class; not pooled
+  bufferptr c(buffer::create(1000));
+  bufferptr d(buffer::create_page_aligned(8 << 20));
+
+  bufferptr e(buffer::create_page_aligned(64 << 10));
+  pthread_t t;
+  pthread_create(&t, NULL, pool_thread_entry, &e);
+  pthread_join(t, NULL);
+
+  buffer::get_pool_stats(after);
+  ASSERT_EQ(4096u, after[0].chunk_size);
+  ASSERT_EQ(before[0].allocs + 2, after[0].allocs);
+  ASSERT_LE(before[0].hits + 1, after[0].hits);
+  ASSERT_EQ(before[0].live + 1, after[0].live);
+  ASSERT_EQ(before[1].allocs + 1, after[1].allocs);
+  ASSERT_EQ(before[1].live, after[1].live);
+  ASSERT_EQ(before[2].allocs, after[2].allocs);
+}
+
+static void *pool_alloc_big_entry(void *arg)
+{
+  bufferptr bp(buffer::create_page_aligned(4 << 20));
+  *(const char **)arg = bp.c_str();
+  return NULL;
+}
+
+TEST(BufferPool, Large) {
+  buffer::pool_stats_t before[buffer::POOL_NUM_CLASSES];
+  buffer::pool_stats_t after[buffer::POOL_NUM_CLASSES];
+  buffer::get_pool_stats(before);
+
+  // much less than a big chunk: allocated at its own size
+  {
+    bufferptr a(buffer::create_page_aligned(2100 << 10));
+    ASSERT_EQ(2100u << 10, a.length());
+  }
+  buffer::get_pool_stats(after);
+  ASSERT_EQ(before[2].allocs, after[2].allocs);
+
+  // a big chunk isn't kept by the thread that frees it, so another
+  // thread gets it back
+  const char *p, *q = NULL;
+  {
+    bufferptr b(buffer::create_page_aligned(4 << 20));
+    p = b.c_str();
+  }
+  pthread_t t;
+  pthread_create(&t, NULL, pool_alloc_big_entry, &q);
+  pthread_join(t, NULL);
+  ASSERT_EQ(p, q);
+
+  buffer::get_pool_stats(after);
+  ASSERT_EQ(before[2].allocs + 2, after[2].allocs);
+  ASSERT_EQ(before[2].live, after[2].live);
+}
+
+TEST(BufferPool, Trim) {
+  buffer::pool_stats_t stats[buffer::POOL_NUM_CLASSES];
+
+  // a freed big chunk waits in the depot...
+  {
+    bufferptr b(buffer::create_page_aligned(4 << 20));
+  }
+  buffer::get_pool_stats(stats);
+  ASSERT_LE(1u, stats[2].cached);
+
+  // ...until it has sat there unused through a whole trim interval
+  buffer::trim_pool();
+  buffer::trim_pool();
+  buffer::get_pool_stats(stats);
+  ASSERT_EQ(0u, stats[2].cached);
+
+  // and the depot keeps no more than it is allowed
+  buffer::set_pool_depot_max(2, 0);
+  {
+    bufferptr b(buffer::create_page_aligned(4 << 20));
+  }
+  buffer::get_pool_stats(stats);
+  ASSERT_EQ(0u, stats[2].cached);
+  buffer::set_pool_depot_max(2, 2);
+}
+
+TEST(BufferPool, LiveBytes) {
+  uint64_t before = buffer::get_live_bytes();
+  {
+    // one pooled, one not
+    bufferptr a(buffer::create(4000));
+    bufferptr b(buffer::create(1000));
+    ASSERT_EQ(before + 5000, buffer::get_live_bytes());
+  }
+  ASSERT_EQ(before, buffer::get_live_bytes());
+}
@@ -52,7 +52,7 @@
     ceph osd blacklist rm <address>[:source_port]
     ceph osd pool mksnap <pool> <snapname>
     ceph osd pool rmsnap <pool> <snapname>
-    ceph osd pool create <pool> [<pg_num> [<pgp_num>]]
+    ceph osd pool create <pool> [<pg_num> [<pgp_num> [<expected_num_objects>]]]
     ceph osd pool delete <pool>
     ceph osd pool rename <pool> <new pool name>
     ceph osd pool set <pool> <field> <value>
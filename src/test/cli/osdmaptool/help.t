@@ -4,4 +4,7 @@
      --export-crush <file>   write osdmap's crush map to <file>
      --import-crush <file>   replace osdmap's crush map with <file>
      --test-map-pg <pgid>    map a pgid to osds
+     --mark-up-in            mark osds up and in (but do not persist)
+     --test-map-pgs [--pool <poolid>] [--mapping-threads <n>]
+                             map all pgs, reporting pgs per osd and timings
   [1]
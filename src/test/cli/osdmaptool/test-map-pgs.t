@@ -0,0 +1,18 @@
+  $ osdmaptool --createsimple 3 myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  osdmaptool: writing epoch 1 to myosdmap
+
+  $ osdmaptool --mark-up-in --test-map-pgs --pool 0 myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  marking all OSDs up and in
+  pool 0 pg_num 192
+  #osd	count	first	primary
+  osd.0	116	68	68
+  osd.1	134	63	63
+  osd.2	134	61	61
+   in 3
+   min pgs per osd 116, max 134
+  mapped 192 pgs
+   first pass \(fills cache\) \d+\.\d+ s (re)
+   second pass \(cached\)     \d+\.\d+ s (re)
+   bulk precompute with 4 threads \d+\.\d+ s (re)
@@ -0,0 +1,76 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef TEST_LATENCY_STATS_H
+#define TEST_LATENCY_STATS_H
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Latencies of one kind of op, for the benchmarks' summary tables
+ *
+ * Not thread safe.  Times are in seconds; dump() prints microseconds.
+ */
+class LatencyStats {
+  std::vector<double> lat;
+  double sum;
+  bool sorted;
+
+  void sort() {
+    if (!sorted)
+      std::sort(lat.begin(), lat.end());
+    sorted = true;
+  }
+
+public:
+  LatencyStats() : sum(0), sorted(true) {}
+
+  void add(double l) {
+    lat.push_back(l);
+    sum += l;
+    sorted = false;
+  }
+  size_t count() const {
+    return lat.size();
+  }
+  /// total of the latencies, i.e. time busy if ops ran one at a time
+  double total() const {
+    return sum;
+  }
+  double avg() const {
+    return lat.empty() ? 0 : sum / lat.size();
+  }
+  /// @param p in [0, 1]
+  double percentile(double p) {
+    if (lat.empty())
+      return 0;
+    sort();
+    return lat[(size_t)(p * (lat.size() - 1))];
+  }
+
+  static void dump_header(std::ostream &out) {
+    out << std::left << std::setw(8) << "op" << std::right
+	<< std::setw(9) << "ops" << std::setw(11) << "ops/s"
+	<< std::setw(9) << "avg us" << std::setw(9) << "p50"
+	<< std::setw(9) << "p90" << std::setw(9) << "p99"
+	<< std::setw(9) << "p99.9" << std::setw(9) << "max" << std::endl;
+  }
+  /// one row of the table; ops/s is count() over elapsed seconds
+  void dump(std::ostream &out, const std::string &name, double elapsed) {
+    out << std::left << std::setw(8) << name << std::right
+	<< std::setw(9) << count()
+	<< std::setw(11) << (unsigned)(elapsed > 0 ? count() / elapsed : 0)
+	<< std::setw(9) << (unsigned)(avg() * 1000000)
+	<< std::setw(9) << (unsigned)(percentile(.5) * 1000000)
+	<< std::setw(9) << (unsigned)(percentile(.9) * 1000000)
+	<< std::setw(9) << (unsigned)(percentile(.99) * 1000000)
+	<< std::setw(9) << (unsigned)(percentile(.999) * 1000000)
+	<< std::setw(9) << (unsigned)(percentile(1) * 1000000)
+	<< std::endl;
+  }
+};
+
+#endif
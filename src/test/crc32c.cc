@@ -0,0 +1,59 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/types.h"
+#include "include/crc32c.h"
+#include "common/crc32c_intel.h"
+#include "common/sctp_crc32.h"
+#include "gtest/gtest.h"
+
+TEST(Crc32c, Small) {
+  const char *a = "foo bar baz";
+  const char *b = "whiz bang boom";
+  ASSERT_EQ(4119623852u, ceph_crc32c_le(0, (unsigned char *)a, strlen(a)));
+  ASSERT_EQ(881700046u, ceph_crc32c_le(1234, (unsigned char *)a, strlen(a)));
+  ASSERT_EQ(2360230088u, ceph_crc32c_le(0, (unsigned char *)b, strlen(b)));
+  ASSERT_EQ(3743019208u, ceph_crc32c_le(5678, (unsigned char *)b, strlen(b)));
+}
+
+TEST(Crc32c, CheckValue) {
+  // the standard crc32c check value (initial ~0, final inversion)
+  const char *s = "123456789";
+  ASSERT_EQ(0xe3069283u, ceph_crc32c_le(-1, (unsigned char *)s, 9) ^ 0xffffffffu);
+  ASSERT_EQ(0xe3069283u, ceph_crc32c_sctp(-1, (unsigned char *)s, 9) ^ 0xffffffffu);
+}
+
+TEST(Crc32c, Incremental) {
+  unsigned char buf[4096];
+  for (unsigned i = 0; i < sizeof(buf); i++)
+    buf[i] = rand();
+  uint32_t whole = ceph_crc32c_le(-1, buf, sizeof(buf));
+  for (unsigned split = 0; split < sizeof(buf); split += 333) {
+    uint32_t c = ceph_crc32c_le(-1, buf, split);
+    c = ceph_crc32c_le(c, buf + split, sizeof(buf) - split);
+    ASSERT_EQ(whole, c);
+  }
+}
+
+TEST(Crc32c, IntelMatchesSctp) {
+  if (!ceph_crc32c_intel_supported()) {
+    std::cout << "SSE4.2 crc32 not supported, skipping" << std::endl;
+    return;
+  }
+  ASSERT_EQ((void*)ceph_crc32c_intel, (void*)ceph_choose_crc32());
+
+  unsigned char buf[8192 + 16];
+  for (unsigned i = 0; i < sizeof(buf); i++)
+    buf[i] = rand();
+  for (unsigned off = 0; off < 16; off++) {
+    for (unsigned len = 0; len < 80; len++)
+      ASSERT_EQ(ceph_crc32c_sctp(off * len, buf + off, len),
+		ceph_crc32c_intel(off * len, buf + off, len));
+    for (unsigned len = 80; len <= 8192; len += 777)
+      ASSERT_EQ(ceph_crc32c_sctp(-1, buf + off, len),
+		ceph_crc32c_intel(-1, buf + off, len));
+  }
+}
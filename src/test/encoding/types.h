@@ -56,6 +56,7 @@ TYPE(object_info_t)
 TYPE(SnapSet)
 TYPE(ObjectRecoveryInfo)
 TYPE(ObjectRecoveryProgress)
+TYPE(PushOp)
 TYPE(ScrubMap::object)
 TYPE(ScrubMap)
 TYPE(osd_peer_stat_t)
@@ -0,0 +1,176 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "msg/EventMessenger.h"
+#include "msg/SimpleMessenger.h"
+#include "msg/Dispatcher.h"
+#include "messages/MPing.h"
+#include "common/Mutex.h"
+#include "common/Cond.h"
+#include "common/ceph_context.h"
+#include "include/page.h"
+#include "test/unit.h"
+
+#include <unistd.h>
+
+/*
+ * Counts the pings it receives, checking that they arrive in order
+ * with intact payloads, and optionally echoes each one back.
+ */
+class PingCounter : public Dispatcher {
+public:
+  Messenger *msgr;
+  bool echo;
+  Mutex lock;
+  Cond cond;
+  int count;
+  bool in_order;
+  bool payload_ok;
+  bool aligned;
+
+  PingCounter(Messenger *m, bool e)
+    : Dispatcher(g_ceph_context), msgr(m), echo(e),
+      lock("PingCounter::lock"), count(0), in_order(true), payload_ok(true),
+      aligned(true) {}
+
+  bool ms_dispatch(Message *m) {
+    if (m->get_type() != CEPH_MSG_PING)
+      return false;
+    Mutex::Locker l(lock);
+    if (m->get_tid() != (tid_t)count)
+      in_order = false;
+    bufferlist& data = m->get_data();
+    if (data.length() != m->get_tid() * 1000)
+      payload_ok = false;
+    for (unsigned i = 0; i < data.length(); i += 997)
+      if (data[i] != (char)(m->get_tid() + i))
+	payload_ok = false;
+    // the sender's data starts on a page, so ours should too
+    if (data.length() >= CEPH_PAGE_SIZE && m->get_header().data_off == 0 &&
+	((unsigned long)data.buffers().front().c_str() & ~CEPH_PAGE_MASK))
+      aligned = false;
+    if (echo) {
+      MPing *r = new MPing;
+      r->set_tid(m->get_tid());
+      r->set_data(data);
+      msgr->send_message(r, m->get_connection());
+    }
+    count++;
+    cond.Signal();
+    m->put();
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) { return true; }
+  void ms_handle_remote_reset(Connection *con) {}
+
+  bool wait_for(int n) {
+    Mutex::Locker l(lock);
+    utime_t until = ceph_clock_now(g_ceph_context);
+    until += 30.0;
+    while (count < n) {
+      if (ceph_clock_now(g_ceph_context) > until)
+	return false;
+      cond.WaitInterval(g_ceph_context, lock, utime_t(1, 0));
+    }
+    return true;
+  }
+};
+
+static MPing *make_ping(int i)
+{
+  MPing *m = new MPing;
+  m->set_tid(i);
+  bufferptr bp(i * 1000);
+  for (int j = 0; j < i * 1000; j++)
+    bp[j] = (char)(i + j);
+  bufferlist bl;
+  bl.append(bp);
+  m->set_data(bl);
+  return m;
+}
+
+static Messenger *start_messenger(bool event, entity_name_t name, bool bind,
+				  Dispatcher **d, bool echo)
+{
+  Messenger *m;
+  if (event)
+    m = new EventMessenger(g_ceph_context, name, "test", getpid());
+  else
+    m = new SimpleMessenger(g_ceph_context, name, "test", getpid());
+  if (bind) {
+    m->set_default_policy(Messenger::Policy::stateless_server(0, 0));
+    entity_addr_t a;
+    a.parse("127.0.0.1:0");
+    EXPECT_EQ(0, m->bind(a));
+  } else {
+    m->set_default_policy(Messenger::Policy::lossless_client(0, 0));
+  }
+  *d = new PingCounter(m, echo);
+  m->add_dispatcher_head(*d);
+  EXPECT_EQ(0, m->start());
+  return m;
+}
+
+static void stop_messenger(Messenger *m, Dispatcher *d)
+{
+  m->shutdown();
+  m->wait();
+  delete m;
+  delete d;
+}
+
+static void ping_pong(bool server_event, bool client_event, int n)
+{
+  Dispatcher *sd, *cd;
+  Messenger *server = start_messenger(server_event, entity_name_t::OSD(0), true, &sd, true);
+  Messenger *client = start_messenger(client_event, entity_name_t::CLIENT(-1), false, &cd, false);
+  PingCounter *sc = (PingCounter*)sd;
+  PingCounter *cc = (PingCounter*)cd;
+
+  for (int i = 0; i < n; i++)
+    client->send_message(make_ping(i), server->get_myinst());
+
+  ASSERT_TRUE(sc->wait_for(n));
+  ASSERT_TRUE(cc->wait_for(n));
+  ASSERT_TRUE(sc->in_order);
+  ASSERT_TRUE(sc->payload_ok);
+  ASSERT_TRUE(cc->in_order);
+  ASSERT_TRUE(cc->payload_ok);
+  ASSERT_TRUE(sc->aligned);
+  ASSERT_TRUE(cc->aligned);
+
+  stop_messenger(client, cd);
+  stop_messenger(server, sd);
+}
+
+TEST(EventMessenger, PingPong) {
+  ping_pong(true, true, 500);
+}
+
+TEST(EventMessenger, SimpleClient) {
+  ping_pong(true, false, 200);
+}
+
+TEST(EventMessenger, SimpleServer) {
+  ping_pong(false, true, 200);
+}
+
+TEST(EventMessenger, Local) {
+  Dispatcher *d;
+  Messenger *m = start_messenger(true, entity_name_t::OSD(0), true, &d, false);
+  for (int i = 0; i < 10; i++)
+    m->send_message(make_ping(i), m->get_myinst());
+  ASSERT_TRUE(((PingCounter*)d)->wait_for(10));
+  ASSERT_TRUE(((PingCounter*)d)->in_order);
+  ASSERT_TRUE(((PingCounter*)d)->payload_ok);
+  stop_messenger(m, d);
+}
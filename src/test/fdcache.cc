@@ -0,0 +1,125 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "os/FDCache.h"
+#include "test/unit.h"
+
+static int open_fd()
+{
+  int fd = ::open("/dev/null", O_RDONLY);
+  assert(fd >= 0);
+  return fd;
+}
+
+static bool fd_is_open(int fd)
+{
+  return ::fcntl(fd, F_GETFD) >= 0;
+}
+
+static hobject_t make_oid(const char *name, uint32_t hash)
+{
+  return hobject_t(object_t(name), "", CEPH_NOSNAP, hash, 0);
+}
+
+TEST(FDCache, LookupAdd) {
+  FDCache cache(16, 4);
+  coll_t c("c");
+  hobject_t oid = make_oid("a", 1);
+  ASSERT_FALSE(cache.lookup(c, oid));
+
+  int fd = open_fd();
+  {
+    FDRef ref = cache.add(c, oid, fd, cache.get_ticket(oid));
+    ASSERT_EQ(fd, **ref);
+  }
+  FDRef hit = cache.lookup(c, oid);
+  ASSERT_TRUE(hit);
+  ASSERT_EQ(fd, **hit);
+
+  // same object in another collection is a different entry
+  ASSERT_FALSE(cache.lookup(coll_t("d"), oid));
+}
+
+TEST(FDCache, Clear) {
+  FDCache cache(16, 4);
+  coll_t c("c");
+  hobject_t oid = make_oid("a", 1);
+  int fd = open_fd();
+  FDRef held = cache.add(c, oid, fd, cache.get_ticket(oid));
+
+  // holders keep a usable fd; new lookups miss
+  cache.clear(c, oid);
+  ASSERT_FALSE(cache.lookup(c, oid));
+  ASSERT_TRUE(fd_is_open(fd));
+
+  // a new entry under the same name survives the old one going away
+  int fd2 = open_fd();
+  cache.add(c, oid, fd2, cache.get_ticket(oid));
+  held.reset();
+  ASSERT_FALSE(fd_is_open(fd));
+  FDRef hit = cache.lookup(c, oid);
+  ASSERT_TRUE(hit);
+  ASSERT_EQ(fd2, **hit);
+
+  hit.reset();
+  cache.clear();
+  ASSERT_FALSE(cache.lookup(c, oid));
+  ASSERT_FALSE(fd_is_open(fd2));
+}
+
+TEST(FDCache, Ticket) {
+  FDCache cache(16, 4);
+  coll_t c("c");
+  hobject_t oid = make_oid("a", 1);
+
+  // an open that raced with an unlink gets its fd, but doesn't cache it
+  uint64_t ticket = cache.get_ticket(oid);
+  cache.clear(c, oid);
+  int fd = open_fd();
+  {
+    FDRef ref = cache.add(c, oid, fd, ticket);
+    ASSERT_EQ(fd, **ref);
+    ASSERT_FALSE(cache.lookup(c, oid));
+  }
+  ASSERT_FALSE(fd_is_open(fd));
+
+  // a fresh ticket works again
+  fd = open_fd();
+  cache.add(c, oid, fd, cache.get_ticket(oid));
+  ASSERT_TRUE(cache.lookup(c, oid));
+}
+
+TEST(FDCache, Evict) {
+  // one shard so the lru order is easy to reason about
+  FDCache cache(2, 1);
+  coll_t c("c");
+  int fds[3];
+  for (int i = 0; i < 3; i++) {
+    char name[10];
+    snprintf(name, sizeof(name), "o%d", i);
+    fds[i] = open_fd();
+    hobject_t oid = make_oid(name, i);
+    cache.add(c, oid, fds[i], cache.get_ticket(oid));
+  }
+  // the oldest one fell out and, since no one holds it, got closed
+  ASSERT_FALSE(fd_is_open(fds[0]));
+  ASSERT_FALSE(cache.lookup(c, make_oid("o0", 0)));
+  ASSERT_TRUE(fd_is_open(fds[1]));
+  ASSERT_TRUE(fd_is_open(fds[2]));
+
+  cache.set_size(0);
+  ASSERT_FALSE(fd_is_open(fds[1]));
+  ASSERT_FALSE(fd_is_open(fds[2]));
+}
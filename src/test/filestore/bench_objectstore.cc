@@ -0,0 +1,453 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "include/types.h"
+#include "include/Context.h"
+#include "common/Clock.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/errno.h"
+#include "common/config.h"
+#include "common/ceph_argparse.h"
+#include "common/Thread.h"
+#include "include/str_list.h"
+#include "global/global_init.h"
+#include "os/FileStore.h"
+#include "test/common/LatencyStats.h"
+
+/*
+ * Runs client-write shaped transactions through a fresh FileStore and its
+ * journal, with no OSD or network, and reports throughput and commit
+ * (journal) and apply (readable) latency.
+ *
+ * Each transaction is what ReplicatedPG queues for a write: the data, the
+ * object_info and snapset attrs, a pg log entry, and the pg info.  Each
+ * simulated pg has its own collection and Sequencer, and transactions go
+ * round robin across them.  The store is in osd_data with its journal at
+ * osd_journal, as for the OSD, and is re-created by every run.
+ *
+ * Then, for each --load-threads count, it remounts the store and times
+ * reading back every pg's info and log with that many threads, as the
+ * OSD does at startup (a cold start with --drop-caches).
+ */
+
+static void usage()
+{
+  cout << "usage: bench_objectstore --osd-data dir --osd-journal file [options]\n"
+       << "  --sequencers n     pgs, each with its own collection and sequencer (default 8)\n"
+       << "  --objects n        objects per pg (default 1024)\n"
+       << "  --object-size n    bytes; writes land at random aligned offsets (default 4M)\n"
+       << "  --write-size n     bytes per write (default 4096)\n"
+       << "  --in-flight n      transactions queued at once, over all pgs (default 64)\n"
+       << "  --ops n            transactions to run (default 10000)\n"
+       << "  --duration secs    stop earlier after this long (default 0, no limit)\n"
+       << "  --log omap|append  pg log entries and info as omap keys, as the OSD keeps\n"
+       << "                     them, or the log appended to the log object and the\n"
+       << "                     info in a file, as older OSDs did (default omap)\n"
+       << "  --load-threads n,n...  after writing, time loading the pgs back with this\n"
+       << "                     many threads, remounting before each (default 1,4)\n"
+       << "  --drop-caches      drop the page cache before each load (needs root)\n"
+       << "  --seed n           random seed (default 0)\n";
+}
+
+class Bench;
+
+/// one transaction in flight
+struct Op {
+  Bench *bench;
+  ObjectStore::Transaction *t;
+  utime_t start;
+  bool committed, applied;
+  Op(Bench *b, ObjectStore::Transaction *t, utime_t start)
+    : bench(b), t(t), start(start), committed(false), applied(false) {}
+};
+
+/// a simulated pg
+struct Shard {
+  coll_t coll;
+  hobject_t log_oid, biginfo_oid;
+  ObjectStore::Sequencer osr;
+  uint64_t version;
+  uint64_t log_head;  ///< --log append: end of the log object
+  Shard(const string &name)
+    : coll(name + "_head"),
+      log_oid(sobject_t(object_t("pglog_" + name), 0)),
+      biginfo_oid(sobject_t(object_t("pginfo_" + name), 0)),
+      osr(name), version(0), log_head(0) {}
+};
+
+class Bench {
+  ObjectStore *store;
+  vector<Shard*> shards;
+  unsigned objects;
+  uint64_t object_size, write_size;
+  bool omap_log;
+  bufferlist data, oi, snapset, entry, info;
+
+  Mutex lock;
+  Cond cond;
+  unsigned in_flight;
+  LatencyStats commit_lat, apply_lat;
+
+  void finish(Op *op) {
+    assert(lock.is_locked());
+    if (!op->committed || !op->applied)
+      return;
+    delete op->t;
+    delete op;
+    --in_flight;
+    cond.Signal();
+  }
+
+public:
+  uint64_t bytes;
+
+  Bench(ObjectStore *store, unsigned sequencers, unsigned objects,
+	uint64_t object_size, uint64_t write_size, bool omap_log)
+    : store(store), objects(objects), object_size(object_size),
+      write_size(write_size), omap_log(omap_log),
+      lock("Bench::lock"), in_flight(0), bytes(0), next_load(0) {
+    for (unsigned i = 0; i < sequencers; ++i) {
+      char name[20];
+      snprintf(name, sizeof(name), "0.%x", i);
+      shards.push_back(new Shard(name));
+    }
+    bufferptr bp = buffer::create_page_aligned(write_size);
+    memset(bp.c_str(), 0xa5, bp.length());
+    data.append(bp);
+    oi.append(string(230, 'o'));       // a typical encoded object_info_t
+    snapset.append(string(30, 's'));
+    entry.append(string(150, 'e'));    // pg_log_entry_t
+    info.append(string(300, 'i'));     // pg_info_t (and past intervals)
+  }
+  ~Bench() {
+    for (vector<Shard*>::iterator i = shards.begin(); i != shards.end(); ++i)
+      delete *i;
+  }
+
+  void setup() {
+    ObjectStore::Transaction t;
+    t.create_collection(coll_t::META_COLL);
+    for (vector<Shard*>::iterator i = shards.begin(); i != shards.end(); ++i) {
+      t.create_collection((*i)->coll);
+      t.touch(coll_t::META_COLL, (*i)->log_oid);
+      t.touch(coll_t::META_COLL, (*i)->biginfo_oid);
+      if (omap_log) {
+	// past intervals and snap collections, which rarely change
+	bufferlist infobl;
+	__u8 struct_v = 5;
+	::encode(struct_v, infobl);
+	t.collection_setattr((*i)->coll, "info", infobl);
+	t.write(coll_t::META_COLL, (*i)->biginfo_oid, 0, info.length(), info);
+      }
+    }
+    int r = store->apply_transaction(t);
+    assert(r == 0);
+  }
+
+  /// what ReplicatedPG and PG queue for a client write
+  ObjectStore::Transaction *build(Shard *s) {
+    ObjectStore::Transaction *t = new ObjectStore::Transaction;
+    unsigned n = rand() % objects;
+    char name[40];
+    snprintf(name, sizeof(name), "rb.0.%s.%012x", s->coll.c_str(), n);
+    hobject_t oid(object_t(name), "", CEPH_NOSNAP, n * 2654435761u, 0);
+    uint64_t off = 0;
+    if (object_size > write_size)
+      off = (rand() % (object_size / write_size)) * write_size;
+
+    t->write(s->coll, oid, off, data.length(), data);
+    t->setattr(s->coll, oid, "_", oi);
+    t->setattr(s->coll, oid, "snapset", snapset);
+
+    ++s->version;
+    if (omap_log) {
+      map<string, bufferlist> keys;
+      char key[40];
+      snprintf(key, sizeof(key), "%010u.%020llu", 1,
+	       (unsigned long long)s->version);
+      keys[key] = entry;
+      t->omap_setkeys(coll_t::META_COLL, s->log_oid, keys);
+      keys.clear();
+      keys["info"] = info;
+      t->omap_setkeys(coll_t::META_COLL, s->biginfo_oid, keys);
+    } else {
+      t->write(coll_t::META_COLL, s->log_oid, s->log_head, entry.length(),
+	       entry);
+      s->log_head += entry.length();
+      bufferlist ondisklog;
+      ::encode(s->log_head, ondisklog);
+      t->collection_setattr(s->coll, "ondisklog", ondisklog);
+
+      bufferlist infobl;
+      __u8 struct_v = 4;
+      ::encode(struct_v, infobl);
+      t->collection_setattr(s->coll, "info", infobl);
+      t->truncate(coll_t::META_COLL, s->biginfo_oid, 0);
+      t->write(coll_t::META_COLL, s->biginfo_oid, 0, info.length(), info);
+    }
+    bytes += data.length();
+    return t;
+  }
+
+  struct C_Committed : public Context {
+    Op *op;
+    C_Committed(Op *op) : op(op) {}
+    void finish(int r) {
+      op->bench->committed(op);
+    }
+  };
+  struct C_Applied : public Context {
+    Op *op;
+    C_Applied(Op *op) : op(op) {}
+    void finish(int r) {
+      op->bench->applied(op);
+    }
+  };
+
+  void committed(Op *op) {
+    Mutex::Locker l(lock);
+    commit_lat.add(ceph_clock_now(g_ceph_context) - op->start);
+    op->committed = true;
+    finish(op);
+  }
+  void applied(Op *op) {
+    Mutex::Locker l(lock);
+    apply_lat.add(ceph_clock_now(g_ceph_context) - op->start);
+    op->applied = true;
+    finish(op);
+  }
+
+  /// @return seconds taken
+  double run(unsigned ops, double duration, unsigned max_in_flight) {
+    utime_t start = ceph_clock_now(g_ceph_context);
+    utime_t until = start;
+    until += duration;
+    unsigned next = 0;
+    for (unsigned i = 0; i < ops; ++i) {
+      {
+	Mutex::Locker l(lock);
+	while (in_flight >= max_in_flight)
+	  cond.Wait(lock);
+	++in_flight;
+      }
+      Shard *s = shards[next++ % shards.size()];
+      ObjectStore::Transaction *t = build(s);
+      Op *op = new Op(this, t, ceph_clock_now(g_ceph_context));
+      store->queue_transaction(&s->osr, t, new C_Applied(op),
+			       new C_Committed(op));
+      if (duration > 0 && ceph_clock_now(g_ceph_context) > until)
+	break;
+    }
+    Mutex::Locker l(lock);
+    while (in_flight)
+      cond.Wait(lock);
+    return ceph_clock_now(g_ceph_context) - start;
+  }
+
+  /// read what PG::read_state does for one pg
+  void load(Shard *s) {
+    bufferlist bl;
+    store->collection_getattr(s->coll, "info", bl);
+    bl.clear();
+    store->read(coll_t::META_COLL, s->biginfo_oid, 0, 0, bl);
+    if (omap_log) {
+      set<string> keys;
+      keys.insert("info");
+      map<string, bufferlist> values;
+      store->omap_get_values(coll_t::META_COLL, s->biginfo_oid, keys, &values);
+      ObjectMap::ObjectMapIterator p =
+	store->get_omap_iterator(coll_t::META_COLL, s->log_oid);
+      for (p->seek_to_first(); p->valid(); p->next())
+	p->value();
+    } else {
+      bl.clear();
+      store->collection_getattr(s->coll, "ondisklog", bl);
+      bl.clear();
+      store->read(coll_t::META_COLL, s->log_oid, 0, 0, bl);
+    }
+  }
+
+  struct LoadThread : public Thread {
+    Bench *bench;
+    LoadThread(Bench *b) : bench(b) {}
+    void *entry() {
+      bench->load_some();
+      return 0;
+    }
+  };
+  unsigned next_load;
+
+  void load_some() {
+    while (true) {
+      Shard *s;
+      {
+	Mutex::Locker l(lock);
+	if (next_load == shards.size())
+	  return;
+	s = shards[next_load++];
+      }
+      load(s);
+    }
+  }
+
+  /// @return seconds to load every pg with nthreads
+  double load_all(unsigned nthreads) {
+    utime_t start = ceph_clock_now(g_ceph_context);
+    next_load = 0;
+    vector<LoadThread*> threads;
+    for (unsigned i = 0; i < nthreads; ++i) {
+      threads.push_back(new LoadThread(this));
+      threads.back()->create();
+    }
+    for (vector<LoadThread*>::iterator i = threads.begin(); i != threads.end(); ++i) {
+      (*i)->join();
+      delete *i;
+    }
+    return ceph_clock_now(g_ceph_context) - start;
+  }
+
+  void dump(ostream &out, double elapsed) {
+    out << commit_lat.count() << " transactions in " << elapsed << " s: "
+	<< (unsigned)(commit_lat.count() / elapsed) << " txn/s, "
+	<< (bytes / elapsed / 1048576) << " MB/s written" << std::endl;
+    LatencyStats::dump_header(out);
+    commit_lat.dump(out, "commit", elapsed);
+    apply_lat.dump(out, "apply", elapsed);
+  }
+};
+
+static void drop_page_cache()
+{
+  ::sync();
+  int fd = ::open("/proc/sys/vm/drop_caches", O_WRONLY);
+  if (fd < 0 || ::write(fd, "3\n", 2) != 2)
+    cerr << "could not drop caches: " << cpp_strerror(errno) << std::endl;
+  if (fd >= 0)
+    ::close(fd);
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_OSD, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  int sequencers = 8, objects = 1024, in_flight = 64, ops = 10000, seed = 0;
+  long long object_size = 4 << 20, write_size = 4096;
+  float duration = 0;
+  string log = "omap", load_threads = "1,4";
+  bool drop_caches = false;
+  std::ostringstream err;
+  for (std::vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage();
+      return 0;
+    } else if (ceph_argparse_withint(args, i, &sequencers, &err, "--sequencers", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &objects, &err, "--objects", (char*)NULL)) {
+    } else if (ceph_argparse_withlonglong(args, i, &object_size, &err, "--object-size", (char*)NULL)) {
+    } else if (ceph_argparse_withlonglong(args, i, &write_size, &err, "--write-size", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &in_flight, &err, "--in-flight", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &ops, &err, "--ops", (char*)NULL)) {
+    } else if (ceph_argparse_withfloat(args, i, &duration, &err, "--duration", (char*)NULL)) {
+    } else if (ceph_argparse_witharg(args, i, &log, "--log", (char*)NULL)) {
+    } else if (ceph_argparse_witharg(args, i, &load_threads, "--load-threads", (char*)NULL)) {
+    } else if (ceph_argparse_flag(args, i, "--drop-caches", (char*)NULL)) {
+      drop_caches = true;
+    } else if (ceph_argparse_withint(args, i, &seed, &err, "--seed", (char*)NULL)) {
+    } else {
+      cerr << "unrecognized argument " << *i << std::endl;
+      usage();
+      return 1;
+    }
+    if (!err.str().empty()) {
+      cerr << err.str() << std::endl;
+      return 1;
+    }
+  }
+  if (sequencers < 1 || objects < 1 || in_flight < 1 || write_size < 1 ||
+      object_size < write_size) {
+    cerr << "sizes and counts must be positive, and writes fit in objects"
+	 << std::endl;
+    return 1;
+  }
+  if (log != "omap" && log != "append") {
+    cerr << "--log must be omap or append" << std::endl;
+    return 1;
+  }
+  if (g_conf->osd_data.empty() || g_conf->osd_journal.empty()) {
+    usage();
+    return 1;
+  }
+  srand(seed);
+
+  cout << "data " << g_conf->osd_data << ", journal " << g_conf->osd_journal
+       << ": " << sequencers << " pgs, " << in_flight << " in flight, "
+       << write_size << " byte writes, pg log by " << log << std::endl;
+
+  ::mkdir(g_conf->osd_data.c_str(), 0755);
+  FileStore *store = new FileStore(g_conf->osd_data, g_conf->osd_journal);
+  int r = store->mkfs();
+  if (r < 0) {
+    cerr << "mkfs failed: " << cpp_strerror(r) << std::endl;
+    return 1;
+  }
+  r = store->mount();
+  if (r < 0) {
+    cerr << "mount failed: " << cpp_strerror(r) << std::endl;
+    return 1;
+  }
+
+  {
+    Bench bench(store, sequencers, objects, object_size, write_size,
+		log == "omap");
+    bench.setup();
+    double elapsed = bench.run(ops, duration, in_flight);
+    bench.dump(cout, elapsed);
+
+    list<string> counts;
+    get_str_list(load_threads, counts);
+    for (list<string>::iterator i = counts.begin(); i != counts.end(); ++i) {
+      int n = atoi(i->c_str());
+      if (n < 1)
+	continue;
+      store->umount();
+      if (drop_caches)
+	drop_page_cache();
+      r = store->mount();
+      if (r < 0) {
+	cerr << "mount failed: " << cpp_strerror(r) << std::endl;
+	return 1;
+      }
+      double t = bench.load_all(n);
+      cout << "load " << sequencers << " pgs with " << n << " threads: "
+	   << t << " s" << std::endl;
+    }
+  }
+
+  store->umount();
+  delete store;
+  return 0;
+}
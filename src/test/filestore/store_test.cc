@@ -16,7 +16,10 @@
 #include <string.h>
 #include <iostream>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "os/FileStore.h"
+#include "os/HashIndex.h"
 #include "include/Context.h"
 #include "common/ceph_argparse.h"
 #include "global/global_init.h"
@@ -243,6 +246,145 @@ TEST_F(StoreTest, ManyObjectTest) {
   }
 }
 
+TEST_F(StoreTest, PreSplitTest) {
+  int NUM_OBJS = 1000;
+  int r = 0;
+  coll_t cid("presplit");
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    t.collection_expected_objects(cid, 100000);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  set<hobject_t> created;
+  for (int i = 0; i < NUM_OBJS; ++i) {
+    ObjectStore::Transaction t;
+    char buf[100];
+    snprintf(buf, sizeof(buf), "presplit_%d", i);
+    hobject_t hoid(sobject_t(string(buf), CEPH_NOSNAP));
+    t.touch(cid, hoid);
+    created.insert(hoid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+
+  vector<hobject_t> objects;
+  r = store->collection_list(cid, objects);
+  ASSERT_EQ(r, 0);
+  ASSERT_EQ(created.size(), objects.size());
+  for (vector<hobject_t>::iterator i = objects.begin(); i != objects.end(); ++i)
+    ASSERT_TRUE(created.count(*i));
+
+  // 100000 objects at 320 per directory takes three levels
+  struct stat st;
+  const char *leaves[] = {
+    "store_test_temp_dir/current/presplit/DIR_0/DIR_0/DIR_0",
+    "store_test_temp_dir/current/presplit/DIR_F/DIR_F/DIR_F",
+    "store_test_temp_dir/current/presplit/DIR_7/DIR_A/DIR_3"
+  };
+  for (unsigned i = 0; i < sizeof(leaves) / sizeof(leaves[0]); ++i)
+    ASSERT_EQ(0, ::stat(leaves[i], &st)) << leaves[i];
+
+  // nearly empty, but the pre-split tree is not merged away
+  for (set<hobject_t>::iterator i = created.begin(); i != created.end(); ++i) {
+    ObjectStore::Transaction t;
+    t.remove(cid, *i);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  for (unsigned i = 0; i < sizeof(leaves) / sizeof(leaves[0]); ++i)
+    ASSERT_EQ(0, ::stat(leaves[i], &st)) << leaves[i];
+
+  // and doesn't get in the way of removing the collection
+  {
+    ObjectStore::Transaction t;
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_FALSE(store->collection_exists(cid));
+}
+
+struct TestSplitQueue : public HashIndexSplitQueue {
+  list<vector<string> > queued;
+  void queue_split(coll_t c, const string &base_path,
+		   const vector<string> &path) {
+    queued.push_back(path);
+  }
+};
+
+static void create_indexed(Index index, const hobject_t &hoid)
+{
+  IndexedPath path;
+  int exists;
+  ASSERT_EQ(0, index->lookup(hoid, &path, &exists));
+  ASSERT_EQ(0, exists);
+  int fd = ::open(path->path(), O_CREAT|O_WRONLY, 0644);
+  ASSERT_LE(0, fd);
+  ::close(fd);
+  ASSERT_EQ(0, index->created(hoid, path->path()));
+}
+
+static void check_indexed(Index index, const hobject_t &hoid)
+{
+  IndexedPath path;
+  int exists;
+  ASSERT_EQ(0, index->lookup(hoid, &path, &exists));
+  ASSERT_EQ(1, exists);
+  struct stat st;
+  ASSERT_EQ(0, ::stat(path->path(), &st)) << path->path();
+}
+
+TEST(HashIndexTest, PartialSplit) {
+  // objects stay where lookup finds them at every step of a split
+  const char *dir = "hashindex_split_temp_dir";
+  ::mkdir(dir, 0777);
+  TestSplitQueue queue;
+  coll_t cid("split");
+  // splits past 16 objects, merges only empty directories
+  Index index(new HashIndex(cid, dir, 1, 1,
+			    CollectionIndex::HOBJECT_WITH_POOL, &queue));
+  index->set_ref(index);
+  ASSERT_EQ(0, index->init());
+
+  vector<hobject_t> objs;
+  for (int i = 0; i < 40; ++i) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "split_%d", i);
+    objs.push_back(hobject_t(object_t(buf), "", CEPH_NOSNAP, i, 0));
+    create_indexed(index, objs.back());
+  }
+  ASSERT_FALSE(queue.queued.empty());
+  vector<string> path = queue.queued.front();
+  ASSERT_TRUE(path.empty());  // the root
+  HashIndex *hindex = static_cast<HashIndex*>(index.get());
+
+  bool done = false;
+  ASSERT_EQ(0, hindex->split_step(path, &done));
+  ASSERT_FALSE(done);
+  for (unsigned i = 0; i < objs.size(); ++i)
+    check_indexed(index, objs[i]);
+  for (int i = 40; i < 50; ++i) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "split_%d", i);
+    objs.push_back(hobject_t(object_t(buf), "", CEPH_NOSNAP, i, 0));
+    create_indexed(index, objs.back());
+    check_indexed(index, objs.back());
+  }
+
+  while (!done)
+    ASSERT_EQ(0, hindex->split_step(path, &done));
+  for (unsigned i = 0; i < objs.size(); ++i)
+    check_indexed(index, objs[i]);
+  vector<hobject_t> ls;
+  ASSERT_EQ(0, index->collection_list(&ls));
+  ASSERT_EQ(objs.size(), ls.size());
+
+  for (unsigned i = 0; i < objs.size(); ++i)
+    ASSERT_EQ(0, index->unlink(objs[i]));
+}
+
 class ObjectGenerator {
 public:
   virtual hobject_t create_object(gen_type *gen) = 0;
@@ -480,6 +622,68 @@ TEST_F(StoreTest, Synthetic) {
   test_obj.wait_for_done();
 }
 
+TEST_F(StoreTest, ManySequencers) {
+  // sequencers apply in parallel, round robin; each must still apply its
+  // own ops in order.
+  const int num_osr = 8, num_ops = 50;
+  vector<ObjectStore::Sequencer*> osrs;
+  vector<coll_t> cids;
+  hobject_t hoid("obj", "", CEPH_NOSNAP, 0, 0);
+  for (int i = 0; i < num_osr; ++i) {
+    ostringstream ss;
+    ss << "osr_" << i;
+    osrs.push_back(new ObjectStore::Sequencer(ss.str()));
+    cids.push_back(coll_t(ss.str()));
+    ObjectStore::Transaction t;
+    t.create_collection(cids[i]);
+    ASSERT_EQ(0u, store->apply_transaction(t));
+  }
+  for (int j = 0; j < num_ops; ++j) {
+    for (int i = 0; i < num_osr; ++i) {
+      ObjectStore::Transaction *t = new ObjectStore::Transaction;
+      bufferlist bl;
+      ::encode(j, bl);
+      t->write(cids[i], hoid, 0, bl.length(), bl);
+      store->queue_transaction(osrs[i], t);
+    }
+  }
+  for (int i = 0; i < num_osr; ++i) {
+    osrs[i]->flush();
+    bufferlist bl;
+    ASSERT_EQ(4, store->read(cids[i], hoid, 0, 4, bl));
+    int last;
+    bufferlist::iterator p = bl.begin();
+    ::decode(last, p);
+    ASSERT_EQ(num_ops - 1, last);
+
+    ObjectStore::Transaction t;
+    t.remove(cids[i], hoid);
+    t.remove_collection(cids[i]);
+    ASSERT_EQ(0u, store->apply_transaction(t));
+    delete osrs[i];
+  }
+}
+
+TEST_F(StoreTest, SequencerOutlivesStore) {
+  // like OSD::shutdown, which puts its PGs after deleting the store
+  ObjectStore::Sequencer *osr = new ObjectStore::Sequencer("outlive");
+  coll_t cid("outlive");
+  {
+    ObjectStore::Transaction *t = new ObjectStore::Transaction;
+    t->create_collection(cid);
+    store->queue_transaction(osr, t);
+    osr->flush();
+  }
+  store->umount();
+  store.reset(new FileStore(string("store_test_temp_dir"), string("store_test_temp_journal")));
+  delete osr;
+  store->mount();
+
+  ObjectStore::Transaction t;
+  t.remove_collection(cid);
+  ASSERT_EQ(0u, store->apply_transaction(t));
+}
+
 TEST_F(StoreTest, HashCollisionTest) {
   coll_t cid("blah");
   int r;
@@ -33,6 +33,7 @@
 #include <inttypes.h>
 #include <map>
 #include <poll.h>
+#include <pthread.h>
 #include <sstream>
 #include <stdint.h>
 #include <string.h>
@@ -51,6 +52,7 @@ int main(int argc, char **argv) {
   std::vector<const char *> preargs;
   preargs.push_back("--admin-socket");
   preargs.push_back(get_rand_socket_path());
+  preargs.push_back("--perf-buffer-pool=false");
   std::vector<const char*> args;
   global_init(&preargs, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY,
 	      CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
@@ -116,6 +118,11 @@ TEST(PerfCounters, SinglePerfCounters) {
   ASSERT_EQ("", client.do_request("perfcounters_dump", &msg));
   ASSERT_EQ(sd("{'test_perfcounter_1':{'element1':1,'element2':0.5,"
 	    "'element3':{'avgcount':3,'sum':125}}}"), msg);
+  uint64_t count;
+  ASSERT_EQ(125.0, fake_pf->fget(TEST_PERFCOUNTERS1_ELEMENT_3, &count));
+  ASSERT_EQ(3u, count);
+  ASSERT_EQ(0.5, fake_pf->fget(TEST_PERFCOUNTERS1_ELEMENT_2, &count));
+  ASSERT_EQ(0u, count);
 }
 
 enum {
@@ -165,3 +172,102 @@ TEST(PerfCounters, MultiplePerfCounters) {
   ASSERT_EQ("", client.do_request("perfcounters_dump", &msg));
   ASSERT_EQ("{}", msg);
 }
+
+enum {
+  TEST_PERFCOUNTERS3_ELEMENT_FIRST = 600,
+  TEST_PERFCOUNTERS3_ELEMENT_COUNT,
+  TEST_PERFCOUNTERS3_ELEMENT_AVG,
+  TEST_PERFCOUNTERS3_ELEMENT_HIST,
+  TEST_PERFCOUNTERS3_ELEMENT_HIST2D,
+  TEST_PERFCOUNTERS3_ELEMENT_LAST,
+};
+
+static PerfCounters* setup_test_perfcounter3(CephContext *cct)
+{
+  PerfCountersBuilder bld(cct, "test_perfcounter_3",
+	  TEST_PERFCOUNTERS3_ELEMENT_FIRST, TEST_PERFCOUNTERS3_ELEMENT_LAST);
+  bld.add_u64_counter(TEST_PERFCOUNTERS3_ELEMENT_COUNT, "count");
+  bld.add_fl_avg(TEST_PERFCOUNTERS3_ELEMENT_AVG, "avg");
+  bld.add_histogram(TEST_PERFCOUNTERS3_ELEMENT_HIST, "hist", 6);
+  bld.add_histogram(TEST_PERFCOUNTERS3_ELEMENT_HIST2D, "hist2d", 3, 2);
+  return bld.create_perf_counters();
+}
+
+TEST(PerfCounters, Histogram) {
+  PerfCountersCollection *coll = g_ceph_context->get_perfcounters_collection();
+  coll->clear();
+  PerfCounters* pf = setup_test_perfcounter3(g_ceph_context);
+  coll->add(pf);
+  AdminSocketClient client(get_rand_socket_path());
+  std::string msg;
+
+  ASSERT_EQ("", client.do_request("perfcounters_dump", &msg));
+  ASSERT_EQ(sd("{'test_perfcounter_3':{'count':0,'avg':{'avgcount':0,'sum':0},"
+	       "'hist':{'count':0,'p50':0,'p99':0,'p999':0,'buckets':[0,0,0,0,0,0]},"
+	       "'hist2d':{'count':0,'p50':0,'p99':0,'p999':0,'buckets':[[0,0,0],[0,0,0]]}}}"),
+	    msg);
+
+  // 0 -> 0, 1 -> 1, [2,4) -> 2, [4,8) -> 3, ..., big -> last
+  for (int i = 0; i < 98; i++)
+    pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, 3);
+  pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, 0);
+  pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, 1000);
+  ASSERT_EQ(1u, pf->hget(TEST_PERFCOUNTERS3_ELEMENT_HIST, 0));
+  ASSERT_EQ(98u, pf->hget(TEST_PERFCOUNTERS3_ELEMENT_HIST, 2));
+  ASSERT_EQ(1u, pf->hget(TEST_PERFCOUNTERS3_ELEMENT_HIST, 5));
+
+  pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST2D, 1, 0);
+  pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST2D, 2, 1);
+  pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST2D, 100, 100);
+
+  // hinc on something that isn't a histogram is ignored
+  pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_COUNT, 1);
+
+  ASSERT_EQ("", client.do_request("perfcounters_dump", &msg));
+  ASSERT_EQ(sd("{'test_perfcounter_3':{'count':0,'avg':{'avgcount':0,'sum':0},"
+	       "'hist':{'count':100,'p50':3,'p99':3,'p999':-1,'buckets':[1,0,98,0,0,1]},"
+	       "'hist2d':{'count':3,'p50':-1,'p99':-1,'p999':-1,'buckets':[[0,1,0],[0,0,2]]}}}"),
+	    msg);
+  ASSERT_EQ("", client.do_request("perfcounters_schema", &msg));
+  ASSERT_EQ(sd("{'test_perfcounter_3':{'count':{'type':10},'avg':{'type':5},"
+	       "'hist':{'type':16},'hist2d':{'type':16}}}"), msg);
+  coll->clear();
+  delete pf;
+}
+
+static const int THREAD_INCS = 100000;
+
+static void *inc_thread_entry(void *arg)
+{
+  PerfCounters *pf = (PerfCounters *)arg;
+  for (int i = 0; i < THREAD_INCS; i++) {
+    pf->inc(TEST_PERFCOUNTERS3_ELEMENT_COUNT);
+    pf->finc(TEST_PERFCOUNTERS3_ELEMENT_AVG, 0.5);
+    pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, i & 7);
+  }
+  return NULL;
+}
+
+TEST(PerfCounters, ConcurrentUpdates) {
+  PerfCounters* pf = setup_test_perfcounter3(g_ceph_context);
+  const int nthreads = 12;  // more than there are stripes
+  pthread_t threads[nthreads];
+  for (int i = 0; i < nthreads; i++)
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, inc_thread_entry, pf));
+  for (int i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  uint64_t total = (uint64_t)nthreads * THREAD_INCS;
+  ASSERT_EQ(total, pf->get(TEST_PERFCOUNTERS3_ELEMENT_COUNT));
+  ASSERT_EQ(0.5 * total, pf->fget(TEST_PERFCOUNTERS3_ELEMENT_AVG));
+  uint64_t hist_total = 0;
+  for (unsigned b = 0; b < 6; b++)
+    hist_total += pf->hget(TEST_PERFCOUNTERS3_ELEMENT_HIST, b);
+  ASSERT_EQ(total, hist_total);
+  ASSERT_EQ(total / 8, pf->hget(TEST_PERFCOUNTERS3_ELEMENT_HIST, 0));
+
+  // set() replaces whatever the stripes had summed to
+  pf->set(TEST_PERFCOUNTERS3_ELEMENT_COUNT, 7);
+  ASSERT_EQ(7u, pf->get(TEST_PERFCOUNTERS3_ELEMENT_COUNT));
+  delete pf;
+}
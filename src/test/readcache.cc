@@ -0,0 +1,156 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "os/ReadCache.h"
+#include "test/unit.h"
+
+static hobject_t make_oid(const char *name, uint32_t hash)
+{
+  return hobject_t(object_t(name), "", CEPH_NOSNAP, hash, 0);
+}
+
+static bufferptr make_bp(const char *s)
+{
+  return bufferptr(s, strlen(s));
+}
+
+static string get(ReadCache &cache, coll_t c, const hobject_t& oid,
+		  uint64_t off, size_t len)
+{
+  bufferlist bl;
+  if (!cache.lookup(c, oid, off, len, &bl))
+    return "<miss>";
+  return string(bl.c_str(), bl.length());
+}
+
+TEST(ReadCache, AddLookup) {
+  ReadCache cache(1024, 4);
+  coll_t c("c");
+  hobject_t oid = make_oid("a", 1);
+  ASSERT_EQ("<miss>", get(cache, c, oid, 0, 4));
+
+  cache.add(c, oid, 10, make_bp("0123456789"), false, cache.get_ticket(oid));
+  ASSERT_EQ("0123456789", get(cache, c, oid, 10, 10));
+  ASSERT_EQ("345", get(cache, c, oid, 13, 3));
+  ASSERT_EQ("<miss>", get(cache, c, oid, 9, 2));
+  ASSERT_EQ("<miss>", get(cache, c, oid, 15, 10));   // past what we read
+  ASSERT_EQ("<miss>", get(cache, c, oid, 10, 0));    // to eof: unknown
+  ASSERT_EQ("<miss>", get(cache, coll_t("d"), oid, 10, 10));
+
+  // the cache keeps its own copy
+  bufferptr bp = make_bp("abc");
+  cache.add(c, oid, 100, bp, false, cache.get_ticket(oid));
+  bp.c_str()[0] = 'X';
+  ASSERT_EQ("abc", get(cache, c, oid, 100, 3));
+}
+
+TEST(ReadCache, Eof) {
+  ReadCache cache(1024, 4);
+  coll_t c("c");
+  hobject_t oid = make_oid("a", 1);
+
+  // a read of 0~100 came back short: the object is 5 bytes
+  cache.add(c, oid, 0, make_bp("hello"), true, cache.get_ticket(oid));
+  ASSERT_EQ("hello", get(cache, c, oid, 0, 100));
+  ASSERT_EQ("hello", get(cache, c, oid, 0, 0));
+  ASSERT_EQ("llo", get(cache, c, oid, 2, 0));
+  ASSERT_EQ("", get(cache, c, oid, 5, 10));
+  ASSERT_EQ("<miss>", get(cache, c, oid, 6, 10));
+
+  // so did a read past the end of another object
+  hobject_t oid2 = make_oid("b", 2);
+  cache.add(c, oid2, 4096, bufferptr(), true, cache.get_ticket(oid2));
+  ASSERT_EQ("", get(cache, c, oid2, 4096, 10));
+  ASSERT_EQ("<miss>", get(cache, c, oid2, 0, 10));
+}
+
+TEST(ReadCache, Overlap) {
+  ReadCache cache(1024, 1);
+  coll_t c("c");
+  hobject_t oid = make_oid("a", 1);
+
+  cache.add(c, oid, 0, make_bp("aaaa"), false, cache.get_ticket(oid));
+  cache.add(c, oid, 8, make_bp("bbbb"), false, cache.get_ticket(oid));
+  cache.add(c, oid, 16, make_bp("cccc"), false, cache.get_ticket(oid));
+
+  // a new extent replaces those it overlaps, and only those
+  cache.add(c, oid, 2, make_bp("xxxxxxxx"), false, cache.get_ticket(oid));
+  ASSERT_EQ("<miss>", get(cache, c, oid, 0, 2));
+  ASSERT_EQ("xxxxxxxx", get(cache, c, oid, 2, 8));
+  ASSERT_EQ("<miss>", get(cache, c, oid, 8, 4));
+  ASSERT_EQ("cccc", get(cache, c, oid, 16, 4));
+}
+
+TEST(ReadCache, StaleTicket) {
+  ReadCache cache(1024, 4);
+  coll_t c("c");
+  hobject_t oid = make_oid("a", 1);
+
+  // a reader misses and goes to disk, while a writer changes the data
+  uint64_t t = cache.get_ticket(oid);
+  cache.clear(oid);
+  cache.add(c, oid, 0, make_bp("old"), false, t);
+  ASSERT_EQ("<miss>", get(cache, c, oid, 0, 3));
+}
+
+TEST(ReadCache, Links) {
+  ReadCache cache(1024, 4);
+  coll_t c("c"), d("d");
+  hobject_t oid = make_oid("a", 1);
+
+  cache.add(c, oid, 0, make_bp("data"), false, cache.get_ticket(oid));
+  cache.add(d, oid, 0, make_bp("data"), false, cache.get_ticket(oid));
+  ASSERT_EQ("data", get(cache, d, oid, 0, 4));
+
+  // a write through either link clears both
+  cache.clear(oid);
+  ASSERT_EQ("<miss>", get(cache, c, oid, 0, 4));
+  ASSERT_EQ("<miss>", get(cache, d, oid, 0, 4));
+}
+
+TEST(ReadCache, Evict) {
+  ReadCache cache(16, 1);
+  coll_t c("c");
+  for (int i = 0; i < 4; ++i) {
+    hobject_t oid = make_oid("o", i);
+    cache.add(c, oid, 0, make_bp("vvvv"), false, cache.get_ticket(oid));
+  }
+  // touch 0 so that 1 is the oldest
+  ASSERT_EQ("vvvv", get(cache, c, make_oid("o", 0), 0, 4));
+  hobject_t oid = make_oid("o", 4);
+  cache.add(c, oid, 0, make_bp("vvvv"), false, cache.get_ticket(oid));
+  ASSERT_EQ("vvvv", get(cache, c, make_oid("o", 0), 0, 4));
+  ASSERT_EQ("<miss>", get(cache, c, make_oid("o", 1), 0, 4));
+  ASSERT_EQ("vvvv", get(cache, c, make_oid("o", 4), 0, 4));
+
+  // nothing bigger than the cache
+  hobject_t big = make_oid("big", 5);
+  cache.add(c, big, 0, make_bp("0123456789abcdefg"), false,
+	    cache.get_ticket(big));
+  ASSERT_EQ("<miss>", get(cache, c, big, 0, 4));
+  ASSERT_EQ("vvvv", get(cache, c, make_oid("o", 4), 0, 4));
+
+  cache.set_size(4);
+  ASSERT_EQ("vvvv", get(cache, c, make_oid("o", 4), 0, 4));
+  ASSERT_EQ("<miss>", get(cache, c, make_oid("o", 0), 0, 4));
+
+  // size 0 disables the cache
+  cache.set_size(0);
+  ASSERT_EQ("<miss>", get(cache, c, oid, 0, 4));
+  cache.add(c, oid, 0, make_bp("vvvv"), false, cache.get_ticket(oid));
+  ASSERT_EQ("<miss>", get(cache, c, oid, 0, 4));
+
+  cache.set_size(16);
+  cache.add(c, oid, 0, make_bp("vvvv"), false, cache.get_ticket(oid));
+  cache.clear();
+  ASSERT_EQ("<miss>", get(cache, c, oid, 0, 4));
+}
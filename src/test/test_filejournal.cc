@@ -160,6 +160,50 @@ TEST(TestFileJournal, WriteMany) {
   j.close();
 }
 
+TEST(TestFileJournal, WriteManyBatched) {
+  g_ceph_context->_conf->set_val("journal_batch_window_us", "2000");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  fsid.generate_random();
+  FileJournal j(fsid, finisher, &sync_cond, path, directio, aio);
+  ASSERT_EQ(0, j.create());
+  j.make_writeable();
+
+  C_GatherBuilder gb(g_ceph_context, new C_SafeCond(&lock, &cond, &done));
+
+  uint64_t seq = 1;
+  for (int i=0; i<200; i++) {
+    bufferlist bl;
+    bl.append((char *)&seq, sizeof(seq));
+    j.submit_entry(seq++, bl, 0, gb.new_sub());
+    if (i % 10 == 0)
+      usleep(100);
+  }
+
+  gb.activate();
+  wait();
+  j.close();
+
+  // everything made it out, in order
+  j.open(0);
+  bufferlist inbl;
+  uint64_t rseq = 0;
+  for (uint64_t i=1; i<seq; i++) {
+    ASSERT_TRUE(j.read_entry(inbl, rseq));
+    ASSERT_EQ(i, rseq);
+    uint64_t v;
+    inbl.copy(0, sizeof(v), (char *)&v);
+    ASSERT_EQ(i, v);
+    inbl.clear();
+  }
+  ASSERT_TRUE(!j.read_entry(inbl, rseq));
+  j.make_writeable();
+  j.close();
+
+  g_ceph_context->_conf->set_val("journal_batch_window_us", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
 TEST(TestFileJournal, ReplaySmall) {
   fsid.generate_random();
   FileJournal j(fsid, finisher, &sync_cond, path, directio, aio);
@@ -122,3 +122,96 @@ TEST(pg_t, split)
   ASSERT_TRUE(s.count(pg_t(7, 0, -1)));
 
 }
+
+TEST(eversion_t, get_key_name)
+{
+  eversion_t a(3, 10), b(3, 9), c(4, 1), d(10, 0);
+  ASSERT_TRUE(b.get_key_name() < a.get_key_name());
+  ASSERT_TRUE(a.get_key_name() < c.get_key_name());
+  ASSERT_TRUE(c.get_key_name() < d.get_key_name());
+  ASSERT_TRUE(d.get_key_name() < eversion_t::max().get_key_name());
+  ASSERT_EQ(a.get_key_name(), eversion_t(3, 10).get_key_name());
+}
+
+TEST(pg_log_entry_t, encode_with_checksum)
+{
+  pg_log_entry_t e(pg_log_entry_t::MODIFY,
+		   hobject_t(object_t("foo"), "", CEPH_NOSNAP, 123, 1),
+		   eversion_t(3, 10), eversion_t(3, 9),
+		   osd_reqid_t(), utime_t(1, 2));
+  bufferlist bl;
+  e.encode_with_checksum(bl);
+
+  pg_log_entry_t d;
+  bufferlist::iterator p = bl.begin();
+  d.decode_with_checksum(p);
+  ASSERT_TRUE(p.end());
+  ASSERT_EQ(e.version, d.version);
+  ASSERT_EQ(e.soid, d.soid);
+  ASSERT_EQ(e.get_key_name(), d.get_key_name());
+
+  // flip a bit in the entry
+  bufferlist bad;
+  bad.substr_of(bl, 0, bl.length());
+  bad.rebuild();
+  bad.c_str()[bl.length() / 2] ^= 1;
+  p = bad.begin();
+  ASSERT_THROW(d.decode_with_checksum(p), buffer::malformed_input);
+}
+
+TEST(PushOp, encode)
+{
+  PushOp op;
+  op.soid = hobject_t(object_t("foo"), "", CEPH_NOSNAP, 123, 1);
+  op.version = eversion_t(3, 10);
+  op.data.append("0123456789");
+  op.data_included.insert(0, 10);
+  op.omap_header.append("hdr");
+  op.omap_entries["key"].append("value");
+  op.attrset["_"] = buffer::copy("oi", 2);
+  op.after_progress.data_complete = true;
+  op.after_progress.omap_complete = true;
+  ASSERT_EQ(10u + 3u + 3u + 5u, op.length());
+
+  bufferlist bl;
+  ::encode(op, bl);
+  PushOp d;
+  bufferlist::iterator p = bl.begin();
+  ::decode(d, p);
+  ASSERT_EQ(op.soid, d.soid);
+  ASSERT_EQ(op.version, d.version);
+  ASSERT_EQ(op.data_included, d.data_included);
+  ASSERT_TRUE(d.data.contents_equal(op.data));
+  ASSERT_EQ(1u, d.omap_entries.size());
+  ASSERT_EQ(1u, d.attrset.count("_"));
+  ASSERT_TRUE(d.before_progress.first);
+  ASSERT_TRUE(d.after_progress.data_complete);
+  ASSERT_EQ(op.length(), d.length());
+}
+
+TEST(pg_log_entry_t, dirty_extents)
+{
+  pg_log_entry_t e(pg_log_entry_t::MODIFY,
+		   hobject_t(object_t("foo"), "", CEPH_NOSNAP, 123, 1),
+		   eversion_t(3, 10), eversion_t(3, 9),
+		   osd_reqid_t(), utime_t(1, 2));
+  bufferlist bl;
+  ::encode(e, bl);
+  pg_log_entry_t d;
+  d.has_dirty_extents = true;
+  d.dirty_extents.insert(0, 1);
+  bufferlist::iterator p = bl.begin();
+  ::decode(d, p);
+  ASSERT_FALSE(d.has_dirty_extents);
+  ASSERT_TRUE(d.dirty_extents.empty());
+
+  e.has_dirty_extents = true;
+  e.dirty_extents.insert(4096, 4096);
+  e.dirty_extents.insert(1 << 20, (uint64_t)-1 - (1 << 20));
+  bl.clear();
+  ::encode(e, bl);
+  p = bl.begin();
+  ::decode(d, p);
+  ASSERT_TRUE(d.has_dirty_extents);
+  ASSERT_EQ(e.dirty_extents, d.dirty_extents);
+}
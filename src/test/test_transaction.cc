@@ -0,0 +1,233 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <sstream>
+#include "os/ObjectStore.h"
+#include "common/Formatter.h"
+#include "test/unit.h"
+
+typedef ObjectStore::Transaction Transaction;
+
+static string dump(Transaction &t)
+{
+  JSONFormatter f(false);
+  t.dump(&f);
+  stringstream ss;
+  f.flush(ss);
+  return ss.str();
+}
+
+static void build(Transaction *t)
+{
+  coll_t c("foocoll"), c2("foocoll2");
+  hobject_t o1("obj", "", 123, 456, -1);
+  hobject_t o2("obj2", "", 123, 456, 3);
+  bufferlist bl;
+  bl.append("some data");
+  bufferlist big;
+  big.append(string(5000, 'x'));
+  map<string,bufferptr> m;
+  m["a"] = buffer::copy("this", 4);
+  map<string,bufferlist> km;
+  km["k"] = bl;
+  set<string> ks;
+  ks.insert("k");
+
+  t->create_collection(c);
+  t->collection_expected_objects(c, 1000);
+  t->touch(c, o1);
+  t->write(c, o1, 1, bl.length(), bl);
+  t->write(c, o2, 8192, big.length(), big);
+  t->zero(c, o1, 22, 33);
+  t->truncate(c, o1, 99);
+  t->setattr(c, o1, "key", bl);
+  t->setattrs(c, o1, m);
+  t->rmattr(c, o1, "b");
+  t->rmattrs(c, o1);
+  t->clone(c, o1, o2);
+  t->clone_range(c, o1, o2, 1, 12, 99);
+  t->collection_move(c2, c, o1);
+  t->collection_setattr(c, "this", bl);
+  t->collection_rmattr(c, "foo");
+  t->collection_setattrs(c, m);
+  t->omap_clear(c, o2);
+  t->omap_setkeys(c, o2, km);
+  t->omap_rmkeys(c, o2, ks);
+  t->omap_setheader(c, o2, bl);
+  t->start_sync();
+  t->remove(c, o2);
+  t->remove_collection(c2);
+  t->collection_rename(c, c2);
+}
+
+TEST(Transaction, EncodeDecode) {
+  Transaction t;
+  build(&t);
+  bufferlist bl;
+  t.encode(bl);
+
+  Transaction d(bl);
+  ASSERT_EQ(t.get_num_ops(), d.get_num_ops());
+  ASSERT_EQ(dump(t), dump(d));
+
+  bufferlist bl2;
+  d.encode(bl2);
+  ASSERT_TRUE(bl.contents_equal(bl2));
+}
+
+TEST(Transaction, Legacy) {
+  // what an older version wrote must still decode to the same ops
+  Transaction t;
+  build(&t);
+  bufferlist bl;
+  t.encode_legacy(bl);
+
+  Transaction d(bl);
+  ASSERT_EQ(t.get_num_ops(), d.get_num_ops());
+  ASSERT_EQ(dump(t), dump(d));
+
+  // and re-encodes as it was
+  bufferlist bl2;
+  d.encode(bl2);
+  ASSERT_TRUE(bl.contents_equal(bl2));
+}
+
+TEST(Transaction, LegacyByHand) {
+  // a v6 touch + write, field by field
+  coll_t c("c");
+  hobject_t o("o", "", CEPH_NOSNAP, 7, 1);
+  bufferlist data;
+  data.append("hello");
+
+  bufferlist tbl;
+  __u32 op = Transaction::OP_TOUCH;
+  ::encode(op, tbl);
+  ::encode(c, tbl);
+  ::encode(o, tbl);
+  op = Transaction::OP_WRITE;
+  ::encode(op, tbl);
+  ::encode(c, tbl);
+  ::encode(o, tbl);
+  uint64_t off = 10, len = data.length();
+  ::encode(off, tbl);
+  ::encode(len, tbl);
+  ::encode(data, tbl);
+
+  bufferlist bl;
+  ENCODE_START(6, 5, bl);
+  uint64_t ops = 2, pad = 0;
+  uint32_t zero = 0;
+  ::encode(ops, bl);
+  ::encode(pad, bl);
+  ::encode(zero, bl);
+  ::encode(zero, bl);
+  ::encode(zero, bl);
+  ::encode(tbl, bl);
+  ENCODE_FINISH(bl);
+
+  Transaction t(bl);
+  ASSERT_EQ(2, t.get_num_ops());
+  Transaction::iterator i = t.begin();
+  ASSERT_TRUE(i.have_op());
+  ASSERT_EQ(Transaction::OP_TOUCH, i.get_op());
+  ASSERT_EQ(c, i.get_cid());
+  ASSERT_EQ(o, i.get_oid());
+  ASSERT_TRUE(i.have_op());
+  ASSERT_EQ(Transaction::OP_WRITE, i.get_op());
+  ASSERT_EQ(c, i.get_cid());
+  ASSERT_EQ(o, i.get_oid());
+  ASSERT_EQ(10u, i.get_length());
+  ASSERT_EQ(5u, i.get_length());
+  bufferlist got;
+  i.get_bl(got);
+  ASSERT_TRUE(data.contents_equal(got));
+  ASSERT_FALSE(i.have_op());
+}
+
+TEST(Transaction, DataOffset) {
+  // the journal aligns the largest write using get_data_offset()
+  Transaction t;
+  build(&t);
+  ASSERT_EQ(5000u, t.get_data_length());
+
+  bufferlist bl;
+  t.encode(bl);
+  ASSERT_EQ(0, memcmp(bl.c_str() + t.get_data_offset(),
+		      string(5000, 'x').c_str(), 5000));
+
+  bufferlist lbl;
+  t.encode_legacy(lbl);
+  Transaction l(lbl);
+  ASSERT_EQ(5000u, l.get_data_length());
+  ASSERT_EQ(0, memcmp(lbl.c_str() + l.get_data_offset(),
+		      string(5000, 'x').c_str(), 5000));
+}
+
+TEST(Transaction, ZeroCopy) {
+  coll_t c("c");
+  hobject_t o("o", "", CEPH_NOSNAP, 7, 1);
+  bufferptr payload(65536);
+  memset(payload.c_str(), 1, payload.length());
+  bufferlist data;
+  data.append(payload);
+
+  Transaction t;
+  t.write(c, o, 0, data.length(), data);
+  bufferlist bl;
+  t.encode(bl);
+
+  Transaction d(bl);
+  Transaction::iterator i = d.begin();
+  ASSERT_EQ(Transaction::OP_WRITE, i.get_op());
+  i.get_cid();
+  i.get_oid();
+  i.get_length();
+  i.get_length();
+  bufferlist got;
+  i.get_bl(got);
+  ASSERT_EQ(1u, got.buffers().size());
+  ASSERT_EQ(payload.c_str(), got.buffers().front().c_str());
+}
+
+TEST(Transaction, Append) {
+  coll_t c("c"), c2("c2");
+  hobject_t o1("o1", "", CEPH_NOSNAP, 1, 1);
+  hobject_t o2("o2", "", CEPH_NOSNAP, 2, 1);
+  bufferlist small, big;
+  small.append("abc");
+  big.append(string(100, 'y'));
+
+  Transaction a, b, all;
+  a.touch(c, o1);
+  a.write(c, o1, 0, small.length(), small);
+  b.touch(c2, o2);                         // new ids in b...
+  b.clone(c2, o2, o1);
+  b.write(c, o1, 4096, big.length(), big);  // ...and ids shared with a
+  b.collection_add(c2, c, o1);
+
+  all.touch(c, o1);
+  all.write(c, o1, 0, small.length(), small);
+  all.touch(c2, o2);
+  all.clone(c2, o2, o1);
+  all.write(c, o1, 4096, big.length(), big);
+  all.collection_add(c2, c, o1);
+
+  a.append(b);
+  ASSERT_EQ(all.get_num_ops(), a.get_num_ops());
+  ASSERT_EQ(dump(all), dump(a));
+
+  bufferlist abl, allbl;
+  a.encode(abl);
+  all.encode(allbl);
+  ASSERT_EQ(all.get_data_offset(), a.get_data_offset());
+  ASSERT_TRUE(abl.contents_equal(allbl));
+}
@@ -0,0 +1,108 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/WeightedScheduler.h"
+#include "common/Clock.h"
+#include "common/ceph_context.h"
+#include "test/unit.h"
+
+TEST(WeightedScheduler, Uncontended) {
+  WeightedScheduler s(g_ceph_context, "uncontended", 1000, 5.0);
+  int bg = s.add_class("bg", 1, true);
+
+  // with nobody else busy, a blocking class never waits
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (int i = 0; i < 100; i++) {
+    utime_t t = s.get(bg, 1000000);
+    s.put(bg, t);
+  }
+  ASSERT_LT((double)(ceph_clock_now(g_ceph_context) - start), 1.0);
+}
+
+TEST(WeightedScheduler, NonBlocking) {
+  WeightedScheduler s(g_ceph_context, "nonblocking", 1000, 5.0);
+  int fg = s.add_class("fg", 1, false);
+  int bg = s.add_class("bg", 100, true);
+
+  // a non-blocking class is never held back, however far ahead it is
+  utime_t t = s.get(bg, 1000000);
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (int i = 0; i < 100; i++) {
+    utime_t f = s.get(fg, 1000000);
+    s.put(fg, f);
+  }
+  s.put(bg, t);
+  ASSERT_LT((double)(ceph_clock_now(g_ceph_context) - start), 1.0);
+}
+
+TEST(WeightedScheduler, Share) {
+  WeightedScheduler s(g_ceph_context, "share", 1000, 0.5);
+  int fg = s.add_class("fg", 10, false);
+  int bg = s.add_class("bg", 1, true);
+
+  // fg is busy and bg is within its burst: no wait
+  s.queued(fg);
+  utime_t start = ceph_clock_now(g_ceph_context);
+  utime_t t = s.get(bg, 1500);
+  s.put(bg, t);
+  ASSERT_LT((double)(ceph_clock_now(g_ceph_context) - start), 0.25);
+
+  // bg is now well beyond its share of fg's (zero) cost, so the next
+  // get waits until max_wait expires
+  start = ceph_clock_now(g_ceph_context);
+  t = s.get(bg, 1000);
+  s.put(bg, t);
+  ASSERT_GE((double)(ceph_clock_now(g_ceph_context) - start), 0.4);
+
+  // once fg has been charged enough, bg may proceed immediately
+  utime_t f = s.get(fg, 100000);
+  s.put(fg, f);
+  start = ceph_clock_now(g_ceph_context);
+  t = s.get(bg, 1000);
+  s.put(bg, t);
+  ASSERT_LT((double)(ceph_clock_now(g_ceph_context) - start), 0.25);
+
+  // and when fg goes idle, bg is not held back at all
+  s.dequeued(fg);
+  start = ceph_clock_now(g_ceph_context);
+  for (int i = 0; i < 10; i++) {
+    t = s.get(bg, 100000);
+    s.put(bg, t);
+  }
+  ASSERT_LT((double)(ceph_clock_now(g_ceph_context) - start), 0.25);
+}
+
+TEST(WeightedScheduler, NoLeadWhenAlone) {
+  WeightedScheduler s(g_ceph_context, "alone", 1000, 0.5);
+  int fg = s.add_class("fg", 1, false);
+  int bg = s.add_class("bg", 1, true);
+
+  // bg runs alone for a while...
+  for (int i = 0; i < 100; i++) {
+    utime_t t = s.get(bg, 1000000);
+    s.put(bg, t);
+  }
+
+  // ...which doesn't put it ahead of fg when fg turns up
+  s.queued(fg);
+  utime_t start = ceph_clock_now(g_ceph_context);
+  utime_t t = s.get(bg, 1000000);
+  s.put(bg, t);
+  ASSERT_LT((double)(ceph_clock_now(g_ceph_context) - start), 0.25);
+
+  // but from here on they share
+  start = ceph_clock_now(g_ceph_context);
+  t = s.get(bg, 1000);
+  s.put(bg, t);
+  ASSERT_GE((double)(ceph_clock_now(g_ceph_context) - start), 0.4);
+  s.dequeued(fg);
+}
@@ -0,0 +1,156 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "os/XattrCache.h"
+#include "test/unit.h"
+
+static hobject_t make_oid(const char *name, uint32_t hash)
+{
+  return hobject_t(object_t(name), "", CEPH_NOSNAP, hash, 0);
+}
+
+static bufferptr make_bp(const char *s)
+{
+  return bufferptr(s, strlen(s));
+}
+
+static string get(XattrCache &cache, coll_t c, const hobject_t& oid,
+		  const char *name)
+{
+  bufferptr bp;
+  if (!cache.lookup(c, oid, name, &bp))
+    return "<miss>";
+  return string(bp.c_str(), bp.length());
+}
+
+TEST(XattrCache, AddLookup) {
+  XattrCache cache(16, 4);
+  coll_t c("c");
+  hobject_t oid = make_oid("a", 1);
+  ASSERT_EQ("<miss>", get(cache, c, oid, "_"));
+
+  uint64_t t = cache.get_ticket(oid);
+  cache.add(c, oid, "_", make_bp("oi"), t);
+  ASSERT_EQ("oi", get(cache, c, oid, "_"));
+  ASSERT_EQ("<miss>", get(cache, c, oid, "snapset"));
+  ASSERT_EQ("<miss>", get(cache, coll_t("d"), oid, "_"));
+
+  // zero-length values are values too
+  cache.add(c, oid, "empty", bufferptr(), cache.get_ticket(oid));
+  bufferptr bp;
+  ASSERT_TRUE(cache.lookup(c, oid, "empty", &bp));
+  ASSERT_EQ(0u, bp.length());
+}
+
+TEST(XattrCache, StaleTicket) {
+  XattrCache cache(16, 4);
+  coll_t c("c");
+  hobject_t oid = make_oid("a", 1);
+
+  // a reader misses and goes to disk...
+  uint64_t t = cache.get_ticket(oid);
+
+  // ...while a writer changes the attr
+  XattrCache::attrs_t aset;
+  aset["_"] = make_bp("new");
+  cache.set(c, oid, aset);
+
+  // the reader's (possibly old) value must not win
+  cache.add(c, oid, "_", make_bp("old"), t);
+  ASSERT_EQ("new", get(cache, c, oid, "_"));
+
+  // same for an invalidation racing with a reader
+  t = cache.get_ticket(oid);
+  cache.clear(oid);
+  cache.add(c, oid, "_", make_bp("old"), t);
+  ASSERT_EQ("<miss>", get(cache, c, oid, "_"));
+}
+
+TEST(XattrCache, SetRm) {
+  XattrCache cache(16, 4);
+  coll_t c("c");
+  hobject_t oid = make_oid("a", 1);
+
+  XattrCache::attrs_t aset;
+  aset["_"] = make_bp("oi");
+  aset["snapset"] = make_bp("ss");
+  cache.set(c, oid, aset);
+  ASSERT_EQ("oi", get(cache, c, oid, "_"));
+  ASSERT_EQ("ss", get(cache, c, oid, "snapset"));
+
+  // the cache keeps its own copy
+  aset["_"].c_str()[0] = 'X';
+  ASSERT_EQ("oi", get(cache, c, oid, "_"));
+
+  cache.rm(c, oid, "_");
+  ASSERT_EQ("<miss>", get(cache, c, oid, "_"));
+  ASSERT_EQ("ss", get(cache, c, oid, "snapset"));
+
+  cache.clear(oid);
+  ASSERT_EQ("<miss>", get(cache, c, oid, "snapset"));
+
+  // rm of an uncached object doesn't create anything
+  cache.rm(c, make_oid("b", 2), "_");
+  ASSERT_EQ("<miss>", get(cache, c, make_oid("b", 2), "_"));
+}
+
+TEST(XattrCache, Links) {
+  XattrCache cache(16, 4);
+  coll_t c("c"), d("d");
+  hobject_t oid = make_oid("a", 1);
+
+  cache.add(c, oid, "_", make_bp("oi"), cache.get_ticket(oid));
+  cache.add(d, oid, "_", make_bp("oi"), cache.get_ticket(oid));
+  ASSERT_EQ("oi", get(cache, d, oid, "_"));
+
+  // a change through one link invalidates the others
+  XattrCache::attrs_t aset;
+  aset["_"] = make_bp("oi2");
+  cache.set(c, oid, aset);
+  ASSERT_EQ("oi2", get(cache, c, oid, "_"));
+  ASSERT_EQ("<miss>", get(cache, d, oid, "_"));
+
+  cache.add(d, oid, "snapset", make_bp("ss"), cache.get_ticket(oid));
+  cache.rm(c, oid, "_");
+  ASSERT_EQ("<miss>", get(cache, d, oid, "snapset"));
+}
+
+TEST(XattrCache, Evict) {
+  XattrCache cache(4, 1);
+  coll_t c("c");
+  for (int i = 0; i < 4; ++i) {
+    hobject_t oid = make_oid("o", i);
+    cache.add(c, oid, "_", make_bp("v"), cache.get_ticket(oid));
+  }
+  // touch 0 so that 1 is the oldest
+  ASSERT_EQ("v", get(cache, c, make_oid("o", 0), "_"));
+  hobject_t oid = make_oid("o", 4);
+  cache.add(c, oid, "_", make_bp("v"), cache.get_ticket(oid));
+  ASSERT_EQ("v", get(cache, c, make_oid("o", 0), "_"));
+  ASSERT_EQ("<miss>", get(cache, c, make_oid("o", 1), "_"));
+  ASSERT_EQ("v", get(cache, c, make_oid("o", 4), "_"));
+
+  cache.set_size(1);
+  ASSERT_EQ("v", get(cache, c, make_oid("o", 4), "_"));
+  ASSERT_EQ("<miss>", get(cache, c, make_oid("o", 0), "_"));
+
+  // size 0 disables the cache
+  cache.set_size(0);
+  ASSERT_EQ("<miss>", get(cache, c, make_oid("o", 4), "_"));
+  cache.add(c, oid, "_", make_bp("v"), cache.get_ticket(oid));
+  ASSERT_EQ("<miss>", get(cache, c, oid, "_"));
+
+  cache.set_size(4);
+  cache.add(c, oid, "_", make_bp("v"), cache.get_ticket(oid));
+  cache.clear();
+  ASSERT_EQ("<miss>", get(cache, c, oid, "_"));
+}